@@ -0,0 +1,64 @@
+#include "board.h"
+
+const board_region_t board_flash_sectors[BOARD_NUM_OF_FLASH_SECTORS] = BOARD_FLASH_SECTORS;
+const board_region_t board_ram_regions[BOARD_NUM_OF_RAM_REGIONS] = BOARD_RAM_REGIONS;
+
+#define NUM_OF_GRANULES     (BOARD_FLASH_SIZE / BOARD_FLASH_GRANULE)
+
+/* Sector number of every granule of the FLASH, built from the sector map on first use */
+static uint8_t sector_lookup[NUM_OF_GRANULES];
+static uint8_t lookup_ready;
+
+static void board_build_sector_lookup(void)
+{
+    for (uint32_t granule = 0; granule < NUM_OF_GRANULES; granule++)
+    {
+        uint32_t address = BOARD_FLASH_BASE_ADDR + granule * BOARD_FLASH_GRANULE;
+
+        sector_lookup[granule] = BOARD_INVALID_SECTOR;
+        for (uint8_t sector = 0; sector < BOARD_NUM_OF_FLASH_SECTORS; sector++)
+        {
+            if (address - board_flash_sectors[sector].base_address < board_flash_sectors[sector].size)
+            {
+                sector_lookup[granule] = sector;
+                break;
+            }
+        }
+    }
+
+    lookup_ready = 1;
+}
+
+/* Returns the sector holding address in O(1), or BOARD_INVALID_SECTOR outside the FLASH */
+uint8_t board_flash_sector(uint32_t address)
+{
+    if (!board_address_in_flash(address))
+    {
+        return BOARD_INVALID_SECTOR;
+    }
+
+    if (!lookup_ready)
+    {
+        board_build_sector_lookup();
+    }
+
+    return sector_lookup[(address - BOARD_FLASH_BASE_ADDR) / BOARD_FLASH_GRANULE];
+}
+
+uint8_t board_address_in_flash(uint32_t address)
+{
+    return address - BOARD_FLASH_BASE_ADDR < BOARD_FLASH_SIZE;
+}
+
+uint8_t board_address_in_ram(uint32_t address)
+{
+    for (uint32_t i = 0; i < BOARD_NUM_OF_RAM_REGIONS; i++)
+    {
+        if (address - board_ram_regions[i].base_address < board_ram_regions[i].size)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,36 @@
+#ifndef __BOARD_H__
+#define __BOARD_H__
+
+#include <stdint.h>
+
+/*
+ * Board description: FLASH sector map, RAM regions, pins and the enabled commands.
+ * Another board provides a header defining the same macros and is selected at build time
+ * with make BOARD_HEADER=<file>.h, see board_nucleo_f446re.h for the complete list.
+ */
+#ifdef BL_BOARD_HEADER
+#include BL_BOARD_HEADER
+#else
+#include "board_nucleo_f446re.h"
+#endif
+
+#if defined(BL_CMD_ENABLE_STAGE) && !defined(BOARD_QSPI_FLASH_SIZE)
+#error "BL_CMD_ENABLE_STAGE needs an external QSPI flash, see BOARD_QSPI_* in board_nucleo_f446re_qspi.h"
+#endif
+
+#define BOARD_INVALID_SECTOR        0xFF
+
+typedef struct
+{
+    uint32_t base_address;
+    uint32_t size;
+} board_region_t;
+
+extern const board_region_t board_flash_sectors[BOARD_NUM_OF_FLASH_SECTORS];
+extern const board_region_t board_ram_regions[BOARD_NUM_OF_RAM_REGIONS];
+
+uint8_t board_flash_sector(uint32_t address);
+uint8_t board_address_in_flash(uint32_t address);
+uint8_t board_address_in_ram(uint32_t address);
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef __BOARD_NUCLEO_F446RE_H__
+#define __BOARD_NUCLEO_F446RE_H__
+
+/* NUCLEO-F446RE, STM32F446RE with 512KB of FLASH */
+#define BOARD_NAME                  "NUCLEO-F446RE"
+
+/* FLASH geometry, sectors are listed in address order */
+#define BOARD_FLASH_BASE_ADDR       0x08000000U
+#define BOARD_FLASH_SIZE            (512 * 1024)
+#define BOARD_FLASH_GRANULE         (16 * 1024)     // Size of the smallest sector
+#define BOARD_NUM_OF_FLASH_SECTORS  8
+#define BOARD_FLASH_SECTORS                         \
+    {                                               \
+        { 0x08000000U,  16 * 1024 },                \
+        { 0x08004000U,  16 * 1024 },                \
+        { 0x08008000U,  16 * 1024 },                \
+        { 0x0800C000U,  16 * 1024 },                \
+        { 0x08010000U,  64 * 1024 },                \
+        { 0x08020000U, 128 * 1024 },                \
+        { 0x08040000U, 128 * 1024 },                \
+        { 0x08060000U, 128 * 1024 },                \
+    }
+
+/* Must match the regions of stm32f446xx_flash_ram.ld */
+#define BOARD_APP_BASE_ADDR         0x08008000U
+#define BOARD_METADATA_SECTOR       7
+#define BOARD_METADATA_BASE_ADDR    0x08060000U
+#define BOARD_METADATA_SIZE         (128 * 1024)    // The whole metadata sector
+
+#define BOARD_NUM_OF_RAM_REGIONS    2
+#define BOARD_RAM_REGIONS                           \
+    {                                               \
+        { 0x20000000U, 112 * 1024 },    /* SRAM1 */ \
+        { 0x2001C000U,  16 * 1024 },    /* SRAM2 */ \
+    }
+
+/*
+ * Host access policy, see policy.h. The bootloader, the metadata sector and the SRAM used
+ * by the bootloader can only be read, so a host can never brick the board. Nothing can be
+ * written to SRAM, so it is not executable either. Mass erase covers the bootloader too and
+ * is therefore rejected.
+ */
+#define BOARD_POLICY_REGIONS                                                                    \
+    {                                                                                           \
+        { 0x08000000U, 0x08008000U, POLICY_READ },                          /* Bootloader */    \
+        { 0x08008000U, 0x08060000U, POLICY_READ | POLICY_WRITE | POLICY_ERASE | POLICY_EXECUTE }, \
+        { 0x08060000U, 0x08080000U, POLICY_READ },                          /* Metadata */      \
+        { 0x20000000U, 0x20020000U, POLICY_READ },                          /* SRAM1, SRAM2 */  \
+    }
+
+/* Host link, USART2 on the ST-LINK virtual COM port */
+#define BOARD_BL_UART               USART2
+#define BOARD_BL_UART_PORT          GPIOA
+#define BOARD_BL_UART_TX_PIN        GPIO_PIN_2
+#define BOARD_BL_UART_RX_PIN        GPIO_PIN_3
+#define BOARD_BL_UART_ALT_FUNC      GPIO_ALT_FUNC_7
+#define BOARD_BL_UART_IRQ_NO        38
+#define BOARD_BL_UART_IRQHandler    USART2_IRQHandler
+#define BOARD_BL_UART_BAUDRATE      115200U
+
+/*
+ * Optional flow control for the host link: CTS is checked by the USART, RTS is a GPIO driven
+ * from the receive buffer level. Remove the defines for a link without flow control.
+ */
+#define BOARD_BL_UART_CTS_PORT      GPIOA
+#define BOARD_BL_UART_CTS_PIN       GPIO_PIN_0
+#define BOARD_BL_UART_CTS_ALT_FUNC  GPIO_ALT_FUNC_7
+#define BOARD_BL_UART_RTS_PORT      GPIOA
+#define BOARD_BL_UART_RTS_PIN       GPIO_PIN_1
+
+/*
+ * Optional transports, remove a define to compile the transport out. The host link above is
+ * always available.
+ */
+#define BL_ENABLE_USB_CDC               // USB OTG FS on PA11 (DM) and PA12 (DP)
+#define BL_ENABLE_CAN
+#define BL_ENABLE_SPI_SLAVE
+
+/* CAN1, see can_isotp.h */
+#define BOARD_CAN_PORT              GPIOB
+#define BOARD_CAN_RX_PIN            GPIO_PIN_8
+#define BOARD_CAN_TX_PIN            GPIO_PIN_9
+#define BOARD_CAN_ALT_FUNC          GPIO_ALT_FUNC_9
+
+/* SPI2 slave, see spi_slave.h. All four pins on one port. */
+#define BOARD_SPI_PORT              GPIOB
+#define BOARD_SPI_PORT_INDEX        1               // Port number for the SYSCFG EXTI mux, GPIOA = 0
+#define BOARD_SPI_NSS_PIN           GPIO_PIN_12
+#define BOARD_SPI_SCK_PIN           GPIO_PIN_13
+#define BOARD_SPI_MISO_PIN          GPIO_PIN_14
+#define BOARD_SPI_MOSI_PIN          GPIO_PIN_15
+#define BOARD_SPI_ALT_FUNC          GPIO_ALT_FUNC_5
+#define BOARD_SPI_NSS_IRQ_NO        40              // EXTI line of the NSS pin
+#define BOARD_SPI_NSS_IRQHandler    EXTI15_10_IRQHandler
+
+/* Debug output */
+#define BOARD_DEBUG_UART            USART3
+#define BOARD_DEBUG_UART_PORT       GPIOC
+#define BOARD_DEBUG_UART_TX_PIN     GPIO_PIN_10
+#define BOARD_DEBUG_UART_RX_PIN     GPIO_PIN_11
+#define BOARD_DEBUG_UART_ALT_FUNC   GPIO_ALT_FUNC_7
+
+/* Held during reset to enter interactive mode */
+#define BOARD_BUTTON_PORT           GPIOC
+#define BOARD_BUTTON_PIN            GPIO_PIN_13
+#define BOARD_BUTTON_PRESSED        GPIO_PIN_LOW
+
+/*
+ * Optional commands, remove a define to compile the command out.
+ * BL_GET_VER and BL_GET_HELP are always available.
+ */
+#define BL_CMD_ENABLE_GET_DEV_ID
+#define BL_CMD_ENABLE_GET_RDP_LEVEL
+#define BL_CMD_ENABLE_JMP_ADDR
+#define BL_CMD_ENABLE_FLASH_ERASE
+#define BL_CMD_ENABLE_MEM_WRITE
+#define BL_CMD_ENABLE_MEM_READ
+#define BL_CMD_ENABLE_SET_RW_PROTECT
+#define BL_CMD_ENABLE_GET_RW_PROTECT
+#define BL_CMD_ENABLE_MCAST             // BL_MCAST_START, BL_MCAST_DATA, BL_MCAST_STATUS
+#define BL_CMD_ENABLE_SESSION           // BL_SESSION_BEGIN, BL_SESSION_QUERY, BL_SESSION_END
+#define BL_CMD_ENABLE_GET_STATUS
+#define BL_CMD_ENABLE_SET_TIMEOUTS
+#define BL_CMD_ENABLE_BATCH
+#define BL_CMD_ENABLE_MANIFEST
+#define BL_CMD_ENABLE_BOOT_LOG
+
+/* Read back every programmed payload, see verify.h */
+#define BL_ENABLE_WRITE_VERIFY
+
+#endif
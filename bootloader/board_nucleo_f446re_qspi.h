@@ -0,0 +1,54 @@
+#ifndef __BOARD_NUCLEO_F446RE_QSPI_H__
+#define __BOARD_NUCLEO_F446RE_QSPI_H__
+
+/*
+ * NUCLEO-F446RE with a W25Q128JV (16MB) wired to the morpho connectors, selected with
+ * make BOARD_HEADER=board_nucleo_f446re_qspi.h. Adds the QSPI staging commands.
+ */
+#include "board_nucleo_f446re.h"
+
+#undef BOARD_NAME
+#define BOARD_NAME                  "NUCLEO-F446RE-QSPI"
+
+/* External NOR flash used as staging area, see qspi.h */
+#define BOARD_QSPI_FLASH_SIZE       (16U * 1024 * 1024)     // Must be a power of 2
+#define BOARD_QSPI_CLK_PORT         GPIOB
+#define BOARD_QSPI_CLK_PIN          GPIO_PIN_1
+#define BOARD_QSPI_CLK_ALT_FUNC     GPIO_ALT_FUNC_9
+#define BOARD_QSPI_NCS_PORT         GPIOB
+#define BOARD_QSPI_NCS_PIN          GPIO_PIN_6
+#define BOARD_QSPI_NCS_ALT_FUNC     GPIO_ALT_FUNC_10
+#define BOARD_QSPI_IO0_PORT         GPIOC
+#define BOARD_QSPI_IO0_PIN          GPIO_PIN_9
+#define BOARD_QSPI_IO0_ALT_FUNC     GPIO_ALT_FUNC_9
+#define BOARD_QSPI_IO1_PORT         GPIOC
+#define BOARD_QSPI_IO1_PIN          GPIO_PIN_10
+#define BOARD_QSPI_IO1_ALT_FUNC     GPIO_ALT_FUNC_9
+#define BOARD_QSPI_IO2_PORT         GPIOC
+#define BOARD_QSPI_IO2_PIN          GPIO_PIN_8
+#define BOARD_QSPI_IO2_ALT_FUNC     GPIO_ALT_FUNC_9
+#define BOARD_QSPI_IO3_PORT         GPIOA
+#define BOARD_QSPI_IO3_PIN          GPIO_PIN_1
+#define BOARD_QSPI_IO3_ALT_FUNC     GPIO_ALT_FUNC_9
+
+/* PA1 is QUADSPI IO3, RTS of the host link moves to PA8 */
+#undef BOARD_BL_UART_RTS_PORT
+#undef BOARD_BL_UART_RTS_PIN
+#define BOARD_BL_UART_RTS_PORT      GPIOA
+#define BOARD_BL_UART_RTS_PIN       GPIO_PIN_8
+
+/* PC10 is QUADSPI IO1 on the 64 pin package, debug output moves to USART1 */
+#undef BOARD_DEBUG_UART
+#undef BOARD_DEBUG_UART_PORT
+#undef BOARD_DEBUG_UART_TX_PIN
+#undef BOARD_DEBUG_UART_RX_PIN
+#undef BOARD_DEBUG_UART_ALT_FUNC
+#define BOARD_DEBUG_UART            USART1
+#define BOARD_DEBUG_UART_PORT       GPIOA
+#define BOARD_DEBUG_UART_TX_PIN     GPIO_PIN_9
+#define BOARD_DEBUG_UART_RX_PIN     GPIO_PIN_10
+#define BOARD_DEBUG_UART_ALT_FUNC   GPIO_ALT_FUNC_7
+
+#define BL_CMD_ENABLE_STAGE             // BL_STAGE_ERASE, BL_STAGE_WRITE, BL_STAGE_COMMIT
+
+#endif
@@ -0,0 +1,109 @@
+#include "bootloader.h"
+#include "cortex_m4.h"
+#include "boot_log.h"
+
+/* Backup domain access (RM0390, 5.1.2) */
+#define PWR_CR                  (*(volatile uint32_t *)0x40007000U)
+#define PWR_CR_DBP              (1U << 8)
+#define RCC_APB1ENR_PWREN       (1U << 28)
+#define RCC_AHB1ENR_BKPSRAMEN   (1U << 18)
+#define RCC_CSR_FLAGS_POS       24
+
+#define BOOT_LOG_MAGIC          0xB0071060U
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t head;              // Entries ever written, the sequence number of the next one
+    uint32_t reserved[2];
+    boot_log_entry_t entries[BOOT_LOG_NUM_OF_ENTRIES];
+} boot_log_t;
+
+static boot_log_t *const ring = (boot_log_t *)BOOT_LOG_BASE_ADDR;
+static boot_log_entry_t *current;
+static uint32_t trace_enabled;
+
+/* Called first thing in main(), opens the entry of this boot */
+void boot_log_start(void)
+{
+    /* A debugger may already use the trace unit, it is left as found by boot_log_finish() */
+    trace_enabled = DEMCR & DEMCR_TRCENA;
+    DEMCR |= DEMCR_TRCENA;
+    DWT_CYCCNT = 0;
+    DWT_CTRL |= DWT_CTRL_CYCCNTENA;
+
+    RCC->APB1ENR |= RCC_APB1ENR_PWREN;
+    PWR_CR |= PWR_CR_DBP;
+    RCC->AHB1ENR |= RCC_AHB1ENR_BKPSRAMEN;
+    (void)RCC->AHB1ENR;
+
+    /* The backup SRAM is random after a power loss */
+    if (ring->magic != BOOT_LOG_MAGIC)
+    {
+        ring->magic = BOOT_LOG_MAGIC;
+        ring->head = 0;
+    }
+
+    current = &ring->entries[ring->head % BOOT_LOG_NUM_OF_ENTRIES];
+    current->sequence = ring->head;
+    current->boot_cycles = 0;
+    current->bytes_written = 0;
+    current->reset_flags = RCC->CSR >> RCC_CSR_FLAGS_POS;
+    current->decision = BOOT_LOG_DECISION_NONE;
+    current->image_status = BOOT_LOG_IMAGE_NOT_CHECKED;
+    current->update_status = BOOT_LOG_UPDATE_NONE;
+    ring->head++;
+}
+
+/* The boot time is taken at the first decision, a later one only replaces the decision */
+void boot_log_decision(uint8_t decision, uint8_t image_status)
+{
+    if (current->decision == BOOT_LOG_DECISION_NONE)
+    {
+        current->boot_cycles = DWT_CYCCNT;
+    }
+
+    current->decision = decision;
+    current->image_status = image_status;
+}
+
+void boot_log_update(uint8_t update_status, uint32_t bytes_written)
+{
+    current->update_status = update_status;
+    current->bytes_written += bytes_written;
+}
+
+/* Hands the cycle counter and the backup domain back in their reset state */
+void boot_log_finish(void)
+{
+    DWT_CTRL &= ~DWT_CTRL_CYCCNTENA;
+    if (!trace_enabled)
+    {
+        DEMCR &= ~DEMCR_TRCENA;
+    }
+
+    RCC->AHB1ENR &= ~RCC_AHB1ENR_BKPSRAMEN;
+    PWR_CR &= ~PWR_CR_DBP;
+    RCC->APB1ENR &= ~RCC_APB1ENR_PWREN;
+}
+
+/* Copies up to max_entries entries, oldest first, starting at sequence or the oldest one kept */
+uint32_t boot_log_read(uint32_t sequence, boot_log_entry_t *entries, uint32_t max_entries)
+{
+    uint32_t head = ring->head;
+    uint32_t oldest = head > BOOT_LOG_NUM_OF_ENTRIES ? head - BOOT_LOG_NUM_OF_ENTRIES : 0;
+    uint32_t count = 0;
+
+    if (sequence < oldest)
+    {
+        sequence = oldest;
+    }
+
+    while (sequence < head && count < max_entries)
+    {
+        entries[count++] = ring->entries[sequence % BOOT_LOG_NUM_OF_ENTRIES];
+        sequence++;
+    }
+
+    return count;
+}
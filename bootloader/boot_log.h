@@ -0,0 +1,51 @@
+#ifndef __BOOT_LOG_H__
+#define __BOOT_LOG_H__
+
+#include <stdint.h>
+
+/*
+ * Boot log, one entry per reset in a ring in the 4KB backup SRAM. The backup SRAM keeps its
+ * contents over every reset except a power loss without VBAT and does not wear, so the
+ * entry is written in place as the boot progresses at the cost of a few stores.
+ *
+ * The reset flags of RCC_CSR are recorded but left set, the application still reads the cause
+ * of its reset from RCC_CSR and owns clearing them with RMVF. Flags the application does not
+ * clear are recorded again by the next boot.
+ */
+#define BOOT_LOG_BASE_ADDR          0x40024000U
+#define BOOT_LOG_NUM_OF_ENTRIES     128         // Must be a power of 2
+#define BOOT_LOG_MAX_READ_ENTRIES   15          // Entries behind a single ACK length byte
+
+#define BOOT_LOG_DECISION_NONE      0
+#define BOOT_LOG_DECISION_APP       1           // No reason to stay, application started
+#define BOOT_LOG_DECISION_BUTTON    2           // Interactive mode, button held
+#define BOOT_LOG_DECISION_REQUEST   3           // Interactive mode, requested by the application
+#define BOOT_LOG_DECISION_TIMEOUT   4           // Interactive mode, application started after the session timeout
+
+#define BOOT_LOG_IMAGE_NOT_CHECKED  0
+#define BOOT_LOG_IMAGE_VALID        1
+#define BOOT_LOG_IMAGE_INVALID      2
+
+#define BOOT_LOG_UPDATE_NONE        0
+#define BOOT_LOG_UPDATE_WRITING     1           // FLASH erased or written since the last outcome
+#define BOOT_LOG_UPDATE_COMPLETE    2           // Session ended or staged image committed
+#define BOOT_LOG_UPDATE_FAILED      3           // Last write or commit failed
+
+typedef struct
+{
+    uint32_t sequence;          // Number of the boot, counts up from 0
+    uint32_t boot_cycles;       // Core clock cycles from main() to the boot decision
+    uint32_t bytes_written;     // Bytes programmed into the FLASH
+    uint8_t reset_flags;        // RCC_CSR bits 31-24
+    uint8_t decision;
+    uint8_t image_status;       // Vector table check of the application
+    uint8_t update_status;
+} boot_log_entry_t;
+
+void boot_log_start(void);
+void boot_log_decision(uint8_t decision, uint8_t image_status);
+void boot_log_update(uint8_t update_status, uint32_t bytes_written);
+void boot_log_finish(void);
+uint32_t boot_log_read(uint32_t sequence, boot_log_entry_t *entries, uint32_t max_entries);
+
+#endif
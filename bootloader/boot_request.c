@@ -0,0 +1,19 @@
+#include "boot_request.h"
+
+/* Placed at BOOT_REQUEST_ADDR by the linker script */
+volatile boot_request_t boot_request __attribute__((section(".noinit")));
+
+/*
+ * Returns 1 if the application requested interactive mode before the last reset.
+ * The request is consumed, so the next reset boots normally again.
+ */
+uint8_t boot_request_take(void)
+{
+    uint8_t requested = boot_request.magic == BOOT_REQUEST_MAGIC &&
+                        boot_request.magic_inverted == ~BOOT_REQUEST_MAGIC;
+
+    boot_request.magic = 0;
+    boot_request.magic_inverted = 0;
+
+    return requested;
+}
@@ -0,0 +1,29 @@
+#ifndef __BOOT_REQUEST_H__
+#define __BOOT_REQUEST_H__
+
+#include <stdint.h>
+
+/*
+ * Software requested entry into interactive mode. The request lives in the .noinit section
+ * at a fixed address at the top of SRAM, which the startup code neither copies nor clears,
+ * so it survives a system reset. To enter the bootloader the application writes the magic
+ * value and its complement and resets the MCU:
+ *
+ *     BOOT_REQUEST->magic          = BOOT_REQUEST_MAGIC;
+ *     BOOT_REQUEST->magic_inverted = ~BOOT_REQUEST_MAGIC;
+ *     SCB->AIRCR = (0x05FA << 16) | (1 << 2);
+ */
+#define BOOT_REQUEST_ADDR       0x2001FFE0U
+#define BOOT_REQUEST_MAGIC      0xB00710ADU
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t magic_inverted;
+} boot_request_t;
+
+#define BOOT_REQUEST            ((volatile boot_request_t *)BOOT_REQUEST_ADDR)
+
+uint8_t boot_request_take(void);
+
+#endif
@@ -1,21 +1,111 @@
 #include "bootloader.h"
+#include "transport.h"
+#include "usart_transport.h"
+#include "multicast.h"
+#include "journal.h"
+#include "frames.h"
+#include "supervisor.h"
+#include "boot_request.h"
+#include "cortex_m4.h"
+#include "pool.h"
+#include "verify.h"
+#include "policy.h"
+#include "power.h"
+#include "qspi.h"
+#include "manifest.h"
+#include "boot_log.h"
 #include "stm32f446xx_crc.h"
-#include <stdlib.h>
+
+/* Provided by the linker script */
+extern uint32_t _stack_guard;
+extern uint32_t _stack_guard_size;
+
+/* Commands compiled in for this board, see BL_CMD_ENABLE_* in the board header */
+uint8_t supported_commands[] = {
+    BL_GET_VER, BL_GET_HELP,
+#ifdef BL_CMD_ENABLE_GET_DEV_ID
+    BL_GET_DEV_ID,
+#endif
+#ifdef BL_CMD_ENABLE_GET_RDP_LEVEL
+    BL_GET_RDP_LEVEL,
+#endif
+#ifdef BL_CMD_ENABLE_JMP_ADDR
+    BL_JMP_ADDR,
+#endif
+#ifdef BL_CMD_ENABLE_FLASH_ERASE
+    BL_FLASH_ERASE,
+#endif
+#ifdef BL_CMD_ENABLE_MEM_WRITE
+    BL_MEM_WRITE,
+#endif
+#ifdef BL_CMD_ENABLE_MEM_READ
+    BL_MEM_READ,
+#endif
+#ifdef BL_CMD_ENABLE_SET_RW_PROTECT
+    BL_SET_RW_PROTECT,
+#endif
+#ifdef BL_CMD_ENABLE_GET_RW_PROTECT
+    BL_GET_RW_PROTECT,
+#endif
+#ifdef BL_CMD_ENABLE_MCAST
+    BL_MCAST_START, BL_MCAST_DATA, BL_MCAST_STATUS,
+#endif
+#ifdef BL_CMD_ENABLE_SESSION
+    BL_SESSION_BEGIN, BL_SESSION_QUERY, BL_SESSION_END,
+#endif
+#ifdef BL_CMD_ENABLE_GET_STATUS
+    BL_GET_STATUS,
+#endif
+#ifdef BL_CMD_ENABLE_SET_TIMEOUTS
+    BL_SET_TIMEOUTS,
+#endif
+#ifdef BL_CMD_ENABLE_BATCH
+    BL_BATCH,
+#endif
+#ifdef BL_CMD_ENABLE_STAGE
+    BL_STAGE_ERASE, BL_STAGE_WRITE, BL_STAGE_COMMIT,
+#endif
+#ifdef BL_CMD_ENABLE_MANIFEST
+    BL_GET_MANIFEST,
+#endif
+#ifdef BL_CMD_ENABLE_BOOT_LOG
+    BL_GET_BOOT_LOG,
+#endif
+};
+
+static uint32_t rx_timeouts;
+static uint32_t crc_errors;
+
+/* While a batch runs, replies are collected here instead of being sent */
+static uint8_t *capture_buffer;
+static uint32_t capture_size;
+static uint32_t capture_length;
+static uint8_t capture_overflow;
 
 int main()
 {
+    /* Checked before anything else touches the peripherals or the SRAM */
+    uint8_t boot_requested = boot_request_take();
+    boot_log_start();
+
+    /* A stack overflow faults on the guard instead of silently corrupting the buffers below */
+    mpu_guard_region(0, (uint32_t)&_stack_guard, (uint32_t)&_stack_guard_size);
+
     init_gpio();
-    init_usart2();
     init_usart3();
     init_crc();
 
-    if (gpio_read_pin(GPIOC, GPIO_PIN_13) == GPIO_PIN_LOW)
+    if (boot_requested || gpio_read_pin(BOARD_BUTTON_PORT, BOARD_BUTTON_PIN) == BOARD_BUTTON_PRESSED)
     {
-        BL_LOG("Executing bootloader interactive mode.\n");
+        boot_log_decision(boot_requested ? BOOT_LOG_DECISION_REQUEST : BOOT_LOG_DECISION_BUTTON, BOOT_LOG_IMAGE_NOT_CHECKED);
+        BL_LOG("Executing bootloader interactive mode (%s).\n", boot_requested ? "requested by application" : "user button");
+        transport_init();
         bootloader_start_interactive_mode();
     }
     else
     {
+        boot_log_decision(BOOT_LOG_DECISION_APP,
+                          bootloader_image_valid(BL_APP_BASE_ADDR) ? BOOT_LOG_IMAGE_VALID : BOOT_LOG_IMAGE_INVALID);
         BL_LOG("Executing user application.\n");
         bootloader_goto_application();
     }
@@ -27,79 +117,353 @@ void bootloader_goto_application(void)
 {
     BL_LOG("Executing bootloader_goto_application.\n");
 
-    uint32_t reset_handler_addr = *(volatile uint32_t *)(FLASH_SECTOR_2_BASE_ADDR + 0x4);
-    void (*application_reset_handler)(void) = (void (*)(void))reset_handler_addr;
+    /* We assume that the application firmware is stored in sector 2 of the flash memory */
+    bootloader_jump_to_image(BL_APP_BASE_ADDR);
+}
 
-    BL_LOG("Application reset handler address = 0x%08lX\n", (unsigned long)application_reset_handler);
+/*
+ * Hands the MCU over to the image whose vector table starts at base_address. Interrupts and
+ * peripherals used by the bootloader are shut down, so the image starts as if from reset,
+ * except for the watchdog which cannot be stopped.
+ */
+void bootloader_jump_to_image(uint32_t base_address)
+{
+    uint32_t msp = *(volatile uint32_t *)base_address;
+    uint32_t reset_handler_addr = *(volatile uint32_t *)(base_address + 0x4);
 
-    /* We assume that the application firmware is stored in sector 2 of the flash memory */
-    uint32_t msp = *(volatile uint32_t *)FLASH_SECTOR_2_BASE_ADDR;
     BL_LOG("MSP value = 0x%08lX\n", msp);
+    BL_LOG("Reset handler address = 0x%08lX\n", reset_handler_addr);
+
+    cpu_disable_irq();
+
+    SYST_CSR = 0;
+    SCB_ICSR = SCB_ICSR_PENDSTCLR | SCB_ICSR_PENDSVCLR;
+
+    for (uint32_t i = 0; i < NVIC_NUM_OF_REGS; i++)
+    {
+        NVIC_ICER[i] = 0xFFFFFFFF;
+        NVIC_ICPR[i] = 0xFFFFFFFF;
+    }
+
+    boot_log_finish();
+    deinit_peripherals();
+    mpu_disable();
+    SCB_SCR &= ~SCB_SCR_SEVONPEND;
 
-    /* Set main stack pointer */
-    __asm volatile("MSR MSP, %0"::"r"(msp));
+    SCB_VTOR = base_address;
+    cpu_dsb();
+    cpu_isb();
 
-    application_reset_handler();
+    /* Nothing can be pending anymore, the image starts with interrupts unmasked as after reset */
+    cpu_enable_irq();
+
+    cpu_start_image(msp, reset_handler_addr);
+}
+
+/*
+ * An image is considered present if its vector table is aligned as VTOR requires and holds
+ * an initial stack pointer inside SRAM and a Thumb reset handler inside FLASH or SRAM.
+ */
+uint8_t bootloader_image_valid(uint32_t base_address)
+{
+    if (base_address % SCB_VTOR_ALIGNMENT != 0 || bootloader_verify_address(base_address) != VALID_ADDR)
+    {
+        return 0;
+    }
+
+    uint32_t msp = *(volatile uint32_t *)base_address;
+    uint32_t reset_handler_addr = *(volatile uint32_t *)(base_address + 0x4);
+
+    /* The initial stack pointer may point just past the end of a RAM region */
+    return board_address_in_ram(msp - 1) && (reset_handler_addr & 1) &&
+           bootloader_verify_address(reset_handler_addr & ~1U) == VALID_ADDR;
+}
+
+/* Called when the host stayed silent for the whole session timeout */
+static void bootloader_session_timeout(void)
+{
+    if (bootloader_image_valid(BL_APP_BASE_ADDR))
+    {
+        BL_LOG("Session timed out, starting the application.\n");
+        boot_log_decision(BOOT_LOG_DECISION_TIMEOUT, BOOT_LOG_IMAGE_VALID);
+        bootloader_goto_application();
+    }
+
+    BL_LOG("Session timed out, no valid application to start.\n");
 }
 
 void bootloader_start_interactive_mode(void)
 {
-    uint8_t rx_buffer[BL_RX_BUFFER_SIZE];
-    uint8_t rx_length = 0;
+    supervisor_init();
+    power_init();
+#ifdef BL_CMD_ENABLE_STAGE
+    /* After supervisor_init(), the waits on the device are bounded by SysTick */
+    qspi_init();
+#endif
+
+    while (transport_wait_for_host(supervisor_get_config()->session_timeout_ms))
+    {
+        bootloader_session_timeout();
+    }
 
     while (1)
     {
-        memset(rx_buffer, 0, BL_RX_BUFFER_SIZE);
-        bootloader_receive_data(rx_buffer, 1);
-        rx_length = rx_buffer[0];
-        bootloader_receive_data(&rx_buffer[1], rx_length);
+        if (bootloader_wait_for_data(supervisor_get_config()->session_timeout_ms) != RX_STATUS_SUCCESS)
+        {
+            bootloader_session_timeout();
+            continue;
+        }
 
-        switch (rx_buffer[1])
+        /* Frames are received in place, the buffer is not cleared between frames */
+        uint8_t *rx_buffer = pool_acquire();
+        if (rx_buffer == NULL)
         {
-        case BL_GET_VER:
-            bootloader_cmd_get_version(rx_buffer);
-            break;
-        case BL_GET_HELP:
-            bootloader_cmd_get_help(rx_buffer);
-            break;
-        case BL_GET_DEV_ID:
-            bootloader_cmd_get_device_id(rx_buffer);
-            break;
-        case BL_GET_RDP_LEVEL:
-            bootloader_cmd_get_rdp_level(rx_buffer);
-            break;
-        case BL_JMP_ADDR:
-            bootloader_cmd_jump_address(rx_buffer);
-            break;
-        case BL_FLASH_ERASE:
-            bootloader_cmd_flash_erase(rx_buffer);
-            break;
-        case BL_MEM_WRITE:
-            bootloader_cmd_mem_write(rx_buffer);
-            break;
-        case BL_MEM_READ:
-            bootloader_cmd_mem_read(rx_buffer);
-            break;
-        case BL_SET_RW_PROTECT:
-            bootloader_cmd_set_rw_protect(rx_buffer);
-            break;
-        case BL_GET_RW_PROTECT:
-            bootloader_cmd_get_rw_protect(rx_buffer);
-            break;
-        default:
-            BL_LOG("Error {Unknown command}\n");
+            continue;
+        }
+
+        uint8_t *frame = bootloader_receive_frame(rx_buffer);
+
+        if (frame != NULL)
+        {
+            bootloader_process_frame(frame);
         }
+
+        pool_release(rx_buffer);
     }
 }
 
+uint8_t bootloader_process_frame(uint8_t *frame)
+{
+    if (bootloader_verify_frame_crc(frame) != CRC_STATUS_SUCCESS)
+    {
+        BL_LOG("CRC checksum failed!\n");
+        crc_errors++;
+        /* Multicast data frames are never answered, a dropped frame is reported as missing later */
+        if (frame[1] != BL_MCAST_DATA)
+        {
+            bootloader_send_nack();
+        }
+        return BL_CMD_FAILURE;
+    }
+
+    /* Handlers read their fields straight from the frame, so they have to be part of it */
+    if (frame[0] < bootloader_frame_min_length(frame[1]))
+    {
+        BL_LOG("Frame too short for command %#02X!\n", frame[1]);
+        if (frame[1] != BL_MCAST_DATA)
+        {
+            bootloader_send_nack();
+        }
+        return BL_CMD_FAILURE;
+    }
+
+    return bootloader_dispatch_command(frame);
+}
+
+uint8_t bootloader_dispatch_command(uint8_t *frame)
+{
+    switch (frame[1])
+    {
+    case BL_GET_VER:
+        return bootloader_cmd_get_version(frame);
+    case BL_GET_HELP:
+        return bootloader_cmd_get_help(frame);
+#ifdef BL_CMD_ENABLE_GET_DEV_ID
+    case BL_GET_DEV_ID:
+        return bootloader_cmd_get_device_id(frame);
+#endif
+#ifdef BL_CMD_ENABLE_GET_RDP_LEVEL
+    case BL_GET_RDP_LEVEL:
+        return bootloader_cmd_get_rdp_level(frame);
+#endif
+#ifdef BL_CMD_ENABLE_JMP_ADDR
+    case BL_JMP_ADDR:
+        return bootloader_cmd_jump_address(frame);
+#endif
+#ifdef BL_CMD_ENABLE_FLASH_ERASE
+    case BL_FLASH_ERASE:
+        return bootloader_cmd_flash_erase(frame);
+#endif
+#ifdef BL_CMD_ENABLE_MEM_WRITE
+    case BL_MEM_WRITE:
+        return bootloader_cmd_mem_write(frame);
+#endif
+#ifdef BL_CMD_ENABLE_MEM_READ
+    case BL_MEM_READ:
+        return bootloader_cmd_mem_read(frame);
+#endif
+#ifdef BL_CMD_ENABLE_SET_RW_PROTECT
+    case BL_SET_RW_PROTECT:
+        return bootloader_cmd_set_rw_protect(frame);
+#endif
+#ifdef BL_CMD_ENABLE_GET_RW_PROTECT
+    case BL_GET_RW_PROTECT:
+        return bootloader_cmd_get_rw_protect(frame);
+#endif
+#ifdef BL_CMD_ENABLE_MCAST
+    case BL_MCAST_START:
+        return bootloader_cmd_mcast_start(frame);
+    case BL_MCAST_DATA:
+        return bootloader_cmd_mcast_data(frame);
+    case BL_MCAST_STATUS:
+        return bootloader_cmd_mcast_status(frame);
+#endif
+#ifdef BL_CMD_ENABLE_SESSION
+    case BL_SESSION_BEGIN:
+        return bootloader_cmd_session_begin(frame);
+    case BL_SESSION_QUERY:
+        return bootloader_cmd_session_query(frame);
+    case BL_SESSION_END:
+        return bootloader_cmd_session_end(frame);
+#endif
+#ifdef BL_CMD_ENABLE_GET_STATUS
+    case BL_GET_STATUS:
+        return bootloader_cmd_get_status(frame);
+#endif
+#ifdef BL_CMD_ENABLE_SET_TIMEOUTS
+    case BL_SET_TIMEOUTS:
+        return bootloader_cmd_set_timeouts(frame);
+#endif
+#ifdef BL_CMD_ENABLE_BATCH
+    case BL_BATCH:
+        return bootloader_cmd_batch(frame);
+#endif
+#ifdef BL_CMD_ENABLE_STAGE
+    case BL_STAGE_ERASE:
+        return bootloader_cmd_stage_erase(frame);
+    case BL_STAGE_WRITE:
+        return bootloader_cmd_stage_write(frame);
+    case BL_STAGE_COMMIT:
+        return bootloader_cmd_stage_commit(frame);
+#endif
+#ifdef BL_CMD_ENABLE_MANIFEST
+    case BL_GET_MANIFEST:
+        return bootloader_cmd_get_manifest(frame);
+#endif
+#ifdef BL_CMD_ENABLE_BOOT_LOG
+    case BL_GET_BOOT_LOG:
+        return bootloader_cmd_get_boot_log(frame);
+#endif
+    default:
+        BL_LOG("Error {Unknown command}\n");
+        return BL_CMD_FAILURE;
+    }
+}
+
+/*
+ * Frames that carry a payload to be programmed are placed so that the payload starts
+ * on a word boundary of the receive buffer.
+ */
+uint32_t bootloader_frame_offset(uint8_t command)
+{
+    switch (command)
+    {
+    case BL_MEM_WRITE:
+        return BL_FRAME_ALIGN_OFFSET(offsetof(bl_mem_write_frame_t, payload));
+    case BL_MCAST_DATA:
+        return BL_FRAME_ALIGN_OFFSET(offsetof(bl_mcast_data_frame_t, payload));
+    default:
+        return 0;
+    }
+}
+
+/* Shortest valid frame of each command, as the value of its length byte */
+uint32_t bootloader_frame_min_length(uint8_t command)
+{
+    switch (command)
+    {
+    case BL_JMP_ADDR:
+        return BL_FRAME_LENGTH(bl_jump_address_frame_t);
+    case BL_FLASH_ERASE:
+        return BL_FRAME_LENGTH(bl_flash_erase_frame_t);
+    case BL_MEM_WRITE:
+        return BL_FRAME_LENGTH(bl_mem_write_frame_t);
+    case BL_MEM_READ:
+        return BL_FRAME_LENGTH(bl_mem_read_frame_t);
+    case BL_SET_RW_PROTECT:
+        return BL_FRAME_LENGTH(bl_set_rw_protect_frame_t);
+    case BL_MCAST_START:
+        return BL_FRAME_LENGTH(bl_mcast_start_frame_t);
+    case BL_MCAST_DATA:
+        return BL_FRAME_LENGTH(bl_mcast_data_frame_t);
+    case BL_MCAST_STATUS:
+        return BL_FRAME_LENGTH(bl_mcast_status_frame_t);
+    case BL_SESSION_BEGIN:
+        return BL_FRAME_LENGTH(bl_session_begin_frame_t);
+    case BL_SESSION_QUERY:
+    case BL_SESSION_END:
+        return BL_FRAME_LENGTH(bl_session_frame_t);
+    case BL_SET_TIMEOUTS:
+        return BL_FRAME_LENGTH(bl_set_timeouts_frame_t);
+    case BL_STAGE_ERASE:
+        return BL_FRAME_LENGTH(bl_stage_erase_frame_t);
+    case BL_STAGE_WRITE:
+        return BL_FRAME_LENGTH(bl_stage_write_frame_t);
+    case BL_STAGE_COMMIT:
+        return BL_FRAME_LENGTH(bl_stage_commit_frame_t);
+    case BL_GET_MANIFEST:
+        return BL_FRAME_LENGTH(bl_get_manifest_frame_t);
+    case BL_GET_BOOT_LOG:
+        return BL_FRAME_LENGTH(bl_get_boot_log_frame_t);
+    default:
+        return BL_FRAME_LENGTH(bl_frame_header_t);
+    }
+}
+
+/*
+ * Receives one frame into the word aligned rx_buffer and returns a pointer to its first byte,
+ * or NULL if the host sent an empty frame or stopped sending in the middle of one.
+ */
+uint8_t *bootloader_receive_frame(uint8_t *rx_buffer)
+{
+    bl_frame_header_t header;
+
+    if (bootloader_receive_data(&header.length, 1) != RX_STATUS_SUCCESS || header.length == 0)
+    {
+        return NULL;
+    }
+
+    if (bootloader_receive_data(&header.command, 1) != RX_STATUS_SUCCESS)
+    {
+        return NULL;
+    }
+
+    uint8_t *frame = rx_buffer + bootloader_frame_offset(header.command);
+    memcpy(frame, &header, sizeof(header));
+
+    if (bootloader_receive_data(frame + sizeof(header), header.length - 1) != RX_STATUS_SUCCESS)
+    {
+        BL_LOG("Frame timed out, dropping it.\n");
+        return NULL;
+    }
+
+    return frame;
+}
+
+uint8_t bootloader_verify_frame_crc(uint8_t *frame)
+{
+    uint32_t packet_length = frame[0] + 1;
+    uint32_t host_crc;
+
+    if (packet_length < sizeof(bl_frame_header_t) + BL_FRAME_CRC_SIZE)
+    {
+        return CRC_STATUS_FAILURE;
+    }
+
+    memcpy(&host_crc, frame + packet_length - BL_FRAME_CRC_SIZE, sizeof(host_crc));
+    return bootloader_verify_crc(frame, packet_length - BL_FRAME_CRC_SIZE, host_crc);
+}
+
 uint8_t bootloader_verify_crc(uint8_t *data, uint32_t length, uint32_t host_crc)
 {
-    uint32_t crc_value;
+    uint32_t crc_value = 0;
 
-    for (uint32_t i = 0; i < length; i++) {
-        uint32_t value = data[i];
-        crc_value = crc_accumulate(CRC, &value, 1);
+    /* The host feeds every byte as a separate 32-bit word, so the data register is written directly */
+    for (uint32_t i = 0; i < length; i++)
+    {
+        CRC->DR = data[i];
     }
+    crc_value = CRC->DR;
     BL_LOG("CRC value = 0x%08lX\n", crc_value);
     /* Reset CRC afterwards so that next time it starts accumulating with no previous value. */
     CRC->CR |= 1 << CRC_CR_RESET;
@@ -113,314 +477,692 @@ uint8_t bootloader_verify_crc(uint8_t *data, uint32_t length, uint32_t host_crc)
 
 uint8_t bootloader_verify_address(uint32_t address)
 {
-    if (
-        (address >= FLASH_BASE_ADDR && address <= FLASH_END_ADDR) ||
-        (address >= SRAM1_BASE_ADDR && address <= SRAM1_END_ADDR) ||
-        (address >= SRAM2_BASE_ADDR && address <= SRAM2_END_ADDR)
-    ) {
+    if (board_address_in_flash(address) || board_address_in_ram(address))
+    {
         return VALID_ADDR;
     }
 
     return INVALID_ADDR;
 }
 
-void bootloader_cmd_get_version(uint8_t *buffer)
+uint8_t bootloader_cmd_get_version(uint8_t *buffer)
 {
     uint8_t bl_version;
-    uint32_t packet_length = buffer[0] + 1;
-    uint32_t host_crc = *(uint32_t *)(buffer + packet_length - 4);
 
     BL_LOG("Called bootloader_cmd_get_version.\n");
-    if (!bootloader_verify_crc(buffer, packet_length - 4, host_crc))
-    {
-        BL_LOG("CRC checksum approved!\n");
-        bl_version = bootloader_get_version();
-        BL_LOG("BL_VERSION = %d (%#02X)\n", bl_version, bl_version);
-        bootloader_send_ack(1);
-        bootloader_send_data(&bl_version, 1);
-    }
-    else
-    {
-        BL_LOG("CRC checksum failed!\n");
-        bootloader_send_nack();
-    }
+
+    bl_version = bootloader_get_version();
+    BL_LOG("BL_VERSION = %d (%#02X)\n", bl_version, bl_version);
+    bootloader_send_ack(1);
+    bootloader_send_data(&bl_version, 1);
+
+    return BL_CMD_SUCCESS;
 }
 
-void bootloader_cmd_get_help(uint8_t *buffer)
+uint8_t bootloader_cmd_get_help(uint8_t *buffer)
 {
-    uint32_t packet_length = buffer[0] + 1;
-    uint32_t host_crc = *(uint32_t *)(buffer + packet_length - 4);
-
     BL_LOG("Called bootloader_cmd_get_help.\n");
-    if (!bootloader_verify_crc(buffer, packet_length - 4, host_crc))
-    {
-        BL_LOG("CRC checksum approved!\n");
-        uint8_t length = sizeof(supported_commands);
-        bootloader_send_ack(length);
-        bootloader_send_data(supported_commands, length);
-    }
-    else
-    {
-        BL_LOG("CRC checksum failed!\n");
-        bootloader_send_nack();
-    }
+
+    uint8_t length = sizeof(supported_commands);
+    bootloader_send_ack(length);
+    bootloader_send_data(supported_commands, length);
+
+    return BL_CMD_SUCCESS;
 }
 
-void bootloader_cmd_get_device_id(uint8_t *buffer)
+uint8_t bootloader_cmd_get_device_id(uint8_t *buffer)
 {
-    uint32_t packet_length = buffer[0] + 1;
-    uint32_t host_crc = *(uint32_t *)(buffer + packet_length - 4);
-
     BL_LOG("Called bootloader_cmd_get_device_id.\n");
-    if (!bootloader_verify_crc(buffer, packet_length - 4, host_crc))
-    {
-        BL_LOG("CRC checksum approved!\n");
-        uint16_t dev_id = bootloader_get_device_id();
-        BL_LOG("DEVICE_ID = %#04X\n", dev_id);
-        bootloader_send_ack(2);
-        bootloader_send_data((uint8_t *)&dev_id, 2);
-    }
-    else
-    {
-        BL_LOG("CRC checksum failed!\n");
-        bootloader_send_nack();
-    }
+
+    uint16_t dev_id = bootloader_get_device_id();
+    BL_LOG("DEVICE_ID = %#04X\n", dev_id);
+    bootloader_send_ack(2);
+    bootloader_send_data((uint8_t *)&dev_id, 2);
+
+    return BL_CMD_SUCCESS;
 }
 
-void bootloader_cmd_get_rdp_level(uint8_t *buffer)
+uint8_t bootloader_cmd_get_rdp_level(uint8_t *buffer)
 {
-    uint32_t packet_length = buffer[0] + 1;
-    uint32_t host_crc = *(uint32_t *)(buffer + packet_length - 4);
-
     BL_LOG("Called bootloader_cmd_get_rdp_level.\n");
-    if (!bootloader_verify_crc(buffer, packet_length - 4, host_crc))
+
+    uint8_t rdp_level = bootloader_get_rdp_level();
+    BL_LOG("RDP LEVEL = %#02X\n", rdp_level);
+    bootloader_send_ack(1);
+    bootloader_send_data(&rdp_level, 1);
+
+    return BL_CMD_SUCCESS;
+}
+
+uint8_t bootloader_cmd_jump_address(uint8_t *buffer)
+{
+    bl_jump_address_frame_t *frame = (bl_jump_address_frame_t *)buffer;
+
+    BL_LOG("Called bootloader_cmd_jump_address.\n");
+
+    bootloader_send_ack(1);
+
+    uint32_t jump_addr = frame->address;
+    BL_LOG("Jump address = 0x%08lX\n", jump_addr);
+    if (policy_check(jump_addr, 1, POLICY_EXECUTE) == POLICY_ALLOW)
     {
-        BL_LOG("CRC checksum approved!\n");
-        uint8_t rdp_level = bootloader_get_rdp_level();
-        BL_LOG("RDP LEVEL = %#02X\n", rdp_level);
-        bootloader_send_ack(1);
-        bootloader_send_data(&rdp_level, 1);
+        uint8_t valid_addr = VALID_ADDR;
+        bootloader_send_data(&valid_addr, 1);
+
+        if (bootloader_image_valid(jump_addr))
+        {
+            BL_LOG("Vector table found. Starting image at 0x%08lX.\n", jump_addr);
+            bootloader_jump_to_image(jump_addr);
+        }
+
+        BL_LOG("Valid. Jumping to 0x%08lX.\n", jump_addr);
+
+        /* Ensure that the last bit in the address is set for it to be a THUMB instruction */
+        jump_addr |= 1; 
+
+        void (*jump_address)(void) = (void (*)(void))jump_addr;
+        jump_address();
     }
     else
     {
-        BL_LOG("CRC checksum failed!\n");
-        bootloader_send_nack();
+        BL_LOG("Invalid address!\n");
+        uint8_t invalid_addr = INVALID_ADDR;
+        bootloader_send_data(&invalid_addr, 1);
     }
+
+    return BL_CMD_FAILURE;
 }
 
-void bootloader_cmd_jump_address(uint8_t *buffer)
+uint8_t bootloader_cmd_flash_erase(uint8_t *buffer)
 {
-    uint32_t packet_length = buffer[0] + 1;
-    uint32_t host_crc = *(uint32_t *)(buffer + packet_length - 4);
+    bl_flash_erase_frame_t *frame = (bl_flash_erase_frame_t *)buffer;
 
-    BL_LOG("Called bootloader_cmd_jump_address.\n");
+    BL_LOG("Called bootloader_cmd_flash_erase.\n");
+
+    bootloader_send_ack(1);
+
+    uint8_t status = bootloader_flash_erase(frame->base_sector_number, frame->num_of_sectors);
+    bootloader_send_data(&status, 1);
+
+    return status == ERASE_SUCCESS ? BL_CMD_SUCCESS : BL_CMD_FAILURE;
+}
+
+uint8_t bootloader_cmd_mem_write(uint8_t *buffer)
+{
+    bl_mem_write_frame_t *frame = (bl_mem_write_frame_t *)buffer;
+
+    BL_LOG("Called bootloader_cmd_mem_write.\n");
 
-    if (!bootloader_verify_crc(buffer, packet_length - 4, host_crc))
+    uint32_t base_address = frame->base_address;
+    uint8_t payload_size = frame->payload_size;
+
+    /* The payload size has to match the frame, otherwise stale buffer contents would be programmed */
+    if (payload_size == frame->header.length - BL_FRAME_LENGTH(bl_mem_write_frame_t) &&
+        policy_check(base_address, payload_size, POLICY_WRITE) == POLICY_ALLOW)
     {
-        BL_LOG("CRC checksum approved!\n");
-        bootloader_send_ack(1);
+        transport_hold(1);
+        manifest_range_modified(base_address, payload_size);
 
-        uint32_t jump_addr = *(uint32_t *)(buffer + 2);
-        BL_LOG("Jump address = 0x%08lX\n", jump_addr);
-        if (bootloader_verify_address(jump_addr) == VALID_ADDR)
-        {
-            uint8_t valid_addr = VALID_ADDR;
-            bootloader_send_data(&valid_addr, 1);
+        /* The payload is word aligned in the receive buffer and programmed from there */
+        flash_init();
+        flash_write(base_address, frame->payload, payload_size);
+        transport_hold(0);
 
-            BL_LOG("Valid. Jumping to 0x%08lX.\n", jump_addr);
+        /* The programmed range is read back by DMA while the ACK goes out */
+        verify_start(base_address, frame->payload, payload_size);
+        bootloader_send_ack(1);
 
-            /* Ensure that the last bit in the address is set for it to be a THUMB instruction */
-            jump_addr |= 1; 
+        /* The ACK already announced a 1 byte reply, the failing address is kept for BL_GET_STATUS */
+        uint32_t fail_address;
+        uint8_t status = WRITE_VERIFY_FAIL;
 
-            void (*jump_address)(void) = (void (*)(void))jump_addr;
-            jump_address();
-        }
-        else
+        if (verify_finish(&fail_address) == VERIFY_SUCCESS)
         {
-            BL_LOG("Invalid address!\n");
-            uint8_t invalid_addr = INVALID_ADDR;
-            bootloader_send_data(&invalid_addr, 1);
+            journal_write_completed(base_address, payload_size);
+            status = FLASH_SUCCESS;
         }
+        boot_log_update(status == FLASH_SUCCESS ? BOOT_LOG_UPDATE_WRITING : BOOT_LOG_UPDATE_FAILED, payload_size);
+
+        bootloader_send_data(&status, 1);
+        return status == FLASH_SUCCESS ? BL_CMD_SUCCESS : BL_CMD_FAILURE;
     }
     else
     {
-        BL_LOG("CRC checksum failed!\n");
-        bootloader_send_nack();
+        BL_LOG("Invalid address or payload size!\n");
+        bootloader_send_ack(1);
+        uint8_t status = FLASH_FAIL;
+        bootloader_send_data(&status, 1);
+        return BL_CMD_FAILURE;
     }
 }
 
-void bootloader_cmd_flash_erase(uint8_t *buffer)
+uint8_t bootloader_cmd_mem_read(uint8_t *buffer)
 {
-    uint32_t packet_length = buffer[0] + 1;
-    uint32_t host_crc = *(uint32_t *)(buffer + packet_length - 4);
+    bl_mem_read_frame_t *frame = (bl_mem_read_frame_t *)buffer;
 
-    BL_LOG("Called bootloader_cmd_flash_erase.\n");
+    BL_LOG("Called bootloader_cmd_mem_read.\n");
+
+    uint32_t base_address = frame->base_address;
+    uint32_t length = frame->length;
 
-    if (bootloader_verify_crc(buffer, packet_length - 4, host_crc) == CRC_STATUS_SUCCESS)
+    BL_LOG("Address: 0x%08lX, Length: %lu.\n", base_address, length);
+
+    /* A NACK would make the host resend the frame, a refused read is answered with a failure status */
+    uint8_t *response_buffer = pool_acquire();
+    if (response_buffer == NULL || length > BL_MEM_READ_MAX_LENGTH ||
+        policy_check(base_address, length, POLICY_READ) != POLICY_ALLOW)
     {
-        BL_LOG("CRC checksum approved!\n");
+        BL_LOG("Invalid address or length!\n");
+        pool_release(response_buffer);
         bootloader_send_ack(1);
-
-        uint8_t status = bootloader_flash_erase(buffer[2], buffer[3]);
+        uint8_t status = FLASH_FAIL;
         bootloader_send_data(&status, 1);
+        return BL_CMD_FAILURE;
     }
-    else
+
+    bootloader_send_ack(length + 1);
+
+    flash_init();
+    uint8_t status = flash_read(base_address, &response_buffer[1], length);
+    response_buffer[0] = status;
+
+    BL_LOG("Flash read status: %s.\n", status == FLASH_SUCCESS ? "success" : "fail");
+    bootloader_send_data(response_buffer, length + 1);
+    pool_release(response_buffer);
+
+    return status == FLASH_SUCCESS ? BL_CMD_SUCCESS : BL_CMD_FAILURE;
+}
+
+uint8_t bootloader_cmd_set_rw_protect(uint8_t *buffer)
+{
+    bl_set_rw_protect_frame_t *frame = (bl_set_rw_protect_frame_t *)buffer;
+
+    BL_LOG("Called bootloader_cmd_set_rw_protect.\n");
+
+    bootloader_send_ack(1);
+
+    uint8_t sectors = frame->sectors;
+    uint8_t prot_level = frame->protection_level;
+
+    char bin_sectors[sizeof(uint8_t) * 8 + 1];
+
+    for (uint8_t i = 0; i < sizeof(uint8_t) * 8; i++)
     {
-        BL_LOG("CRC checksum failed!\n");
-        bootloader_send_nack();
+        bin_sectors[i] = sectors >> ((sizeof(uint8_t) * 8) - i - 1) & 1 ? '1' : '0';
     }
+
+    bin_sectors[sizeof(uint8_t) * 8] = '\0';
+
+    BL_LOG("Sectors: 0b%s, Protection Level: %02u\n", bin_sectors, prot_level);
+
+    flash_init();
+    flash_set_protection_level(prot_level, sectors);
+
+    uint8_t status = FLASH_SUCCESS;
+    bootloader_send_data(&status, 1);
+
+    return status == FLASH_SUCCESS ? BL_CMD_SUCCESS : BL_CMD_FAILURE;
 }
 
-void bootloader_cmd_mem_write(uint8_t *buffer)
+uint8_t bootloader_cmd_get_rw_protect(uint8_t *buffer)
 {
-    uint32_t packet_length = buffer[0] + 1;
-    uint32_t host_crc = *(uint32_t *)(buffer + packet_length - 4);
+    BL_LOG("Called bootloader_cmd_get_rw_protect.\n");
 
-    BL_LOG("Called bootloader_cmd_mem_write.\n");
+    bootloader_send_ack(8);
+
+    uint8_t prot_level[8] = {0};
+
+    flash_init();
+    flash_get_protection_level(prot_level);
 
-    if (bootloader_verify_crc(buffer, packet_length - 4, host_crc) == CRC_STATUS_SUCCESS)
+    bootloader_send_data(prot_level, 8);
+
+    return BL_CMD_SUCCESS;
+}
+
+uint8_t bootloader_cmd_mcast_start(uint8_t *buffer)
+{
+    bl_mcast_start_frame_t *frame = (bl_mcast_start_frame_t *)buffer;
+
+    BL_LOG("Called bootloader_cmd_mcast_start.\n");
+
+    uint32_t base_address = frame->base_address;
+    uint16_t frame_count = frame->frame_count;
+    uint8_t frame_size = frame->frame_size;
+
+    bootloader_send_ack(1);
+
+    BL_LOG("Multicast base: 0x%08lX, frames: %u, frame size: %u.\n", base_address, frame_count, frame_size);
+
+    uint8_t status = FLASH_FAIL;
+    if (policy_check(base_address, (uint32_t)frame_count * frame_size, POLICY_WRITE) == POLICY_ALLOW &&
+        !mcast_session_start(base_address, frame_count, frame_size))
     {
-        BL_LOG("CRC checksum approved!\n");
+        flash_init();
+        status = FLASH_SUCCESS;
+    }
+    bootloader_send_data(&status, 1);
+
+    return status == FLASH_SUCCESS ? BL_CMD_SUCCESS : BL_CMD_FAILURE;
+}
 
-        uint32_t base_address = *(uint32_t *)(buffer + 2);
-        uint8_t payload_size = buffer[6];
+/*
+ * Data frames are never answered, otherwise every node on a shared link would reply to every frame.
+ * Out of range frames, and frames other than the last one with less than frame_size bytes of
+ * payload, are dropped and show up in the missing frames bitmap.
+ */
+uint8_t bootloader_cmd_mcast_data(uint8_t *buffer)
+{
+    bl_mcast_data_frame_t *frame = (bl_mcast_data_frame_t *)buffer;
+    const mcast_session_t *session = mcast_get_session();
 
-        bootloader_send_ack(1);
+    uint16_t sequence = frame->sequence;
+    uint32_t payload_size = frame->header.length + 1 - sizeof(bl_mcast_data_frame_t) - BL_FRAME_CRC_SIZE;
 
-        if (bootloader_verify_address(base_address) == VALID_ADDR)
-        {
-            flash_init();
-            flash_write(base_address, &buffer[7], payload_size);
+    if (!session->active || sequence >= session->frame_count || payload_size > session->frame_size ||
+        (sequence != session->frame_count - 1 ? payload_size != session->frame_size : payload_size == 0))
+    {
+        BL_LOG("Multicast frame %u dropped.\n", sequence);
+        return BL_CMD_FAILURE;
+    }
 
-            uint8_t status = FLASH_SUCCESS;
-            bootloader_send_data(&status, 1);
-        }
-        else
+    if (!mcast_frame_received(sequence))
+    {
+        uint32_t address = session->base_address + (uint32_t)sequence * session->frame_size;
+        uint32_t fail_address;
+
+        transport_hold(1);
+        manifest_range_modified(address, payload_size);
+        flash_write(address, frame->payload, payload_size);
+        transport_hold(0);
+
+        /* A frame that did not program correctly stays missing and is retransmitted */
+        verify_start(address, frame->payload, payload_size);
+        if (verify_finish(&fail_address) != VERIFY_SUCCESS)
         {
-            BL_LOG("Invalid address!\n");
-            uint8_t status = FLASH_FAIL;
-            bootloader_send_data(&status, 1);
+            boot_log_update(BOOT_LOG_UPDATE_FAILED, 0);
+            return BL_CMD_FAILURE;
         }
+        boot_log_update(BOOT_LOG_UPDATE_WRITING, payload_size);
+        mcast_mark_received(sequence);
     }
-    else
+
+    return BL_CMD_SUCCESS;
+}
+
+uint8_t bootloader_cmd_mcast_status(uint8_t *buffer)
+{
+    bl_mcast_status_frame_t *frame = (bl_mcast_status_frame_t *)buffer;
+
+    BL_LOG("Called bootloader_cmd_mcast_status.\n");
+
+    /* Without a session nothing is missing, the host has to tell that from a finished update */
+    uint8_t response[3 + MCAST_BITMAP_WINDOW];
+    uint8_t active = mcast_get_session()->active;
+    uint16_t missing = mcast_missing_count();
+
+    response[0] = active ? MCAST_SESSION_ACTIVE : MCAST_SESSION_NONE;
+    response[1] = missing & 0xFF;
+    response[2] = missing >> 8;
+    mcast_get_missing_bitmap(frame->first_frame, &response[3], MCAST_BITMAP_WINDOW);
+
+    BL_LOG("Multicast session %s, frames missing: %u.\n", active ? "active" : "not started", missing);
+    bootloader_send_ack(sizeof(response));
+    bootloader_send_data(response, sizeof(response));
+
+    return BL_CMD_SUCCESS;
+}
+
+uint8_t bootloader_cmd_session_begin(uint8_t *buffer)
+{
+    bl_session_begin_frame_t *frame = (bl_session_begin_frame_t *)buffer;
+
+    BL_LOG("Called bootloader_cmd_session_begin.\n");
+
+    uint32_t session_id = frame->session_id;
+    uint32_t base_address = frame->base_address;
+    uint32_t length = frame->length;
+
+    bootloader_send_ack(1);
+
+    BL_LOG("Session 0x%08lX, base: 0x%08lX, length: %lu.\n", session_id, base_address, length);
+
+    uint8_t status = FLASH_FAIL;
+    if (policy_check(base_address, length, POLICY_WRITE) == POLICY_ALLOW &&
+        !journal_session_begin(session_id, base_address, length))
     {
-        BL_LOG("CRC checksum failed!\n");
-        bootloader_send_nack();
+        status = FLASH_SUCCESS;
     }
+    bootloader_send_data(&status, 1);
+
+    return status == FLASH_SUCCESS ? BL_CMD_SUCCESS : BL_CMD_FAILURE;
 }
 
-void bootloader_cmd_mem_read(uint8_t *buffer)
+uint8_t bootloader_cmd_session_query(uint8_t *buffer)
 {
-    uint32_t packet_length = buffer[0] + 1;
-    uint32_t host_crc = *(uint32_t *)(buffer + packet_length - 4);
+    bl_session_frame_t *frame = (bl_session_frame_t *)buffer;
 
-    BL_LOG("Called bootloader_cmd_mem_read.\n");
+    BL_LOG("Called bootloader_cmd_session_query.\n");
+
+    const journal_record_t *session = journal_get_session();
+    uint8_t response[9] = {0};
 
-    if (bootloader_verify_crc(buffer, packet_length - 4, host_crc) == CRC_STATUS_SUCCESS)
+    /* The host only learns about its own session, anything else reads as no session */
+    if (session->state != JOURNAL_STATE_NONE && session->session_id == frame->session_id)
     {
-        BL_LOG("CRC checksum approved!\n");
+        response[0] = (uint8_t)session->state;
+        memcpy(&response[1], &session->committed_offset, 4);
+        memcpy(&response[5], &session->length, 4);
+    }
 
-        uint32_t base_address = *(uint32_t *)(buffer + 2);
-        uint32_t length = buffer[6];
+    BL_LOG("Session state: %d, committed offset: %lu.\n", response[0], session->committed_offset);
+    bootloader_send_ack(sizeof(response));
+    bootloader_send_data(response, sizeof(response));
 
-        bootloader_send_ack(length + 1);
+    return BL_CMD_SUCCESS;
+}
 
-        BL_LOG("Address: 0x%08lX, Length: %lu.\n", base_address, length);
+uint8_t bootloader_cmd_session_end(uint8_t *buffer)
+{
+    bl_session_frame_t *frame = (bl_session_frame_t *)buffer;
 
-        // TODO: Find out why malloc doesn't work and fix it
-        // uint8_t *response_buffer = (uint8_t *)malloc(length + 1);
-        // Temporarily switch to allocating memory on the stack
-        uint8_t response_buffer[255] = {0};
+    BL_LOG("Called bootloader_cmd_session_end.\n");
 
-        flash_init();
-        uint8_t status = flash_read(base_address, &response_buffer[1], length);
-        response_buffer[0] = status;
+    bootloader_send_ack(1);
 
-        BL_LOG("Flash read status: %s.\n", status == FLASH_SUCCESS ? "success" : "fail");
-        bootloader_send_data(response_buffer, length + 1);
-    }
-    else
+    uint8_t status = journal_session_end(frame->session_id) ? FLASH_FAIL : FLASH_SUCCESS;
+    if (status == FLASH_SUCCESS)
     {
-        BL_LOG("CRC checksum failed!\n");
-        bootloader_send_nack();
+        boot_log_update(BOOT_LOG_UPDATE_COMPLETE, 0);
     }
+    bootloader_send_data(&status, 1);
+
+    return status == FLASH_SUCCESS ? BL_CMD_SUCCESS : BL_CMD_FAILURE;
 }
 
-void bootloader_cmd_set_rw_protect(uint8_t *buffer)
+uint8_t bootloader_cmd_get_status(uint8_t *buffer)
 {
-    uint32_t packet_length = buffer[0] + 1;
-    uint32_t host_crc = *(uint32_t *)(buffer + packet_length - 4);
+    const supervisor_config_t *config = supervisor_get_config();
+    const pool_stats_t *pool = pool_get_stats();
+    const verify_stats_t *verify = verify_get_stats();
+    const usart_transport_stats_t *uart = usart_transport_get_stats();
+    bl_status_t status = {
+        .uptime_ms           = supervisor_get_ticks(),
+        .byte_timeout_ms     = config->byte_timeout_ms,
+        .session_timeout_ms  = config->session_timeout_ms,
+        .watchdog_timeout_ms = config->watchdog_timeout_ms,
+        .rx_timeouts         = rx_timeouts,
+        .crc_errors          = crc_errors,
+        .pool_in_use         = pool->in_use,
+        .pool_high_water     = pool->high_water,
+        .pool_failures       = pool->acquire_failures,
+        .verify_failures     = verify->failures,
+        .verify_fail_address = verify->last_fail_address,
+        .cycles_asleep       = power_get_cycles_asleep(),
+        .uart_overruns       = uart->overruns,
+        .uart_framing_errors = uart->framing_errors,
+        .uart_noise_errors   = uart->noise_errors,
+    };
+
+    BL_LOG("Called bootloader_cmd_get_status.\n");
+
+    bootloader_send_ack(sizeof(status));
+    bootloader_send_data((uint8_t *)&status, sizeof(status));
+
+    return BL_CMD_SUCCESS;
+}
 
-    BL_LOG("Called bootloader_cmd_set_rw_protect.\n");
+uint8_t bootloader_cmd_set_timeouts(uint8_t *buffer)
+{
+    bl_set_timeouts_frame_t *frame = (bl_set_timeouts_frame_t *)buffer;
+
+    BL_LOG("Called bootloader_cmd_set_timeouts.\n");
+    BL_LOG("Byte timeout: %lu ms, session timeout: %lu ms.\n", frame->byte_timeout_ms, frame->session_timeout_ms);
+
+    bootloader_send_ack(1);
+
+    uint8_t status = supervisor_set_timeouts(frame->byte_timeout_ms, frame->session_timeout_ms) ? FLASH_FAIL : FLASH_SUCCESS;
+    bootloader_send_data(&status, 1);
 
-    if (bootloader_verify_crc(buffer, packet_length - 4, host_crc) == CRC_STATUS_SUCCESS)
+    return status == FLASH_SUCCESS ? BL_CMD_SUCCESS : BL_CMD_FAILURE;
+}
+
+/*
+ * Executes the sub-frames of a batch in order and returns all their replies in one response:
+ * the number of executed sub-frames followed by their replies, each with its own ACK/NACK.
+ * Sub-frames are complete frames, CRC included. The batch stops at the first sub-frame that
+ * fails, which is the last one counted. Jumps and nested batches are rejected.
+ */
+uint8_t bootloader_cmd_batch(uint8_t *buffer)
+{
+    uint32_t offset = sizeof(bl_frame_header_t);
+    uint32_t end = buffer[0] + 1 - BL_FRAME_CRC_SIZE;
+    uint8_t status = BL_CMD_SUCCESS;
+
+    BL_LOG("Called bootloader_cmd_batch.\n");
+
+    uint8_t *results = pool_acquire();
+    uint8_t *sub_buffer = pool_acquire();
+    if (results == NULL || sub_buffer == NULL)
+    {
+        pool_release(results);
+        pool_release(sub_buffer);
+        bootloader_send_nack();
+        return BL_CMD_FAILURE;
+    }
+
+    /* The whole reply has to fit behind a single ACK length byte */
+    results[0] = 0;
+    capture_buffer = &results[1];
+    capture_size = BL_BATCH_MAX_REPLY_SIZE - 1;
+    capture_length = 0;
+    capture_overflow = 0;
+
+    while (offset < end && status == BL_CMD_SUCCESS)
     {
-        BL_LOG("CRC checksum approved!\n");
+        uint8_t *sub = &buffer[offset];
+        uint32_t sub_length = sub[0] + 1;
 
-        bootloader_send_ack(1);
+        if (sub_length < sizeof(bl_frame_header_t) || offset + sub_length > end ||
+            sub[1] == BL_BATCH || sub[1] == BL_JMP_ADDR)
+        {
+            BL_LOG("Invalid sub-frame at offset %lu.\n", offset);
+            status = BL_CMD_FAILURE;
+            break;
+        }
 
-        uint8_t sectors = buffer[2];
-        uint8_t prot_level = buffer[3];
+        /* Copied so that payloads are word aligned, as in a standalone frame */
+        uint8_t *sub_frame = sub_buffer + bootloader_frame_offset(sub[1]);
+        memcpy(sub_frame, sub, sub_length);
 
-        char bin_sectors[sizeof(uint8_t) * 8 + 1];
+        supervisor_kick();
+        status = bootloader_process_frame(sub_frame);
+        results[0]++;
+        offset += sub_length;
 
-        for (uint8_t i = 0; i < sizeof(uint8_t) * 8; i++)
+        if (capture_overflow)
         {
-            bin_sectors[i] = sectors >> ((sizeof(uint8_t) * 8) - i - 1) & 1 ? '1' : '0';
+            BL_LOG("Batch reply too long, stopping.\n");
+            status = BL_CMD_FAILURE;
         }
+    }
 
-        bin_sectors[sizeof(uint8_t) * 8] = '\0';
+    uint32_t length = capture_length + 1;
+    capture_buffer = NULL;
 
-        BL_LOG("Sectors: 0b%s, Protection Level: %02u\n", bin_sectors, prot_level);
+    BL_LOG("Batch executed %u sub-frames.\n", results[0]);
+    bootloader_send_ack(length);
+    bootloader_send_data(results, length);
 
-        flash_init();
-        flash_set_protection_level(prot_level, sectors);
+    pool_release(sub_buffer);
+    pool_release(results);
 
-        uint8_t status = FLASH_SUCCESS;
-        bootloader_send_data(&status, 1);
+    return status;
+}
+
+uint8_t bootloader_cmd_get_manifest(uint8_t *buffer)
+{
+    bl_get_manifest_frame_t *frame = (bl_get_manifest_frame_t *)buffer;
+    uint8_t response[1 + 4 * BOARD_NUM_OF_FLASH_SECTORS];
+
+    BL_LOG("Called bootloader_cmd_get_manifest.\n");
+
+    response[0] = BOARD_NUM_OF_FLASH_SECTORS;
+    for (uint8_t i = 0; i < BOARD_NUM_OF_FLASH_SECTORS; i++)
+    {
+        uint32_t crc = manifest_sector_crc(i, frame->flags);
+        memcpy(&response[1 + 4 * i], &crc, 4);
     }
-    else
+
+    bootloader_send_ack(sizeof(response));
+    bootloader_send_data(response, sizeof(response));
+
+    return BL_CMD_SUCCESS;
+}
+
+uint8_t bootloader_cmd_get_boot_log(uint8_t *buffer)
+{
+    bl_get_boot_log_frame_t *frame = (bl_get_boot_log_frame_t *)buffer;
+
+    BL_LOG("Called bootloader_cmd_get_boot_log.\n");
+
+    uint8_t *response_buffer = pool_acquire();
+    if (response_buffer == NULL)
     {
-        BL_LOG("CRC checksum failed!\n");
         bootloader_send_nack();
+        return BL_CMD_FAILURE;
     }
+
+    /* The entries stay word aligned, the count goes right in front of them */
+    boot_log_entry_t *entries = (boot_log_entry_t *)&response_buffer[4];
+    uint8_t count = boot_log_read(frame->sequence, entries, BOOT_LOG_MAX_READ_ENTRIES);
+    uint32_t length = 1 + count * sizeof(boot_log_entry_t);
+
+    response_buffer[3] = count;
+
+    BL_LOG("Boot log entries from %lu: %u.\n", frame->sequence, count);
+    bootloader_send_ack(length);
+    bootloader_send_data(&response_buffer[3], length);
+    pool_release(response_buffer);
+
+    return BL_CMD_SUCCESS;
 }
 
-void bootloader_cmd_get_rw_protect(uint8_t *buffer)
+#ifdef BL_CMD_ENABLE_STAGE
+uint8_t bootloader_cmd_stage_erase(uint8_t *buffer)
 {
-    uint32_t packet_length = buffer[0] + 1;
-    uint32_t host_crc = *(uint32_t *)(buffer + packet_length - 4);
+    bl_stage_erase_frame_t *frame = (bl_stage_erase_frame_t *)buffer;
 
-    BL_LOG("Called bootloader_cmd_get_rw_protect.\n");
+    BL_LOG("Called bootloader_cmd_stage_erase.\n");
+    BL_LOG("Staging offset: 0x%08lX, length: %lu.\n", frame->offset, frame->length);
+
+    bootloader_send_ack(1);
+
+    uint8_t status = qspi_erase(frame->offset, frame->length) == QSPI_SUCCESS ? FLASH_SUCCESS : FLASH_FAIL;
+    bootloader_send_data(&status, 1);
+
+    return status == FLASH_SUCCESS ? BL_CMD_SUCCESS : BL_CMD_FAILURE;
+}
+
+uint8_t bootloader_cmd_stage_write(uint8_t *buffer)
+{
+    bl_stage_write_frame_t *frame = (bl_stage_write_frame_t *)buffer;
+    uint8_t payload_size = frame->payload_size;
+    uint8_t status = FLASH_FAIL;
+
+    BL_LOG("Called bootloader_cmd_stage_write.\n");
 
-    if (bootloader_verify_crc(buffer, packet_length - 4, host_crc) == CRC_STATUS_SUCCESS)
+    if (payload_size == frame->header.length - BL_FRAME_LENGTH(bl_stage_write_frame_t) &&
+        qspi_write(frame->offset, frame->payload, payload_size) == QSPI_SUCCESS)
     {
-        BL_LOG("CRC checksum approved!\n");
+        status = FLASH_SUCCESS;
+    }
 
-        bootloader_send_ack(8);
+    bootloader_send_ack(1);
+    bootloader_send_data(&status, 1);
 
-        uint8_t prot_level[8] = {0};
+    return status == FLASH_SUCCESS ? BL_CMD_SUCCESS : BL_CMD_FAILURE;
+}
 
-        flash_init();
-        flash_get_protection_level(prot_level);
+uint8_t bootloader_cmd_stage_commit(uint8_t *buffer)
+{
+    bl_stage_commit_frame_t *frame = (bl_stage_commit_frame_t *)buffer;
 
-        bootloader_send_data(prot_level, 8);
+    BL_LOG("Called bootloader_cmd_stage_commit.\n");
+    BL_LOG("Staging offset: 0x%08lX, destination: 0x%08lX, length: %lu.\n",
+           frame->offset, frame->destination_address, frame->length);
+
+    bootloader_send_ack(1);
+
+    uint8_t status = bootloader_stage_commit(frame->offset, frame->destination_address, frame->length, frame->crc);
+    if (status == FLASH_SUCCESS)
+    {
+        boot_log_update(BOOT_LOG_UPDATE_COMPLETE, frame->length);
     }
     else
     {
-        BL_LOG("CRC checksum failed!\n");
-        bootloader_send_nack();
+        boot_log_update(BOOT_LOG_UPDATE_FAILED, 0);
     }
+    bootloader_send_data(&status, 1);
+
+    return status == FLASH_SUCCESS ? BL_CMD_SUCCESS : BL_CMD_FAILURE;
 }
+#endif
 
 void bootloader_send_data(uint8_t *tx_data, uint32_t length)
 {
-    usart_transmit(&BL_UART, tx_data, length);
+    if (capture_buffer != NULL)
+    {
+        if (length > capture_size - capture_length)
+        {
+            length = capture_size - capture_length;
+            capture_overflow = 1;
+        }
+        memcpy(&capture_buffer[capture_length], tx_data, length);
+        capture_length += length;
+        return;
+    }
+
+    transport_get_active()->send(tx_data, length);
+}
+
+/* Polls the active transport and keeps the watchdog fed until data arrives or timeout_ms passes (0 waits forever) */
+uint8_t bootloader_wait_for_data(uint32_t timeout_ms)
+{
+    const bl_transport_t *transport = transport_get_active();
+    uint32_t start_tick = supervisor_get_ticks();
+
+    while (!transport->data_available())
+    {
+        supervisor_kick();
+
+        if (timeout_ms != 0 && supervisor_elapsed(start_tick, timeout_ms))
+        {
+            return RX_STATUS_TIMEOUT;
+        }
+
+        power_idle();
+    }
+
+    return RX_STATUS_SUCCESS;
 }
 
-void bootloader_receive_data(uint8_t *rx_data, uint32_t length)
+/* Every byte has to arrive within the byte timeout of the previous one */
+uint8_t bootloader_receive_data(uint8_t *rx_data, uint32_t length)
 {
-    usart_receive(&BL_UART, rx_data, length);
+    const bl_transport_t *transport = transport_get_active();
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        if (bootloader_wait_for_data(supervisor_get_config()->byte_timeout_ms) != RX_STATUS_SUCCESS)
+        {
+            rx_timeouts++;
+            return RX_STATUS_TIMEOUT;
+        }
+        transport->receive(&rx_data[i], 1);
+    }
+
+    return RX_STATUS_SUCCESS;
 }
 
 void bootloader_send_ack(uint8_t length_to_follow)
@@ -457,31 +1199,133 @@ uint8_t bootloader_flash_erase(uint8_t base_sector_number, uint8_t num_of_sector
 {
     if (base_sector_number == 0xFF)
     {
+        if (policy_check(BOARD_FLASH_BASE_ADDR, BOARD_FLASH_SIZE, POLICY_ERASE) != POLICY_ALLOW)
+        {
+            BL_LOG("Mass erase is not allowed.\n");
+            return ERASE_FAILURE;
+        }
+
+        for (uint8_t i = 0; i < BOARD_NUM_OF_FLASH_SECTORS; i++)
+        {
+            manifest_sector_modified(i);
+        }
+
         /* Perform mass erase */
         BL_LOG("Performing mass erase of flash memory.\n");
+        boot_log_update(BOOT_LOG_UPDATE_WRITING, 0);
+        transport_hold(1);
         flash_init();
+        supervisor_kick();
         flash_mass_erase();
+        transport_hold(0);
         return ERASE_SUCCESS;
     }
 
-    const uint8_t NUM_OF_FLASH_SECTORS = 8;
-
     if (
-        base_sector_number < FLASH_SECTOR_0_NUMBER ||
-        base_sector_number > FLASH_SECTOR_7_NUMBER ||
-        num_of_sectors > NUM_OF_FLASH_SECTORS - base_sector_number)
+        base_sector_number >= BOARD_NUM_OF_FLASH_SECTORS ||
+        num_of_sectors > BOARD_NUM_OF_FLASH_SECTORS - base_sector_number)
     {
         BL_LOG("Incorrect parameters for flash erase.\n");
         return ERASE_FAILURE;
     }
 
+    if (num_of_sectors == 0)
+    {
+        return ERASE_SUCCESS;
+    }
+
+    /* Rejected before the first, slow, sector erase starts */
+    const board_region_t *first = &board_flash_sectors[base_sector_number];
+    const board_region_t *last = &board_flash_sectors[base_sector_number + num_of_sectors - 1];
+    uint32_t length = last->base_address + last->size - first->base_address;
+
+    if (policy_check(first->base_address, length, POLICY_ERASE) != POLICY_ALLOW)
+    {
+        return ERASE_FAILURE;
+    }
+
     BL_LOG("Erasing %d sectors starting from %d.\n", num_of_sectors, base_sector_number);
+    boot_log_update(BOOT_LOG_UPDATE_WRITING, 0);
+    transport_hold(1);
     flash_init();
     for (uint8_t i = base_sector_number; i < base_sector_number + num_of_sectors; i++)
     {
+        /* A 128 KB sector takes up to 2 s, a run of them would outlast the watchdog */
+        supervisor_kick();
+        manifest_sector_modified(i);
         flash_sector_erase(i);
         BL_LOG("Erased %d sector.\n", i);
     }
+    transport_hold(0);
 
     return ERASE_SUCCESS;
 }
+
+#ifdef BL_CMD_ENABLE_STAGE
+/*
+ * Copies an image staged in the external flash to destination_address, which has to be the
+ * base of a sector. The staged copy is checked against the CRC of the host first, so a bad
+ * image never erases the internal FLASH. It is then programmed straight from the memory-mapped
+ * window and verified in blocks of BL_STAGE_BLOCK_SIZE.
+ */
+uint8_t bootloader_stage_commit(uint32_t offset, uint32_t destination_address, uint32_t length, uint32_t crc)
+{
+    const uint8_t *staged = (const uint8_t *)(QSPI_MAPPED_BASE_ADDR + offset);
+
+    if (!qspi_is_ready())
+    {
+        BL_LOG("QSPI flash not available.\n");
+        return FLASH_FAIL;
+    }
+
+    if (length == 0 || offset % 4 != 0 || !qspi_range_valid(offset, length) ||
+        policy_check(destination_address, length, POLICY_ERASE | POLICY_WRITE) != POLICY_ALLOW)
+    {
+        BL_LOG("Invalid staging parameters.\n");
+        return FLASH_FAIL;
+    }
+
+    uint8_t first = board_flash_sector(destination_address);
+    uint8_t last = board_flash_sector(destination_address + length - 1);
+
+    if (first == BOARD_INVALID_SECTOR || last == BOARD_INVALID_SECTOR ||
+        board_flash_sectors[first].base_address != destination_address)
+    {
+        BL_LOG("Destination is not the base of a sector.\n");
+        return FLASH_FAIL;
+    }
+
+    if (bootloader_verify_crc((uint8_t *)staged, length, crc) != CRC_STATUS_SUCCESS)
+    {
+        BL_LOG("Staged image CRC mismatch!\n");
+        return FLASH_FAIL;
+    }
+
+    if (bootloader_flash_erase(first, last - first + 1) != ERASE_SUCCESS)
+    {
+        return FLASH_FAIL;
+    }
+
+    for (uint32_t done = 0; done < length; done += BL_STAGE_BLOCK_SIZE)
+    {
+        uint32_t block_size = length - done < BL_STAGE_BLOCK_SIZE ? length - done : BL_STAGE_BLOCK_SIZE;
+        uint32_t fail_address;
+
+        supervisor_kick();
+        transport_hold(1);
+        manifest_range_modified(destination_address + done, block_size);
+        flash_write(destination_address + done, (uint8_t *)&staged[done], block_size);
+        transport_hold(0);
+
+        verify_start(destination_address + done, &staged[done], block_size);
+        if (verify_finish(&fail_address) != VERIFY_SUCCESS)
+        {
+            return FLASH_FAIL;
+        }
+    }
+
+    BL_LOG("Staged image committed to 0x%08lX.\n", destination_address);
+
+    return FLASH_SUCCESS;
+}
+#endif
@@ -5,18 +5,19 @@
 #include "stm32f446xx_flash.h"
 
 #define BL_ENABLE_DEBUG_PRINT
+#include "board.h"
 #include "peripherals.h"
 #include "utils.h"
 
 /* Version 1.0 */
 #define BL_VERSION          0x10
-#define BL_RX_BUFFER_SIZE   1024
+#define BL_APP_BASE_ADDR    BOARD_APP_BASE_ADDR
+#define BL_BATCH_MAX_REPLY_SIZE 255
+#define BL_MEM_READ_MAX_LENGTH  254     // Status byte and data behind a single ACK length byte
+#define BL_STAGE_BLOCK_SIZE     4096    // Programmed and verified at once by BL_STAGE_COMMIT
 
-/* STM32F466xx memory addresses */
-#define SRAM1_SIZE      (112 * 1024)                      // 112KB of SRAM1
-#define SRAM1_END_ADDR  (SRAM1_BASE_ADDR + SRAM1_SIZE)
-#define SRAM2_SIZE      (16 * 1024)                       // 16KB of SRAM2
-#define SRAM2_END_ADDR  (SRAM2_BASE_ADDR + SRAM2_SIZE)
+/* Large buffers go to the BUFFERS SRAM region, which is not cleared at startup */
+#define BL_BUFFER           __attribute__((section(".buffers"), aligned(4)))
 
 #define BL_ACK              0xBB
 #define BL_NACK             0xEE
@@ -26,6 +27,11 @@
 #define ERASE_FAILURE       1
 #define CRC_STATUS_SUCCESS  0
 #define CRC_STATUS_FAILURE  1
+#define RX_STATUS_SUCCESS   0
+#define RX_STATUS_TIMEOUT   1
+#define WRITE_VERIFY_FAIL   2   // Reply to BL_MEM_WRITE
+#define BL_CMD_SUCCESS      0
+#define BL_CMD_FAILURE      1
 
 #define BL_GET_VER          0xA1
 #define BL_GET_HELP         0xA2
@@ -37,35 +43,68 @@
 #define BL_MEM_READ         0xA8
 #define BL_SET_RW_PROTECT   0xA9
 #define BL_GET_RW_PROTECT   0xAA
+#define BL_MCAST_START      0xAB
+#define BL_MCAST_DATA       0xAC
+#define BL_MCAST_STATUS     0xAD
+#define BL_SESSION_BEGIN    0xAE
+#define BL_SESSION_QUERY    0xAF
+#define BL_SESSION_END      0xB0
+#define BL_GET_STATUS       0xB1
+#define BL_SET_TIMEOUTS     0xB2
+#define BL_BATCH            0xB3
+#define BL_STAGE_ERASE      0xB4
+#define BL_STAGE_WRITE      0xB5
+#define BL_STAGE_COMMIT     0xB6
+#define BL_GET_MANIFEST     0xB7
+#define BL_GET_BOOT_LOG     0xB8
 
-uint8_t supported_commands[] = {
-    BL_GET_VER, BL_GET_HELP, BL_GET_DEV_ID, BL_GET_RDP_LEVEL, BL_JMP_ADDR,
-    BL_FLASH_ERASE, BL_MEM_WRITE, BL_MEM_READ, BL_SET_RW_PROTECT, BL_GET_RW_PROTECT
-};
-
-void bootloader_cmd_get_version(uint8_t *buffer);
-void bootloader_cmd_get_help(uint8_t *buffer);
-void bootloader_cmd_get_device_id(uint8_t *buffer);
-void bootloader_cmd_get_rdp_level(uint8_t *buffer);
-void bootloader_cmd_jump_address(uint8_t *buffer);
-void bootloader_cmd_flash_erase(uint8_t *buffer);
-void bootloader_cmd_mem_write(uint8_t *buffer);
-void bootloader_cmd_mem_read(uint8_t *buffer);
-void bootloader_cmd_set_rw_protect(uint8_t *buffer);
-void bootloader_cmd_get_rw_protect(uint8_t *buffer);
+uint8_t bootloader_cmd_get_version(uint8_t *buffer);
+uint8_t bootloader_cmd_get_help(uint8_t *buffer);
+uint8_t bootloader_cmd_get_device_id(uint8_t *buffer);
+uint8_t bootloader_cmd_get_rdp_level(uint8_t *buffer);
+uint8_t bootloader_cmd_jump_address(uint8_t *buffer);
+uint8_t bootloader_cmd_flash_erase(uint8_t *buffer);
+uint8_t bootloader_cmd_mem_write(uint8_t *buffer);
+uint8_t bootloader_cmd_mem_read(uint8_t *buffer);
+uint8_t bootloader_cmd_set_rw_protect(uint8_t *buffer);
+uint8_t bootloader_cmd_get_rw_protect(uint8_t *buffer);
+uint8_t bootloader_cmd_mcast_start(uint8_t *buffer);
+uint8_t bootloader_cmd_mcast_data(uint8_t *buffer);
+uint8_t bootloader_cmd_mcast_status(uint8_t *buffer);
+uint8_t bootloader_cmd_session_begin(uint8_t *buffer);
+uint8_t bootloader_cmd_session_query(uint8_t *buffer);
+uint8_t bootloader_cmd_session_end(uint8_t *buffer);
+uint8_t bootloader_cmd_get_status(uint8_t *buffer);
+uint8_t bootloader_cmd_set_timeouts(uint8_t *buffer);
+uint8_t bootloader_cmd_batch(uint8_t *buffer);
+uint8_t bootloader_cmd_stage_erase(uint8_t *buffer);
+uint8_t bootloader_cmd_stage_write(uint8_t *buffer);
+uint8_t bootloader_cmd_stage_commit(uint8_t *buffer);
+uint8_t bootloader_cmd_get_manifest(uint8_t *buffer);
+uint8_t bootloader_cmd_get_boot_log(uint8_t *buffer);
 
 void bootloader_goto_application(void);
+void bootloader_jump_to_image(uint32_t base_address);
+uint8_t bootloader_image_valid(uint32_t base_address);
 void bootloader_start_interactive_mode(void);
+uint8_t bootloader_process_frame(uint8_t *frame);
+uint8_t bootloader_dispatch_command(uint8_t *frame);
+uint8_t *bootloader_receive_frame(uint8_t *rx_buffer);
+uint32_t bootloader_frame_offset(uint8_t command);
+uint32_t bootloader_frame_min_length(uint8_t command);
 void bootloader_send_data(uint8_t *tx_data, uint32_t length);
-void bootloader_receive_data(uint8_t *rx_data, uint32_t length);
+uint8_t bootloader_wait_for_data(uint32_t timeout_ms);
+uint8_t bootloader_receive_data(uint8_t *rx_data, uint32_t length);
 void bootloader_send_ack(uint8_t length_to_follow);
 void bootloader_send_nack(void);
 
 uint8_t bootloader_verify_crc(uint8_t *data, uint32_t length, uint32_t host_crc);
+uint8_t bootloader_verify_frame_crc(uint8_t *frame);
 uint8_t bootloader_verify_address(uint32_t address);
 uint8_t bootloader_get_version(void);
 uint8_t bootloader_get_rdp_level(void);
 uint16_t bootloader_get_device_id(void);
 uint8_t bootloader_flash_erase(uint8_t base_sector_number, uint8_t num_of_sectors);
+uint8_t bootloader_stage_commit(uint32_t offset, uint32_t destination_address, uint32_t length, uint32_t crc);
 
 #endif
@@ -0,0 +1,409 @@
+#include "bootloader.h"
+#include "ring_buffer.h"
+#include "supervisor.h"
+#include "transport.h"
+#include "can_isotp.h"
+
+#ifdef BL_ENABLE_CAN
+
+/* bxCAN registers (RM0390, chapter 30) */
+#define CAN1_BASE_ADDR          0x40006400U
+#define CAN_REG(offset)         (*(volatile uint32_t *)(CAN1_BASE_ADDR + (offset)))
+
+#define CAN_MCR                 CAN_REG(0x000)
+#define CAN_MSR                 CAN_REG(0x004)
+#define CAN_TSR                 CAN_REG(0x008)
+#define CAN_RF0R                CAN_REG(0x00C)
+#define CAN_IER                 CAN_REG(0x014)
+#define CAN_BTR                 CAN_REG(0x01C)
+#define CAN_TI0R                CAN_REG(0x180)
+#define CAN_TDT0R               CAN_REG(0x184)
+#define CAN_TDL0R               CAN_REG(0x188)
+#define CAN_TDH0R               CAN_REG(0x18C)
+#define CAN_RI0R                CAN_REG(0x1B0)
+#define CAN_RDT0R               CAN_REG(0x1B4)
+#define CAN_RDL0R               CAN_REG(0x1B8)
+#define CAN_RDH0R               CAN_REG(0x1BC)
+#define CAN_FMR                 CAN_REG(0x200)
+#define CAN_FM1R                CAN_REG(0x204)
+#define CAN_FS1R                CAN_REG(0x20C)
+#define CAN_FFA1R               CAN_REG(0x214)
+#define CAN_FA1R                CAN_REG(0x21C)
+#define CAN_F0R1                CAN_REG(0x240)
+#define CAN_F0R2                CAN_REG(0x244)
+
+#define CAN_MCR_INRQ            (1U << 0)
+#define CAN_MCR_SLEEP           (1U << 1)
+#define CAN_MCR_TXFP            (1U << 2)
+#define CAN_MCR_ABOM            (1U << 6)
+#define CAN_MSR_INAK            (1U << 0)
+#define CAN_MSR_SLAK            (1U << 1)
+#define CAN_TSR_ABRQ0           (1U << 7)
+#define CAN_TSR_TME0            (1U << 26)
+#define CAN_RF0R_FMP0_MASK      0x3U
+#define CAN_RF0R_RFOM0          (1U << 5)
+#define CAN_IER_FMPIE0          (1U << 1)
+#define CAN_TIR_TXRQ            (1U << 0)
+#define CAN_ID_STID_POS         21
+#define CAN_RDTR_DLC_MASK       0xFU
+#define CAN_FMR_FINIT           (1U << 0)
+#define CAN_FILTER_STID_POS     5
+#define RCC_APB1ENR_CAN1EN      (1U << 25)
+
+/* 16 MHz APB1 / 2 = 8 MHz time quantum, 1 + 13 + 2 = 16 tq per bit -> 500 kbit/s, 87.5% sample point */
+#define CAN_BTR_500KBPS         ((1U << 20) | (12U << 16) | 1U)
+
+/* ISO-TP protocol control information */
+#define ISOTP_SINGLE_FRAME      0x0
+#define ISOTP_FIRST_FRAME       0x1
+#define ISOTP_CONSECUTIVE_FRAME 0x2
+#define ISOTP_FLOW_CONTROL      0x3
+#define ISOTP_FC_CONTINUE       0x0
+#define ISOTP_FC_WAIT           0x1
+#define ISOTP_FC_OVERFLOW       0x2
+#define ISOTP_PADDING_BYTE      0xCC
+
+#define REQUEST_ID              (CAN_ISOTP_REQUEST_BASE_ID + BL_NODE_ID)
+#define BROADCAST_ID            (CAN_ISOTP_REQUEST_BASE_ID + BL_BROADCAST_NODE_ID)
+#define RESPONSE_ID             (CAN_ISOTP_RESPONSE_BASE_ID + BL_NODE_ID)
+
+typedef struct
+{
+    uint32_t id;
+    uint8_t dlc;
+    uint8_t data[8];
+} can_frame_t;
+
+static volatile uint8_t rx_storage[CAN_ISOTP_RX_BUFFER_SIZE] BL_BUFFER;
+static ring_buffer_t rx_buffer = RING_BUFFER_INIT(rx_storage);
+
+/* Reassembly state of the segmented message currently being received */
+static uint8_t message[CAN_ISOTP_MAX_MESSAGE_SIZE] BL_BUFFER;
+static uint32_t message_length;
+static uint32_t message_received;
+static uint8_t message_sequence;
+static uint8_t message_block_count;     // Consecutive frames received since the last flow control frame
+
+/* Last flow control frame sent by the host */
+static uint8_t fc_received;
+static uint8_t fc_status;
+static uint8_t fc_block_size;
+static uint8_t fc_st_min;
+
+static void can_gpio_init(void)
+{
+    gpio_handle_t can_gpio = {0};
+    can_gpio.gpiox                  = BOARD_CAN_PORT;
+    can_gpio.config.pin_mode        = GPIO_MODE_ALT_FUNC;
+    can_gpio.config.pin_alt_func    = BOARD_CAN_ALT_FUNC;
+    can_gpio.config.pin_output_type = GPIO_OUTPUT_PUSH_PULL;
+    can_gpio.config.pin_pupd        = GPIO_PULL_UP;
+    can_gpio.config.pin_speed       = GPIO_SPEED_HIGH;
+
+    can_gpio.config.pin_number      = BOARD_CAN_RX_PIN;
+    gpio_init(&can_gpio);
+
+    can_gpio.config.pin_number      = BOARD_CAN_TX_PIN;
+    gpio_init(&can_gpio);
+}
+
+static uint8_t can_read_frame(can_frame_t *frame)
+{
+    if (!(CAN_RF0R & CAN_RF0R_FMP0_MASK))
+    {
+        return 0;
+    }
+
+    uint32_t low = CAN_RDL0R;
+    uint32_t high = CAN_RDH0R;
+
+    frame->id = CAN_RI0R >> CAN_ID_STID_POS;
+    frame->dlc = CAN_RDT0R & CAN_RDTR_DLC_MASK;
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        frame->data[i] = (uint8_t)(low >> (8 * i));
+        frame->data[i + 4] = (uint8_t)(high >> (8 * i));
+    }
+
+    CAN_RF0R |= CAN_RF0R_RFOM0;
+    return 1;
+}
+
+/* Returns 0 if mailbox 0 did not become free within CAN_ISOTP_TX_TIMEOUT_MS */
+static uint8_t can_write_frame(uint32_t id, const uint8_t *data, uint8_t length)
+{
+    uint8_t padded[8];
+    uint32_t start_tick = supervisor_get_ticks();
+
+    memset(padded, ISOTP_PADDING_BYTE, sizeof(padded));
+    memcpy(padded, data, length);
+
+    /* Only mailbox 0 is used so that consecutive frames can never overtake each other */
+    while (!(CAN_TSR & CAN_TSR_TME0))
+    {
+        supervisor_kick();
+
+        if (supervisor_elapsed(start_tick, CAN_ISOTP_TX_TIMEOUT_MS))
+        {
+            /* Nobody acknowledges the pending frame, drop it instead of retrying forever */
+            CAN_TSR |= CAN_TSR_ABRQ0;
+            BL_LOG("CAN transmit timeout.\n");
+            return 0;
+        }
+    }
+
+    CAN_TI0R  = id << CAN_ID_STID_POS;
+    CAN_TDT0R = sizeof(padded);
+    CAN_TDL0R = padded[0] | (padded[1] << 8) | (padded[2] << 16) | ((uint32_t)padded[3] << 24);
+    CAN_TDH0R = padded[4] | (padded[5] << 8) | (padded[6] << 16) | ((uint32_t)padded[7] << 24);
+    CAN_TI0R |= CAN_TIR_TXRQ;
+    return 1;
+}
+
+static void isotp_send_flow_control(uint8_t flow_status)
+{
+    /* STmin 0: the frames of a block may come back to back, the receive FIFO holds all of them */
+    uint8_t frame[3] = { (ISOTP_FLOW_CONTROL << 4) | flow_status, CAN_ISOTP_BLOCK_SIZE, 0 };
+    message_block_count = 0;
+    (void)can_write_frame(RESPONSE_ID, frame, sizeof(frame));
+}
+
+static void isotp_store(const uint8_t *data, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        ring_buffer_put(&rx_buffer, data[i]);
+    }
+}
+
+static void isotp_process_frame(const can_frame_t *frame)
+{
+    uint32_t length;
+
+    switch (frame->data[0] >> 4)
+    {
+    case ISOTP_SINGLE_FRAME:
+        length = frame->data[0] & 0x0F;
+        if (length > 0 && length < frame->dlc && length <= ring_buffer_free(&rx_buffer))
+        {
+            isotp_store(&frame->data[1], length);
+        }
+        break;
+    case ISOTP_FIRST_FRAME:
+        length = ((frame->data[0] & 0x0F) << 8) | frame->data[1];
+        if (length > CAN_ISOTP_MAX_MESSAGE_SIZE || length > ring_buffer_free(&rx_buffer))
+        {
+            BL_LOG("ISO-TP message of %lu bytes does not fit.\n", length);
+            isotp_send_flow_control(ISOTP_FC_OVERFLOW);
+            break;
+        }
+        memcpy(message, &frame->data[2], 6);
+        message_length = length;
+        message_received = 6;
+        message_sequence = 1;
+        isotp_send_flow_control(ISOTP_FC_CONTINUE);
+        break;
+    case ISOTP_CONSECUTIVE_FRAME:
+        if (message_received >= message_length)
+        {
+            break;
+        }
+        if ((frame->data[0] & 0x0F) != message_sequence)
+        {
+            BL_LOG("ISO-TP sequence error, dropping message.\n");
+            message_length = message_received = 0;
+            break;
+        }
+        length = message_length - message_received;
+        if (length > 7)
+        {
+            length = 7;
+        }
+        memcpy(&message[message_received], &frame->data[1], length);
+        message_received += length;
+        message_sequence = (message_sequence + 1) & 0x0F;
+        /* Only complete messages reach the bootloader so that a lost frame cannot desync the parser */
+        if (message_received == message_length)
+        {
+            isotp_store(message, message_length);
+        }
+        else if (++message_block_count == CAN_ISOTP_BLOCK_SIZE)
+        {
+            isotp_send_flow_control(ISOTP_FC_CONTINUE);
+        }
+        break;
+    case ISOTP_FLOW_CONTROL:
+        fc_status = frame->data[0] & 0x0F;
+        fc_block_size = frame->data[1];
+        fc_st_min = frame->data[2];
+        fc_received = 1;
+        break;
+    default:
+        break;
+    }
+}
+
+static void can_poll(void)
+{
+    can_frame_t frame;
+
+    while (can_read_frame(&frame))
+    {
+        isotp_process_frame(&frame);
+    }
+}
+
+/* An FC_WAIT restarts N_Bs, but only CAN_ISOTP_FC_WAIT_MAX of them in a row are accepted */
+static uint8_t isotp_wait_flow_control(void)
+{
+    uint32_t start_tick = supervisor_get_ticks();
+    uint32_t waits = 0;
+
+    while (1)
+    {
+        supervisor_kick();
+        can_poll();
+
+        if (fc_received)
+        {
+            fc_received = 0;
+            if (fc_status != ISOTP_FC_WAIT)
+            {
+                return fc_status;
+            }
+            if (++waits > CAN_ISOTP_FC_WAIT_MAX)
+            {
+                BL_LOG("ISO-TP flow control waits exceeded.\n");
+                return ISOTP_FC_OVERFLOW;
+            }
+            start_tick = supervisor_get_ticks();
+        }
+
+        if (supervisor_elapsed(start_tick, CAN_ISOTP_FC_TIMEOUT_MS))
+        {
+            BL_LOG("ISO-TP flow control timeout.\n");
+            return ISOTP_FC_OVERFLOW;
+        }
+    }
+}
+
+static void isotp_separation_delay(uint8_t st_min)
+{
+    /* 0x00-0x7F are milliseconds, 0xF1-0xF9 are 100-900 us, anything else is reserved and means 127 ms */
+    uint32_t us = st_min <= 0x7F ? st_min * 1000U : (st_min >= 0xF1 && st_min <= 0xF9 ? (st_min - 0xF0) * 100U : 127000U);
+    uint64_t end = supervisor_get_cycles() + (uint64_t)us * (SYSTEM_CORE_CLOCK_HZ / 1000000U);
+
+    while (supervisor_get_cycles() < end);
+}
+
+void can_isotp_init(void)
+{
+    RCC->APB1ENR |= RCC_APB1ENR_CAN1EN;
+    can_gpio_init();
+
+    CAN_MCR &= ~CAN_MCR_SLEEP;
+    CAN_MCR |= CAN_MCR_INRQ;
+    while ((CAN_MSR & (CAN_MSR_INAK | CAN_MSR_SLAK)) != CAN_MSR_INAK);
+
+    CAN_MCR |= CAN_MCR_ABOM | CAN_MCR_TXFP;
+    CAN_BTR = CAN_BTR_500KBPS;
+
+    /* Filter 0 in 16-bit list mode: accept only our request ID and the broadcast ID into FIFO 0 */
+    CAN_FMR |= CAN_FMR_FINIT;
+    CAN_FA1R &= ~1U;
+    CAN_FS1R &= ~1U;
+    CAN_FM1R |= 1U;
+    CAN_FFA1R &= ~1U;
+    CAN_F0R1 = (REQUEST_ID << CAN_FILTER_STID_POS) | (BROADCAST_ID << (16 + CAN_FILTER_STID_POS));
+    CAN_F0R2 = (REQUEST_ID << CAN_FILTER_STID_POS) | (BROADCAST_ID << (16 + CAN_FILTER_STID_POS));
+    CAN_FA1R |= 1U;
+    CAN_FMR &= ~CAN_FMR_FINIT;
+
+    /* Wake-up source for power_idle(), the interrupt stays disabled in the NVIC */
+    CAN_IER = CAN_IER_FMPIE0;
+
+    CAN_MCR &= ~CAN_MCR_INRQ;
+    while (CAN_MSR & CAN_MSR_INAK);
+
+    BL_LOG("CAN ISO-TP initialized, node ID = %d.\n", BL_NODE_ID);
+}
+
+void can_isotp_send(uint8_t *tx_data, uint32_t length)
+{
+    uint8_t frame[8];
+
+    if (length <= 7)
+    {
+        frame[0] = (ISOTP_SINGLE_FRAME << 4) | length;
+        memcpy(&frame[1], tx_data, length);
+        (void)can_write_frame(RESPONSE_ID, frame, length + 1);
+        return;
+    }
+
+    frame[0] = (ISOTP_FIRST_FRAME << 4) | ((length >> 8) & 0x0F);
+    frame[1] = length & 0xFF;
+    memcpy(&frame[2], tx_data, 6);
+    if (!can_write_frame(RESPONSE_ID, frame, 8))
+    {
+        return;
+    }
+
+    uint32_t offset = 6;
+    uint32_t block_remaining = 0;
+    uint8_t sequence = 1;
+
+    while (offset < length)
+    {
+        if (block_remaining == 0)
+        {
+            if (isotp_wait_flow_control() != ISOTP_FC_CONTINUE)
+            {
+                BL_LOG("ISO-TP transmission aborted.\n");
+                return;
+            }
+            block_remaining = fc_block_size ? fc_block_size : UINT32_MAX;
+        }
+
+        uint32_t chunk = length - offset > 7 ? 7 : length - offset;
+        frame[0] = (ISOTP_CONSECUTIVE_FRAME << 4) | sequence;
+        memcpy(&frame[1], &tx_data[offset], chunk);
+        if (!can_write_frame(RESPONSE_ID, frame, chunk + 1))
+        {
+            BL_LOG("ISO-TP transmission aborted.\n");
+            return;
+        }
+
+        offset += chunk;
+        sequence = (sequence + 1) & 0x0F;
+        block_remaining--;
+        isotp_separation_delay(fc_st_min);
+    }
+}
+
+void can_isotp_receive(uint8_t *rx_data, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        while (!ring_buffer_count(&rx_buffer))
+        {
+            can_poll();
+        }
+        rx_data[i] = ring_buffer_get(&rx_buffer);
+    }
+}
+
+uint8_t can_isotp_data_available(void)
+{
+    can_poll();
+    return ring_buffer_count(&rx_buffer) != 0;
+}
+
+const bl_transport_t bl_transport_can = {
+    .name           = "can1",
+    .init           = can_isotp_init,
+    .send           = can_isotp_send,
+    .receive        = can_isotp_receive,
+    .data_available = can_isotp_data_available,
+};
+
+#endif
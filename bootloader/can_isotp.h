@@ -0,0 +1,37 @@
+#ifndef __CAN_ISOTP_H__
+#define __CAN_ISOTP_H__
+
+#include <stdint.h>
+
+/*
+ * CAN1 on BOARD_CAN_RX_PIN and BOARD_CAN_TX_PIN of the board header (PB8 and PB9 on the NUCLEO).
+ *
+ * Bootloader frames are carried as ISO-TP (ISO 15765-2) messages with normal addressing
+ * at 500 kbit/s. Every bootloader message from the host is one ISO-TP message and every
+ * bootloader_send_data() call is answered with one ISO-TP message.
+ *
+ * Host -> node:       CAN_ISOTP_REQUEST_BASE_ID  + node ID (BL_BROADCAST_NODE_ID for all nodes)
+ * Node -> host:       CAN_ISOTP_RESPONSE_BASE_ID + node ID
+ *
+ * Broadcast requests are answered by each node on its own response ID, so the host can
+ * collect one ACK per node.
+ *
+ * The node is polled, so it paces segmented messages from the host: every flow control frame
+ * allows CAN_ISOTP_BLOCK_SIZE consecutive frames and the node sends the next one once it has
+ * processed them. For a broadcast, the host waits for the flow control frame of every node.
+ */
+#define CAN_ISOTP_REQUEST_BASE_ID   0x600U
+#define CAN_ISOTP_RESPONSE_BASE_ID  0x700U
+#define CAN_ISOTP_RX_BUFFER_SIZE    1024    // Must be a power of 2
+#define CAN_ISOTP_MAX_MESSAGE_SIZE  512
+#define CAN_ISOTP_BLOCK_SIZE        2       // Consecutive frames per flow control frame, fits the 3 frame FIFO
+#define CAN_ISOTP_TX_TIMEOUT_MS     100     // Wait for a free mailbox, e.g. with no other node on the bus
+#define CAN_ISOTP_FC_TIMEOUT_MS     1000    // N_Bs, wait for a flow control frame from the host
+#define CAN_ISOTP_FC_WAIT_MAX       10      // N_WFTmax, FC_WAIT frames in a row before giving up
+
+void can_isotp_init(void);
+void can_isotp_send(uint8_t *tx_data, uint32_t length);
+void can_isotp_receive(uint8_t *rx_data, uint32_t length);
+uint8_t can_isotp_data_available(void);
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef __CORTEX_M4_H__
+#define __CORTEX_M4_H__
+
+#include <stdint.h>
+
+/* Cortex-M4 core peripherals used by the bootloader */
+#define NVIC_ISER_BASE_ADDR     0xE000E100U
+#define NVIC_ICER_BASE_ADDR     0xE000E180U
+#define NVIC_ICPR_BASE_ADDR     0xE000E280U
+#define NVIC_NUM_OF_REGS        8
+
+#define NVIC_ISER               ((volatile uint32_t *)NVIC_ISER_BASE_ADDR)
+#define NVIC_ICER               ((volatile uint32_t *)NVIC_ICER_BASE_ADDR)
+#define NVIC_ICPR               ((volatile uint32_t *)NVIC_ICPR_BASE_ADDR)
+
+#define SCB_ICSR                (*(volatile uint32_t *)0xE000ED04U)
+#define SCB_VTOR                (*(volatile uint32_t *)0xE000ED08U)
+#define SCB_ICSR_PENDSTCLR      (1U << 25)
+#define SCB_ICSR_PENDSVCLR      (1U << 27)
+#define SCB_VTOR_ALIGNMENT      512     // 97 vectors rounded up to a power of 2 words
+#define SCB_SHCSR               (*(volatile uint32_t *)0xE000ED24U)
+#define SCB_SHCSR_MEMFAULTENA   (1U << 16)
+#define SCB_SCR                 (*(volatile uint32_t *)0xE000ED10U)
+#define SCB_SCR_SEVONPEND       (1U << 4)
+
+#define MPU_CTRL                (*(volatile uint32_t *)0xE000ED94U)
+#define MPU_RNR                 (*(volatile uint32_t *)0xE000ED98U)
+#define MPU_RBAR                (*(volatile uint32_t *)0xE000ED9CU)
+#define MPU_RASR                (*(volatile uint32_t *)0xE000EDA0U)
+#define MPU_CTRL_ENABLE         (1U << 0)
+#define MPU_CTRL_PRIVDEFENA     (1U << 2)
+#define MPU_RASR_ENABLE         (1U << 0)
+#define MPU_RASR_SIZE_POS       1
+#define MPU_RASR_XN             (1U << 28)
+
+#define SYST_CSR                (*(volatile uint32_t *)0xE000E010U)
+#define SYST_RVR                (*(volatile uint32_t *)0xE000E014U)
+#define SYST_CVR                (*(volatile uint32_t *)0xE000E018U)
+#define SYST_CSR_ENABLE         (1U << 0)
+#define SYST_CSR_TICKINT        (1U << 1)
+#define SYST_CSR_CLKSOURCE      (1U << 2)
+
+#define DEMCR                   (*(volatile uint32_t *)0xE000EDFCU)
+#define DEMCR_TRCENA            (1U << 24)
+#define DWT_CTRL                (*(volatile uint32_t *)0xE0001000U)
+#define DWT_CYCCNT              (*(volatile uint32_t *)0xE0001004U)
+#define DWT_CTRL_CYCCNTENA      (1U << 0)
+
+/* STM32F446xx IRQ numbers */
+#define IRQ_NO_SPI2             36
+#define IRQ_NO_OTG_FS           67
+
+static inline void nvic_enable_irq(uint8_t irq_number)
+{
+    NVIC_ISER[irq_number / 32] = 1U << (irq_number % 32);
+}
+
+static inline void nvic_disable_irq(uint8_t irq_number)
+{
+    NVIC_ICER[irq_number / 32] = 1U << (irq_number % 32);
+}
+
+#ifdef BL_HOST_TEST
+/* The host tests run the bootloader on a simulated core, see tests/sim/sim_core.h */
+#include "sim_core.h"
+#else
+static inline void cpu_disable_irq(void)
+{
+    __asm volatile("CPSID I" ::: "memory");
+}
+
+static inline void cpu_enable_irq(void)
+{
+    __asm volatile("CPSIE I" ::: "memory");
+}
+
+static inline void cpu_dsb(void)
+{
+    __asm volatile("DSB" ::: "memory");
+}
+
+static inline void cpu_isb(void)
+{
+    __asm volatile("ISB" ::: "memory");
+}
+
+/* Sleeps until an interrupt, an event or, with SEVONPEND, a newly pending disabled interrupt */
+static inline void cpu_wfe(void)
+{
+    __asm volatile("WFE" ::: "memory");
+}
+
+/*
+ * Starts an image with the initial stack pointer and reset handler of its vector table.
+ * The stack is switched in the same asm block so nothing is read from the old one afterwards.
+ */
+static inline void cpu_start_image(uint32_t msp, uint32_t reset_handler_addr)
+{
+    __asm volatile(
+        "MSR MSP, %0\n"
+        "BX %1\n"
+        :: "r"(msp), "r"(reset_handler_addr) : "memory"
+    );
+}
+#endif
+
+/*
+ * Makes size bytes at base inaccessible (size is a power of 2 of at least 32 and base is
+ * aligned to it), every other address keeps the default memory map. An access to the region
+ * raises a MemManage fault.
+ */
+static inline void mpu_guard_region(uint8_t region, uint32_t base, uint32_t size)
+{
+    uint32_t size_log2 = 31 - __builtin_clz(size);
+
+    MPU_CTRL = 0;
+    MPU_RNR = region;
+    MPU_RBAR = base;
+    MPU_RASR = MPU_RASR_XN | ((size_log2 - 1) << MPU_RASR_SIZE_POS) | MPU_RASR_ENABLE;
+    MPU_CTRL = MPU_CTRL_PRIVDEFENA | MPU_CTRL_ENABLE;
+    SCB_SHCSR |= SCB_SHCSR_MEMFAULTENA;
+    cpu_dsb();
+    cpu_isb();
+}
+
+static inline void mpu_disable(void)
+{
+    MPU_CTRL = 0;
+    SCB_SHCSR &= ~SCB_SHCSR_MEMFAULTENA;
+    cpu_dsb();
+    cpu_isb();
+}
+
+#endif
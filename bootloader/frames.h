@@ -0,0 +1,162 @@
+#ifndef __FRAMES_H__
+#define __FRAMES_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * On-wire layout of the host frames. Every frame starts with the length of the rest of the
+ * frame and the command code, and ends with a 4 byte CRC. Multi-byte fields are little-endian.
+ * The structures are packed, so fields can be read straight from the receive buffer.
+ */
+#define BL_FRAME_CRC_SIZE   4
+
+typedef struct __attribute__((packed))
+{
+    uint8_t length;
+    uint8_t command;
+} bl_frame_header_t;
+
+typedef struct __attribute__((packed))
+{
+    bl_frame_header_t header;
+    uint32_t address;
+} bl_jump_address_frame_t;
+
+typedef struct __attribute__((packed))
+{
+    bl_frame_header_t header;
+    uint8_t base_sector_number;
+    uint8_t num_of_sectors;
+} bl_flash_erase_frame_t;
+
+typedef struct __attribute__((packed))
+{
+    bl_frame_header_t header;
+    uint32_t base_address;
+    uint8_t payload_size;
+    uint8_t payload[];
+} bl_mem_write_frame_t;
+
+typedef struct __attribute__((packed))
+{
+    bl_frame_header_t header;
+    uint32_t base_address;
+    uint8_t length;
+} bl_mem_read_frame_t;
+
+typedef struct __attribute__((packed))
+{
+    bl_frame_header_t header;
+    uint8_t sectors;
+    uint8_t protection_level;
+} bl_set_rw_protect_frame_t;
+
+typedef struct __attribute__((packed))
+{
+    bl_frame_header_t header;
+    uint32_t base_address;
+    uint16_t frame_count;
+    uint8_t frame_size;
+} bl_mcast_start_frame_t;
+
+typedef struct __attribute__((packed))
+{
+    bl_frame_header_t header;
+    uint16_t sequence;
+    uint8_t payload[];
+} bl_mcast_data_frame_t;
+
+typedef struct __attribute__((packed))
+{
+    bl_frame_header_t header;
+    uint16_t first_frame;
+} bl_mcast_status_frame_t;
+
+typedef struct __attribute__((packed))
+{
+    bl_frame_header_t header;
+    uint32_t session_id;
+    uint32_t base_address;
+    uint32_t length;
+} bl_session_begin_frame_t;
+
+typedef struct __attribute__((packed))
+{
+    bl_frame_header_t header;
+    uint32_t session_id;
+} bl_session_frame_t;
+
+typedef struct __attribute__((packed))
+{
+    bl_frame_header_t header;
+    uint32_t byte_timeout_ms;
+    uint32_t session_timeout_ms;
+} bl_set_timeouts_frame_t;
+
+typedef struct __attribute__((packed))
+{
+    bl_frame_header_t header;
+    uint32_t offset;
+    uint32_t length;
+} bl_stage_erase_frame_t;
+
+typedef struct __attribute__((packed))
+{
+    bl_frame_header_t header;
+    uint32_t offset;
+    uint8_t payload_size;
+    uint8_t payload[];
+} bl_stage_write_frame_t;
+
+typedef struct __attribute__((packed))
+{
+    bl_frame_header_t header;
+    uint32_t offset;
+    uint32_t destination_address;
+    uint32_t length;
+    uint32_t crc;
+} bl_stage_commit_frame_t;
+
+typedef struct __attribute__((packed))
+{
+    bl_frame_header_t header;
+    uint8_t flags;
+} bl_get_manifest_frame_t;
+
+typedef struct __attribute__((packed))
+{
+    bl_frame_header_t header;
+    uint32_t sequence;
+} bl_get_boot_log_frame_t;
+
+/* Reply to BL_GET_STATUS, new fields are only ever appended */
+typedef struct __attribute__((packed))
+{
+    uint32_t uptime_ms;
+    uint32_t byte_timeout_ms;
+    uint32_t session_timeout_ms;
+    uint32_t watchdog_timeout_ms;
+    uint32_t rx_timeouts;
+    uint32_t crc_errors;
+    uint32_t pool_in_use;
+    uint32_t pool_high_water;
+    uint32_t pool_failures;
+    uint32_t verify_failures;
+    uint32_t verify_fail_address;
+    uint64_t cycles_asleep;
+    uint32_t uart_overruns;
+    uint32_t uart_framing_errors;
+    uint32_t uart_noise_errors;
+} bl_status_t;
+
+/* Value of the length byte of a frame made of the structure type followed by the CRC */
+#define BL_FRAME_LENGTH(type)   (sizeof(type) + BL_FRAME_CRC_SIZE - 1)
+
+/*
+ * Offset from a word boundary at which a frame has to be received
+ * so that a payload at payload_offset within the frame is word aligned.
+ */
+#define BL_FRAME_ALIGN_OFFSET(payload_offset)   ((4 - ((payload_offset) % 4)) % 4)
+
+#endif
@@ -0,0 +1,224 @@
+#include "bootloader.h"
+#include "journal.h"
+#include "transport.h"
+#include "supervisor.h"
+
+#define JOURNAL_MAGIC           0x4A524E4CU     // "JRNL"
+#define MANIFEST_MAGIC          0x4D4E4654U     // "MNFT"
+#define JOURNAL_ERASED_WORD     0xFFFFFFFFU
+#define JOURNAL_MAX_RECORDS     (JOURNAL_SIZE / sizeof(journal_record_t))
+
+static const journal_record_t *journal = (const journal_record_t *)JOURNAL_BASE_ADDR;
+static journal_record_t session;
+static journal_manifest_record_t manifest[BOARD_NUM_OF_FLASH_SECTORS];
+static uint32_t next_record;
+static uint32_t contiguous_offset;
+static uint8_t initialized;
+
+static uint32_t journal_checksum(const void *record)
+{
+    const uint32_t *words = (const uint32_t *)record;
+    uint32_t sum = 0;
+
+    for (uint32_t i = 0; i < sizeof(journal_record_t) / 4 - 1; i++)
+    {
+        sum += words[i];
+    }
+
+    return ~sum;
+}
+
+static uint8_t journal_record_valid(const journal_record_t *record)
+{
+    return record->check == journal_checksum(record);
+}
+
+/* Scans the journal once to find the newest session snapshot and the first free slot */
+static void journal_init(void)
+{
+    memset(&session, 0, sizeof(session));
+    memset(manifest, 0, sizeof(manifest));
+    next_record = 0;
+
+    while (next_record < JOURNAL_MAX_RECORDS && journal[next_record].magic != JOURNAL_ERASED_WORD)
+    {
+        const journal_record_t *record = &journal[next_record];
+
+        /* A record torn by a reset fails the checksum and is skipped */
+        if (journal_record_valid(record) && record->magic == JOURNAL_MAGIC)
+        {
+            session = *record;
+        }
+        else if (journal_record_valid(record) && record->magic == MANIFEST_MAGIC)
+        {
+            const journal_manifest_record_t *entry = (const journal_manifest_record_t *)record;
+
+            if (entry->sector < BOARD_NUM_OF_FLASH_SECTORS)
+            {
+                manifest[entry->sector] = *entry;
+            }
+        }
+        next_record++;
+    }
+
+    contiguous_offset = session.committed_offset;
+    initialized = 1;
+
+    BL_LOG("Journal: %lu records, session 0x%08lX at offset %lu.\n", next_record, session.session_id, session.committed_offset);
+}
+
+static void journal_write(void *record)
+{
+    flash_write(JOURNAL_BASE_ADDR + next_record * sizeof(journal_record_t), (uint8_t *)record, sizeof(journal_record_t));
+    next_record++;
+}
+
+/* record is the session or one of the manifest entries, with its magic already set */
+static void journal_append(void *record)
+{
+    transport_hold(1);
+    flash_init();
+
+    ((journal_record_t *)record)->check = journal_checksum(record);
+
+    if (next_record >= JOURNAL_MAX_RECORDS)
+    {
+        BL_LOG("Journal full, erasing sector %d.\n", JOURNAL_SECTOR_NUMBER);
+        /* Up to 2 s for the 128 KB sector, on top of whatever the command already took */
+        supervisor_kick();
+        flash_sector_erase(JOURNAL_SECTOR_NUMBER);
+        supervisor_kick();
+        next_record = 0;
+
+        /* Everything else that is still current moves to the erased sector first */
+        if (session.state != JOURNAL_STATE_NONE && record != &session)
+        {
+            journal_write(&session);
+        }
+
+        for (uint32_t i = 0; i < BOARD_NUM_OF_FLASH_SECTORS; i++)
+        {
+            if (manifest[i].state != JOURNAL_MANIFEST_NONE && record != &manifest[i])
+            {
+                journal_write(&manifest[i]);
+            }
+        }
+    }
+
+    journal_write(record);
+    transport_hold(0);
+}
+
+static void journal_append_session(void)
+{
+    session.magic = JOURNAL_MAGIC;
+    session.reserved = JOURNAL_ERASED_WORD;
+    journal_append(&session);
+}
+
+uint8_t journal_session_begin(uint32_t session_id, uint32_t base_address, uint32_t length)
+{
+    if (!initialized)
+    {
+        journal_init();
+    }
+
+    /* Reopening the same session keeps its progress so that the host can resume */
+    if (session.state == JOURNAL_STATE_OPEN && session.session_id == session_id &&
+        session.base_address == base_address && session.length == length)
+    {
+        contiguous_offset = session.committed_offset;
+        return 0;
+    }
+
+    session.state = JOURNAL_STATE_OPEN;
+    session.session_id = session_id;
+    session.base_address = base_address;
+    session.length = length;
+    session.committed_offset = 0;
+    contiguous_offset = 0;
+    journal_append_session();
+
+    return 0;
+}
+
+uint8_t journal_session_end(uint32_t session_id)
+{
+    if (!initialized)
+    {
+        journal_init();
+    }
+
+    if (session.state != JOURNAL_STATE_OPEN || session.session_id != session_id)
+    {
+        return 1;
+    }
+
+    session.state = JOURNAL_STATE_CLOSED;
+    session.committed_offset = contiguous_offset;
+    journal_append_session();
+
+    return 0;
+}
+
+/*
+ * Called after every successful memory write. Progress only advances over contiguous data
+ * from the start of the session range and is committed every JOURNAL_COMMIT_INTERVAL bytes.
+ */
+void journal_write_completed(uint32_t address, uint32_t length)
+{
+    if (!initialized || session.state != JOURNAL_STATE_OPEN)
+    {
+        return;
+    }
+
+    if (address != session.base_address + contiguous_offset || contiguous_offset + length > session.length)
+    {
+        return;
+    }
+
+    contiguous_offset += length;
+
+    if (contiguous_offset - session.committed_offset >= JOURNAL_COMMIT_INTERVAL || contiguous_offset == session.length)
+    {
+        session.committed_offset = contiguous_offset;
+        journal_append_session();
+    }
+}
+
+const journal_record_t *journal_get_session(void)
+{
+    if (!initialized)
+    {
+        journal_init();
+    }
+
+    return &session;
+}
+
+void journal_manifest_update(uint8_t sector, uint32_t state, uint32_t crc)
+{
+    if (!initialized)
+    {
+        journal_init();
+    }
+
+    journal_manifest_record_t *entry = &manifest[sector];
+
+    entry->magic = MANIFEST_MAGIC;
+    entry->sector = sector;
+    entry->state = state;
+    entry->crc = crc;
+    memset(entry->reserved, 0xFF, sizeof(entry->reserved));
+    journal_append(entry);
+}
+
+const journal_manifest_record_t *journal_manifest_get(uint8_t sector)
+{
+    if (!initialized)
+    {
+        journal_init();
+    }
+
+    return &manifest[sector];
+}
@@ -0,0 +1,58 @@
+#ifndef __JOURNAL_H__
+#define __JOURNAL_H__
+
+#include <stdint.h>
+#include "board.h"
+
+/*
+ * Update session journal. Every record is a full snapshot of the session and records are
+ * only ever appended to the journal sector, so the sector is erased only when it runs full.
+ * The newest valid record describes the current session.
+ *
+ * The journal also keeps the sector manifest (see manifest.h), one record per update of a
+ * sector entry. When the sector is erased, the current session and manifest are written again.
+ */
+#define JOURNAL_SECTOR_NUMBER       BOARD_METADATA_SECTOR
+#define JOURNAL_BASE_ADDR           BOARD_METADATA_BASE_ADDR
+#define JOURNAL_SIZE                BOARD_METADATA_SIZE
+#define JOURNAL_COMMIT_INTERVAL     1024    // Bytes written between two progress records
+
+#define JOURNAL_STATE_NONE          0
+#define JOURNAL_STATE_OPEN          1
+#define JOURNAL_STATE_CLOSED        2
+
+#define JOURNAL_MANIFEST_NONE       0       // Sector never hashed
+#define JOURNAL_MANIFEST_CLEAN      1       // crc matches the sector contents
+#define JOURNAL_MANIFEST_DIRTY      2       // Sector modified since it was hashed
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t state;
+    uint32_t session_id;
+    uint32_t base_address;
+    uint32_t length;
+    uint32_t committed_offset;
+    uint32_t reserved;
+    uint32_t check;
+} journal_record_t;
+
+/* Same size as journal_record_t, told apart by the magic */
+typedef struct
+{
+    uint32_t magic;
+    uint32_t sector;
+    uint32_t state;
+    uint32_t crc;
+    uint32_t reserved[3];
+    uint32_t check;
+} journal_manifest_record_t;
+
+uint8_t journal_session_begin(uint32_t session_id, uint32_t base_address, uint32_t length);
+uint8_t journal_session_end(uint32_t session_id);
+void journal_write_completed(uint32_t address, uint32_t length);
+const journal_record_t *journal_get_session(void);
+void journal_manifest_update(uint8_t sector, uint32_t state, uint32_t crc);
+const journal_manifest_record_t *journal_manifest_get(uint8_t sector);
+
+#endif
@@ -0,0 +1,82 @@
+#include "bootloader.h"
+#include "journal.h"
+#include "supervisor.h"
+#include "manifest.h"
+#include "stm32f446xx_crc.h"
+
+/* CRC-32 of the sector fed to the CRC unit as little-endian words */
+static uint32_t manifest_hash(uint8_t sector)
+{
+    const volatile uint32_t *words = (const volatile uint32_t *)board_flash_sectors[sector].base_address;
+    uint32_t num_of_words = board_flash_sectors[sector].size / 4;
+
+    supervisor_kick();
+
+    CRC->CR |= 1 << CRC_CR_RESET;
+    for (uint32_t i = 0; i < num_of_words; i++)
+    {
+        CRC->DR = words[i];
+    }
+    uint32_t crc = CRC->DR;
+    CRC->CR |= 1 << CRC_CR_RESET;
+
+    return crc;
+}
+
+/* Called before the sector is erased or programmed, only the first call after a hash writes a record */
+void manifest_sector_modified(uint8_t sector)
+{
+    if (sector >= BOARD_NUM_OF_FLASH_SECTORS || sector == BOARD_METADATA_SECTOR)
+    {
+        return;
+    }
+
+    if (journal_manifest_get(sector)->state != JOURNAL_MANIFEST_DIRTY)
+    {
+        journal_manifest_update(sector, JOURNAL_MANIFEST_DIRTY, 0);
+    }
+}
+
+void manifest_range_modified(uint32_t address, uint32_t length)
+{
+    if (length == 0)
+    {
+        return;
+    }
+
+    uint8_t first = board_flash_sector(address);
+    uint8_t last = board_flash_sector(address + length - 1);
+
+    if (first == BOARD_INVALID_SECTOR || last == BOARD_INVALID_SECTOR)
+    {
+        return;
+    }
+
+    for (uint8_t i = first; i <= last; i++)
+    {
+        manifest_sector_modified(i);
+    }
+}
+
+uint32_t manifest_sector_crc(uint8_t sector, uint8_t flags)
+{
+    if (sector == BOARD_METADATA_SECTOR)
+    {
+        return manifest_hash(sector);
+    }
+
+    const journal_manifest_record_t *entry = journal_manifest_get(sector);
+
+    if (entry->state != JOURNAL_MANIFEST_CLEAN || (flags & MANIFEST_FLAG_REHASH))
+    {
+        uint32_t crc = manifest_hash(sector);
+
+        /* A rehash that finds the cached value does not need a new record */
+        if (entry->state != JOURNAL_MANIFEST_CLEAN || entry->crc != crc)
+        {
+            journal_manifest_update(sector, JOURNAL_MANIFEST_CLEAN, crc);
+        }
+    }
+
+    return entry->crc;
+}
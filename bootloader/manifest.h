@@ -0,0 +1,22 @@
+#ifndef __MANIFEST_H__
+#define __MANIFEST_H__
+
+#include <stdint.h>
+
+/*
+ * CRC manifest of the internal FLASH sectors. The CRC of every sector is kept in the journal
+ * and only computed again after the sector was erased or written, so the host can compare the
+ * whole FLASH against a new image without reading it back. A sector is marked dirty before it
+ * is modified, a reset in the middle of an update never leaves a stale CRC behind.
+ *
+ * Only modifications made by the bootloader are tracked, MANIFEST_FLAG_REHASH recomputes every
+ * sector, e.g. after the application wrote to its own FLASH. The metadata sector changes with
+ * every journal record and is always hashed.
+ */
+#define MANIFEST_FLAG_REHASH    (1U << 0)
+
+void manifest_sector_modified(uint8_t sector);
+void manifest_range_modified(uint32_t address, uint32_t length);
+uint32_t manifest_sector_crc(uint8_t sector, uint8_t flags);
+
+#endif
@@ -0,0 +1,62 @@
+#include "multicast.h"
+#include <string.h>
+
+static mcast_session_t session;
+static uint8_t received_bitmap[MCAST_MAX_FRAMES / 8];
+
+uint8_t mcast_session_start(uint32_t base_address, uint16_t frame_count, uint8_t frame_size)
+{
+    if (frame_count == 0 || frame_count > MCAST_MAX_FRAMES || frame_size == 0)
+    {
+        session.active = 0;
+        return 1;
+    }
+
+    session.base_address = base_address;
+    session.frame_count = frame_count;
+    session.frame_size = frame_size;
+    session.received_count = 0;
+    session.active = 1;
+    memset(received_bitmap, 0, sizeof(received_bitmap));
+
+    return 0;
+}
+
+uint8_t mcast_frame_received(uint16_t sequence)
+{
+    return (received_bitmap[sequence / 8] >> (sequence % 8)) & 1;
+}
+
+void mcast_mark_received(uint16_t sequence)
+{
+    if (!mcast_frame_received(sequence))
+    {
+        received_bitmap[sequence / 8] |= 1 << (sequence % 8);
+        session.received_count++;
+    }
+}
+
+uint16_t mcast_missing_count(void)
+{
+    return session.active ? session.frame_count - session.received_count : 0;
+}
+
+/* Bit N of the result is set when frame first_frame + N has not been received yet */
+void mcast_get_missing_bitmap(uint16_t first_frame, uint8_t *bitmap, uint32_t length)
+{
+    memset(bitmap, 0, length);
+
+    for (uint32_t i = 0; i < length * 8; i++)
+    {
+        uint32_t sequence = first_frame + i;
+        if (session.active && sequence < session.frame_count && !mcast_frame_received(sequence))
+        {
+            bitmap[i / 8] |= 1 << (i % 8);
+        }
+    }
+}
+
+const mcast_session_t *mcast_get_session(void)
+{
+    return &session;
+}
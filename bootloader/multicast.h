@@ -0,0 +1,34 @@
+#ifndef __MULTICAST_H__
+#define __MULTICAST_H__
+
+#include <stdint.h>
+
+/*
+ * Multicast update: the host streams the image once as sequence-numbered frames to every
+ * listening node, then asks each node which frames it missed and retransmits only those.
+ * Frame N is programmed at base_address + N * frame_size.
+ */
+#define MCAST_MAX_FRAMES        4096
+#define MCAST_BITMAP_WINDOW     32      // Bytes of the missing frames bitmap returned per status request
+
+/* First byte of the BL_MCAST_STATUS reply */
+#define MCAST_SESSION_NONE      0       // No BL_MCAST_START received or the last one refused
+#define MCAST_SESSION_ACTIVE    1
+
+typedef struct
+{
+    uint32_t base_address;
+    uint16_t frame_count;
+    uint8_t frame_size;
+    uint8_t active;
+    uint16_t received_count;
+} mcast_session_t;
+
+uint8_t mcast_session_start(uint32_t base_address, uint16_t frame_count, uint8_t frame_size);
+uint8_t mcast_frame_received(uint16_t sequence);
+void mcast_mark_received(uint16_t sequence);
+uint16_t mcast_missing_count(void);
+void mcast_get_missing_bitmap(uint16_t first_frame, uint8_t *bitmap, uint32_t length);
+const mcast_session_t *mcast_get_session(void);
+
+#endif
@@ -0,0 +1,141 @@
+#include "peripherals.h"
+#include "board.h"
+
+/* Peripherals the bootloader may have touched, see deinit_peripherals() */
+#define RCC_CR_HSEON            (1U << 16)
+#define RCC_CR_HSEBYP           (1U << 18)
+#define RCC_CR_PLLON            (1U << 24)
+#define RCC_AHB1_USED           ((1U << 0) | (1U << 1) | (1U << 2) | (1U << 12) | (1U << 22)) // GPIOA-C, CRC, DMA2
+#define RCC_AHB2_USED           (1U << 7)                                           // OTG FS
+#define RCC_AHB3_USED           (1U << 1)                                           // QSPI
+#define RCC_APB1_USED           ((1U << 14) | (1U << 17) | (1U << 18) | (1U << 25)) // SPI2, USART2-3, CAN1
+#define RCC_APB2_USED           ((1U << 4) | (1U << 14))                            // USART1, SYSCFG
+
+usart_handle_t usart2;
+usart_handle_t usart3;
+
+void init_gpio(void)
+{
+    gpio_handle_t usart2_gpio = {0};
+    usart2_gpio.gpiox                  = BOARD_BL_UART_PORT;
+    usart2_gpio.config.pin_mode        = GPIO_MODE_ALT_FUNC;
+    usart2_gpio.config.pin_alt_func    = BOARD_BL_UART_ALT_FUNC;
+    usart2_gpio.config.pin_output_type = GPIO_OUTPUT_PUSH_PULL;
+    usart2_gpio.config.pin_pupd        = GPIO_PULL_UP;
+    usart2_gpio.config.pin_speed       = GPIO_SPEED_HIGH;
+
+    usart2_gpio.config.pin_number      = BOARD_BL_UART_TX_PIN;
+    gpio_init(&usart2_gpio);
+
+    usart2_gpio.config.pin_number      = BOARD_BL_UART_RX_PIN;
+    gpio_init(&usart2_gpio);
+
+#ifdef BOARD_BL_UART_CTS_PIN
+    /* Pulled low, so a host without flow control (e.g. the ST-LINK virtual COM port) is always clear to send */
+    usart2_gpio.gpiox                  = BOARD_BL_UART_CTS_PORT;
+    usart2_gpio.config.pin_number      = BOARD_BL_UART_CTS_PIN;
+    usart2_gpio.config.pin_alt_func    = BOARD_BL_UART_CTS_ALT_FUNC;
+    usart2_gpio.config.pin_pupd        = GPIO_PULL_DOWN;
+    gpio_init(&usart2_gpio);
+#endif
+
+#ifdef BOARD_BL_UART_RTS_PIN
+    /* Deasserted (high) until the receive interrupt is running, see usart_transport_init() */
+    BOARD_BL_UART_RTS_PORT->BSRR = 1U << BOARD_BL_UART_RTS_PIN;
+
+    gpio_handle_t rts_gpio = {0};
+    rts_gpio.gpiox                  = BOARD_BL_UART_RTS_PORT;
+    rts_gpio.config.pin_number      = BOARD_BL_UART_RTS_PIN;
+    rts_gpio.config.pin_mode        = GPIO_MODE_OUTPUT;
+    rts_gpio.config.pin_output_type = GPIO_OUTPUT_PUSH_PULL;
+    rts_gpio.config.pin_pupd        = GPIO_NO_PUPD;
+    rts_gpio.config.pin_speed       = GPIO_SPEED_MEDIUM;
+    gpio_init(&rts_gpio);
+#endif
+
+    gpio_handle_t usart3_gpio = {0};
+    usart3_gpio.gpiox                  = BOARD_DEBUG_UART_PORT;
+    usart3_gpio.config.pin_mode        = GPIO_MODE_ALT_FUNC;
+    usart3_gpio.config.pin_alt_func    = BOARD_DEBUG_UART_ALT_FUNC;
+    usart3_gpio.config.pin_output_type = GPIO_OUTPUT_PUSH_PULL;
+    usart3_gpio.config.pin_pupd        = GPIO_PULL_UP;
+    usart3_gpio.config.pin_speed       = GPIO_SPEED_HIGH;
+
+    usart3_gpio.config.pin_number      = BOARD_DEBUG_UART_TX_PIN;
+    gpio_init(&usart3_gpio);
+
+    usart3_gpio.config.pin_number      = BOARD_DEBUG_UART_RX_PIN;
+    gpio_init(&usart3_gpio);
+
+    gpio_handle_t user_button = {0};
+    user_button.gpiox                  = BOARD_BUTTON_PORT;
+    user_button.config.pin_number      = BOARD_BUTTON_PIN;
+    user_button.config.pin_mode        = GPIO_MODE_INPUT;
+    user_button.config.pin_speed       = GPIO_SPEED_MEDIUM;
+    user_button.config.pin_pupd        = GPIO_NO_PUPD;
+
+    gpio_init(&user_button);
+}
+
+void init_usart2(void)
+{
+    usart2.usartx                 = BOARD_BL_UART;
+    usart2.config.mode            = USART_MODE_TX_RX;
+    usart2.config.baudrate        = BOARD_BL_UART_BAUDRATE;
+    usart2.config.word_length     = USART_WORD_LENGTH_8BITS;
+    usart2.config.parity          = USART_PARITY_NONE;
+    usart2.config.stop_bits       = USART_STOP_BITS_1;
+#ifdef BOARD_BL_UART_CTS_PIN
+    usart2.config.hw_flow_control = USART_HW_FLOW_CONTROL_CTS;
+#else
+    usart2.config.hw_flow_control = USART_HW_FLOW_CONTROL_NONE;
+#endif
+
+    usart_init(&usart2);
+}
+
+void init_usart3(void)
+{
+    usart3.usartx                 = BOARD_DEBUG_UART;
+    usart3.config.mode            = USART_MODE_TX_RX;
+    usart3.config.baudrate        = USART_BAUDRATE_115200;
+    usart3.config.word_length     = USART_WORD_LENGTH_8BITS;
+    usart3.config.parity          = USART_PARITY_NONE;
+    usart3.config.stop_bits       = USART_STOP_BITS_1;
+    usart3.config.hw_flow_control = USART_HW_FLOW_CONTROL_NONE;
+
+    usart_init(&usart3);
+}
+
+void init_crc(void)
+{
+    CRC_CLK_ENABLE();
+}
+
+/*
+ * Puts every peripheral the bootloader may have used back into its reset state and stops
+ * its clock, so that the application starts from the same state as after a reset.
+ */
+void deinit_peripherals(void)
+{
+    RCC->AHB1RSTR |= RCC_AHB1_USED;
+    RCC->AHB2RSTR |= RCC_AHB2_USED;
+    RCC->AHB3RSTR |= RCC_AHB3_USED;
+    RCC->APB1RSTR |= RCC_APB1_USED;
+    RCC->APB2RSTR |= RCC_APB2_USED;
+
+    RCC->AHB1RSTR &= ~RCC_AHB1_USED;
+    RCC->AHB2RSTR &= ~RCC_AHB2_USED;
+    RCC->AHB3RSTR &= ~RCC_AHB3_USED;
+    RCC->APB1RSTR &= ~RCC_APB1_USED;
+    RCC->APB2RSTR &= ~RCC_APB2_USED;
+
+    RCC->AHB1ENR &= ~RCC_AHB1_USED;
+    RCC->AHB2ENR &= ~RCC_AHB2_USED;
+    RCC->AHB3ENR &= ~RCC_AHB3_USED;
+    RCC->APB1ENR &= ~RCC_APB1_USED;
+    RCC->APB2ENR &= ~RCC_APB2_USED;
+
+    /* The PLL only clocks USB, SYSCLK stays on HSI */
+    RCC->CR &= ~(RCC_CR_PLLON | RCC_CR_HSEON | RCC_CR_HSEBYP);
+}
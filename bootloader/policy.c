@@ -0,0 +1,66 @@
+#include "bootloader.h"
+#include "policy.h"
+
+static const policy_region_t regions[] = BOARD_POLICY_REGIONS;
+
+#define NUM_OF_REGIONS (sizeof(regions) / sizeof(regions[0]))
+
+/* Binary search for the region containing address, returns NUM_OF_REGIONS if there is none */
+static uint32_t policy_find_region(uint32_t address)
+{
+    uint32_t low = 0;
+    uint32_t high = NUM_OF_REGIONS;
+
+    while (low < high)
+    {
+        uint32_t mid = low + (high - low) / 2;
+
+        if (address < regions[mid].start_address)
+        {
+            high = mid;
+        }
+        else if (address >= regions[mid].end_address)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            return mid;
+        }
+    }
+
+    return NUM_OF_REGIONS;
+}
+
+/*
+ * Allows the access only if every byte of [address, address + length) lies in regions granting
+ * all of the requested permissions. A range may span several adjacent regions.
+ */
+uint8_t policy_check(uint32_t address, uint32_t length, uint8_t permissions)
+{
+    if (length == 0 || length - 1 > UINT32_MAX - address)
+    {
+        return POLICY_DENY;
+    }
+
+    uint32_t last_address = address + length - 1;
+    uint32_t i = policy_find_region(address);
+
+    for (; i < NUM_OF_REGIONS; i++)
+    {
+        if (regions[i].start_address > address || (regions[i].permissions & permissions) != permissions)
+        {
+            break;
+        }
+
+        if (last_address < regions[i].end_address)
+        {
+            return POLICY_ALLOW;
+        }
+
+        address = regions[i].end_address;
+    }
+
+    BL_LOG("Access to 0x%08lX denied by the memory policy.\n", address);
+    return POLICY_DENY;
+}
@@ -0,0 +1,28 @@
+#ifndef __POLICY_H__
+#define __POLICY_H__
+
+#include <stdint.h>
+
+/*
+ * Memory access policy for host commands. The board header lists the regions as
+ * BOARD_POLICY_REGIONS, sorted by address and not overlapping. Addresses outside every
+ * region allow nothing.
+ */
+#define POLICY_READ         (1U << 0)
+#define POLICY_WRITE        (1U << 1)
+#define POLICY_ERASE        (1U << 2)
+#define POLICY_EXECUTE      (1U << 3)
+
+#define POLICY_ALLOW        0
+#define POLICY_DENY         1
+
+typedef struct
+{
+    uint32_t start_address;
+    uint32_t end_address;   // Exclusive
+    uint8_t permissions;
+} policy_region_t;
+
+uint8_t policy_check(uint32_t address, uint32_t length, uint8_t permissions);
+
+#endif
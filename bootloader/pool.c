@@ -0,0 +1,70 @@
+#include "bootloader.h"
+#include "pool.h"
+
+static uint8_t buffers[POOL_NUM_OF_BUFFERS][POOL_BUFFER_SIZE] BL_BUFFER;
+
+/* Stack of free buffer indices, free_count entries from the bottom are valid */
+static uint8_t free_list[POOL_NUM_OF_BUFFERS];
+static uint32_t free_count;
+static uint8_t initialized;
+static pool_stats_t stats;
+
+static void pool_init(void)
+{
+    for (uint32_t i = 0; i < POOL_NUM_OF_BUFFERS; i++)
+    {
+        free_list[i] = i;
+    }
+    free_count = POOL_NUM_OF_BUFFERS;
+    initialized = 1;
+}
+
+/* Returns NULL when every buffer is in use */
+uint8_t *pool_acquire(void)
+{
+    if (!initialized)
+    {
+        pool_init();
+    }
+
+    if (free_count == 0)
+    {
+        stats.acquire_failures++;
+        BL_LOG("Packet buffer pool exhausted!\n");
+        return NULL;
+    }
+
+    stats.in_use++;
+    if (stats.in_use > stats.high_water)
+    {
+        stats.high_water = stats.in_use;
+    }
+
+    return buffers[free_list[--free_count]];
+}
+
+void pool_release(uint8_t *buffer)
+{
+    /* Like free(), releasing NULL does nothing */
+    if (buffer == NULL)
+    {
+        return;
+    }
+
+    uint32_t offset = (uint32_t)buffer - (uint32_t)buffers;
+    uint32_t index = offset / POOL_BUFFER_SIZE;
+
+    if (index >= POOL_NUM_OF_BUFFERS || offset % POOL_BUFFER_SIZE != 0 || free_count >= POOL_NUM_OF_BUFFERS)
+    {
+        BL_LOG("Released a buffer that does not belong to the pool!\n");
+        return;
+    }
+
+    free_list[free_count++] = index;
+    stats.in_use--;
+}
+
+const pool_stats_t *pool_get_stats(void)
+{
+    return &stats;
+}
@@ -0,0 +1,30 @@
+#ifndef __POOL_H__
+#define __POOL_H__
+
+#include <stdint.h>
+
+/*
+ * Fixed-size packet buffers shared by the receive, response and staging paths. Buffers are
+ * word aligned and large enough for the longest frame (length byte + 255 bytes) received at
+ * its alignment offset, see BL_FRAME_ALIGN_OFFSET. Acquire and release are O(1).
+ * The pool is only used from thread mode, never from interrupt handlers.
+ */
+#define POOL_BUFFER_SIZE        264
+/*
+ * The most buffers held at once: the received frame, the reply and sub-frame buffers of a
+ * batch and the reply buffer of BL_MEM_READ or BL_GET_BOOT_LOG run inside the batch.
+ */
+#define POOL_NUM_OF_BUFFERS     4
+
+typedef struct
+{
+    uint32_t in_use;
+    uint32_t high_water;
+    uint32_t acquire_failures;
+} pool_stats_t;
+
+uint8_t *pool_acquire(void);
+void pool_release(uint8_t *buffer);
+const pool_stats_t *pool_get_stats(void);
+
+#endif
@@ -0,0 +1,60 @@
+#include "bootloader.h"
+#include "cortex_m4.h"
+#include "supervisor.h"
+#include "power.h"
+
+/*
+ * Peripheral clocks left running in sleep mode (RCC_xxxLPENR, RM0390 6.3). The GPIO ports and
+ * the transport peripherals keep receiving; FLASH interface, SRAM, CRC and DMA are gated since
+ * nothing accesses them until the core wakes up. USART1 and USART3 keep shifting out debug output.
+ */
+#define POWER_AHB1_SLEEP_CLOCKS ((1U << 0) | (1U << 1) | (1U << 2))                 // GPIOA-C
+#define POWER_AHB2_SLEEP_CLOCKS (1U << 7)                                           // OTGFS
+#define POWER_APB1_SLEEP_CLOCKS ((1U << 14) | (1U << 17) | (1U << 18) | (1U << 25)) // SPI2, USART2-3, CAN1
+#define POWER_APB2_SLEEP_CLOCKS (1U << 4)                                           // USART1
+
+static uint64_t cycles_asleep;
+
+void power_init(void)
+{
+    SCB_SCR |= SCB_SCR_SEVONPEND;
+}
+
+/*
+ * Sleeps until the next interrupt or wake-up event. Called from the wait loops after they
+ * found no data, a byte arriving in between sets the event register and WFE returns at once.
+ */
+void power_idle(void)
+{
+    uint64_t start = supervisor_get_cycles();
+    uint32_t ahb1 = RCC->AHB1LPENR;
+    uint32_t ahb2 = RCC->AHB2LPENR;
+    uint32_t apb1 = RCC->APB1LPENR;
+    uint32_t apb2 = RCC->APB2LPENR;
+
+    /* Disabled interrupts stay pending until cleared, a new event is only sent on the next one */
+    for (uint32_t i = 0; i < NVIC_NUM_OF_REGS; i++)
+    {
+        NVIC_ICPR[i] = ~NVIC_ISER[i];
+    }
+
+    RCC->AHB1LPENR = POWER_AHB1_SLEEP_CLOCKS;
+    RCC->AHB2LPENR = POWER_AHB2_SLEEP_CLOCKS;
+    RCC->APB1LPENR = POWER_APB1_SLEEP_CLOCKS;
+    RCC->APB2LPENR = POWER_APB2_SLEEP_CLOCKS;
+
+    cpu_dsb();
+    cpu_wfe();
+
+    RCC->AHB1LPENR = ahb1;
+    RCC->AHB2LPENR = ahb2;
+    RCC->APB1LPENR = apb1;
+    RCC->APB2LPENR = apb2;
+
+    cycles_asleep += supervisor_get_cycles() - start;
+}
+
+uint64_t power_get_cycles_asleep(void)
+{
+    return cycles_asleep;
+}
@@ -0,0 +1,18 @@
+#ifndef __POWER_H__
+#define __POWER_H__
+
+#include <stdint.h>
+
+/*
+ * Low-power idle for the interactive mode wait loops. The core sleeps (WFE) until a transport
+ * has data or the next SysTick, the clocks of every peripheral that is not needed to receive
+ * a byte are gated for the duration of the sleep.
+ *
+ * CAN is polled: it enables its receive interrupt in the peripheral but not in the NVIC, with
+ * SEVONPEND the pending interrupt only wakes the core, no handler runs.
+ */
+void power_init(void);
+void power_idle(void);
+uint64_t power_get_cycles_asleep(void);
+
+#endif
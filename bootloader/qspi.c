@@ -0,0 +1,388 @@
+#include "bootloader.h"
+#include "supervisor.h"
+#include "qspi.h"
+
+#ifdef BOARD_QSPI_FLASH_SIZE
+
+/* QUADSPI registers (RM0390, chapter 12) */
+#define QUADSPI_BASE_ADDR       0xA0001000U
+#define QSPI_REG(offset)        (*(volatile uint32_t *)(QUADSPI_BASE_ADDR + (offset)))
+#define QSPI_CR                 QSPI_REG(0x00)
+#define QSPI_DCR                QSPI_REG(0x04)
+#define QSPI_SR                 QSPI_REG(0x08)
+#define QSPI_FCR                QSPI_REG(0x0C)
+#define QSPI_DLR                QSPI_REG(0x10)
+#define QSPI_CCR                QSPI_REG(0x14)
+#define QSPI_AR                 QSPI_REG(0x18)
+#define QSPI_DR_BYTE            (*(volatile uint8_t *)(QUADSPI_BASE_ADDR + 0x20))
+#define QSPI_PSMKR              QSPI_REG(0x24)
+#define QSPI_PSMAR              QSPI_REG(0x28)
+#define QSPI_PIR                QSPI_REG(0x2C)
+
+#define QSPI_CR_EN              (1U << 0)
+#define QSPI_CR_ABORT           (1U << 1)
+#define QSPI_CR_APMS            (1U << 22)
+#define QSPI_CR_PRESCALER_POS   24
+#define QSPI_DCR_CSHT_POS       8
+#define QSPI_DCR_FSIZE_POS      16
+#define QSPI_SR_TCF             (1U << 1)
+#define QSPI_SR_FTF             (1U << 2)
+#define QSPI_SR_SMF             (1U << 3)
+#define QSPI_SR_BUSY            (1U << 5)
+#define QSPI_FCR_ALL            0x1BU
+#define QSPI_CCR_IMODE_1LINE    (1U << 8)
+#define QSPI_CCR_ADMODE_1LINE   (1U << 10)
+#define QSPI_CCR_ADSIZE_24BIT   (2U << 12)
+#define QSPI_CCR_DCYC_POS       18
+#define QSPI_CCR_DMODE_1LINE    (1U << 24)
+#define QSPI_CCR_DMODE_4LINES   (3U << 24)
+#define QSPI_CCR_FMODE_WRITE    (0U << 26)
+#define QSPI_CCR_FMODE_READ     (1U << 26)
+#define QSPI_CCR_FMODE_POLL     (2U << 26)
+#define QSPI_CCR_FMODE_MAPPED   (3U << 26)
+#define RCC_AHB3ENR_QSPIEN      (1U << 1)
+
+/* 16 MHz HCLK / (0 + 1), chip select high for 2 + 1 cycles between commands */
+#define QSPI_PRESCALER          0
+#define QSPI_CS_HIGH_TIME       2
+#define QSPI_POLL_INTERVAL      0x10
+#define QSPI_FSIZE              (__builtin_ctz(BOARD_QSPI_FLASH_SIZE) - 1)
+
+/* W25Q instructions */
+#define NOR_WRITE_ENABLE        0x06
+#define NOR_READ_STATUS_1       0x05
+#define NOR_READ_STATUS_2       0x35
+#define NOR_WRITE_STATUS_2      0x31
+#define NOR_SECTOR_ERASE        0x20
+#define NOR_BLOCK_ERASE         0xD8
+#define NOR_QUAD_PAGE_PROGRAM   0x32
+#define NOR_FAST_READ_QUAD_OUT  0x6B
+#define NOR_RESET_ENABLE        0x66
+#define NOR_RESET               0x99
+#define NOR_STATUS_1_BUSY       (1U << 0)
+#define NOR_STATUS_2_QE         (1U << 1)
+#define NOR_FAST_READ_DUMMY     8
+#define NOR_RESET_DELAY         1000    // Loop iterations, at least 30 us
+
+/*
+ * Upper bounds of every wait: a transfer on the bus, then the W25Q128JV maximums of each
+ * operation (tW, tPP, tSE, tBE2) with some margin. A device that misses one is not used again
+ * until the next qspi_init().
+ */
+#define QSPI_TRANSFER_TIMEOUT_MS        10
+#define QSPI_STATUS_TIMEOUT_MS          20
+#define QSPI_PROGRAM_TIMEOUT_MS         10
+#define QSPI_SECTOR_ERASE_TIMEOUT_MS    500
+#define QSPI_BLOCK_ERASE_TIMEOUT_MS     2500
+
+static uint8_t qspi_ready;              // Set once qspi_init() found the device
+
+static void qspi_gpio_init(void)
+{
+    gpio_handle_t qspi_gpio = {0};
+    qspi_gpio.config.pin_mode        = GPIO_MODE_ALT_FUNC;
+    qspi_gpio.config.pin_output_type = GPIO_OUTPUT_PUSH_PULL;
+    qspi_gpio.config.pin_pupd        = GPIO_NO_PUPD;
+    qspi_gpio.config.pin_speed       = GPIO_SPEED_HIGH;
+
+    qspi_gpio.gpiox                  = BOARD_QSPI_CLK_PORT;
+    qspi_gpio.config.pin_number      = BOARD_QSPI_CLK_PIN;
+    qspi_gpio.config.pin_alt_func    = BOARD_QSPI_CLK_ALT_FUNC;
+    gpio_init(&qspi_gpio);
+
+    qspi_gpio.gpiox                  = BOARD_QSPI_IO0_PORT;
+    qspi_gpio.config.pin_number      = BOARD_QSPI_IO0_PIN;
+    qspi_gpio.config.pin_alt_func    = BOARD_QSPI_IO0_ALT_FUNC;
+    gpio_init(&qspi_gpio);
+
+    qspi_gpio.gpiox                  = BOARD_QSPI_IO1_PORT;
+    qspi_gpio.config.pin_number      = BOARD_QSPI_IO1_PIN;
+    qspi_gpio.config.pin_alt_func    = BOARD_QSPI_IO1_ALT_FUNC;
+    gpio_init(&qspi_gpio);
+
+    qspi_gpio.gpiox                  = BOARD_QSPI_IO2_PORT;
+    qspi_gpio.config.pin_number      = BOARD_QSPI_IO2_PIN;
+    qspi_gpio.config.pin_alt_func    = BOARD_QSPI_IO2_ALT_FUNC;
+    gpio_init(&qspi_gpio);
+
+    qspi_gpio.gpiox                  = BOARD_QSPI_IO3_PORT;
+    qspi_gpio.config.pin_number      = BOARD_QSPI_IO3_PIN;
+    qspi_gpio.config.pin_alt_func    = BOARD_QSPI_IO3_ALT_FUNC;
+    gpio_init(&qspi_gpio);
+
+    /* Keeps the device deselected until the peripheral drives the pin */
+    qspi_gpio.config.pin_pupd        = GPIO_PULL_UP;
+    qspi_gpio.gpiox                  = BOARD_QSPI_NCS_PORT;
+    qspi_gpio.config.pin_number      = BOARD_QSPI_NCS_PIN;
+    qspi_gpio.config.pin_alt_func    = BOARD_QSPI_NCS_ALT_FUNC;
+    gpio_init(&qspi_gpio);
+}
+
+/* Waits until the bits in mask of reg are all set (set != 0) or all clear */
+static uint8_t qspi_wait(volatile uint32_t *reg, uint32_t mask, uint8_t set, uint32_t timeout_ms)
+{
+    uint32_t start_tick = supervisor_get_ticks();
+    while (((*reg & mask) != 0) != (set != 0))
+    {
+        if (supervisor_elapsed(start_tick, timeout_ms))
+        {
+            return QSPI_FAILURE;
+        }
+    }
+
+    return QSPI_SUCCESS;
+}
+
+static uint8_t qspi_transfer_complete(void)
+{
+    if (qspi_wait(&QSPI_SR, QSPI_SR_TCF, 1, QSPI_TRANSFER_TIMEOUT_MS) != QSPI_SUCCESS)
+    {
+        return QSPI_FAILURE;
+    }
+    QSPI_FCR = QSPI_FCR_ALL;
+    return qspi_wait(&QSPI_SR, QSPI_SR_BUSY, 0, QSPI_TRANSFER_TIMEOUT_MS);
+}
+
+/* Memory-mapped mode has to be left before any indirect command */
+static uint8_t qspi_abort(void)
+{
+    QSPI_CR |= QSPI_CR_ABORT;
+    if (qspi_wait(&QSPI_CR, QSPI_CR_ABORT, 0, QSPI_TRANSFER_TIMEOUT_MS) != QSPI_SUCCESS)
+    {
+        return QSPI_FAILURE;
+    }
+    return qspi_wait(&QSPI_SR, QSPI_SR_BUSY, 0, QSPI_TRANSFER_TIMEOUT_MS);
+}
+
+static void qspi_memory_mapped(void)
+{
+    QSPI_FCR = QSPI_FCR_ALL;
+    QSPI_CCR = QSPI_CCR_FMODE_MAPPED | QSPI_CCR_DMODE_4LINES | (NOR_FAST_READ_DUMMY << QSPI_CCR_DCYC_POS) |
+               QSPI_CCR_ADSIZE_24BIT | QSPI_CCR_ADMODE_1LINE | QSPI_CCR_IMODE_1LINE | NOR_FAST_READ_QUAD_OUT;
+}
+
+/* Instruction only, the transfer starts when CCR is written */
+static uint8_t qspi_command(uint8_t instruction)
+{
+    QSPI_FCR = QSPI_FCR_ALL;
+    QSPI_CCR = QSPI_CCR_FMODE_WRITE | QSPI_CCR_IMODE_1LINE | instruction;
+    return qspi_transfer_complete();
+}
+
+/* Instruction and address, the transfer starts when AR is written */
+static uint8_t qspi_address_command(uint8_t instruction, uint32_t offset)
+{
+    QSPI_FCR = QSPI_FCR_ALL;
+    QSPI_CCR = QSPI_CCR_FMODE_WRITE | QSPI_CCR_ADSIZE_24BIT | QSPI_CCR_ADMODE_1LINE | QSPI_CCR_IMODE_1LINE | instruction;
+    QSPI_AR = offset;
+    return qspi_transfer_complete();
+}
+
+static uint8_t qspi_read_register(uint8_t instruction, uint8_t *value)
+{
+    QSPI_FCR = QSPI_FCR_ALL;
+    QSPI_DLR = 0;
+    QSPI_CCR = QSPI_CCR_FMODE_READ | QSPI_CCR_DMODE_1LINE | QSPI_CCR_IMODE_1LINE | instruction;
+    if (qspi_wait(&QSPI_SR, QSPI_SR_TCF, 1, QSPI_TRANSFER_TIMEOUT_MS) != QSPI_SUCCESS)
+    {
+        return QSPI_FAILURE;
+    }
+    *value = QSPI_DR_BYTE;
+
+    return qspi_transfer_complete();
+}
+
+static uint8_t qspi_write_register(uint8_t instruction, uint8_t value)
+{
+    QSPI_FCR = QSPI_FCR_ALL;
+    QSPI_DLR = 0;
+    QSPI_CCR = QSPI_CCR_FMODE_WRITE | QSPI_CCR_DMODE_1LINE | QSPI_CCR_IMODE_1LINE | instruction;
+    QSPI_DR_BYTE = value;
+    return qspi_transfer_complete();
+}
+
+/*
+ * The peripheral polls the BUSY bit of the device, the CPU only keeps the watchdog fed. A
+ * device still busy after timeout_ms (the datasheet maximum of the operation) is dead or gone.
+ */
+static uint8_t qspi_wait_ready(uint32_t timeout_ms)
+{
+    QSPI_FCR = QSPI_FCR_ALL;
+    QSPI_PSMKR = NOR_STATUS_1_BUSY;
+    QSPI_PSMAR = 0;
+    QSPI_PIR = QSPI_POLL_INTERVAL;
+    QSPI_DLR = 0;
+    QSPI_CR |= QSPI_CR_APMS;
+    QSPI_CCR = QSPI_CCR_FMODE_POLL | QSPI_CCR_DMODE_1LINE | QSPI_CCR_IMODE_1LINE | NOR_READ_STATUS_1;
+
+    uint32_t start_tick = supervisor_get_ticks();
+    while (!(QSPI_SR & QSPI_SR_SMF))
+    {
+        supervisor_kick();
+        if (supervisor_elapsed(start_tick, timeout_ms))
+        {
+            return QSPI_FAILURE;
+        }
+    }
+
+    QSPI_FCR = QSPI_FCR_ALL;
+    return qspi_wait(&QSPI_SR, QSPI_SR_BUSY, 0, QSPI_TRANSFER_TIMEOUT_MS);
+}
+
+/* Stops whatever the peripheral was waiting for, the window stays unmapped until the next qspi_init() */
+static uint8_t qspi_fail(void)
+{
+    qspi_ready = 0;
+    qspi_abort();
+    BL_LOG("QSPI flash not responding.\n");
+
+    return QSPI_FAILURE;
+}
+
+uint8_t qspi_init(void)
+{
+    uint8_t status_2;
+
+    RCC->AHB3ENR |= RCC_AHB3ENR_QSPIEN;
+    qspi_gpio_init();
+
+    qspi_ready = 0;
+    QSPI_CR = QSPI_PRESCALER << QSPI_CR_PRESCALER_POS;
+    QSPI_DCR = (QSPI_FSIZE << QSPI_DCR_FSIZE_POS) | (QSPI_CS_HIGH_TIME << QSPI_DCR_CSHT_POS);
+    QSPI_CR |= QSPI_CR_EN;
+
+    /* A reset of the MCU may have interrupted a program or erase operation */
+    if (qspi_command(NOR_RESET_ENABLE) != QSPI_SUCCESS || qspi_command(NOR_RESET) != QSPI_SUCCESS)
+    {
+        return qspi_fail();
+    }
+    for (volatile uint32_t i = 0; i < NOR_RESET_DELAY; i++);
+
+    /* Nothing drives the lines without a device, the BUSY bit then reads as set */
+    if (qspi_wait_ready(QSPI_STATUS_TIMEOUT_MS) != QSPI_SUCCESS ||
+        qspi_read_register(NOR_READ_STATUS_2, &status_2) != QSPI_SUCCESS)
+    {
+        return qspi_fail();
+    }
+
+    /* The data phases run on four lines, which needs the non-volatile QE bit */
+    if (!(status_2 & NOR_STATUS_2_QE))
+    {
+        if (qspi_command(NOR_WRITE_ENABLE) != QSPI_SUCCESS ||
+            qspi_write_register(NOR_WRITE_STATUS_2, NOR_STATUS_2_QE) != QSPI_SUCCESS ||
+            qspi_wait_ready(QSPI_STATUS_TIMEOUT_MS) != QSPI_SUCCESS)
+        {
+            return qspi_fail();
+        }
+    }
+
+    qspi_memory_mapped();
+    qspi_ready = 1;
+
+    BL_LOG("QSPI flash initialized, %u KB.\n", BOARD_QSPI_FLASH_SIZE / 1024);
+
+    return QSPI_SUCCESS;
+}
+
+uint8_t qspi_is_ready(void)
+{
+    return qspi_ready;
+}
+
+uint8_t qspi_range_valid(uint32_t offset, uint32_t length)
+{
+    return length <= BOARD_QSPI_FLASH_SIZE && offset <= BOARD_QSPI_FLASH_SIZE - length;
+}
+
+/* offset and length are multiples of QSPI_SECTOR_SIZE, aligned 64 KB blocks are erased at once */
+uint8_t qspi_erase(uint32_t offset, uint32_t length)
+{
+    if (!qspi_ready || offset % QSPI_SECTOR_SIZE != 0 || length % QSPI_SECTOR_SIZE != 0 ||
+        !qspi_range_valid(offset, length))
+    {
+        return QSPI_FAILURE;
+    }
+
+    if (qspi_abort() != QSPI_SUCCESS)
+    {
+        return qspi_fail();
+    }
+
+    while (length != 0)
+    {
+        uint8_t block = offset % QSPI_BLOCK_SIZE == 0 && length >= QSPI_BLOCK_SIZE;
+        uint32_t size = block ? QSPI_BLOCK_SIZE : QSPI_SECTOR_SIZE;
+
+        if (qspi_command(NOR_WRITE_ENABLE) != QSPI_SUCCESS ||
+            qspi_address_command(block ? NOR_BLOCK_ERASE : NOR_SECTOR_ERASE, offset) != QSPI_SUCCESS ||
+            qspi_wait_ready(block ? QSPI_BLOCK_ERASE_TIMEOUT_MS : QSPI_SECTOR_ERASE_TIMEOUT_MS) != QSPI_SUCCESS)
+        {
+            return qspi_fail();
+        }
+
+        offset += size;
+        length -= size;
+    }
+
+    qspi_memory_mapped();
+
+    return QSPI_SUCCESS;
+}
+
+uint8_t qspi_write(uint32_t offset, const uint8_t *data, uint32_t length)
+{
+    if (!qspi_ready || !qspi_range_valid(offset, length))
+    {
+        return QSPI_FAILURE;
+    }
+
+    if (qspi_abort() != QSPI_SUCCESS)
+    {
+        return qspi_fail();
+    }
+
+    while (length != 0)
+    {
+        /* A page program wraps around at the end of the page, so no chunk crosses one */
+        uint32_t chunk = QSPI_PAGE_SIZE - offset % QSPI_PAGE_SIZE;
+        if (chunk > length)
+        {
+            chunk = length;
+        }
+
+        if (qspi_command(NOR_WRITE_ENABLE) != QSPI_SUCCESS)
+        {
+            return qspi_fail();
+        }
+
+        QSPI_FCR = QSPI_FCR_ALL;
+        QSPI_DLR = chunk - 1;
+        QSPI_CCR = QSPI_CCR_FMODE_WRITE | QSPI_CCR_DMODE_4LINES | QSPI_CCR_ADSIZE_24BIT |
+                   QSPI_CCR_ADMODE_1LINE | QSPI_CCR_IMODE_1LINE | NOR_QUAD_PAGE_PROGRAM;
+        QSPI_AR = offset;
+
+        for (uint32_t i = 0; i < chunk; i++)
+        {
+            if (qspi_wait(&QSPI_SR, QSPI_SR_FTF, 1, QSPI_TRANSFER_TIMEOUT_MS) != QSPI_SUCCESS)
+            {
+                return qspi_fail();
+            }
+            QSPI_DR_BYTE = data[i];
+        }
+
+        if (qspi_transfer_complete() != QSPI_SUCCESS || qspi_wait_ready(QSPI_PROGRAM_TIMEOUT_MS) != QSPI_SUCCESS)
+        {
+            return qspi_fail();
+        }
+
+        offset += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+
+    qspi_memory_mapped();
+
+    return QSPI_SUCCESS;
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef __QSPI_H__
+#define __QSPI_H__
+
+#include <stdint.h>
+
+/*
+ * External NOR flash (W25Q-style command set, 3-byte addresses) on QUADSPI bank 1. The pins
+ * and the size of the device come from the board header, see BOARD_QSPI_*.
+ *
+ * Erase and program use indirect mode, instructions and addresses on one line and data on
+ * four. Reads go through the memory-mapped window at QSPI_MAPPED_BASE_ADDR (fast read quad
+ * output), which is left enabled after every operation. Offsets are relative to the start
+ * of the external flash.
+ *
+ * Every wait on the peripheral or the device is bounded. After a timeout, or if qspi_init()
+ * found no device, qspi_erase() and qspi_write() fail and the window is not mapped until
+ * the next qspi_init(), see qspi_is_ready().
+ */
+#define QSPI_MAPPED_BASE_ADDR   0x90000000U
+#define QSPI_PAGE_SIZE          256
+#define QSPI_SECTOR_SIZE        (4 * 1024)      // Smallest erasable unit
+#define QSPI_BLOCK_SIZE         (64 * 1024)
+
+#define QSPI_SUCCESS            0
+#define QSPI_FAILURE            1
+
+uint8_t qspi_init(void);
+uint8_t qspi_is_ready(void);
+uint8_t qspi_erase(uint32_t offset, uint32_t length);
+uint8_t qspi_write(uint32_t offset, const uint8_t *data, uint32_t length);
+uint8_t qspi_range_valid(uint32_t offset, uint32_t length);
+
+#endif
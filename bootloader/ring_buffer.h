@@ -0,0 +1,48 @@
+#ifndef __RING_BUFFER_H__
+#define __RING_BUFFER_H__
+
+#include <stdint.h>
+
+/*
+ * Single producer, single consumer byte queue. The producer may run in an interrupt handler.
+ * The size must be a power of 2 so that the free running indexes can be masked.
+ */
+typedef struct
+{
+    volatile uint8_t *buffer;
+    uint32_t size;
+    volatile uint32_t head;
+    volatile uint32_t tail;
+} ring_buffer_t;
+
+#define RING_BUFFER_INIT(storage) { (storage), sizeof(storage), 0, 0 }
+
+static inline uint32_t ring_buffer_count(const ring_buffer_t *rb)
+{
+    return rb->head - rb->tail;
+}
+
+static inline uint32_t ring_buffer_free(const ring_buffer_t *rb)
+{
+    return rb->size - (rb->head - rb->tail);
+}
+
+static inline void ring_buffer_put(ring_buffer_t *rb, uint8_t byte)
+{
+    rb->buffer[rb->head & (rb->size - 1)] = byte;
+    rb->head++;
+}
+
+static inline uint8_t ring_buffer_get(ring_buffer_t *rb)
+{
+    uint8_t byte = rb->buffer[rb->tail & (rb->size - 1)];
+    rb->tail++;
+    return byte;
+}
+
+static inline void ring_buffer_reset(ring_buffer_t *rb)
+{
+    rb->head = rb->tail = 0;
+}
+
+#endif
@@ -0,0 +1,276 @@
+#include "bootloader.h"
+#include "cortex_m4.h"
+#include "ring_buffer.h"
+#include "supervisor.h"
+#include "transport.h"
+#include "spi_slave.h"
+
+#ifdef BL_ENABLE_SPI_SLAVE
+
+/* SPI2, EXTI and SYSCFG registers (RM0390) */
+#define SPI2_BASE_ADDR          0x40003800U
+#define SPI_REG(offset)         (*(volatile uint32_t *)(SPI2_BASE_ADDR + (offset)))
+#define SPI_CR1                 SPI_REG(0x00)
+#define SPI_CR2                 SPI_REG(0x04)
+#define SPI_SR                  SPI_REG(0x08)
+#define SPI_DR                  SPI_REG(0x0C)
+
+#define EXTI_BASE_ADDR          0x40013C00U
+#define EXTI_IMR                (*(volatile uint32_t *)(EXTI_BASE_ADDR + 0x00))
+#define EXTI_RTSR               (*(volatile uint32_t *)(EXTI_BASE_ADDR + 0x08))
+#define EXTI_PR                 (*(volatile uint32_t *)(EXTI_BASE_ADDR + 0x14))
+
+#define SYSCFG_BASE_ADDR        0x40013800U
+#define SYSCFG_EXTICR(n)        (*(volatile uint32_t *)(SYSCFG_BASE_ADDR + 0x08 + 0x04 * (n)))
+
+#define SPI_CR1_SPE             (1U << 6)
+#define SPI_CR2_RXNEIE          (1U << 6)
+#define SPI_SR_RXNE             (1U << 0)
+#define RCC_APB1ENR_SPI2EN      (1U << 14)
+#define RCC_APB1RSTR_SPI2RST    (1U << 14)
+#define RCC_APB2ENR_SYSCFGEN    (1U << 14)
+
+/* The rising edge of NSS raises an EXTI interrupt at the end of every transaction */
+#define NSS_EXTI_LINE           (1U << BOARD_SPI_NSS_PIN)
+#define NSS_EXTICR              SYSCFG_EXTICR(BOARD_SPI_NSS_PIN / 4)
+#define NSS_EXTICR_POS          (4 * (BOARD_SPI_NSS_PIN % 4))
+#define MISO_MODER_POS          (2 * BOARD_SPI_MISO_PIN)
+#define MODER_ALT_FUNC          2U
+
+typedef enum
+{
+    FRAME_IDLE,         // Waiting for the address byte
+    FRAME_UNICAST,      // Addressed to this node, MISO is driven
+    FRAME_BROADCAST,    // Addressed to all nodes, MISO is floating
+    FRAME_IGNORE        // Addressed to another node
+} spi_frame_state_t;
+
+static volatile uint8_t rx_storage[SPI_SLAVE_RX_BUFFER_SIZE] BL_BUFFER;
+static ring_buffer_t rx_buffer = RING_BUFFER_INIT(rx_storage);
+static volatile spi_frame_state_t frame_state = FRAME_IDLE;
+
+/* Reply handed to the interrupt handlers by spi_slave_send() */
+static const uint8_t *volatile tx_data;
+static volatile uint32_t tx_length;
+static volatile uint32_t tx_index;
+static volatile uint8_t tx_loaded;      // tx_data[tx_index] is in DR, waiting for the host to clock it out
+static volatile uint8_t read_transaction;   // The host clocks out a response, its bytes are dummies
+
+static void spi_gpio_init(void)
+{
+    gpio_handle_t spi_gpio = {0};
+    spi_gpio.gpiox                  = BOARD_SPI_PORT;
+    spi_gpio.config.pin_mode        = GPIO_MODE_ALT_FUNC;
+    spi_gpio.config.pin_alt_func    = BOARD_SPI_ALT_FUNC;
+    spi_gpio.config.pin_output_type = GPIO_OUTPUT_PUSH_PULL;
+    spi_gpio.config.pin_pupd        = GPIO_NO_PUPD;
+    spi_gpio.config.pin_speed       = GPIO_SPEED_HIGH;
+
+    spi_gpio.config.pin_number      = BOARD_SPI_SCK_PIN;
+    gpio_init(&spi_gpio);
+
+    spi_gpio.config.pin_number      = BOARD_SPI_MISO_PIN;
+    gpio_init(&spi_gpio);
+
+    spi_gpio.config.pin_number      = BOARD_SPI_MOSI_PIN;
+    gpio_init(&spi_gpio);
+
+    spi_gpio.config.pin_pupd        = GPIO_PULL_UP;
+    spi_gpio.config.pin_number      = BOARD_SPI_NSS_PIN;
+    gpio_init(&spi_gpio);
+}
+
+static void miso_drive(void)
+{
+    BOARD_SPI_PORT->MODER = (BOARD_SPI_PORT->MODER & ~(3U << MISO_MODER_POS)) | (MODER_ALT_FUNC << MISO_MODER_POS);
+}
+
+static void miso_release(void)
+{
+    BOARD_SPI_PORT->MODER &= ~(3U << MISO_MODER_POS);
+}
+
+static void spi_peripheral_init(void)
+{
+    /* Slave, mode 0, 8-bit, MSB first, hardware NSS */
+    SPI_CR1 = SPI_CR1_SPE;
+    SPI_CR2 = SPI_CR2_RXNEIE;
+}
+
+/* Drops a byte that was written to DR but never clocked out by the host */
+static void spi_peripheral_reset(void)
+{
+    RCC->APB1RSTR |= RCC_APB1RSTR_SPI2RST;
+    RCC->APB1RSTR &= ~RCC_APB1RSTR_SPI2RST;
+    spi_peripheral_init();
+}
+
+/* Puts the next reply byte in DR, the host clocks it out with its next dummy byte */
+static void tx_load(void)
+{
+    if (tx_index < tx_length)
+    {
+        SPI_DR = tx_data[tx_index];
+        tx_loaded = 1;
+        read_transaction = 1;
+    }
+}
+
+/* Rising edge of NSS, the transaction is over */
+void BOARD_SPI_NSS_IRQHandler(void)
+{
+    EXTI_PR = NSS_EXTI_LINE;
+    frame_state = FRAME_IDLE;
+    read_transaction = 0;
+    miso_release();
+
+    /* The host ended the transaction early, the byte goes out again in the next one */
+    if (tx_loaded)
+    {
+        tx_loaded = 0;
+        spi_peripheral_reset();
+    }
+}
+
+/* One byte per interrupt, a byte arriving meanwhile raises it again */
+void SPI2_IRQHandler(void)
+{
+    if (!(SPI_SR & SPI_SR_RXNE))
+    {
+        return;
+    }
+
+    uint8_t byte = (uint8_t)SPI_DR;
+
+    switch (frame_state)
+    {
+    case FRAME_IDLE:
+        if (byte == BL_NODE_ID)
+        {
+            frame_state = FRAME_UNICAST;
+            miso_drive();
+            tx_load();
+        }
+        else if (byte == BL_BROADCAST_NODE_ID)
+        {
+            frame_state = FRAME_BROADCAST;
+        }
+        else
+        {
+            frame_state = FRAME_IGNORE;
+        }
+        break;
+    case FRAME_UNICAST:
+        /* The byte just received clocked out the loaded one */
+        if (tx_loaded)
+        {
+            tx_loaded = 0;
+            tx_index++;
+            tx_load();
+        }
+        else if (tx_index < tx_length)
+        {
+            /* The response became ready while the host was already polling */
+            tx_load();
+        }
+        else if (!read_transaction && ring_buffer_free(&rx_buffer))
+        {
+            ring_buffer_put(&rx_buffer, byte);
+        }
+        break;
+    case FRAME_BROADCAST:
+        if (ring_buffer_free(&rx_buffer))
+        {
+            ring_buffer_put(&rx_buffer, byte);
+        }
+        break;
+    case FRAME_IGNORE:
+        break;
+    }
+}
+
+void spi_slave_init(void)
+{
+    RCC->APB1ENR |= RCC_APB1ENR_SPI2EN;
+    RCC->APB2ENR |= RCC_APB2ENR_SYSCFGEN;
+    spi_gpio_init();
+    miso_release();
+
+    NSS_EXTICR = (NSS_EXTICR & ~(0xFU << NSS_EXTICR_POS)) | (BOARD_SPI_PORT_INDEX << NSS_EXTICR_POS);
+    EXTI_RTSR |= NSS_EXTI_LINE;
+    EXTI_PR = NSS_EXTI_LINE;
+    EXTI_IMR |= NSS_EXTI_LINE;
+
+    ring_buffer_reset(&rx_buffer);
+    spi_peripheral_init();
+    nvic_enable_irq(IRQ_NO_SPI2);
+    nvic_enable_irq(BOARD_SPI_NSS_IRQ_NO);
+
+    BL_LOG("SPI slave initialized, node ID = %d.\n", BL_NODE_ID);
+}
+
+/*
+ * Responses only go out in transactions addressed to this node, the interrupt handlers
+ * clock them out as the host polls. Gives up if the host does not fetch the whole response
+ * within SPI_SLAVE_TX_TIMEOUT_MS.
+ */
+void spi_slave_send(uint8_t *data, uint32_t length)
+{
+    uint32_t start_tick = supervisor_get_ticks();
+
+    cpu_disable_irq();
+    tx_data = data;
+    tx_index = 0;
+    tx_length = length;
+    /* The host may already be polling, its next dummy byte fetches the first response byte */
+    if (frame_state == FRAME_UNICAST)
+    {
+        tx_load();
+    }
+    cpu_enable_irq();
+
+    while (tx_index < tx_length)
+    {
+        supervisor_kick();
+
+        if (supervisor_elapsed(start_tick, SPI_SLAVE_TX_TIMEOUT_MS))
+        {
+            BL_LOG("SPI host did not fetch the response, dropping it.\n");
+            break;
+        }
+    }
+
+    cpu_disable_irq();
+    if (tx_loaded)
+    {
+        tx_loaded = 0;
+        spi_peripheral_reset();
+    }
+    tx_length = 0;
+    tx_index = 0;
+    cpu_enable_irq();
+}
+
+void spi_slave_receive(uint8_t *rx_data, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        while (!ring_buffer_count(&rx_buffer));
+        rx_data[i] = ring_buffer_get(&rx_buffer);
+    }
+}
+
+uint8_t spi_slave_data_available(void)
+{
+    return ring_buffer_count(&rx_buffer) != 0;
+}
+
+const bl_transport_t bl_transport_spi_slave = {
+    .name           = "spi2",
+    .init           = spi_slave_init,
+    .send           = spi_slave_send,
+    .receive        = spi_slave_receive,
+    .data_available = spi_slave_data_available,
+};
+
+#endif
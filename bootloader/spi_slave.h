@@ -0,0 +1,33 @@
+#ifndef __SPI_SLAVE_H__
+#define __SPI_SLAVE_H__
+
+#include <stdint.h>
+
+/*
+ * SPI2 on the BOARD_SPI_* pins of the board header (PB12-PB15 as NSS, SCK, MISO and MOSI on
+ * the NUCLEO).
+ *
+ * SPI mode 0, 8-bit frames, MSB first. The first byte of every NSS-framed transaction is
+ * the destination node ID. Bytes of transactions addressed to this node or to
+ * BL_BROADCAST_NODE_ID are handed to the bootloader.
+ *
+ * Responses are only clocked out in transactions addressed to this node: the host sends the
+ * node ID followed by dummy bytes. MISO is left floating otherwise, so several nodes can share
+ * the bus. After a broadcast, the host collects the per-node ACKs by polling each node.
+ * The host must leave at least 10 us between the address byte and the first dummy byte.
+ * Dummy bytes are 0x00: one clocked before a response is ready is received as an empty frame
+ * and dropped. The rest of a transaction that clocked out response bytes is ignored.
+ *
+ * The RXNE interrupt fills the receive ring buffer and loads the response bytes, so no byte
+ * is lost while the bootloader is busy, except during a FLASH stall. A sender that is not
+ * polled within SPI_SLAVE_TX_TIMEOUT_MS drops the rest of its response.
+ */
+#define SPI_SLAVE_RX_BUFFER_SIZE    1024    // Must be a power of 2
+#define SPI_SLAVE_TX_TIMEOUT_MS     1000
+
+void spi_slave_init(void);
+void spi_slave_send(uint8_t *data, uint32_t length);
+void spi_slave_receive(uint8_t *rx_data, uint32_t length);
+uint8_t spi_slave_data_available(void);
+
+#endif
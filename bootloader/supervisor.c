@@ -0,0 +1,108 @@
+#include "bootloader.h"
+#include "cortex_m4.h"
+#include "supervisor.h"
+
+/* Independent watchdog registers (RM0390, chapter 19) */
+#define IWDG_BASE_ADDR          0x40003000U
+#define IWDG_KR                 (*(volatile uint32_t *)(IWDG_BASE_ADDR + 0x00))
+#define IWDG_PR                 (*(volatile uint32_t *)(IWDG_BASE_ADDR + 0x04))
+#define IWDG_RLR                (*(volatile uint32_t *)(IWDG_BASE_ADDR + 0x08))
+#define IWDG_SR                 (*(volatile uint32_t *)(IWDG_BASE_ADDR + 0x0C))
+
+#define IWDG_KEY_START          0xCCCC
+#define IWDG_KEY_UNLOCK         0x5555
+#define IWDG_KEY_REFRESH        0xAAAA
+#define IWDG_PRESCALER_256      6
+#define IWDG_MS_PER_COUNT       8       // 32 kHz LSI / 256
+#define IWDG_MAX_RELOAD         0x0FFF
+
+static volatile uint32_t ticks;
+static supervisor_config_t config = {
+    .byte_timeout_ms     = BL_BYTE_TIMEOUT_MS,
+    .session_timeout_ms  = BL_SESSION_TIMEOUT_MS,
+    .watchdog_timeout_ms = BL_WATCHDOG_TIMEOUT_MS,
+};
+
+void SysTick_Handler(void)
+{
+    ticks++;
+}
+
+static void watchdog_init(void)
+{
+    uint32_t reload = config.watchdog_timeout_ms / IWDG_MS_PER_COUNT;
+
+    if (reload > IWDG_MAX_RELOAD)
+    {
+        reload = IWDG_MAX_RELOAD;
+    }
+
+    IWDG_KR = IWDG_KEY_START;
+    IWDG_KR = IWDG_KEY_UNLOCK;
+    IWDG_PR = IWDG_PRESCALER_256;
+    IWDG_RLR = reload;
+    while (IWDG_SR);
+    IWDG_KR = IWDG_KEY_REFRESH;
+}
+
+void supervisor_init(void)
+{
+    SYST_RVR = SYSTEM_CORE_CLOCK_HZ / 1000 - 1;
+    SYST_CVR = 0;
+    SYST_CSR = SYST_CSR_CLKSOURCE | SYST_CSR_TICKINT | SYST_CSR_ENABLE;
+
+    watchdog_init();
+
+    BL_LOG("Supervisor started, byte timeout: %lu ms, session timeout: %lu ms, watchdog: %lu ms.\n",
+           config.byte_timeout_ms, config.session_timeout_ms, config.watchdog_timeout_ms);
+}
+
+void supervisor_kick(void)
+{
+    IWDG_KR = IWDG_KEY_REFRESH;
+}
+
+uint32_t supervisor_get_ticks(void)
+{
+    return ticks;
+}
+
+/* Core clock cycles since supervisor_init(), resolution of one cycle */
+uint64_t supervisor_get_cycles(void)
+{
+    uint32_t tick_count;
+    uint32_t counter;
+
+    /* Read again if SysTick wrapped between the two reads */
+    do
+    {
+        tick_count = ticks;
+        counter = SYST_CVR;
+    } while (tick_count != ticks);
+
+    return (uint64_t)tick_count * (SYST_RVR + 1) + (SYST_RVR - counter);
+}
+
+uint8_t supervisor_elapsed(uint32_t start_tick, uint32_t timeout_ms)
+{
+    return ticks - start_tick >= timeout_ms;
+}
+
+uint8_t supervisor_set_timeouts(uint32_t byte_timeout_ms, uint32_t session_timeout_ms)
+{
+    if (byte_timeout_ms < BL_MIN_BYTE_TIMEOUT_MS ||
+        (session_timeout_ms != 0 && session_timeout_ms < byte_timeout_ms))
+    {
+        return 1;
+    }
+
+    config.byte_timeout_ms = byte_timeout_ms;
+    config.session_timeout_ms = session_timeout_ms;
+
+    return 0;
+}
+
+const supervisor_config_t *supervisor_get_config(void)
+{
+    return &config;
+}
@@ -0,0 +1,39 @@
+#ifndef __SUPERVISOR_H__
+#define __SUPERVISOR_H__
+
+#include <stdint.h>
+
+/*
+ * Interactive mode supervisor. SysTick provides a 1 ms time base for the receive timeouts
+ * and the independent watchdog resets the MCU if the bootloader stops making progress.
+ *
+ * byte timeout     - maximum gap between two bytes of one frame, the frame is dropped after it
+ * session timeout  - maximum time without any frame, the bootloader then starts the application
+ *                    if a valid one is present (0 disables it)
+ *
+ * Note that the watchdog keeps running in the application when it is started from an
+ * interactive session, the application has to refresh it.
+ */
+#define BL_BYTE_TIMEOUT_MS          1000
+#define BL_SESSION_TIMEOUT_MS       30000
+#define BL_WATCHDOG_TIMEOUT_MS      20000   // Up to 32760 ms, longer than a mass erase
+#define BL_MIN_BYTE_TIMEOUT_MS      10
+
+#define SYSTEM_CORE_CLOCK_HZ        16000000U
+
+typedef struct
+{
+    uint32_t byte_timeout_ms;
+    uint32_t session_timeout_ms;
+    uint32_t watchdog_timeout_ms;
+} supervisor_config_t;
+
+void supervisor_init(void);
+void supervisor_kick(void);
+uint32_t supervisor_get_ticks(void);
+uint64_t supervisor_get_cycles(void);
+uint8_t supervisor_elapsed(uint32_t start_tick, uint32_t timeout_ms);
+uint8_t supervisor_set_timeouts(uint32_t byte_timeout_ms, uint32_t session_timeout_ms);
+const supervisor_config_t *supervisor_get_config(void);
+
+#endif
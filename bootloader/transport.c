@@ -0,0 +1,76 @@
+#include "bootloader.h"
+#include "transport.h"
+#include "supervisor.h"
+#include "power.h"
+
+static const bl_transport_t *transports[] = {
+    &bl_transport_usart,
+#ifdef BL_ENABLE_USB_CDC
+    &bl_transport_usb_cdc,
+#endif
+#ifdef BL_ENABLE_CAN
+    &bl_transport_can,
+#endif
+#ifdef BL_ENABLE_SPI_SLAVE
+    &bl_transport_spi_slave,
+#endif
+};
+
+#define NUM_OF_TRANSPORTS (sizeof(transports) / sizeof(transports[0]))
+
+/* USART2 stays the default link until a host shows up on another one */
+static const bl_transport_t *active_transport = &bl_transport_usart;
+
+void transport_init(void)
+{
+    for (uint32_t i = 0; i < NUM_OF_TRANSPORTS; i++)
+    {
+        transports[i]->init();
+    }
+}
+
+/*
+ * Block until the host sends the first byte on any of the enabled transports
+ * and use that transport for the rest of the interactive session.
+ * Returns 1 if no host showed up within timeout_ms, 0 waits forever.
+ */
+uint8_t transport_wait_for_host(uint32_t timeout_ms)
+{
+    uint32_t start_tick = supervisor_get_ticks();
+
+    while (timeout_ms == 0 || !supervisor_elapsed(start_tick, timeout_ms))
+    {
+        supervisor_kick();
+
+        for (uint32_t i = 0; i < NUM_OF_TRANSPORTS; i++)
+        {
+            if (transports[i]->data_available())
+            {
+                active_transport = transports[i];
+                BL_LOG("Host connected over %s.\n", active_transport->name);
+                return 0;
+            }
+        }
+
+        power_idle();
+    }
+
+    return 1;
+}
+
+const bl_transport_t *transport_get_active(void)
+{
+    return active_transport;
+}
+
+/*
+ * Brackets FLASH erase and programming, which stall instruction fetches and with them every
+ * receive interrupt. Calls nest, transports without flow control ignore them.
+ */
+void transport_hold(uint8_t hold)
+{
+    if (active_transport->hold != NULL)
+    {
+        active_transport->hold(hold);
+    }
+}
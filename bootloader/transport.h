@@ -0,0 +1,45 @@
+#ifndef __TRANSPORT_H__
+#define __TRANSPORT_H__
+
+#include <stdint.h>
+
+/*
+ * Node addressing for transports on a shared bus (CAN, SPI). Every bootloader on the bus
+ * needs a unique node ID, frames sent to the broadcast ID are processed by all of them.
+ */
+#ifndef BL_NODE_ID
+#define BL_NODE_ID              0x01
+#endif
+#define BL_BROADCAST_NODE_ID    0x7F
+
+/*
+ * A transport moves the raw bootloader protocol bytes between the host and the MCU.
+ * The command set is the same for every backend, only the physical link differs.
+ */
+typedef struct
+{
+    const char *name;
+    void (*init)(void);
+    void (*send)(uint8_t *tx_data, uint32_t length);
+    void (*receive)(uint8_t *rx_data, uint32_t length);
+    uint8_t (*data_available)(void);
+    void (*hold)(uint8_t hold);     // Optional, pauses the host while the CPU cannot receive
+} bl_transport_t;
+
+extern const bl_transport_t bl_transport_usart;
+#ifdef BL_ENABLE_USB_CDC
+extern const bl_transport_t bl_transport_usb_cdc;
+#endif
+#ifdef BL_ENABLE_CAN
+extern const bl_transport_t bl_transport_can;
+#endif
+#ifdef BL_ENABLE_SPI_SLAVE
+extern const bl_transport_t bl_transport_spi_slave;
+#endif
+
+void transport_init(void);
+uint8_t transport_wait_for_host(uint32_t timeout_ms);
+const bl_transport_t *transport_get_active(void);
+void transport_hold(uint8_t hold);
+
+#endif
@@ -0,0 +1,148 @@
+#include "bootloader.h"
+#include "cortex_m4.h"
+#include "ring_buffer.h"
+#include "supervisor.h"
+#include "transport.h"
+#include "usart_transport.h"
+
+#define USART_SR_FE             (1U << 1)
+#define USART_SR_NF             (1U << 2)
+#define USART_SR_ORE            (1U << 3)
+#define USART_SR_RXNE           (1U << 5)
+#define USART_CR1_RXNEIE        (1U << 5)
+
+/* Start, 8 data and stop bits at the baud rate of the board */
+#define USART_CHAR_CYCLES       (10 * SYSTEM_CORE_CLOCK_HZ / BOARD_BL_UART_BAUDRATE)
+
+/* RTS is active low: the host may send while the pin is driven low */
+#ifdef BOARD_BL_UART_RTS_PIN
+#define RTS_ASSERT()            (BOARD_BL_UART_RTS_PORT->BSRR = 1U << (BOARD_BL_UART_RTS_PIN + 16))
+#define RTS_DEASSERT()          (BOARD_BL_UART_RTS_PORT->BSRR = 1U << BOARD_BL_UART_RTS_PIN)
+#else
+#define RTS_ASSERT()
+#define RTS_DEASSERT()
+#endif
+
+static volatile uint8_t rx_storage[USART_TRANSPORT_RX_BUFFER_SIZE] BL_BUFFER;
+static ring_buffer_t rx_buffer = RING_BUFFER_INIT(rx_storage);
+static volatile usart_transport_stats_t stats;
+static uint32_t hold_depth;
+
+void BOARD_BL_UART_IRQHandler(void)
+{
+    uint32_t sr;
+
+    /* Reading SR then DR also clears the overrun, noise and framing error flags */
+    while ((sr = BL_UART.usartx->SR) & USART_SR_RXNE)
+    {
+        uint8_t byte = (uint8_t)BL_UART.usartx->DR;
+
+        if (sr & USART_SR_ORE)
+        {
+            stats.overruns++;
+        }
+        if (sr & USART_SR_FE)
+        {
+            stats.framing_errors++;
+        }
+        if (sr & USART_SR_NF)
+        {
+            stats.noise_errors++;
+        }
+
+        /* A byte that does not fit is lost just like a hardware overrun */
+        if (ring_buffer_free(&rx_buffer))
+        {
+            ring_buffer_put(&rx_buffer, byte);
+        }
+        else
+        {
+            stats.overruns++;
+        }
+
+        if (ring_buffer_count(&rx_buffer) >= USART_TRANSPORT_RTS_HIGH_WATER)
+        {
+            RTS_DEASSERT();
+        }
+    }
+}
+
+/* Lets the host send again once the buffer has drained and no flash operation holds the link */
+static void rts_update(void)
+{
+    if (hold_depth == 0 && ring_buffer_count(&rx_buffer) <= USART_TRANSPORT_RTS_LOW_WATER)
+    {
+        RTS_ASSERT();
+    }
+}
+
+void usart_transport_init(void)
+{
+    init_usart2();
+
+    ring_buffer_reset(&rx_buffer);
+    BL_UART.usartx->CR1 |= USART_CR1_RXNEIE;
+    nvic_enable_irq(BOARD_BL_UART_IRQ_NO);
+
+    hold_depth = 0;
+    rts_update();
+}
+
+void usart_transport_send(uint8_t *tx_data, uint32_t length)
+{
+    usart_transmit(&BL_UART, tx_data, length);
+}
+
+void usart_transport_receive(uint8_t *rx_data, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        while (!ring_buffer_count(&rx_buffer));
+        rx_data[i] = ring_buffer_get(&rx_buffer);
+    }
+
+    rts_update();
+}
+
+uint8_t usart_transport_data_available(void)
+{
+    return ring_buffer_count(&rx_buffer) != 0;
+}
+
+/*
+ * Holds can nest. The outermost hold deasserts RTS and waits until the bytes the host already
+ * committed to have arrived, so none of them is overrun while the CPU stalls on the FLASH.
+ */
+void usart_transport_hold(uint8_t hold)
+{
+    if (hold)
+    {
+        if (hold_depth++ == 0)
+        {
+            RTS_DEASSERT();
+#ifdef BOARD_BL_UART_RTS_PIN
+            uint64_t start = supervisor_get_cycles();
+            while (supervisor_get_cycles() - start < USART_TRANSPORT_HOLD_CHARS * USART_CHAR_CYCLES);
+#endif
+        }
+    }
+    else if (hold_depth != 0)
+    {
+        hold_depth--;
+        rts_update();
+    }
+}
+
+const usart_transport_stats_t *usart_transport_get_stats(void)
+{
+    return (const usart_transport_stats_t *)&stats;
+}
+
+const bl_transport_t bl_transport_usart = {
+    .name           = "usart2",
+    .init           = usart_transport_init,
+    .send           = usart_transport_send,
+    .receive        = usart_transport_receive,
+    .data_available = usart_transport_data_available,
+    .hold           = usart_transport_hold,
+};
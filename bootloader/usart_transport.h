@@ -0,0 +1,38 @@
+#ifndef __USART_TRANSPORT_H__
+#define __USART_TRANSPORT_H__
+
+#include <stdint.h>
+
+/*
+ * Host link over BL_UART (USART2 on the default board, see BOARD_BL_UART_* in the board header).
+ *
+ * Received bytes are moved into a ring buffer by the RXNE interrupt, so the core can sleep
+ * between bytes without losing data. Transmission stays blocking.
+ *
+ * With BOARD_BL_UART_CTS_PIN and BOARD_BL_UART_RTS_PIN defined, the link uses RTS/CTS flow
+ * control. CTS is checked by the USART before every transmitted byte. RTS is a plain GPIO:
+ * it is deasserted when the ring buffer reaches the high-water mark or while a FLASH operation
+ * stalls the receive interrupt, and asserted again once the buffer has drained to the low-water
+ * mark. The headroom above the high-water mark absorbs the bytes a host adapter still sends
+ * after RTS goes inactive.
+ */
+#define USART_TRANSPORT_RX_BUFFER_SIZE  512     // Must be a power of 2
+#define USART_TRANSPORT_RTS_HIGH_WATER  (USART_TRANSPORT_RX_BUFFER_SIZE - 64)
+#define USART_TRANSPORT_RTS_LOW_WATER   (USART_TRANSPORT_RX_BUFFER_SIZE / 2)
+#define USART_TRANSPORT_HOLD_CHARS      4       // Bytes still accepted after RTS is deasserted for a hold
+
+typedef struct
+{
+    uint32_t overruns;          // Bytes lost in the USART or because the ring buffer was full
+    uint32_t framing_errors;
+    uint32_t noise_errors;
+} usart_transport_stats_t;
+
+void usart_transport_init(void);
+void usart_transport_send(uint8_t *tx_data, uint32_t length);
+void usart_transport_receive(uint8_t *rx_data, uint32_t length);
+uint8_t usart_transport_data_available(void);
+void usart_transport_hold(uint8_t hold);
+const usart_transport_stats_t *usart_transport_get_stats(void);
+
+#endif
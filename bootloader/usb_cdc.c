@@ -0,0 +1,637 @@
+#include "bootloader.h"
+#include "cortex_m4.h"
+#include "ring_buffer.h"
+#include "supervisor.h"
+#include "transport.h"
+#include "usb_cdc.h"
+
+#ifdef BL_ENABLE_USB_CDC
+
+/* USB OTG FS core registers (RM0390, chapter 26) */
+#define OTG_FS_BASE_ADDR        0x50000000U
+#define OTG_REG(offset)         (*(volatile uint32_t *)(OTG_FS_BASE_ADDR + (offset)))
+
+#define OTG_GOTGCTL             OTG_REG(0x000)
+#define OTG_GAHBCFG             OTG_REG(0x008)
+#define OTG_GUSBCFG             OTG_REG(0x00C)
+#define OTG_GRSTCTL             OTG_REG(0x010)
+#define OTG_GINTSTS             OTG_REG(0x014)
+#define OTG_GINTMSK             OTG_REG(0x018)
+#define OTG_GRXSTSP             OTG_REG(0x020)
+#define OTG_GRXFSIZ             OTG_REG(0x024)
+#define OTG_DIEPTXF0            OTG_REG(0x028)
+#define OTG_GCCFG               OTG_REG(0x038)
+#define OTG_DIEPTXF(n)          OTG_REG(0x104 + 0x04 * ((n) - 1))
+#define OTG_DCFG                OTG_REG(0x800)
+#define OTG_DCTL                OTG_REG(0x804)
+#define OTG_DIEPMSK             OTG_REG(0x810)
+#define OTG_DOEPMSK             OTG_REG(0x814)
+#define OTG_DAINT               OTG_REG(0x818)
+#define OTG_DAINTMSK            OTG_REG(0x81C)
+#define OTG_DIEPCTL(n)          OTG_REG(0x900 + 0x20 * (n))
+#define OTG_DIEPINT(n)          OTG_REG(0x908 + 0x20 * (n))
+#define OTG_DIEPTSIZ(n)         OTG_REG(0x910 + 0x20 * (n))
+#define OTG_DOEPCTL(n)          OTG_REG(0xB00 + 0x20 * (n))
+#define OTG_DOEPINT(n)          OTG_REG(0xB08 + 0x20 * (n))
+#define OTG_DOEPTSIZ(n)         OTG_REG(0xB10 + 0x20 * (n))
+#define OTG_PCGCCTL             OTG_REG(0xE00)
+#define OTG_FIFO(n)             OTG_REG(0x1000 + 0x1000 * (n))
+
+#define GOTGCTL_BVALOEN         (1U << 6)
+#define GOTGCTL_BVALOVAL        (1U << 7)
+#define GAHBCFG_GINTMSK         (1U << 0)
+#define GUSBCFG_TRDT_POS        10
+#define GUSBCFG_FDMOD           (1U << 30)
+#define GRSTCTL_CSRST           (1U << 0)
+#define GRSTCTL_RXFFLSH         (1U << 4)
+#define GRSTCTL_TXFFLSH         (1U << 5)
+#define GRSTCTL_TXFNUM_ALL      (0x10U << 6)
+#define GRSTCTL_AHBIDL          (1U << 31)
+#define GINTSTS_RXFLVL          (1U << 4)
+#define GINTSTS_USBRST          (1U << 12)
+#define GINTSTS_ENUMDNE         (1U << 13)
+#define GINTSTS_IEPINT          (1U << 18)
+#define GINTSTS_OEPINT          (1U << 19)
+#define GCCFG_PWRDWN            (1U << 16)
+#define DCFG_DSPD_FULL_SPEED    (3U << 0)
+#define DCFG_DAD_POS            4
+#define DCFG_DAD_MASK           (0x7FU << DCFG_DAD_POS)
+#define DCTL_SDIS               (1U << 1)
+#define DEPCTL_USBAEP           (1U << 15)
+#define DEPCTL_EPTYP_POS        18
+#define DEPCTL_STALL            (1U << 21)
+#define DEPCTL_TXFNUM_POS       22
+#define DEPCTL_CNAK             (1U << 26)
+#define DEPCTL_SNAK             (1U << 27)
+#define DEPCTL_SD0PID           (1U << 28)
+#define DEPCTL_EPENA            (1U << 31)
+#define DEPINT_XFRC             (1U << 0)
+#define DOEPINT_STUP            (1U << 3)
+#define DEPTSIZ_PKTCNT_POS      19
+#define DOEPTSIZ0_STUPCNT_3     (3U << 29)
+#define GRXSTS_EPNUM_MASK       0x0FU
+#define GRXSTS_BCNT_POS         4
+#define GRXSTS_BCNT_MASK        (0x7FFU << GRXSTS_BCNT_POS)
+#define GRXSTS_PKTSTS_POS       17
+#define GRXSTS_PKTSTS_MASK      (0x0FU << GRXSTS_PKTSTS_POS)
+#define PKTSTS_OUT_DATA         2
+#define PKTSTS_SETUP_DATA       6
+
+/* RCC bits needed to derive the 48 MHz USB clock from the main PLL */
+#define RCC_CR_HSEON            (1U << 16)
+#define RCC_CR_HSERDY           (1U << 17)
+#define RCC_CR_HSEBYP           (1U << 18)
+#define RCC_CR_PLLON            (1U << 24)
+#define RCC_CR_PLLRDY           (1U << 25)
+#define RCC_PLLCFGR_PLLSRC_HSE  (1U << 22)
+#define RCC_DCKCFGR2_CK48MSEL   (1U << 27)
+#define RCC_AHB2ENR_OTGFSEN     (1U << 7)
+#define HSE_STARTUP_TIMEOUT     100000
+
+/* Endpoint layout */
+#define EP0_MAX_PACKET_SIZE     64
+#define CDC_DATA_EP             1
+#define CDC_CMD_EP              2
+#define CDC_DATA_PACKET_SIZE    64
+#define CDC_CMD_PACKET_SIZE     8
+#define EPTYP_BULK              2
+#define EPTYP_INTERRUPT         3
+
+/* FIFO layout in 32-bit words, 320 words are available on OTG FS */
+#define RX_FIFO_SIZE            128
+#define TX0_FIFO_SIZE           32
+#define TX1_FIFO_SIZE           128
+#define TX2_FIFO_SIZE           16
+
+/* Standard and CDC class requests */
+#define REQ_GET_STATUS              0x00
+#define REQ_SET_ADDRESS             0x05
+#define REQ_GET_DESCRIPTOR          0x06
+#define REQ_GET_CONFIGURATION       0x08
+#define REQ_SET_CONFIGURATION       0x09
+#define REQ_TYPE_MASK               0x60
+#define REQ_TYPE_CLASS              0x20
+#define CDC_SET_LINE_CODING         0x20
+#define CDC_GET_LINE_CODING         0x21
+#define CDC_SET_CONTROL_LINE_STATE  0x22
+#define DESC_TYPE_DEVICE            0x01
+#define DESC_TYPE_CONFIGURATION     0x02
+#define DESC_TYPE_STRING            0x03
+
+typedef struct
+{
+    uint8_t bmRequestType;
+    uint8_t bRequest;
+    uint16_t wValue;
+    uint16_t wIndex;
+    uint16_t wLength;
+} usb_setup_packet_t;
+
+static const uint8_t device_descriptor[] = {
+    18, DESC_TYPE_DEVICE,
+    0x00, 0x02,                                 // bcdUSB 2.00
+    0x02, 0x00, 0x00,                           // CDC device class
+    EP0_MAX_PACKET_SIZE,
+    USB_CDC_VID & 0xFF, USB_CDC_VID >> 8,
+    USB_CDC_PID & 0xFF, USB_CDC_PID >> 8,
+    BL_VERSION, 0x00,                           // bcdDevice
+    1, 2, 3,                                    // Manufacturer, product and serial string indexes
+    1                                           // Number of configurations
+};
+
+static const uint8_t configuration_descriptor[] = {
+    9, DESC_TYPE_CONFIGURATION, 67, 0x00, 2, 1, 0, 0x80, 50,
+    /* Interface 0: CDC communication class, ACM subclass */
+    9, 0x04, 0, 0, 1, 0x02, 0x02, 0x00, 0,
+    5, 0x24, 0x00, 0x10, 0x01,                  // Header functional descriptor, CDC 1.10
+    5, 0x24, 0x01, 0x00, 1,                     // Call management functional descriptor
+    4, 0x24, 0x02, 0x02,                        // ACM functional descriptor
+    5, 0x24, 0x06, 0, 1,                        // Union functional descriptor
+    7, 0x05, 0x80 | CDC_CMD_EP, EPTYP_INTERRUPT, CDC_CMD_PACKET_SIZE, 0x00, 0xFF,
+    /* Interface 1: CDC data class */
+    9, 0x04, 1, 0, 2, 0x0A, 0x00, 0x00, 0,
+    7, 0x05, CDC_DATA_EP, EPTYP_BULK, CDC_DATA_PACKET_SIZE, 0x00, 0x00,
+    7, 0x05, 0x80 | CDC_DATA_EP, EPTYP_BULK, CDC_DATA_PACKET_SIZE, 0x00, 0x00
+};
+
+static const char *string_descriptors[] = {
+    NULL, "wikcioo", "STM32F446xx Bootloader", "BL0001"
+};
+
+static volatile uint8_t rx_storage[USB_CDC_RX_BUFFER_SIZE] BL_BUFFER;
+static ring_buffer_t rx_buffer = RING_BUFFER_INIT(rx_storage);
+static volatile uint8_t rx_paused;
+static volatile uint8_t configuration;
+static volatile uint8_t ep0_out_request;
+static uint8_t ep0_buffer[EP0_MAX_PACKET_SIZE];
+static usb_setup_packet_t setup_packet;
+static uint8_t line_coding[7] = { 0x00, 0xC2, 0x01, 0x00, 0, 0, 8 };  // 115200 8N1
+
+static void usb_clock_init(void)
+{
+    uint32_t timeout = HSE_STARTUP_TIMEOUT;
+    uint32_t pll_source = 0;
+    uint32_t pll_m = 8;                         // 16 MHz HSI / 8 = 2 MHz
+
+    /* Prefer the 8 MHz ST-LINK MCO on HSE, HSI is not accurate enough for USB in all conditions */
+    RCC->CR |= RCC_CR_HSEBYP | RCC_CR_HSEON;
+    while (!(RCC->CR & RCC_CR_HSERDY) && --timeout);
+
+    if (RCC->CR & RCC_CR_HSERDY)
+    {
+        pll_source = RCC_PLLCFGR_PLLSRC_HSE;
+        pll_m = 4;                              // 8 MHz HSE / 4 = 2 MHz
+    }
+    else
+    {
+        BL_LOG("HSE not ready, clocking USB from HSI.\n");
+        RCC->CR &= ~(RCC_CR_HSEON | RCC_CR_HSEBYP);
+    }
+
+    /* VCO = 2 MHz * 96 = 192 MHz, PLL48CLK = 192 MHz / 4 = 48 MHz. SYSCLK stays on HSI. */
+    RCC->PLLCFGR = pll_m | (96U << 6) | pll_source | (4U << 24) | (2U << 28);
+    RCC->CR |= RCC_CR_PLLON;
+    while (!(RCC->CR & RCC_CR_PLLRDY));
+
+    RCC->DCKCFGR2 &= ~RCC_DCKCFGR2_CK48MSEL;
+    RCC->AHB2ENR |= RCC_AHB2ENR_OTGFSEN;
+}
+
+static void usb_gpio_init(void)
+{
+    gpio_handle_t usb_gpio = {0};
+    usb_gpio.gpiox                  = GPIOA;
+    usb_gpio.config.pin_mode        = GPIO_MODE_ALT_FUNC;
+    usb_gpio.config.pin_alt_func    = GPIO_ALT_FUNC_10;
+    usb_gpio.config.pin_output_type = GPIO_OUTPUT_PUSH_PULL;
+    usb_gpio.config.pin_pupd        = GPIO_NO_PUPD;
+    usb_gpio.config.pin_speed       = GPIO_SPEED_HIGH;
+
+    usb_gpio.config.pin_number      = GPIO_PIN_11;
+    gpio_init(&usb_gpio);
+
+    usb_gpio.config.pin_number      = GPIO_PIN_12;
+    gpio_init(&usb_gpio);
+}
+
+static void fifo_write(uint8_t ep_number, const uint8_t *data, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i += 4)
+    {
+        uint32_t word = 0;
+        for (uint32_t j = 0; j < 4 && i + j < length; j++)
+        {
+            word |= (uint32_t)data[i + j] << (8 * j);
+        }
+        OTG_FIFO(ep_number) = word;
+    }
+}
+
+static void fifo_read(uint8_t *data, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i += 4)
+    {
+        uint32_t word = OTG_FIFO(0);
+        for (uint32_t j = 0; j < 4 && i + j < length; j++)
+        {
+            data[i + j] = (uint8_t)(word >> (8 * j));
+        }
+    }
+}
+
+static void ep0_out_arm(void)
+{
+    OTG_DOEPTSIZ(0) = DOEPTSIZ0_STUPCNT_3 | (1U << DEPTSIZ_PKTCNT_POS) | (3 * 8);
+    OTG_DOEPCTL(0) |= DEPCTL_EPENA | DEPCTL_CNAK;
+}
+
+static void ep0_send(const uint8_t *data, uint32_t length, uint16_t requested_length)
+{
+    if (length > requested_length)
+    {
+        length = requested_length;
+    }
+
+    uint32_t packet_count = length == 0 ? 1 : (length + EP0_MAX_PACKET_SIZE - 1) / EP0_MAX_PACKET_SIZE;
+
+    OTG_DIEPTSIZ(0) = (packet_count << DEPTSIZ_PKTCNT_POS) | length;
+    OTG_DIEPCTL(0) |= DEPCTL_EPENA | DEPCTL_CNAK;
+    fifo_write(0, data, length);
+}
+
+static void ep0_stall(void)
+{
+    OTG_DIEPCTL(0) |= DEPCTL_STALL;
+    OTG_DOEPCTL(0) |= DEPCTL_STALL;
+}
+
+static void data_out_arm(void)
+{
+    OTG_DOEPTSIZ(CDC_DATA_EP) = (1U << DEPTSIZ_PKTCNT_POS) | CDC_DATA_PACKET_SIZE;
+    OTG_DOEPCTL(CDC_DATA_EP) |= DEPCTL_EPENA | DEPCTL_CNAK;
+}
+
+static void send_string_descriptor(uint8_t index, uint16_t requested_length)
+{
+    uint8_t length = 2;
+
+    if (index == 0)
+    {
+        ep0_buffer[2] = 0x09;                   // English (United States)
+        ep0_buffer[3] = 0x04;
+        length = 4;
+    }
+    else
+    {
+        for (const char *c = string_descriptors[index]; *c && length < EP0_MAX_PACKET_SIZE; c++)
+        {
+            ep0_buffer[length++] = (uint8_t)*c;
+            ep0_buffer[length++] = 0;
+        }
+    }
+
+    ep0_buffer[0] = length;
+    ep0_buffer[1] = DESC_TYPE_STRING;
+    ep0_send(ep0_buffer, length, requested_length);
+}
+
+static void configure_endpoints(void)
+{
+    OTG_DIEPCTL(CDC_DATA_EP) = DEPCTL_USBAEP | (EPTYP_BULK << DEPCTL_EPTYP_POS) |
+                               (CDC_DATA_EP << DEPCTL_TXFNUM_POS) | DEPCTL_SD0PID | CDC_DATA_PACKET_SIZE;
+    OTG_DIEPCTL(CDC_CMD_EP) = DEPCTL_USBAEP | (EPTYP_INTERRUPT << DEPCTL_EPTYP_POS) |
+                              (CDC_CMD_EP << DEPCTL_TXFNUM_POS) | DEPCTL_SD0PID | CDC_CMD_PACKET_SIZE;
+    OTG_DOEPCTL(CDC_DATA_EP) = DEPCTL_USBAEP | (EPTYP_BULK << DEPCTL_EPTYP_POS) |
+                               DEPCTL_SD0PID | CDC_DATA_PACKET_SIZE;
+    OTG_DAINTMSK |= (1U << CDC_DATA_EP) | (1U << (16 + CDC_DATA_EP));
+
+    ring_buffer_reset(&rx_buffer);
+    rx_paused = 0;
+    data_out_arm();
+}
+
+static void handle_setup(const usb_setup_packet_t *setup)
+{
+    if ((setup->bmRequestType & REQ_TYPE_MASK) == REQ_TYPE_CLASS)
+    {
+        switch (setup->bRequest)
+        {
+        case CDC_SET_LINE_CODING:
+            /* Data stage follows on EP0 OUT, status is sent once it arrives */
+            ep0_out_request = CDC_SET_LINE_CODING;
+            return;
+        case CDC_GET_LINE_CODING:
+            ep0_send(line_coding, sizeof(line_coding), setup->wLength);
+            return;
+        case CDC_SET_CONTROL_LINE_STATE:
+            ep0_send(NULL, 0, 0);
+            return;
+        default:
+            ep0_stall();
+            return;
+        }
+    }
+
+    switch (setup->bRequest)
+    {
+    case REQ_GET_DESCRIPTOR:
+        switch (setup->wValue >> 8)
+        {
+        case DESC_TYPE_DEVICE:
+            ep0_send(device_descriptor, sizeof(device_descriptor), setup->wLength);
+            break;
+        case DESC_TYPE_CONFIGURATION:
+            ep0_send(configuration_descriptor, sizeof(configuration_descriptor), setup->wLength);
+            break;
+        case DESC_TYPE_STRING:
+            if ((setup->wValue & 0xFF) < sizeof(string_descriptors) / sizeof(string_descriptors[0]))
+            {
+                send_string_descriptor(setup->wValue & 0xFF, setup->wLength);
+            }
+            else
+            {
+                ep0_stall();
+            }
+            break;
+        default:
+            ep0_stall();
+        }
+        break;
+    case REQ_SET_ADDRESS:
+        OTG_DCFG = (OTG_DCFG & ~DCFG_DAD_MASK) | ((setup->wValue & 0x7F) << DCFG_DAD_POS);
+        ep0_send(NULL, 0, 0);
+        break;
+    case REQ_SET_CONFIGURATION:
+        configuration = setup->wValue & 0xFF;
+        if (configuration)
+        {
+            configure_endpoints();
+        }
+        ep0_send(NULL, 0, 0);
+        break;
+    case REQ_GET_CONFIGURATION:
+        ep0_buffer[0] = configuration;
+        ep0_send(ep0_buffer, 1, setup->wLength);
+        break;
+    case REQ_GET_STATUS:
+        ep0_buffer[0] = 0;
+        ep0_buffer[1] = 0;
+        ep0_send(ep0_buffer, 2, setup->wLength);
+        break;
+    default:
+        ep0_stall();
+    }
+}
+
+static void handle_reset(void)
+{
+    for (uint8_t i = 0; i < 4; i++)
+    {
+        OTG_DOEPCTL(i) |= DEPCTL_SNAK;
+    }
+
+    OTG_DAINTMSK = (1U << 0) | (1U << 16);
+    OTG_DOEPMSK  = DOEPINT_STUP | DEPINT_XFRC;
+    OTG_DIEPMSK  = DEPINT_XFRC;
+    OTG_DCFG    &= ~DCFG_DAD_MASK;
+
+    configuration = 0;
+    ep0_out_arm();
+}
+
+static void handle_rx_fifo(void)
+{
+    uint32_t status = OTG_GRXSTSP;
+    uint8_t ep_number = status & GRXSTS_EPNUM_MASK;
+    uint32_t byte_count = (status & GRXSTS_BCNT_MASK) >> GRXSTS_BCNT_POS;
+
+    switch ((status & GRXSTS_PKTSTS_MASK) >> GRXSTS_PKTSTS_POS)
+    {
+    case PKTSTS_SETUP_DATA:
+        /* Processed once the setup stage completes, see OTG_FS_IRQHandler */
+        fifo_read((uint8_t *)&setup_packet, sizeof(setup_packet));
+        break;
+    case PKTSTS_OUT_DATA:
+        if (ep_number == CDC_DATA_EP)
+        {
+            for (uint32_t i = 0; i < byte_count; i += 4)
+            {
+                uint32_t word = OTG_FIFO(0);
+                for (uint32_t j = 0; j < 4 && i + j < byte_count; j++)
+                {
+                    ring_buffer_put(&rx_buffer, (uint8_t)(word >> (8 * j)));
+                }
+            }
+        }
+        else
+        {
+            fifo_read(ep0_buffer, byte_count);
+            if (ep0_out_request == CDC_SET_LINE_CODING && byte_count == sizeof(line_coding))
+            {
+                memcpy(line_coding, ep0_buffer, sizeof(line_coding));
+                ep0_send(NULL, 0, 0);
+            }
+            ep0_out_request = 0;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+void OTG_FS_IRQHandler(void)
+{
+    uint32_t status = OTG_GINTSTS & OTG_GINTMSK;
+
+    if (status & GINTSTS_USBRST)
+    {
+        OTG_GINTSTS = GINTSTS_USBRST;
+        handle_reset();
+    }
+
+    if (status & GINTSTS_ENUMDNE)
+    {
+        OTG_GINTSTS = GINTSTS_ENUMDNE;
+        /* EP0 max packet size of 64 bytes is encoded as 0 */
+        OTG_DIEPCTL(0) &= ~0x3U;
+    }
+
+    if (status & GINTSTS_RXFLVL)
+    {
+        handle_rx_fifo();
+    }
+
+    if (status & GINTSTS_OEPINT)
+    {
+        uint32_t out_endpoints = OTG_DAINT >> 16;
+
+        if (out_endpoints & (1U << 0))
+        {
+            uint32_t ep0_status = OTG_DOEPINT(0);
+            OTG_DOEPINT(0) = ep0_status;
+
+            if (ep0_status & DOEPINT_STUP)
+            {
+                handle_setup(&setup_packet);
+            }
+            ep0_out_arm();
+        }
+
+        if (out_endpoints & (1U << CDC_DATA_EP))
+        {
+            OTG_DOEPINT(CDC_DATA_EP) = OTG_DOEPINT(CDC_DATA_EP);
+            /* Leave the endpoint NAKing until the application makes room in the buffer */
+            if (ring_buffer_free(&rx_buffer) >= CDC_DATA_PACKET_SIZE)
+            {
+                data_out_arm();
+            }
+            else
+            {
+                rx_paused = 1;
+            }
+        }
+    }
+
+    if (status & GINTSTS_IEPINT)
+    {
+        uint32_t in_endpoints = OTG_DAINT & 0xFFFF;
+
+        for (uint8_t i = 0; i < 4; i++)
+        {
+            if (in_endpoints & (1U << i))
+            {
+                OTG_DIEPINT(i) = OTG_DIEPINT(i);
+            }
+        }
+    }
+}
+
+void usb_cdc_init(void)
+{
+    usb_clock_init();
+    usb_gpio_init();
+
+    /* AHB clock is 16 MHz which requires a turnaround time of 0xD */
+    OTG_GUSBCFG = GUSBCFG_FDMOD | (0xDU << GUSBCFG_TRDT_POS);
+
+    while (!(OTG_GRSTCTL & GRSTCTL_AHBIDL));
+    OTG_GRSTCTL |= GRSTCTL_CSRST;
+    while (OTG_GRSTCTL & GRSTCTL_CSRST);
+
+    /* VBUS is not routed to PA9 on every board, so force a valid B-session instead */
+    OTG_GCCFG = GCCFG_PWRDWN;
+    OTG_GOTGCTL |= GOTGCTL_BVALOEN | GOTGCTL_BVALOVAL;
+
+    OTG_PCGCCTL = 0;
+    OTG_DCFG = DCFG_DSPD_FULL_SPEED;
+
+    OTG_GRXFSIZ = RX_FIFO_SIZE;
+    OTG_DIEPTXF0 = (TX0_FIFO_SIZE << 16) | RX_FIFO_SIZE;
+    OTG_DIEPTXF(1) = (TX1_FIFO_SIZE << 16) | (RX_FIFO_SIZE + TX0_FIFO_SIZE);
+    OTG_DIEPTXF(2) = (TX2_FIFO_SIZE << 16) | (RX_FIFO_SIZE + TX0_FIFO_SIZE + TX1_FIFO_SIZE);
+
+    OTG_GRSTCTL = GRSTCTL_TXFFLSH | GRSTCTL_TXFNUM_ALL;
+    while (OTG_GRSTCTL & GRSTCTL_TXFFLSH);
+    OTG_GRSTCTL = GRSTCTL_RXFFLSH;
+    while (OTG_GRSTCTL & GRSTCTL_RXFFLSH);
+
+    OTG_GINTSTS = 0xFFFFFFFF;
+    OTG_GINTMSK = GINTSTS_RXFLVL | GINTSTS_USBRST | GINTSTS_ENUMDNE | GINTSTS_IEPINT | GINTSTS_OEPINT;
+    OTG_GAHBCFG = GAHBCFG_GINTMSK;
+    nvic_enable_irq(IRQ_NO_OTG_FS);
+
+    /* Connect to the bus */
+    OTG_DCTL &= ~DCTL_SDIS;
+
+    BL_LOG("USB CDC initialized.\n");
+}
+
+/* Waits for the previous packet to leave the FIFO, gives up if the host stops polling the endpoint */
+static uint8_t data_in_wait(void)
+{
+    uint32_t start_tick = supervisor_get_ticks();
+
+    while (OTG_DIEPCTL(CDC_DATA_EP) & DEPCTL_EPENA)
+    {
+        supervisor_kick();
+
+        if (!configuration || supervisor_elapsed(start_tick, USB_CDC_TX_TIMEOUT_MS))
+        {
+            BL_LOG("USB host not reading, reply dropped.\n");
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void data_in_send(const uint8_t *data, uint32_t length)
+{
+    cpu_disable_irq();
+    OTG_DIEPTSIZ(CDC_DATA_EP) = (1U << DEPTSIZ_PKTCNT_POS) | length;
+    OTG_DIEPCTL(CDC_DATA_EP) |= DEPCTL_EPENA | DEPCTL_CNAK;
+    fifo_write(CDC_DATA_EP, data, length);
+    cpu_enable_irq();
+}
+
+void usb_cdc_send(uint8_t *tx_data, uint32_t length)
+{
+    /* A transfer ends with a short packet, one that fills its last packet needs a zero-length one */
+    uint8_t send_zlp = length != 0 && length % CDC_DATA_PACKET_SIZE == 0;
+
+    while (length > 0)
+    {
+        uint32_t packet_length = length > CDC_DATA_PACKET_SIZE ? CDC_DATA_PACKET_SIZE : length;
+
+        if (data_in_wait())
+        {
+            return;
+        }
+        data_in_send(tx_data, packet_length);
+
+        tx_data += packet_length;
+        length -= packet_length;
+    }
+
+    if (send_zlp && !data_in_wait())
+    {
+        data_in_send(NULL, 0);
+    }
+}
+
+void usb_cdc_receive(uint8_t *rx_data, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        while (!ring_buffer_count(&rx_buffer));
+        rx_data[i] = ring_buffer_get(&rx_buffer);
+
+        if (rx_paused && ring_buffer_free(&rx_buffer) >= CDC_DATA_PACKET_SIZE)
+        {
+            cpu_disable_irq();
+            rx_paused = 0;
+            data_out_arm();
+            cpu_enable_irq();
+        }
+    }
+}
+
+uint8_t usb_cdc_data_available(void)
+{
+    return ring_buffer_count(&rx_buffer) != 0;
+}
+
+uint8_t usb_cdc_is_configured(void)
+{
+    return configuration != 0;
+}
+
+const bl_transport_t bl_transport_usb_cdc = {
+    .name           = "usb-cdc",
+    .init           = usb_cdc_init,
+    .send           = usb_cdc_send,
+    .receive        = usb_cdc_receive,
+    .data_available = usb_cdc_data_available,
+};
+
+#endif
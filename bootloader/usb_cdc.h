@@ -0,0 +1,24 @@
+#ifndef __USB_CDC_H__
+#define __USB_CDC_H__
+
+#include <stdint.h>
+
+/*
+ * PA11 -> OTG_FS_DM
+ * PA12 -> OTG_FS_DP
+ *
+ * The device enumerates as a CDC-ACM virtual COM port. Bulk endpoint 1 carries the
+ * bootloader protocol, interrupt endpoint 2 is the (unused) CDC notification endpoint.
+ */
+#define USB_CDC_VID             0x0483
+#define USB_CDC_PID             0x5740
+#define USB_CDC_RX_BUFFER_SIZE  512     // Must be a power of 2
+#define USB_CDC_TX_TIMEOUT_MS   100     // Longest wait for the host to fetch an IN packet
+
+void usb_cdc_init(void);
+void usb_cdc_send(uint8_t *tx_data, uint32_t length);
+void usb_cdc_receive(uint8_t *rx_data, uint32_t length);
+uint8_t usb_cdc_data_available(void);
+uint8_t usb_cdc_is_configured(void);
+
+#endif
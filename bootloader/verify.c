@@ -0,0 +1,167 @@
+#include "bootloader.h"
+#include "verify.h"
+#include "stm32f446xx_crc.h"
+
+/* DMA2 stream 0 registers (RM0390, chapter 9) */
+#define DMA2_BASE_ADDR          0x40026400U
+#define DMA2_LISR               (*(volatile uint32_t *)(DMA2_BASE_ADDR + 0x00))
+#define DMA2_LIFCR              (*(volatile uint32_t *)(DMA2_BASE_ADDR + 0x08))
+#define DMA2_S0CR               (*(volatile uint32_t *)(DMA2_BASE_ADDR + 0x10))
+#define DMA2_S0NDTR             (*(volatile uint32_t *)(DMA2_BASE_ADDR + 0x14))
+#define DMA2_S0PAR              (*(volatile uint32_t *)(DMA2_BASE_ADDR + 0x18))
+#define DMA2_S0M0AR             (*(volatile uint32_t *)(DMA2_BASE_ADDR + 0x1C))
+#define DMA2_S0FCR              (*(volatile uint32_t *)(DMA2_BASE_ADDR + 0x24))
+
+#define DMA_SxCR_EN             (1U << 0)
+#define DMA_SxCR_DIR_M2M        (2U << 6)
+#define DMA_SxCR_PINC           (1U << 9)
+#define DMA_SxCR_PSIZE_WORD     (2U << 11)
+#define DMA_SxCR_MSIZE_WORD     (2U << 13)
+#define DMA_SxFCR_DMDIS         (1U << 2)   // Memory-to-memory needs the FIFO
+#define DMA_SxFCR_FTH_FULL      (3U << 0)
+#define DMA_LISR_TCIF0          (1U << 5)
+#define DMA_LISR_TEIF0          (1U << 3)
+#define DMA_LIFCR_STREAM0       0x3DU
+#define RCC_AHB1ENR_DMA2EN      (1U << 22)
+
+static verify_stats_t stats;
+
+#ifdef BL_ENABLE_WRITE_VERIFY
+
+static uint32_t verify_address;
+static const uint8_t *verify_data;
+static uint32_t verify_length;
+static uint32_t verify_head;            // Bytes in front of the first word boundary of the FLASH
+static uint32_t expected_crc;
+static uint8_t in_progress;
+
+static void crc_reset(void)
+{
+    CRC->CR |= 1 << CRC_CR_RESET;
+}
+
+/*
+ * Only the aligned words of the FLASH range go through the CRC unit, the DMA ignores the low
+ * bits of PAR. The bytes in front of and behind them are compared directly.
+ */
+void verify_start(uint32_t address, const uint8_t *data, uint32_t length)
+{
+    uint32_t head = (4 - address % 4) % 4;
+
+    verify_address = address;
+    verify_data = data;
+    verify_length = length;
+    verify_head = head < length ? head : length;
+    in_progress = 1;
+
+    uint32_t num_of_words = (length - verify_head) / 4;
+
+    crc_reset();
+    for (uint32_t i = 0; i < num_of_words; i++)
+    {
+        uint32_t word;
+
+        memcpy(&word, &data[verify_head + 4 * i], sizeof(word));
+        CRC->DR = word;
+    }
+    expected_crc = CRC->DR;
+    crc_reset();
+
+    if (num_of_words == 0)
+    {
+        return;
+    }
+
+    RCC->AHB1ENR |= RCC_AHB1ENR_DMA2EN;
+
+    /* In memory-to-memory mode PAR is the source, it walks the FLASH while M0AR stays on CRC->DR */
+    DMA2_S0CR = 0;
+    while (DMA2_S0CR & DMA_SxCR_EN);
+    DMA2_LIFCR = DMA_LIFCR_STREAM0;
+    DMA2_S0PAR = address + verify_head;
+    DMA2_S0M0AR = (uint32_t)&CRC->DR;
+    DMA2_S0NDTR = num_of_words;
+    DMA2_S0FCR = DMA_SxFCR_DMDIS | DMA_SxFCR_FTH_FULL;
+    DMA2_S0CR = DMA_SxCR_DIR_M2M | DMA_SxCR_PINC | DMA_SxCR_PSIZE_WORD | DMA_SxCR_MSIZE_WORD | DMA_SxCR_EN;
+}
+
+/* First byte in [start, end) that differs from the data, end if there is none */
+static uint32_t verify_compare(uint32_t start, uint32_t end)
+{
+    const volatile uint8_t *flash = (const volatile uint8_t *)verify_address;
+
+    while (start < end && flash[start] == verify_data[start])
+    {
+        start++;
+    }
+
+    return start;
+}
+
+uint8_t verify_finish(uint32_t *fail_address)
+{
+    if (!in_progress)
+    {
+        return VERIFY_SUCCESS;
+    }
+    in_progress = 0;
+
+    uint32_t num_of_words = (verify_length - verify_head) / 4;
+    uint32_t words_end = verify_head + num_of_words * 4;
+    uint32_t flash_crc = expected_crc;
+
+    if (num_of_words != 0)
+    {
+        while (!(DMA2_LISR & (DMA_LISR_TCIF0 | DMA_LISR_TEIF0)));
+        flash_crc = (DMA2_LISR & DMA_LISR_TEIF0) ? ~expected_crc : CRC->DR;
+        DMA2_LIFCR = DMA_LIFCR_STREAM0;
+        crc_reset();
+    }
+
+    uint32_t i;
+
+    if (flash_crc == expected_crc)
+    {
+        i = verify_compare(0, verify_head);
+        if (i == verify_head)
+        {
+            i = verify_compare(words_end, verify_length);
+        }
+    }
+    else
+    {
+        i = verify_compare(0, verify_length);
+    }
+
+    /* A CRC mismatch without a differing byte still fails, the FLASH changed during the check */
+    if (i == verify_length && flash_crc == expected_crc)
+    {
+        return VERIFY_SUCCESS;
+    }
+
+    stats.failures++;
+    stats.last_fail_address = verify_address + (i < verify_length ? i : 0);
+    *fail_address = stats.last_fail_address;
+
+    BL_LOG("Verify failed at 0x%08lX!\n", stats.last_fail_address);
+
+    return VERIFY_FAILURE;
+}
+
+#else
+
+void verify_start(uint32_t address, const uint8_t *data, uint32_t length)
+{
+}
+
+uint8_t verify_finish(uint32_t *fail_address)
+{
+    return VERIFY_SUCCESS;
+}
+
+#endif
+
+const verify_stats_t *verify_get_stats(void)
+{
+    return &stats;
+}
@@ -0,0 +1,27 @@
+#ifndef __VERIFY_H__
+#define __VERIFY_H__
+
+#include <stdint.h>
+
+/*
+ * Post-program verification. The CRC of the payload is computed first, then DMA2 stream 0
+ * feeds the programmed FLASH range into the CRC unit as a memory-to-memory transfer while
+ * the CPU is free to do something else, e.g. send the ACK. verify_finish() compares both
+ * CRCs and on a mismatch locates the first byte that differs.
+ *
+ * The CRC unit is busy between verify_start() and verify_finish().
+ */
+#define VERIFY_SUCCESS      0
+#define VERIFY_FAILURE      1
+
+typedef struct
+{
+    uint32_t failures;
+    uint32_t last_fail_address;
+} verify_stats_t;
+
+void verify_start(uint32_t address, const uint8_t *data, uint32_t length);
+uint8_t verify_finish(uint32_t *fail_address);
+const verify_stats_t *verify_get_stats(void);
+
+#endif
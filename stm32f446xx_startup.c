@@ -1,11 +1,6 @@
 #include <stdint.h>
 
-#define SRAM_START      (0x20000000U)
-#define SRAM_SIZE       (128 * 1024) // 128KB
-#define SRAM_END        ((SRAM_START) + (SRAM_SIZE))
-
-#define STACK_START     (SRAM_END)
-
+extern uint32_t _estack;
 extern uint32_t _etext;
 extern uint32_t _sdata;
 extern uint32_t _edata;
@@ -110,7 +105,7 @@ void DCMI_IRQHandler             	(void) __attribute__ ((weak, alias("Default_Ha
 void FPU_IRQHandler              	(void) __attribute__ ((weak, alias("Default_Handler")));
 
 uint32_t vectors[] __attribute__((section(".isr_vector"))) = {
-    STACK_START,
+    (uint32_t) &_estack,
     (uint32_t) &Reset_Handler,
     (uint32_t) &NMI_Handler,
     (uint32_t) &HardFault_Handler,
@@ -223,7 +218,7 @@ void Reset_Handler(void)
     }
 
     // init the .bss section to zero in SRAM
-    size = &_ebss - &_sbss;
+    size = (uint32_t) &_ebss - (uint32_t) &_sbss;
     pDst = (uint8_t*) &_sbss;
 
     for (uint32_t i = 0; i < size; i++) {
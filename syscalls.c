@@ -63,8 +63,6 @@ extern int errno;
 extern int __io_putchar(int ch) __attribute__((weak));
 extern int __io_getchar(void) __attribute__((weak));
 
-char * stack_ptr asm("sp");
-
 char *__env[1] = { 0 };
 char **environ = __env;
 
@@ -194,6 +192,7 @@ int _execve(char *name, char **argv, char **env)
 caddr_t _sbrk(int incr)
 {
 	extern char end asm("end");
+	extern char _heap_limit;
 	static char *heap_end;
 	char *prev_heap_end;
 
@@ -201,7 +200,7 @@ caddr_t _sbrk(int incr)
 		heap_end = &end;
 
 	prev_heap_end = heap_end;
-	if (heap_end + incr > stack_ptr)
+	if (heap_end + incr > &_heap_limit)
 	{
 		errno = ENOMEM;
 		return (caddr_t) -1;
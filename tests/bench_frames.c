@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "harness.h"
+#include "bootloader.h"
+
+/*
+ * Throughput of the frame handling. Reports, per workload, the frames handled per second of
+ * host time and, from the virtual clock, the simulated core cycles per frame and the payload
+ * throughput the bootloader reaches over USART2 at 115200 baud.
+ *
+ * bench_frames [FRAMES]
+ */
+#define BENCH_DEFAULT_FRAMES    5000
+#define BENCH_WRITE_SIZE        200
+#define BENCH_WRITE_BASE_ADDR   (BOARD_APP_BASE_ADDR + 0x10000U)
+#define BENCH_WRITE_SPAN        (64 * 1024)
+
+typedef struct
+{
+    const char *name;
+    uint8_t via_uart;
+    uint32_t (*next_frame)(uint32_t index, uint32_t *seed, uint8_t *frame);
+    uint32_t payload_size;
+} workload_t;
+
+static uint32_t frame_get_version(uint32_t index, uint32_t *seed, uint8_t *frame)
+{
+    return harness_build_frame(frame, BL_GET_VER, NULL, 0);
+}
+
+static uint32_t frame_mem_read(uint32_t index, uint32_t *seed, uint8_t *frame)
+{
+    uint8_t fields[5];
+    uint32_t address = BOARD_APP_BASE_ADDR + (index * 128) % BENCH_WRITE_SPAN;
+
+    memcpy(fields, &address, sizeof(address));
+    fields[4] = 128;
+
+    return harness_build_frame(frame, BL_MEM_READ, fields, sizeof(fields));
+}
+
+/* Consecutive writes through a 64 KB window, erased again whenever it is full */
+static uint32_t frame_mem_write(uint32_t index, uint32_t *seed, uint8_t *frame)
+{
+    uint8_t fields[5 + BENCH_WRITE_SIZE];
+    uint32_t offset = (index * BENCH_WRITE_SIZE) % (BENCH_WRITE_SPAN - BENCH_WRITE_SPAN % BENCH_WRITE_SIZE);
+    uint32_t address = BENCH_WRITE_BASE_ADDR + offset;
+
+    if (offset == 0)
+    {
+        memset(sim_mem(BENCH_WRITE_BASE_ADDR), 0xFF, BENCH_WRITE_SPAN);
+    }
+
+    memcpy(fields, &address, sizeof(address));
+    fields[4] = BENCH_WRITE_SIZE;
+    for (uint32_t i = 0; i < BENCH_WRITE_SIZE; i++)
+    {
+        fields[5 + i] = (uint8_t)harness_random(seed);
+    }
+
+    return harness_build_frame(frame, BL_MEM_WRITE, fields, sizeof(fields));
+}
+
+static uint32_t frame_random(uint32_t index, uint32_t *seed, uint8_t *frame)
+{
+    return harness_random_frame(seed, frame);
+}
+
+static const workload_t workloads[] = {
+    { "get_version", 0, frame_get_version, 0 },
+    { "mem_read", 0, frame_mem_read, 128 },
+    { "mem_write", 0, frame_mem_write, BENCH_WRITE_SIZE },
+    { "random", 0, frame_random, 0 },
+    { "uart get_version", 1, frame_get_version, 0 },
+    { "uart mem_write", 1, frame_mem_write, BENCH_WRITE_SIZE },
+};
+
+static double host_seconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t num_of_frames = argc > 1 ? strtoul(argv[1], NULL, 0) : BENCH_DEFAULT_FRAMES;
+    uint8_t frame[HARNESS_FRAME_MAX_SIZE];
+    static harness_reply_t reply;
+
+    harness_init();
+
+    printf("%-18s %12s %14s %14s\n", "workload", "frames/s", "cycles/frame", "payload B/s");
+
+    for (uint32_t w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++)
+    {
+        const workload_t *workload = &workloads[w];
+        /* Frames over USART2 take milliseconds of virtual time each, fewer of them do */
+        uint32_t frames = workload->via_uart ? (num_of_frames + 9) / 10 : num_of_frames;
+        uint32_t seed = 1;
+
+        sim_flash_erase_all();
+        harness_boot();
+
+        uint64_t start_cycles = sim_cycles();
+        double start = host_seconds();
+
+        for (uint32_t i = 0; i < frames; i++)
+        {
+            uint32_t size = workload->next_frame(i, &seed, frame);
+
+            if (workload->via_uart)
+            {
+                harness_exchange(frame, size, &reply);
+            }
+            else
+            {
+                harness_process(frame, &reply);
+            }
+        }
+
+        double elapsed = host_seconds() - start;
+        double cycles = (double)(sim_cycles() - start_cycles) / frames;
+
+        printf("%-18s %12.0f %14.0f %14.0f\n", workload->name, frames / elapsed, cycles,
+               workload->payload_size * (double)SIM_CORE_CLOCK_HZ / cycles);
+    }
+
+    return 0;
+}
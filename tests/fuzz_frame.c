@@ -0,0 +1,194 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "harness.h"
+
+/*
+ * Fuzz target for the frame handling, usable with libFuzzer and AFL.
+ *
+ * The first byte of an input selects how it is delivered: bit 0 keeps the CRC of every frame
+ * as given instead of fixing it up, bit 1 sends the frames over the simulated USART2 instead of
+ * handing them to bootloader_process_frame(). The rest is a sequence of frames, each a length
+ * byte followed by that many bytes. Every reply is checked by the harness, a violation aborts.
+ *
+ * The bootloader state (FLASH contents, sessions, timeouts) carries over from one input to the
+ * next as it would on the device, so a crash may need the inputs before it to reproduce.
+ *
+ * libFuzzer:   clang -fsanitize=fuzzer -DFUZZ_LIBFUZZER ... and run with -handle_segv=0,
+ *              the simulator needs SIGSEGV for the peripheral registers.
+ * AFL:         build with afl-gcc as usual and run "fuzz_frame @@" or with the input on stdin.
+ * Standalone:  fuzz_frame FILE...         runs the given inputs
+ *              fuzz_frame -runs=N [-seed=S]  runs N random inputs
+ *              fuzz_frame -corpus=DIR [-runs=N]  writes N random inputs to DIR as a seed corpus
+ */
+#define FUZZ_KEEP_CRC           (1U << 0)
+#define FUZZ_VIA_UART           (1U << 1)
+#define FUZZ_INPUT_MAX_SIZE     (16 * 1024)
+#define FUZZ_MAX_FRAMES         8
+
+int LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+    harness_init();
+
+    return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static uint8_t stream[FUZZ_INPUT_MAX_SIZE];
+    uint8_t frame[HARNESS_FRAME_MAX_SIZE];
+    uint32_t stream_length = 0;
+    harness_reply_t reply;
+
+    if (size == 0 || size > FUZZ_INPUT_MAX_SIZE)
+    {
+        return 0;
+    }
+
+    harness_init();
+
+    uint8_t flags = data[0];
+    size_t offset = 1;
+
+    while (offset < size)
+    {
+        uint32_t length = data[offset];
+        uint32_t available = size - offset - 1 < length ? size - offset - 1 : length;
+
+        frame[0] = data[offset];
+        memcpy(&frame[1], &data[offset + 1], available);
+        offset += 1 + available;
+
+        if (!(flags & FUZZ_KEEP_CRC))
+        {
+            harness_fix_crc(frame);
+        }
+
+        if (flags & FUZZ_VIA_UART)
+        {
+            /* A truncated last frame is sent as is, the bootloader has to time out on it */
+            memcpy(&stream[stream_length], frame, 1 + available);
+            stream_length += 1 + available;
+        }
+        else if (length != 0 && available == length)
+        {
+            harness_process(frame, &reply);
+        }
+    }
+
+    if (stream_length != 0)
+    {
+        harness_exchange(stream, stream_length, &reply);
+    }
+
+    return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+/* Random input made of a few frames of harness_random_frame(), returns its size */
+static uint32_t random_input(uint32_t *seed, uint8_t *input)
+{
+    uint32_t num_of_frames = 1 + harness_random(seed) % FUZZ_MAX_FRAMES;
+    uint32_t size = 1;
+
+    /* The frames already carry their CRC, a few of them a wrong one */
+    input[0] = FUZZ_KEEP_CRC | (harness_random(seed) % 4 == 0 ? FUZZ_VIA_UART : 0);
+
+    for (uint32_t i = 0; i < num_of_frames; i++)
+    {
+        size += harness_random_frame(seed, &input[size]);
+    }
+
+    return size;
+}
+
+static int run_file(FILE *file, const char *name)
+{
+    static uint8_t input[FUZZ_INPUT_MAX_SIZE + 1];
+    size_t size = fread(input, 1, sizeof(input), file);
+
+    if (size > FUZZ_INPUT_MAX_SIZE)
+    {
+        fprintf(stderr, "%s: input longer than %u bytes\n", name, FUZZ_INPUT_MAX_SIZE);
+        return 1;
+    }
+
+    LLVMFuzzerTestOneInput(input, size);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t input[FUZZ_MAX_FRAMES * HARNESS_FRAME_MAX_SIZE + 1];
+    const char *corpus = NULL;
+    uint32_t runs = 0;
+    uint32_t seed = 1;
+    int num_of_files = 0;
+
+    LLVMFuzzerInitialize(&argc, &argv);
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "-runs=", 6) == 0)
+        {
+            runs = strtoul(&argv[i][6], NULL, 0);
+        }
+        else if (strncmp(argv[i], "-seed=", 6) == 0)
+        {
+            seed = strtoul(&argv[i][6], NULL, 0);
+        }
+        else if (strncmp(argv[i], "-corpus=", 8) == 0)
+        {
+            corpus = &argv[i][8];
+        }
+        else
+        {
+            FILE *file = fopen(argv[i], "rb");
+
+            if (file == NULL || run_file(file, argv[i]) != 0)
+            {
+                perror(argv[i]);
+                return 1;
+            }
+            fclose(file);
+            num_of_files++;
+        }
+    }
+
+    if (corpus != NULL)
+    {
+        for (uint32_t i = 0; i < (runs != 0 ? runs : 64); i++)
+        {
+            char path[4096];
+            uint32_t size = random_input(&seed, input);
+
+            snprintf(path, sizeof(path), "%s/seed-%04u", corpus, i);
+            FILE *file = fopen(path, "wb");
+            if (file == NULL || fwrite(input, 1, size, file) != size)
+            {
+                perror(path);
+                return 1;
+            }
+            fclose(file);
+        }
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < runs; i++)
+    {
+        LLVMFuzzerTestOneInput(input, random_input(&seed, input));
+    }
+
+    if (runs == 0 && num_of_files == 0)
+    {
+        return run_file(stdin, "stdin");
+    }
+
+    const harness_stats_t *stats = harness_get_stats();
+    printf("%llu frames, %llu jumps, %llu boots\n", (unsigned long long)stats->frames,
+           (unsigned long long)stats->jumps, (unsigned long long)stats->boots);
+
+    return 0;
+}
+#endif
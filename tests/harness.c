@@ -0,0 +1,564 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "harness.h"
+#include "bootloader.h"
+#include "boot_log.h"
+#include "boot_request.h"
+#include "frames.h"
+#include "manifest.h"
+#include "policy.h"
+#include "pool.h"
+#include "power.h"
+#include "qspi.h"
+#include "supervisor.h"
+#include "usart_transport.h"
+
+/* Frames of harness_process() are placed at the end of the arena, the page behind it is inaccessible */
+#define ARENA_BASE_ADDR         0x30000000U
+#define ARENA_SIZE              4096U
+
+/* Longest harness_exchange() may wait for a frame the host never finishes */
+#define EXCHANGE_MAX_MS         10000
+
+static const policy_region_t policy_regions[] = BOARD_POLICY_REGIONS;
+
+static uint8_t *arena;
+static uint8_t supported[256];
+static uint8_t commands[256];
+static uint32_t num_of_commands;
+static harness_stats_t stats;
+
+/* State shared with the code running inside sim_run() */
+static uint8_t *current_frame;
+static uint8_t *held_buffer;
+static volatile uint8_t in_command;
+static volatile uint8_t idle;
+static uint64_t exchange_deadline;
+static harness_reply_t *current_reply;
+static uint32_t reply_start;
+
+static const uint32_t interesting_addresses[] = {
+    0x00000000U, 0x08000000U, 0x08007FFCU, 0x08008000U, 0x08008100U, 0x0800FFF0U, 0x0805FFFCU,
+    0x08060000U, 0x0807FFFFU, 0x08080000U, 0x1FFFC000U, 0x20000000U, 0x2001FFFCU, 0x20020000U,
+    0x40000000U, 0x40024000U, 0xE000E000U, 0xFFFFFFFCU,
+};
+
+static void harness_fail(const uint8_t *frame, const uint8_t *reply, uint32_t length, const char *message)
+{
+    fprintf(stderr, "harness: %s\nframe:", message);
+    for (uint32_t i = 0; i < (uint32_t)frame[0] + 1; i++)
+    {
+        fprintf(stderr, " %02X", frame[i]);
+    }
+    fprintf(stderr, "\nreply:");
+    for (uint32_t i = 0; i < length; i++)
+    {
+        fprintf(stderr, " %02X", reply[i]);
+    }
+    fprintf(stderr, "\n");
+    sim_fail("Frame check failed");
+}
+
+/* The CRC unit sees every byte of the frame as a word, see bootloader_verify_crc() */
+uint32_t harness_crc(const uint8_t *data, uint32_t length)
+{
+    uint32_t crc = 0xFFFFFFFFU;
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        crc = sim_crc_update(crc, data[i]);
+    }
+
+    return crc;
+}
+
+/* Stores the CRC of the frame in its last 4 bytes, frames without room for one are left alone */
+void harness_fix_crc(uint8_t *frame)
+{
+    uint32_t size = frame[0] + 1;
+
+    if (size >= sizeof(bl_frame_header_t) + BL_FRAME_CRC_SIZE)
+    {
+        uint32_t crc = harness_crc(frame, size - BL_FRAME_CRC_SIZE);
+        memcpy(&frame[size - BL_FRAME_CRC_SIZE], &crc, sizeof(crc));
+    }
+}
+
+/* Returns the size of the frame, length byte and CRC included */
+uint32_t harness_build_frame(uint8_t *frame, uint8_t command, const void *fields, uint32_t fields_length)
+{
+    frame[0] = sizeof(bl_frame_header_t) + fields_length + BL_FRAME_CRC_SIZE - 1;
+    frame[1] = command;
+    if (fields_length != 0)
+    {
+        memcpy(&frame[2], fields, fields_length);
+    }
+    harness_fix_crc(frame);
+
+    return frame[0] + 1;
+}
+
+uint8_t harness_command_supported(uint8_t command)
+{
+    return supported[command];
+}
+
+const harness_stats_t *harness_get_stats(void)
+{
+    return &stats;
+}
+
+/* Bootloader side */
+
+/* main() up to the interactive mode, without the transports other than USART2 */
+static void boot_entry(void)
+{
+    boot_request_take();
+    boot_log_start();
+    init_gpio();
+    init_usart3();
+    init_crc();
+    usart_transport_init();
+    supervisor_init();
+    power_init();
+#ifdef BL_CMD_ENABLE_STAGE
+    qspi_init();
+#endif
+}
+
+/* The watchdog is kicked as by bootloader_wait_for_data() in front of every received frame */
+static void process_entry(void)
+{
+    supervisor_kick();
+    in_command = 1;
+    bootloader_process_frame(current_frame);
+    in_command = 0;
+}
+
+static void take_reply(void)
+{
+    uint32_t length = current_reply->length;
+
+    current_reply->length += sim_uart_take(&current_reply->data[length], HARNESS_REPLY_MAX_SIZE - length);
+}
+
+static void check_frame_reply(uint8_t jumped)
+{
+    take_reply();
+    harness_check_reply(current_frame, &current_reply->data[reply_start], current_reply->length - reply_start, jumped);
+    reply_start = current_reply->length;
+    stats.frames++;
+}
+
+/* The receive loop of bootloader_start_interactive_mode() without the session timeout */
+static void exchange_entry(void)
+{
+    while (1)
+    {
+        idle = 1;
+        bootloader_wait_for_data(0);
+        idle = 0;
+
+        held_buffer = pool_acquire();
+        if (held_buffer == NULL)
+        {
+            sim_fail("No packet buffer left between frames");
+        }
+
+        current_frame = bootloader_receive_frame(held_buffer);
+        if (current_frame != NULL)
+        {
+            in_command = 1;
+            bootloader_process_frame(current_frame);
+            in_command = 0;
+            check_frame_reply(0);
+        }
+
+        pool_release(held_buffer);
+        held_buffer = NULL;
+    }
+}
+
+/* Stops the exchange once the bootloader waits for a frame and the host has nothing left to send */
+static void exchange_watch(void *arg)
+{
+    if (sim_uart_pending() == 0 && !in_command && (idle || sim_cycles() >= exchange_deadline))
+    {
+        sim_stop();
+    }
+
+    sim_schedule(SIM_MS(1), exchange_watch, NULL);
+}
+
+static uint8_t executable(uint32_t address)
+{
+    for (uint32_t i = 0; i < sizeof(policy_regions) / sizeof(policy_regions[0]); i++)
+    {
+        if (address >= policy_regions[i].start_address && address < policy_regions[i].end_address)
+        {
+            return (policy_regions[i].permissions & POLICY_EXECUTE) != 0;
+        }
+    }
+
+    return 0;
+}
+
+static void harness_run(void (*entry)(void), harness_reply_t *reply)
+{
+    uint32_t in_use = pool_get_stats()->in_use;
+
+    current_reply = reply;
+    reply->length = 0;
+    reply_start = 0;
+
+    reply->result = sim_run(entry);
+
+    if (reply->result == SIM_JUMPED)
+    {
+        const sim_jump_t *jump = sim_last_jump();
+        uint32_t target = jump->started ? jump->vtor : jump->address & ~1U;
+
+        if (!in_command)
+        {
+            sim_fail("Jump to 0x%08X outside of a command", jump->address);
+        }
+        if (!executable(target))
+        {
+            sim_fail("Jump to 0x%08X, outside the executable regions of the policy", target);
+        }
+        stats.jumps++;
+    }
+
+    if (in_command || entry == process_entry)
+    {
+        check_frame_reply(reply->result == SIM_JUMPED);
+    }
+    in_command = 0;
+
+    if (held_buffer != NULL)
+    {
+        pool_release(held_buffer);
+        held_buffer = NULL;
+    }
+    if (pool_get_stats()->in_use != in_use)
+    {
+        sim_fail("%u packet buffers leaked", pool_get_stats()->in_use - in_use);
+    }
+
+    if (reply->result == SIM_JUMPED)
+    {
+        harness_boot();
+    }
+}
+
+void harness_boot(void)
+{
+    sim_reset();
+    if (sim_run(boot_entry) != SIM_RETURNED)
+    {
+        sim_fail("Bootloader did not start");
+    }
+
+    supervisor_set_timeouts(HARNESS_BYTE_TIMEOUT_MS, 0);
+    stats.boots++;
+}
+
+void harness_init(void)
+{
+    uint8_t frame[HARNESS_FRAME_MAX_SIZE];
+    harness_reply_t reply;
+
+    if (arena != NULL)
+    {
+        return;
+    }
+
+    sim_init();
+
+    arena = mmap((void *)(uintptr_t)ARENA_BASE_ADDR, 2 * ARENA_SIZE, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (arena != (uint8_t *)(uintptr_t)ARENA_BASE_ADDR || mprotect(arena + ARENA_SIZE, ARENA_SIZE, PROT_NONE) != 0)
+    {
+        sim_fail("Cannot map the frame arena");
+    }
+
+    /* The bootloader must never modify its own sectors */
+    sim_flash_guard(BOARD_FLASH_BASE_ADDR, BOARD_APP_BASE_ADDR);
+#ifdef BOARD_BL_UART_RTS_PIN
+    sim_uart_set_rts(BOARD_BL_UART_RTS_PORT, BOARD_BL_UART_RTS_PIN);
+#endif
+
+    harness_boot();
+
+    /* The commands compiled in are taken from BL_GET_HELP */
+    supported[BL_GET_HELP] = 1;
+    harness_build_frame(frame, BL_GET_HELP, NULL, 0);
+    harness_process(frame, &reply);
+
+    for (uint32_t i = 2; i < reply.length; i++)
+    {
+        supported[reply.data[i]] = 1;
+        commands[num_of_commands++] = reply.data[i];
+    }
+}
+
+void harness_process(const uint8_t *frame, harness_reply_t *reply)
+{
+    uint32_t size = frame[0] + 1;
+    uint32_t offset = bootloader_frame_offset(frame[1]);
+
+    if (frame[0] == 0)
+    {
+        sim_fail("bootloader_receive_frame() never returns an empty frame");
+    }
+
+    /* Right at the end of the arena, unless the payload is programmed and word aligned as in a pool buffer */
+    if (frame[1] != BL_MEM_WRITE && frame[1] != BL_MCAST_DATA)
+    {
+        current_frame = arena + ARENA_SIZE - size;
+    }
+    else
+    {
+        current_frame = arena + ((ARENA_SIZE - size - offset) & ~3U) + offset;
+    }
+    memcpy(current_frame, frame, size);
+
+    harness_run(process_entry, reply);
+}
+
+void harness_exchange(const uint8_t *data, uint32_t length, harness_reply_t *reply)
+{
+    /* A BL_SET_TIMEOUTS of an earlier exchange must not make this one wait for seconds */
+    supervisor_set_timeouts(HARNESS_BYTE_TIMEOUT_MS, 0);
+
+    sim_uart_send(data, length);
+    exchange_deadline = sim_cycles() + SIM_MS(EXCHANGE_MAX_MS);
+    sim_schedule(SIM_MS(1), exchange_watch, NULL);
+
+    harness_run(exchange_entry, reply);
+}
+
+/* Reply rules */
+
+static uint8_t frame_crc_valid(const uint8_t *frame)
+{
+    uint32_t size = frame[0] + 1;
+    uint32_t crc;
+
+    if (size < sizeof(bl_frame_header_t) + BL_FRAME_CRC_SIZE)
+    {
+        return 0;
+    }
+
+    memcpy(&crc, &frame[size - BL_FRAME_CRC_SIZE], sizeof(crc));
+    return crc == harness_crc(frame, size - BL_FRAME_CRC_SIZE);
+}
+
+void harness_check_reply(const uint8_t *frame, const uint8_t *reply, uint32_t length, uint8_t jumped)
+{
+    uint8_t command = frame[1];
+
+    /* Multicast data frames are never answered, whatever is wrong with them */
+    if (command == BL_MCAST_DATA)
+    {
+        if (length != 0 || jumped)
+        {
+            harness_fail(frame, reply, length, "BL_MCAST_DATA answered");
+        }
+        return;
+    }
+
+    if (!frame_crc_valid(frame) || frame[0] < bootloader_frame_min_length(command))
+    {
+        if (length != 1 || reply[0] != BL_NACK || jumped)
+        {
+            harness_fail(frame, reply, length, "Bad or short frame not answered with a NACK");
+        }
+        return;
+    }
+
+    if (!supported[command])
+    {
+        if (length != 0 || jumped)
+        {
+            harness_fail(frame, reply, length, "Unknown command answered");
+        }
+        return;
+    }
+
+    if (length < 2 || reply[0] != BL_ACK || length != 2U + reply[1])
+    {
+        harness_fail(frame, reply, length, "Reply is not an ACK with the announced length");
+    }
+
+    if (command == BL_JMP_ADDR && reply[2] != (jumped ? VALID_ADDR : INVALID_ADDR))
+    {
+        harness_fail(frame, reply, length, jumped ? "Jumped without a VALID_ADDR reply" : "Valid jump address not jumped to");
+    }
+    if (command != BL_JMP_ADDR && jumped)
+    {
+        harness_fail(frame, reply, length, "Jump outside BL_JMP_ADDR");
+    }
+}
+
+/* Random frames */
+
+uint32_t harness_random(uint32_t *seed)
+{
+    uint32_t x = *seed != 0 ? *seed : 0x9E3779B9U;
+
+    /* xorshift32 */
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *seed = x;
+
+    return x;
+}
+
+static uint32_t random_address(uint32_t *seed)
+{
+    uint32_t r = harness_random(seed);
+
+    if (r % 4 == 0)
+    {
+        return harness_random(seed);
+    }
+
+    return interesting_addresses[(r >> 8) % (sizeof(interesting_addresses) / sizeof(interesting_addresses[0]))] +
+           ((r >> 24) % 2 ? ((r >> 16) & 0xFC) : 0);
+}
+
+static void put32(uint8_t *field, uint32_t value)
+{
+    memcpy(field, &value, sizeof(value));
+}
+
+/*
+ * Writes a random frame, mostly well formed commands with fields around the interesting
+ * addresses, sometimes too short or long, with a bad CRC or an unknown command.
+ * Returns the size of the frame.
+ */
+uint32_t harness_random_frame(uint32_t *seed, uint8_t *frame)
+{
+    uint32_t r = harness_random(seed);
+    uint8_t command;
+
+    do
+    {
+        command = r % 16 == 0 ? (uint8_t)(r >> 4) : commands[(r >> 4) % num_of_commands];
+        r = harness_random(seed);
+        /* Hashing the FLASH takes long, keep it rare */
+    } while (command == BL_GET_MANIFEST && r % 32 != 0);
+
+    uint32_t min_length = bootloader_frame_min_length(command);
+    uint32_t length = min_length;
+
+    switch (r % 16)
+    {
+    case 0:
+        length = 1 + (r >> 8) % 255;
+        break;
+    case 1:
+        length = min_length > 1 + (r >> 8) % 4 ? min_length - 1 - (r >> 8) % 4 : 1;
+        break;
+    default:
+        if (command == BL_MEM_WRITE || command == BL_MCAST_DATA || command == BL_BATCH)
+        {
+            length = min_length + (r >> 8) % (256 - min_length);
+        }
+        break;
+    }
+
+    frame[0] = (uint8_t)length;
+    frame[1] = command;
+    for (uint32_t i = 2; i <= length; i++)
+    {
+        frame[i] = (uint8_t)harness_random(seed);
+    }
+
+    /* Plausible fields, as far as the frame holds them */
+    uint8_t fields[HARNESS_FRAME_MAX_SIZE];
+    memcpy(fields, frame, sizeof(fields));
+
+    switch (command)
+    {
+    case BL_JMP_ADDR:
+    case BL_MEM_READ:
+    case BL_MCAST_START:
+        put32(&fields[2], random_address(seed));
+        if (command == BL_MEM_READ)
+        {
+            fields[6] = harness_random(seed) % 8 == 0 ? fields[6] : fields[6] % 32;
+        }
+        if (command == BL_MCAST_START)
+        {
+            fields[6] = harness_random(seed) % 8;
+            fields[7] = 0;
+        }
+        break;
+    case BL_MEM_WRITE:
+        put32(&fields[2], random_address(seed));
+        if (harness_random(seed) % 8 != 0)
+        {
+            fields[6] = length > min_length ? length - min_length : 0;
+        }
+        break;
+    case BL_FLASH_ERASE:
+        fields[2] = harness_random(seed) % 16 == 0 ? 0xFF : harness_random(seed) % 10;
+        fields[3] = harness_random(seed) % 4;
+        break;
+    case BL_MCAST_DATA:
+        fields[2] = harness_random(seed) % 8;
+        fields[3] = 0;
+        break;
+    case BL_SESSION_BEGIN:
+        put32(&fields[6], random_address(seed));
+        put32(&fields[10], harness_random(seed) % 0x10000);
+        break;
+    case BL_SET_TIMEOUTS:
+        put32(&fields[2], harness_random(seed) % 100);
+        put32(&fields[6], harness_random(seed) % 2 ? 0 : harness_random(seed) % 1000);
+        break;
+    case BL_GET_MANIFEST:
+        fields[2] = harness_random(seed) % 8 == 0 ? MANIFEST_FLAG_REHASH : 0;
+        break;
+    case BL_BATCH:
+        /* A few well formed sub-frames, the rest of the frame stays random */
+        for (uint32_t offset = 2; length >= 3 && offset + 7 <= length - 3; )
+        {
+            uint8_t sub_command = commands[harness_random(seed) % num_of_commands];
+            uint8_t sub[HARNESS_FRAME_MAX_SIZE];
+            uint32_t sub_size;
+
+            if (sub_command == BL_GET_MANIFEST || sub_command == BL_MEM_WRITE)
+            {
+                break;
+            }
+            sub_size = harness_build_frame(sub, sub_command, &fields[offset + 2],
+                                           bootloader_frame_min_length(sub_command) + 1 - 6);
+            if (offset + sub_size > length - 3)
+            {
+                break;
+            }
+            memcpy(&fields[offset], sub, sub_size);
+            offset += sub_size;
+        }
+        break;
+    default:
+        break;
+    }
+
+    memcpy(&frame[2], &fields[2], length - 1);
+
+    if (harness_random(seed) % 16 != 0)
+    {
+        harness_fix_crc(frame);
+    }
+
+    return length + 1;
+}
@@ -0,0 +1,51 @@
+#ifndef __HARNESS_H__
+#define __HARNESS_H__
+
+#include <stdint.h>
+#include "sim.h"
+
+/*
+ * Runs the bootloader on the simulator of tests/sim and checks what it does with host frames.
+ *
+ * harness_process() hands a frame straight to bootloader_process_frame(), placed in a buffer
+ * that ends right in front of an inaccessible page, so reading past the frame ends the test.
+ * harness_exchange() sends bytes over the simulated USART2 to a receive loop like the one of
+ * the interactive mode and collects everything the bootloader sends back.
+ *
+ * Both check every reply against the rules of the protocol and that the bootloader did not
+ * leak a packet buffer or jump outside the executable regions of the policy. Writes to FLASH
+ * and SRAM outside the FLASH driver, accesses outside the simulated memory and FLASH writes
+ * or erases of the bootloader itself end the test in the simulator.
+ */
+#define HARNESS_FRAME_MAX_SIZE      256         // Length byte + 255 bytes
+#define HARNESS_REPLY_MAX_SIZE      4096
+#define HARNESS_BYTE_TIMEOUT_MS     10
+
+typedef struct
+{
+    uint8_t data[HARNESS_REPLY_MAX_SIZE];
+    uint32_t length;
+    int result;                 // Of sim_run(): SIM_RETURNED, SIM_JUMPED or SIM_STOPPED
+} harness_reply_t;
+
+typedef struct
+{
+    uint64_t frames;
+    uint64_t jumps;
+    uint64_t boots;
+} harness_stats_t;
+
+void harness_init(void);
+void harness_boot(void);
+uint32_t harness_crc(const uint8_t *data, uint32_t length);
+void harness_fix_crc(uint8_t *frame);
+uint32_t harness_build_frame(uint8_t *frame, uint8_t command, const void *fields, uint32_t fields_length);
+void harness_process(const uint8_t *frame, harness_reply_t *reply);
+void harness_exchange(const uint8_t *data, uint32_t length, harness_reply_t *reply);
+void harness_check_reply(const uint8_t *frame, const uint8_t *reply, uint32_t length, uint8_t jumped);
+uint8_t harness_command_supported(uint8_t command);
+uint32_t harness_random(uint32_t *seed);
+uint32_t harness_random_frame(uint32_t *seed, uint8_t *frame);
+const harness_stats_t *harness_get_stats(void);
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef __STM32F446XX_H__
+#define __STM32F446XX_H__
+
+#include <stdint.h>
+
+/*
+ * Host stand-in for the device header of the driver library. The register blocks sit at
+ * their real addresses, which the simulator maps into the test process, see sim.h.
+ */
+#define __vo volatile
+
+#define FLASH_BASE_ADDR         0x08000000U
+#define FLASH_END_ADDR          0x0807FFFFU
+#define SRAM1_BASE_ADDR         0x20000000U
+#define SRAM2_BASE_ADDR         0x2001C000U
+#define OPTION_BYTES_BASE_ADDR  0x1FFFC000U
+
+#define APB1PERIPH_BASE_ADDR    0x40000000U
+#define APB2PERIPH_BASE_ADDR    0x40010000U
+#define AHB1PERIPH_BASE_ADDR    0x40020000U
+
+#define GPIOA_BASE_ADDR         (AHB1PERIPH_BASE_ADDR + 0x0000)
+#define GPIOB_BASE_ADDR         (AHB1PERIPH_BASE_ADDR + 0x0400)
+#define GPIOC_BASE_ADDR         (AHB1PERIPH_BASE_ADDR + 0x0800)
+#define GPIOD_BASE_ADDR         (AHB1PERIPH_BASE_ADDR + 0x0C00)
+#define GPIOE_BASE_ADDR         (AHB1PERIPH_BASE_ADDR + 0x1000)
+#define CRC_BASE_ADDR           (AHB1PERIPH_BASE_ADDR + 0x3000)
+#define RCC_BASE_ADDR           (AHB1PERIPH_BASE_ADDR + 0x3800)
+#define USART2_BASE_ADDR        (APB1PERIPH_BASE_ADDR + 0x4400)
+#define USART3_BASE_ADDR        (APB1PERIPH_BASE_ADDR + 0x4800)
+#define USART1_BASE_ADDR        (APB2PERIPH_BASE_ADDR + 0x1000)
+#define DBGMCU_BASE_ADDR        0xE0042000U
+
+typedef struct
+{
+    __vo uint32_t MODER;
+    __vo uint32_t OTYPER;
+    __vo uint32_t OSPEEDR;
+    __vo uint32_t PUPDR;
+    __vo uint32_t IDR;
+    __vo uint32_t ODR;
+    __vo uint32_t BSRR;
+    __vo uint32_t LCKR;
+    __vo uint32_t AFR[2];
+} GPIO_RegDef_t;
+
+typedef struct
+{
+    __vo uint32_t CR;
+    __vo uint32_t PLLCFGR;
+    __vo uint32_t CFGR;
+    __vo uint32_t CIR;
+    __vo uint32_t AHB1RSTR;
+    __vo uint32_t AHB2RSTR;
+    __vo uint32_t AHB3RSTR;
+    uint32_t RESERVED0;
+    __vo uint32_t APB1RSTR;
+    __vo uint32_t APB2RSTR;
+    uint32_t RESERVED1[2];
+    __vo uint32_t AHB1ENR;
+    __vo uint32_t AHB2ENR;
+    __vo uint32_t AHB3ENR;
+    uint32_t RESERVED2;
+    __vo uint32_t APB1ENR;
+    __vo uint32_t APB2ENR;
+    uint32_t RESERVED3[2];
+    __vo uint32_t AHB1LPENR;
+    __vo uint32_t AHB2LPENR;
+    __vo uint32_t AHB3LPENR;
+    uint32_t RESERVED4;
+    __vo uint32_t APB1LPENR;
+    __vo uint32_t APB2LPENR;
+    uint32_t RESERVED5[2];
+    __vo uint32_t BDCR;
+    __vo uint32_t CSR;
+    uint32_t RESERVED6[2];
+    __vo uint32_t SSCGR;
+    __vo uint32_t PLLI2SCFGR;
+    __vo uint32_t PLLSAICFGR;
+    __vo uint32_t DCKCFGR;
+    __vo uint32_t CKGATENR;
+    __vo uint32_t DCKCFGR2;
+} RCC_RegDef_t;
+
+typedef struct
+{
+    __vo uint32_t SR;
+    __vo uint32_t DR;
+    __vo uint32_t BRR;
+    __vo uint32_t CR1;
+    __vo uint32_t CR2;
+    __vo uint32_t CR3;
+    __vo uint32_t GTPR;
+} USART_RegDef_t;
+
+typedef struct
+{
+    __vo uint32_t DR;
+    __vo uint32_t IDR;
+    __vo uint32_t CR;
+} CRC_RegDef_t;
+
+typedef struct
+{
+    __vo uint32_t IDCODE;
+    __vo uint32_t CR;
+    __vo uint32_t APB1FZ;
+    __vo uint32_t APB2FZ;
+} DBGMCU_RegDef_t;
+
+#define GPIOA                   ((GPIO_RegDef_t *)GPIOA_BASE_ADDR)
+#define GPIOB                   ((GPIO_RegDef_t *)GPIOB_BASE_ADDR)
+#define GPIOC                   ((GPIO_RegDef_t *)GPIOC_BASE_ADDR)
+#define GPIOD                   ((GPIO_RegDef_t *)GPIOD_BASE_ADDR)
+#define GPIOE                   ((GPIO_RegDef_t *)GPIOE_BASE_ADDR)
+#define RCC                     ((RCC_RegDef_t *)RCC_BASE_ADDR)
+#define USART1                  ((USART_RegDef_t *)USART1_BASE_ADDR)
+#define USART2                  ((USART_RegDef_t *)USART2_BASE_ADDR)
+#define USART3                  ((USART_RegDef_t *)USART3_BASE_ADDR)
+#define CRC                     ((CRC_RegDef_t *)CRC_BASE_ADDR)
+#define DBGMCU                  ((DBGMCU_RegDef_t *)DBGMCU_BASE_ADDR)
+
+#define CRC_CLK_ENABLE()        (RCC->AHB1ENR |= (1 << 12))
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef __STM32F446XX_CRC_H__
+#define __STM32F446XX_CRC_H__
+
+#include "stm32f446xx.h"
+
+/* Host stand-in for the CRC driver, the CRC unit itself is simulated in sim_periph.c */
+#define CRC_CR_RESET            0
+
+uint32_t crc_accumulate(CRC_RegDef_t *crcx, uint32_t *data, uint32_t length);
+
+#endif
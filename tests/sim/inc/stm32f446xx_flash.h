@@ -0,0 +1,30 @@
+#ifndef __STM32F446XX_FLASH_H__
+#define __STM32F446XX_FLASH_H__
+
+#include "stm32f446xx.h"
+
+/* Host stand-in for the FLASH driver, implemented in sim_flash.c */
+#define FLASH_SUCCESS               0
+#define FLASH_FAIL                  1
+
+#define FLASH_SECTOR_0_NUMBER       0
+#define FLASH_SECTOR_7_NUMBER       7
+
+#define FLASH_SECTOR_0_BASE_ADDR    0x08000000U
+#define FLASH_SECTOR_1_BASE_ADDR    0x08004000U
+#define FLASH_SECTOR_2_BASE_ADDR    0x08008000U
+#define FLASH_SECTOR_3_BASE_ADDR    0x0800C000U
+#define FLASH_SECTOR_4_BASE_ADDR    0x08010000U
+#define FLASH_SECTOR_5_BASE_ADDR    0x08020000U
+#define FLASH_SECTOR_6_BASE_ADDR    0x08040000U
+#define FLASH_SECTOR_7_BASE_ADDR    0x08060000U
+
+void flash_init(void);
+void flash_write(uint32_t address, uint8_t *data, uint32_t length);
+uint8_t flash_read(uint32_t address, uint8_t *data, uint32_t length);
+void flash_sector_erase(uint8_t sector_number);
+void flash_mass_erase(void);
+void flash_set_protection_level(uint8_t protection_level, uint8_t sectors);
+void flash_get_protection_level(uint8_t *protection_levels);
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef __STM32F446XX_GPIO_H__
+#define __STM32F446XX_GPIO_H__
+
+#include "stm32f446xx.h"
+
+/* Host stand-in for the GPIO driver, implemented in sim_periph.c */
+typedef struct
+{
+    uint8_t pin_number;
+    uint8_t pin_mode;
+    uint8_t pin_speed;
+    uint8_t pin_pupd;
+    uint8_t pin_output_type;
+    uint8_t pin_alt_func;
+} gpio_config_t;
+
+typedef struct
+{
+    GPIO_RegDef_t *gpiox;
+    gpio_config_t config;
+} gpio_handle_t;
+
+#define GPIO_MODE_INPUT         0
+#define GPIO_MODE_OUTPUT        1
+#define GPIO_MODE_ALT_FUNC      2
+#define GPIO_MODE_ANALOG        3
+
+#define GPIO_OUTPUT_PUSH_PULL   0
+#define GPIO_OUTPUT_OPEN_DRAIN  1
+
+#define GPIO_NO_PUPD            0
+#define GPIO_PULL_UP            1
+#define GPIO_PULL_DOWN          2
+
+#define GPIO_SPEED_LOW          0
+#define GPIO_SPEED_MEDIUM       1
+#define GPIO_SPEED_FAST         2
+#define GPIO_SPEED_HIGH         3
+
+#define GPIO_PIN_0              0
+#define GPIO_PIN_1              1
+#define GPIO_PIN_2              2
+#define GPIO_PIN_3              3
+#define GPIO_PIN_4              4
+#define GPIO_PIN_5              5
+#define GPIO_PIN_6              6
+#define GPIO_PIN_7              7
+#define GPIO_PIN_8              8
+#define GPIO_PIN_9              9
+#define GPIO_PIN_10             10
+#define GPIO_PIN_11             11
+#define GPIO_PIN_12             12
+#define GPIO_PIN_13             13
+#define GPIO_PIN_14             14
+#define GPIO_PIN_15             15
+
+#define GPIO_ALT_FUNC_0         0
+#define GPIO_ALT_FUNC_1         1
+#define GPIO_ALT_FUNC_2         2
+#define GPIO_ALT_FUNC_3         3
+#define GPIO_ALT_FUNC_4         4
+#define GPIO_ALT_FUNC_5         5
+#define GPIO_ALT_FUNC_6         6
+#define GPIO_ALT_FUNC_7         7
+#define GPIO_ALT_FUNC_8         8
+#define GPIO_ALT_FUNC_9         9
+#define GPIO_ALT_FUNC_10        10
+#define GPIO_ALT_FUNC_11        11
+#define GPIO_ALT_FUNC_12        12
+
+#define GPIO_PIN_LOW            0
+#define GPIO_PIN_HIGH           1
+
+void gpio_init(gpio_handle_t *gpio_handle);
+uint8_t gpio_read_pin(GPIO_RegDef_t *gpiox, uint8_t pin_number);
+
+#endif
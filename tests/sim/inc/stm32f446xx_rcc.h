@@ -0,0 +1,6 @@
+#ifndef __STM32F446XX_RCC_H__
+#define __STM32F446XX_RCC_H__
+
+#include "stm32f446xx.h"
+
+#endif
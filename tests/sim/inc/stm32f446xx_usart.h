@@ -0,0 +1,49 @@
+#ifndef __STM32F446XX_USART_H__
+#define __STM32F446XX_USART_H__
+
+#include "stm32f446xx.h"
+
+/* Host stand-in for the USART driver, implemented in sim_uart.c */
+typedef struct
+{
+    uint8_t mode;
+    uint32_t baudrate;
+    uint8_t word_length;
+    uint8_t parity;
+    uint8_t stop_bits;
+    uint8_t hw_flow_control;
+} usart_config_t;
+
+typedef struct
+{
+    USART_RegDef_t *usartx;
+    usart_config_t config;
+} usart_handle_t;
+
+#define USART_MODE_TX                   0
+#define USART_MODE_RX                   1
+#define USART_MODE_TX_RX                2
+
+#define USART_BAUDRATE_9600             9600
+#define USART_BAUDRATE_115200           115200
+
+#define USART_WORD_LENGTH_8BITS         0
+#define USART_WORD_LENGTH_9BITS         1
+
+#define USART_PARITY_NONE               0
+#define USART_PARITY_EVEN               1
+#define USART_PARITY_ODD                2
+
+#define USART_STOP_BITS_1               0
+#define USART_STOP_BITS_2               2
+
+#define USART_HW_FLOW_CONTROL_NONE      0
+#define USART_HW_FLOW_CONTROL_CTS       1
+#define USART_HW_FLOW_CONTROL_RTS       2
+#define USART_HW_FLOW_CONTROL_CTS_RTS   3
+
+void usart_init(usart_handle_t *usart_handle);
+void usart_transmit(usart_handle_t *usart_handle, uint8_t *tx_buffer, uint32_t length);
+void usart_receive(usart_handle_t *usart_handle, uint8_t *rx_buffer, uint32_t length);
+
+#endif
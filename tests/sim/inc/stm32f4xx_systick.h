@@ -0,0 +1,6 @@
+#ifndef __STM32F4XX_SYSTICK_H__
+#define __STM32F4XX_SYSTICK_H__
+
+#include "stm32f446xx.h"
+
+#endif
@@ -0,0 +1,1096 @@
+#define _GNU_SOURCE
+#include <setjmp.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include "sim.h"
+#include "sim_core.h"
+
+#define SIM_PAGE_SIZE           4096U
+#define SIM_MAX_BLOCKS          16
+#define SIM_MAX_PERIPHERALS     32
+#define SIM_MAX_EVENTS          64
+#define SIM_IRQ_STORM_LIMIT     100000
+
+#define X86_PF_WRITE            (1U << 1)
+#define X86_PF_INSTRUCTION      (1U << 4)
+#define X86_EFLAGS_TF           (1U << 8)
+
+/* Cortex-M4 system control space (ARMv7-M ARM, B3) */
+#define SCS_BASE_ADDR           0xE000E000U
+#define SYST_CSR_ADDR           0xE000E010U
+#define SYST_RVR_ADDR           0xE000E014U
+#define SYST_CVR_ADDR           0xE000E018U
+#define NVIC_ISER_ADDR          0xE000E100U
+#define NVIC_ICER_ADDR          0xE000E180U
+#define NVIC_ISPR_ADDR          0xE000E200U
+#define NVIC_ICPR_ADDR          0xE000E280U
+#define NVIC_NUM_OF_WORDS       ((SIM_NUM_OF_IRQS + 31) / 32)
+#define SCB_ICSR_ADDR           0xE000ED04U
+#define SCB_VTOR_ADDR           0xE000ED08U
+#define SCB_SCR_ADDR            0xE000ED10U
+#define DWT_BASE_ADDR           0xE0001000U
+#define DWT_CTRL_ADDR           0xE0001000U
+#define DWT_CYCCNT_ADDR         0xE0001004U
+#define DBGMCU_IDCODE_ADDR      0xE0042000U
+
+#define SYST_CSR_ENABLE         (1U << 0)
+#define SYST_CSR_TICKINT        (1U << 1)
+#define SYST_CSR_COUNTFLAG      (1U << 16)
+#define SCB_ICSR_PENDSTCLR      (1U << 25)
+#define SCB_SCR_SEVONPEND       (1U << 4)
+#define DWT_CTRL_CYCCNTENA      (1U << 0)
+#define DBGMCU_IDCODE_F446      0x10006421U     // Revision A, device 0x421
+
+typedef struct
+{
+    uint32_t base_address;
+    uint32_t size;
+    uint8_t kind;
+    const char *name;
+    uint8_t *alias;
+} sim_block_t;
+
+typedef struct
+{
+    uint64_t at;
+    void (*callback)(void *arg);
+    void *arg;
+} sim_event_t;
+
+/* Decoded x86-64 load or store, see sim_decode() */
+#define SIM_OPERAND_IMMEDIATE   0xFF
+#define SIM_EXTEND_MERGE        0       // 8 and 16 bit destinations keep the upper bits
+#define SIM_EXTEND_ZERO         1
+#define SIM_EXTEND_SIGN         2
+
+typedef struct
+{
+    uint8_t length;
+    uint8_t size;
+    uint8_t store;
+    uint8_t operand;            // x86 register number or SIM_OPERAND_IMMEDIATE
+    uint8_t high_byte;          // AH, CH, DH or BH
+    uint8_t extend;
+    uint8_t wide;               // 64-bit destination
+    uint32_t immediate;
+} sim_insn_t;
+
+/* Vectors of the handlers the bootloader may define, the rest stay NULL */
+void SysTick_Handler(void) __attribute__((weak));
+void SPI2_IRQHandler(void) __attribute__((weak));
+void USART2_IRQHandler(void) __attribute__((weak));
+void EXTI15_10_IRQHandler(void) __attribute__((weak));
+void OTG_FS_IRQHandler(void) __attribute__((weak));
+
+static void (*const vectors[SIM_NUM_OF_IRQS])(void) = {
+    [36] = SPI2_IRQHandler,
+    [38] = USART2_IRQHandler,
+    [40] = EXTI15_10_IRQHandler,
+    [67] = OTG_FS_IRQHandler,
+};
+
+/* Linker script symbols referenced by main() */
+uint32_t _stack_guard;
+uint32_t _stack_guard_size;
+
+static const int gregs_index[16] = {
+    REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+    REG_R8, REG_R9, REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15,
+};
+
+static sim_block_t blocks[SIM_MAX_BLOCKS];
+static uint32_t num_of_blocks;
+static const sim_peripheral_t *peripherals[SIM_MAX_PERIPHERALS];
+static uint32_t num_of_peripherals;
+static uint8_t initialized;
+
+static uint64_t now;
+static sim_event_t events[SIM_MAX_EVENTS];
+static uint32_t num_of_events;
+
+static uint32_t nvic_enabled[NVIC_NUM_OF_WORDS];
+static uint32_t nvic_pending[NVIC_NUM_OF_WORDS];
+static uint32_t nvic_level[NVIC_NUM_OF_WORDS];
+static uint8_t systick_pending;
+static uint64_t systick_next;
+static uint64_t cyccnt_start;
+static uint8_t primask;
+static uint8_t wake_event;
+static uint32_t handler_depth;
+static uint32_t stall_depth;
+
+static sigjmp_buf run_env;
+static uint8_t running;
+static sim_jump_t last_jump;
+static sim_stats_t stats;
+
+/* State of an access that could not be decoded and is single stepped instead */
+static struct
+{
+    uint8_t active;
+    uintptr_t page;
+    uint32_t snapshot[SIM_PAGE_SIZE / 4];
+} step;
+
+void sim_fail(const char *format, ...)
+{
+    va_list args;
+
+    fflush(stdout);
+    fprintf(stderr, "sim: ");
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fprintf(stderr, " [cycle %llu]\n", (unsigned long long)now);
+    abort();
+}
+
+static const sim_block_t *sim_find_block(uintptr_t address)
+{
+    for (uint32_t i = 0; i < num_of_blocks; i++)
+    {
+        if (address - blocks[i].base_address < blocks[i].size)
+        {
+            return &blocks[i];
+        }
+    }
+
+    return NULL;
+}
+
+void sim_map(uint32_t base_address, uint32_t size, uint8_t kind, const char *name)
+{
+    int prot = kind == SIM_BLOCK_MEMORY ? PROT_READ : kind == SIM_BLOCK_RAM ? PROT_READ | PROT_WRITE : PROT_NONE;
+    int fd = memfd_create(name, 0);
+
+    if (num_of_blocks == SIM_MAX_BLOCKS || fd < 0 || ftruncate(fd, size) != 0)
+    {
+        sim_fail("Cannot create %s", name);
+    }
+
+    /* Both views share the pages, the alias is how the models change them */
+    void *view = mmap((void *)(uintptr_t)base_address, size, prot, MAP_SHARED | MAP_FIXED_NOREPLACE, fd, 0);
+    void *alias = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (view != (void *)(uintptr_t)base_address || alias == MAP_FAILED)
+    {
+        sim_fail("Cannot map %s at 0x%08X, build the tests with -no-pie", name, base_address);
+    }
+
+    blocks[num_of_blocks++] = (sim_block_t){ base_address, size, kind, name, alias };
+}
+
+void sim_add_peripheral(const sim_peripheral_t *peripheral)
+{
+    if (num_of_peripherals == SIM_MAX_PERIPHERALS)
+    {
+        sim_fail("Too many peripheral models");
+    }
+
+    peripherals[num_of_peripherals++] = peripheral;
+}
+
+static const sim_peripheral_t *sim_find_peripheral(uint32_t address)
+{
+    static const sim_peripheral_t *last;
+
+    if (last != NULL && address - last->base_address < last->size)
+    {
+        return last;
+    }
+
+    for (uint32_t i = 0; i < num_of_peripherals; i++)
+    {
+        if (address - peripherals[i]->base_address < peripherals[i]->size)
+        {
+            last = peripherals[i];
+            return last;
+        }
+    }
+
+    return NULL;
+}
+
+uint8_t *sim_mem(uint32_t address)
+{
+    const sim_block_t *block = sim_find_block(address);
+
+    if (block == NULL)
+    {
+        sim_fail("0x%08X is outside the simulated memory", address);
+    }
+
+    return block->alias + (address - block->base_address);
+}
+
+uint32_t *sim_reg(uint32_t address)
+{
+    return (uint32_t *)sim_mem(address & ~3U);
+}
+
+uint8_t sim_mapped(uint32_t address, uint32_t length)
+{
+    const sim_block_t *block = sim_find_block(address);
+
+    return block != NULL && length <= block->size - (address - block->base_address);
+}
+
+uint32_t sim_read(uint32_t address)
+{
+    const sim_peripheral_t *peripheral = sim_find_peripheral(address);
+
+    if (peripheral != NULL && peripheral->read != NULL)
+    {
+        return peripheral->read(address);
+    }
+
+    return SIM_REG(address);
+}
+
+void sim_write(uint32_t address, uint32_t value)
+{
+    const sim_peripheral_t *peripheral = sim_find_peripheral(address);
+
+    if (peripheral != NULL && peripheral->write != NULL)
+    {
+        peripheral->write(address, value);
+        return;
+    }
+
+    SIM_REG(address) = value;
+}
+
+/* Word access of a bus master other than the core, returns 1 on a bus error */
+uint8_t sim_bus_read(uint32_t address, uint32_t *value)
+{
+    const sim_block_t *block = sim_find_block(address);
+
+    if (block == NULL || address % 4 != 0)
+    {
+        return 1;
+    }
+
+    *value = block->kind == SIM_BLOCK_REGISTERS ? sim_read(address) : *sim_reg(address);
+    return 0;
+}
+
+uint8_t sim_bus_write(uint32_t address, uint32_t value)
+{
+    const sim_block_t *block = sim_find_block(address);
+
+    if (block == NULL || block->kind == SIM_BLOCK_MEMORY || address % 4 != 0)
+    {
+        return 1;
+    }
+
+    if (block->kind == SIM_BLOCK_REGISTERS)
+    {
+        sim_write(address, value);
+    }
+    else
+    {
+        SIM_REG(address) = value;
+    }
+    return 0;
+}
+
+const sim_stats_t *sim_get_stats(void)
+{
+    return &stats;
+}
+
+/* Interrupts. All priorities are equal, so a handler is never preempted. */
+
+static void sim_pend(uint8_t irq_number)
+{
+    uint32_t bit = 1U << (irq_number % 32);
+
+    if (!(nvic_pending[irq_number / 32] & bit))
+    {
+        nvic_pending[irq_number / 32] |= bit;
+
+        if ((nvic_enabled[irq_number / 32] & bit) || (SIM_REG(SCB_SCR_ADDR) & SCB_SCR_SEVONPEND))
+        {
+            wake_event = 1;
+        }
+    }
+}
+
+void sim_set_irq(uint8_t irq_number, uint8_t level)
+{
+    uint32_t bit = 1U << (irq_number % 32);
+
+    if (level)
+    {
+        nvic_level[irq_number / 32] |= bit;
+        sim_pend(irq_number);
+    }
+    else
+    {
+        nvic_level[irq_number / 32] &= ~bit;
+    }
+}
+
+uint8_t sim_irq_enabled(uint8_t irq_number)
+{
+    return (nvic_enabled[irq_number / 32] >> (irq_number % 32)) & 1;
+}
+
+static int sim_next_irq(void)
+{
+    for (uint32_t i = 0; i < NVIC_NUM_OF_WORDS; i++)
+    {
+        uint32_t ready = nvic_pending[i] & nvic_enabled[i];
+
+        if (ready)
+        {
+            return i * 32 + __builtin_ctz(ready);
+        }
+    }
+
+    return -1;
+}
+
+static void sim_dispatch(void)
+{
+    uint32_t count = 0;
+
+    if (primask || handler_depth || stall_depth)
+    {
+        return;
+    }
+
+    while (1)
+    {
+        void (*handler)(void);
+        int irq_number = -1;
+
+        if (systick_pending)
+        {
+            systick_pending = 0;
+            handler = SysTick_Handler;
+        }
+        else if ((irq_number = sim_next_irq()) >= 0)
+        {
+            nvic_pending[irq_number / 32] &= ~(1U << (irq_number % 32));
+            handler = vectors[irq_number];
+        }
+        else
+        {
+            break;
+        }
+
+        if (handler == NULL)
+        {
+            sim_fail("Exception %d taken without a handler", irq_number);
+        }
+        if (++count > SIM_IRQ_STORM_LIMIT)
+        {
+            sim_fail("Interrupt storm on IRQ %d", irq_number);
+        }
+
+        handler_depth++;
+        stats.irqs++;
+        handler();
+        handler_depth--;
+        wake_event = 1;
+
+        /* A level sensitive interrupt still asserted is pended again */
+        if (irq_number >= 0 && (nvic_level[irq_number / 32] & (1U << (irq_number % 32))))
+        {
+            sim_pend(irq_number);
+        }
+    }
+}
+
+void sim_disable_irq(void)
+{
+    primask = 1;
+}
+
+void sim_enable_irq(void)
+{
+    primask = 0;
+    sim_dispatch();
+}
+
+/* Virtual clock */
+
+static uint8_t sim_systick_running(void)
+{
+    return (SIM_REG(SYST_CSR_ADDR) & SYST_CSR_ENABLE) && SIM_REG(SYST_RVR_ADDR) != 0;
+}
+
+uint64_t sim_cycles(void)
+{
+    return now;
+}
+
+static void sim_advance_to(uint64_t target, uint8_t dispatch)
+{
+    do
+    {
+        uint64_t next = target;
+
+        if (num_of_events && events[0].at < next)
+        {
+            next = events[0].at;
+        }
+        if (sim_systick_running() && systick_next < next)
+        {
+            next = systick_next;
+        }
+        if (next > now)
+        {
+            now = next;
+        }
+
+        if (sim_systick_running() && now >= systick_next)
+        {
+            systick_next += SIM_REG(SYST_RVR_ADDR) + 1;
+            SIM_REG(SYST_CSR_ADDR) |= SYST_CSR_COUNTFLAG;
+            if (SIM_REG(SYST_CSR_ADDR) & SYST_CSR_TICKINT)
+            {
+                systick_pending = 1;
+                wake_event = 1;
+            }
+        }
+
+        while (num_of_events && events[0].at <= now)
+        {
+            sim_event_t event = events[0];
+
+            memmove(&events[0], &events[1], --num_of_events * sizeof(events[0]));
+            event.callback(event.arg);
+        }
+
+        sim_watchdog_check();
+
+        if (dispatch)
+        {
+            sim_dispatch();
+        }
+    } while (now < target);
+}
+
+void sim_advance(uint64_t cycles)
+{
+    sim_advance_to(now + cycles, 1);
+}
+
+/* The core stalls, e.g. on a FLASH erase, interrupts are only taken afterwards */
+void sim_stall(uint64_t cycles)
+{
+    stall_depth++;
+    sim_advance_to(now + cycles, 0);
+    stall_depth--;
+    sim_dispatch();
+}
+
+void sim_schedule(uint64_t delay, void (*callback)(void *arg), void *arg)
+{
+    uint32_t i = num_of_events;
+
+    if (num_of_events == SIM_MAX_EVENTS)
+    {
+        sim_fail("Event queue full");
+    }
+
+    while (i > 0 && events[i - 1].at > now + delay)
+    {
+        events[i] = events[i - 1];
+        i--;
+    }
+
+    events[i] = (sim_event_t){ now + delay, callback, arg };
+    num_of_events++;
+}
+
+void sim_wfe(void)
+{
+    uint64_t start = now;
+
+    while (!wake_event)
+    {
+        uint64_t next = UINT64_MAX;
+
+        if (num_of_events)
+        {
+            next = events[0].at;
+        }
+        if (sim_systick_running() && (SIM_REG(SYST_CSR_ADDR) & SYST_CSR_TICKINT) && systick_next < next)
+        {
+            next = systick_next;
+        }
+        if (next == UINT64_MAX)
+        {
+            sim_fail("WFE with nothing left to wake the core");
+        }
+
+        sim_advance_to(next, 1);
+    }
+
+    wake_event = 0;
+    stats.cycles_asleep += now - start;
+}
+
+/* Running bootloader code */
+
+int sim_run(void (*entry)(void))
+{
+    int result;
+
+    if (running)
+    {
+        sim_fail("sim_run() called from simulated code");
+    }
+
+    result = sigsetjmp(run_env, 1);
+    if (result == 0)
+    {
+        running = 1;
+        entry();
+        result = SIM_RETURNED;
+    }
+
+    running = 0;
+    handler_depth = 0;
+    stall_depth = 0;
+    if (step.active)
+    {
+        mprotect((void *)step.page, SIM_PAGE_SIZE, PROT_NONE);
+        step.active = 0;
+    }
+
+    return result;
+}
+
+void sim_stop(void)
+{
+    if (!running)
+    {
+        sim_fail("sim_stop() outside sim_run()");
+    }
+
+    siglongjmp(run_env, SIM_STOPPED);
+}
+
+__attribute__((noreturn)) static void sim_jump(uint32_t address, uint32_t msp, uint8_t started)
+{
+    if (!running)
+    {
+        sim_fail("Jump to 0x%08X outside sim_run()", address);
+    }
+
+    last_jump.address = address;
+    last_jump.msp = msp;
+    last_jump.vtor = SIM_REG(SCB_VTOR_ADDR);
+    last_jump.started = started;
+    siglongjmp(run_env, SIM_JUMPED);
+}
+
+void sim_start_image(uint32_t msp, uint32_t reset_handler_addr)
+{
+    sim_jump(reset_handler_addr, msp, 1);
+}
+
+const sim_jump_t *sim_last_jump(void)
+{
+    return &last_jump;
+}
+
+/* Decodes the MOV and MOVZX/MOVSX forms the compiler emits for volatile register accesses */
+static uint8_t sim_decode(const uint8_t *code, sim_insn_t *insn)
+{
+    const uint8_t *p = code;
+    uint8_t operand16 = 0;
+    uint8_t rex = 0;
+    uint8_t immediate_size = 0;
+
+    memset(insn, 0, sizeof(*insn));
+
+    for (;; p++)
+    {
+        if (*p == 0x66)
+        {
+            operand16 = 1;
+        }
+        else if (*p != 0x26 && *p != 0x2E && *p != 0x36 && *p != 0x3E)
+        {
+            break;
+        }
+    }
+
+    if ((*p & 0xF0) == 0x40)
+    {
+        rex = *p++;
+    }
+
+    uint8_t word_size = (rex & 0x08) ? 8 : operand16 ? 2 : 4;
+    uint8_t opcode = *p++;
+
+    if (opcode == 0x0F)
+    {
+        opcode = *p++;
+        if ((opcode & 0xF6) != 0xB6)
+        {
+            return 0;
+        }
+        /* MOVZX 0xB6/0xB7, MOVSX 0xBE/0xBF */
+        insn->size = (opcode & 1) ? 2 : 1;
+        insn->extend = (opcode & 0x08) ? SIM_EXTEND_SIGN : SIM_EXTEND_ZERO;
+        insn->wide = (rex & 0x08) != 0;
+    }
+    else
+    {
+        switch (opcode)
+        {
+        case 0x88:
+        case 0x8A:
+            insn->size = 1;
+            break;
+        case 0x89:
+        case 0x8B:
+            insn->size = word_size;
+            insn->extend = word_size == 4 ? SIM_EXTEND_ZERO : SIM_EXTEND_MERGE;
+            break;
+        case 0xC6:
+            insn->size = 1;
+            immediate_size = 1;
+            break;
+        case 0xC7:
+            insn->size = word_size;
+            immediate_size = word_size == 2 ? 2 : 4;
+            break;
+        default:
+            return 0;
+        }
+        insn->store = opcode == 0x88 || opcode == 0x89 || opcode >= 0xC6;
+    }
+
+    if (insn->size == 8)
+    {
+        return 0;
+    }
+
+    uint8_t modrm = *p++;
+    uint8_t mod = modrm >> 6;
+    uint8_t rm = modrm & 7;
+
+    if (mod == 3)
+    {
+        return 0;
+    }
+    if (rm == 4)
+    {
+        uint8_t sib = *p++;
+        if ((sib & 7) == 5 && mod == 0)
+        {
+            p += 4;
+        }
+    }
+    else if (rm == 5 && mod == 0)
+    {
+        p += 4;
+    }
+    p += mod == 1 ? 1 : mod == 2 ? 4 : 0;
+
+    if (immediate_size)
+    {
+        if (((modrm >> 3) & 7) != 0)
+        {
+            return 0;
+        }
+        insn->operand = SIM_OPERAND_IMMEDIATE;
+        for (uint8_t i = 0; i < immediate_size; i++)
+        {
+            insn->immediate |= (uint32_t)p[i] << (8 * i);
+        }
+        p += immediate_size;
+    }
+    else
+    {
+        insn->operand = ((rex & 0x04) << 1) | ((modrm >> 3) & 7);
+        if (insn->size == 1 && !insn->extend && rex == 0 && insn->operand >= 4)
+        {
+            insn->operand -= 4;
+            insn->high_byte = 1;
+        }
+    }
+
+    insn->length = p - code;
+    return 1;
+}
+
+static void sim_emulate(greg_t *gregs, uint32_t address, const sim_insn_t *insn)
+{
+    uint32_t word_address = address & ~3U;
+    uint32_t shift = (address & 3) * 8;
+    uint32_t mask = insn->size == 4 ? 0xFFFFFFFFU : (1U << (insn->size * 8)) - 1;
+    greg_t *reg = insn->operand == SIM_OPERAND_IMMEDIATE ? NULL : &gregs[gregs_index[insn->operand]];
+
+    if (insn->store)
+    {
+        uint32_t value = reg == NULL ? insn->immediate : (uint32_t)((uint64_t)*reg >> (insn->high_byte ? 8 : 0));
+
+        value &= mask;
+        if (insn->size != 4)
+        {
+            value = (SIM_REG(word_address) & ~(mask << shift)) | (value << shift);
+        }
+        sim_write(word_address, value);
+    }
+    else
+    {
+        uint64_t value = (sim_read(word_address) >> shift) & mask;
+        uint32_t bits = insn->size * 8;
+
+        if (insn->extend == SIM_EXTEND_SIGN && bits < 32 && (value >> (bits - 1)))
+        {
+            value |= ~(uint64_t)mask;
+        }
+
+        if (insn->high_byte)
+        {
+            *reg = (*reg & ~0xFF00LL) | (greg_t)(value << 8);
+        }
+        else if (insn->extend == SIM_EXTEND_MERGE)
+        {
+            *reg = (*reg & ~(greg_t)mask) | (greg_t)value;
+        }
+        else
+        {
+            /* A 32-bit destination clears the upper half */
+            *reg = insn->wide ? (greg_t)value : (greg_t)(uint32_t)value;
+        }
+    }
+
+    gregs[REG_RIP] += insn->length;
+}
+
+static void sim_segv_handler(int signal_number, siginfo_t *info, void *context)
+{
+    greg_t *gregs = ((ucontext_t *)context)->uc_mcontext.gregs;
+    uintptr_t address = (uintptr_t)info->si_addr;
+    uint8_t write = (gregs[REG_ERR] & X86_PF_WRITE) != 0;
+    const sim_block_t *block = sim_find_block(address);
+    sim_insn_t insn;
+
+    if (gregs[REG_ERR] & X86_PF_INSTRUCTION)
+    {
+        if (block != NULL)
+        {
+            sim_jump(address, 0, 0);
+        }
+        sim_fail("Code fetched from %#lx, outside the simulated memory", (unsigned long)address);
+    }
+
+    if (block == NULL)
+    {
+        sim_fail("Out of bounds %s of %#lx by code at %#lx", write ? "write" : "read",
+                 (unsigned long)address, (unsigned long)gregs[REG_RIP]);
+    }
+
+    if (block->kind != SIM_BLOCK_REGISTERS)
+    {
+        sim_fail("%s %s at 0x%08lX by code at %#lx", write ? "Write to" : "Read of", block->name,
+                 (unsigned long)address, (unsigned long)gregs[REG_RIP]);
+    }
+
+    if (step.active)
+    {
+        sim_fail("Access to 0x%08lX while single stepping another one", (unsigned long)address);
+    }
+
+    stats.accesses++;
+    sim_advance(SIM_ACCESS_CYCLES);
+
+    if (sim_decode((const uint8_t *)gregs[REG_RIP], &insn) && (address & 3) + insn.size <= 4)
+    {
+        sim_emulate(gregs, (uint32_t)address, &insn);
+        return;
+    }
+
+    /* Executed on the unprotected page instead, stores are replayed through the models afterwards */
+    if (!write)
+    {
+        SIM_REG(address) = sim_read(address & ~3U);
+    }
+
+    step.active = 1;
+    step.page = address & ~(uintptr_t)(SIM_PAGE_SIZE - 1);
+    memcpy(step.snapshot, sim_reg(step.page), SIM_PAGE_SIZE);
+    mprotect((void *)step.page, SIM_PAGE_SIZE, PROT_READ | PROT_WRITE);
+    gregs[REG_EFL] |= X86_EFLAGS_TF;
+    stats.single_steps++;
+}
+
+static void sim_trap_handler(int signal_number, siginfo_t *info, void *context)
+{
+    greg_t *gregs = ((ucontext_t *)context)->uc_mcontext.gregs;
+    uint32_t *words;
+
+    if (!step.active)
+    {
+        sim_fail("Unexpected SIGTRAP at %#lx", (unsigned long)gregs[REG_RIP]);
+    }
+
+    gregs[REG_EFL] &= ~X86_EFLAGS_TF;
+    mprotect((void *)step.page, SIM_PAGE_SIZE, PROT_NONE);
+    step.active = 0;
+
+    words = sim_reg(step.page);
+    for (uint32_t i = 0; i < SIM_PAGE_SIZE / 4; i++)
+    {
+        if (words[i] != step.snapshot[i])
+        {
+            uint32_t value = words[i];
+
+            words[i] = step.snapshot[i];
+            sim_write(step.page + 4 * i, value);
+        }
+    }
+
+    sim_dispatch();
+}
+
+/* Core peripherals: SysTick, NVIC, SCB, DWT cycle counter and the DBGMCU ID */
+
+static uint32_t sim_scs_read(uint32_t address)
+{
+    if (address == SYST_CVR_ADDR && sim_systick_running())
+    {
+        return (uint32_t)(systick_next - now - 1);
+    }
+    if (address == SYST_CSR_ADDR)
+    {
+        uint32_t csr = SIM_REG(address);
+        SIM_REG(address) &= ~SYST_CSR_COUNTFLAG;
+        return csr;
+    }
+    if (address >= NVIC_ISER_ADDR && address < NVIC_ISER_ADDR + 4 * NVIC_NUM_OF_WORDS)
+    {
+        return nvic_enabled[(address - NVIC_ISER_ADDR) / 4];
+    }
+    if (address >= NVIC_ICER_ADDR && address < NVIC_ICER_ADDR + 4 * NVIC_NUM_OF_WORDS)
+    {
+        return nvic_enabled[(address - NVIC_ICER_ADDR) / 4];
+    }
+    if (address >= NVIC_ISPR_ADDR && address < NVIC_ISPR_ADDR + 4 * NVIC_NUM_OF_WORDS)
+    {
+        return nvic_pending[(address - NVIC_ISPR_ADDR) / 4];
+    }
+    if (address >= NVIC_ICPR_ADDR && address < NVIC_ICPR_ADDR + 4 * NVIC_NUM_OF_WORDS)
+    {
+        return nvic_pending[(address - NVIC_ICPR_ADDR) / 4];
+    }
+
+    return SIM_REG(address);
+}
+
+static void sim_scs_write(uint32_t address, uint32_t value)
+{
+    if (address == SYST_CSR_ADDR)
+    {
+        if ((value & SYST_CSR_ENABLE) && !(SIM_REG(address) & SYST_CSR_ENABLE))
+        {
+            systick_next = now + SIM_REG(SYST_RVR_ADDR) + 1;
+        }
+        SIM_REG(address) = value & ~SYST_CSR_COUNTFLAG;
+        return;
+    }
+    if (address == SYST_CVR_ADDR)
+    {
+        /* Any write clears the counter, it reloads on the next clock */
+        systick_next = now + SIM_REG(SYST_RVR_ADDR) + 1;
+        SIM_REG(SYST_CSR_ADDR) &= ~SYST_CSR_COUNTFLAG;
+        return;
+    }
+    if (address == SCB_ICSR_ADDR)
+    {
+        if (value & SCB_ICSR_PENDSTCLR)
+        {
+            systick_pending = 0;
+        }
+        return;
+    }
+    if (address >= NVIC_ISER_ADDR && address < NVIC_ISER_ADDR + 4 * NVIC_NUM_OF_WORDS)
+    {
+        nvic_enabled[(address - NVIC_ISER_ADDR) / 4] |= value;
+        if (nvic_pending[(address - NVIC_ISER_ADDR) / 4] & value)
+        {
+            wake_event = 1;
+        }
+        sim_dispatch();
+        return;
+    }
+    if (address >= NVIC_ICER_ADDR && address < NVIC_ICER_ADDR + 4 * NVIC_NUM_OF_WORDS)
+    {
+        nvic_enabled[(address - NVIC_ICER_ADDR) / 4] &= ~value;
+        return;
+    }
+    if (address >= NVIC_ISPR_ADDR && address < NVIC_ISPR_ADDR + 4 * NVIC_NUM_OF_WORDS)
+    {
+        for (uint32_t bit = 0; bit < 32; bit++)
+        {
+            if (value & (1U << bit))
+            {
+                sim_pend((address - NVIC_ISPR_ADDR) / 4 * 32 + bit);
+            }
+        }
+        sim_dispatch();
+        return;
+    }
+    if (address >= NVIC_ICPR_ADDR && address < NVIC_ICPR_ADDR + 4 * NVIC_NUM_OF_WORDS)
+    {
+        uint32_t index = (address - NVIC_ICPR_ADDR) / 4;
+
+        nvic_pending[index] &= ~value;
+        for (uint32_t bit = 0; bit < 32; bit++)
+        {
+            if (value & nvic_level[index] & (1U << bit))
+            {
+                sim_pend(index * 32 + bit);
+            }
+        }
+        return;
+    }
+
+    SIM_REG(address) = value;
+}
+
+static uint32_t sim_dwt_read(uint32_t address)
+{
+    if (address == DWT_CYCCNT_ADDR && (SIM_REG(DWT_CTRL_ADDR) & DWT_CTRL_CYCCNTENA))
+    {
+        return SIM_REG(address) + (uint32_t)(now - cyccnt_start);
+    }
+
+    return SIM_REG(address);
+}
+
+static void sim_dwt_write(uint32_t address, uint32_t value)
+{
+    uint8_t counting = (SIM_REG(DWT_CTRL_ADDR) & DWT_CTRL_CYCCNTENA) != 0;
+
+    if (address == DWT_CTRL_ADDR && counting != ((value & DWT_CTRL_CYCCNTENA) != 0))
+    {
+        /* The count so far is folded into the register whenever counting starts or stops */
+        SIM_REG(DWT_CYCCNT_ADDR) = sim_dwt_read(DWT_CYCCNT_ADDR);
+        cyccnt_start = now;
+    }
+    else if (address == DWT_CYCCNT_ADDR)
+    {
+        cyccnt_start = now;
+    }
+
+    SIM_REG(address) = value;
+}
+
+static void sim_dbgmcu_reset(void)
+{
+    SIM_REG(DBGMCU_IDCODE_ADDR) = DBGMCU_IDCODE_F446;
+}
+
+static const sim_peripheral_t scs = { SCS_BASE_ADDR, 0x1000, sim_scs_read, sim_scs_write, NULL };
+static const sim_peripheral_t dwt = { DWT_BASE_ADDR, 0x1000, sim_dwt_read, sim_dwt_write, NULL };
+static const sim_peripheral_t dbgmcu = { DBGMCU_IDCODE_ADDR, 0x10, NULL, NULL, sim_dbgmcu_reset };
+
+void sim_init(void)
+{
+    struct sigaction action;
+
+    if (initialized)
+    {
+        return;
+    }
+
+    memset(&action, 0, sizeof(action));
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    action.sa_sigaction = sim_segv_handler;
+    sigaction(SIGSEGV, &action, NULL);
+    action.sa_sigaction = sim_trap_handler;
+    sigaction(SIGTRAP, &action, NULL);
+
+    sim_map(0x08000000U, 512 * 1024, SIM_BLOCK_MEMORY, "FLASH");
+    sim_map(0x1FFFC000U, 0x1000, SIM_BLOCK_MEMORY, "option bytes");
+    sim_map(0x20000000U, 128 * 1024, SIM_BLOCK_MEMORY, "SRAM");
+    sim_map(0x40000000U, 0x8000, SIM_BLOCK_REGISTERS, "APB1");
+    sim_map(0x40010000U, 0x8000, SIM_BLOCK_REGISTERS, "APB2");
+    sim_map(0x40020000U, 0x4000, SIM_BLOCK_REGISTERS, "AHB1");
+    sim_map(0x40024000U, 0x1000, SIM_BLOCK_RAM, "backup SRAM");
+    sim_map(0x40025000U, 0x3000, SIM_BLOCK_REGISTERS, "AHB1 DMA");
+    sim_map(0x50000000U, 0x40000, SIM_BLOCK_REGISTERS, "USB OTG FS");
+    sim_map(SIM_QSPI_MAPPED_BASE_ADDR, SIM_QSPI_FLASH_SIZE, SIM_BLOCK_MEMORY, "QSPI flash");
+    sim_map(0xA0001000U, 0x1000, SIM_BLOCK_REGISTERS, "QUADSPI");
+    sim_map(0xE0000000U, 0x100000, SIM_BLOCK_REGISTERS, "Cortex-M4");
+
+    sim_add_peripheral(&scs);
+    sim_add_peripheral(&dwt);
+    sim_add_peripheral(&dbgmcu);
+
+    sim_periph_init();
+    sim_flash_init();
+    sim_uart_init();
+    sim_usb_init();
+    sim_can_init();
+    sim_spi_init();
+    sim_qspi_init();
+
+    initialized = 1;
+    sim_reset();
+}
+
+/* Every register back to its reset value, the memories keep their contents */
+void sim_reset(void)
+{
+    for (uint32_t i = 0; i < num_of_blocks; i++)
+    {
+        if (blocks[i].kind == SIM_BLOCK_REGISTERS)
+        {
+            memset(blocks[i].alias, 0, blocks[i].size);
+        }
+    }
+
+    memset(nvic_enabled, 0, sizeof(nvic_enabled));
+    memset(nvic_pending, 0, sizeof(nvic_pending));
+    memset(nvic_level, 0, sizeof(nvic_level));
+    num_of_events = 0;
+    systick_pending = 0;
+    primask = 0;
+    wake_event = 0;
+
+    for (uint32_t i = 0; i < num_of_peripherals; i++)
+    {
+        if (peripherals[i]->reset != NULL)
+        {
+            peripherals[i]->reset();
+        }
+    }
+}
+
+/* One peripheral back to its reset state, as by its RCC reset bit */
+void sim_reset_peripheral(uint32_t base_address)
+{
+    const sim_peripheral_t *peripheral = sim_find_peripheral(base_address);
+
+    if (peripheral == NULL)
+    {
+        sim_fail("No peripheral model at 0x%08X", base_address);
+    }
+
+    memset(sim_mem(base_address), 0, peripheral->size);
+    if (peripheral->reset != NULL)
+    {
+        peripheral->reset();
+    }
+}
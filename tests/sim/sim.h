@@ -0,0 +1,178 @@
+#ifndef __SIM_H__
+#define __SIM_H__
+
+#include <stdint.h>
+#include "stm32f446xx.h"
+
+/*
+ * Host simulation of the STM32F446 parts the bootloader uses, for the tests in tests/.
+ *
+ * The memories and peripherals are mapped at their real addresses inside the test process.
+ * FLASH, SRAM and the option bytes can be read but not written, only the FLASH driver model
+ * changes them through a second, writable mapping. Peripheral pages cannot be accessed at all:
+ * every access faults, the fault handler decodes the instruction and performs it on the
+ * register model, charges SIM_ACCESS_CYCLES to the virtual clock and runs the interrupts that
+ * became pending. Registers without a model behave as plain memory.
+ *
+ * A write to FLASH or SRAM, an access outside the simulated memory, a read of the QSPI window
+ * outside memory-mapped mode and a watchdog reset end the test with a report. Fetching code
+ * from the simulated memory counts as a jump, sim_run() then returns SIM_JUMPED.
+ */
+#define SIM_CORE_CLOCK_HZ       16000000U
+#define SIM_ACCESS_CYCLES       8       // Charged for every peripheral access
+#define SIM_MS(ms)              ((uint64_t)(ms) * (SIM_CORE_CLOCK_HZ / 1000))
+
+#define SIM_NUM_OF_IRQS         97
+
+/* sim_run() results */
+#define SIM_RETURNED            0
+#define SIM_JUMPED              1
+#define SIM_STOPPED             2
+
+/* Kinds of mapped blocks */
+#define SIM_BLOCK_MEMORY        0       // Readable, written only through sim_mem()
+#define SIM_BLOCK_REGISTERS     1       // Every access goes through the models
+#define SIM_BLOCK_RAM           2       // Plain read/write memory
+
+typedef struct
+{
+    uint32_t base_address;
+    uint32_t size;
+    uint32_t (*read)(uint32_t address);                 // NULL reads the stored value
+    void (*write)(uint32_t address, uint32_t value);    // NULL stores the value
+    void (*reset)(void);                                // Called by sim_reset()
+} sim_peripheral_t;
+
+typedef struct
+{
+    uint32_t address;           // Code address fetched or started
+    uint32_t msp;               // Initial stack pointer, 0 for a plain branch
+    uint32_t vtor;              // SCB_VTOR at the time of the jump
+    uint8_t started;            // 1 if the image was started through cpu_start_image()
+} sim_jump_t;
+
+typedef struct
+{
+    uint64_t accesses;          // Peripheral accesses
+    uint64_t single_steps;      // Of them, not decoded and single stepped instead
+    uint64_t irqs;              // Exception and interrupt handlers run
+    uint64_t cycles_asleep;     // Cycles spent in WFE
+} sim_stats_t;
+
+/* Core */
+void sim_init(void);
+void sim_reset(void);
+void sim_reset_peripheral(uint32_t base_address);
+void sim_map(uint32_t base_address, uint32_t size, uint8_t kind, const char *name);
+void sim_add_peripheral(const sim_peripheral_t *peripheral);
+uint32_t *sim_reg(uint32_t address);
+uint8_t *sim_mem(uint32_t address);
+uint8_t sim_mapped(uint32_t address, uint32_t length);
+uint32_t sim_read(uint32_t address);
+void sim_write(uint32_t address, uint32_t value);
+uint8_t sim_bus_read(uint32_t address, uint32_t *value);
+uint8_t sim_bus_write(uint32_t address, uint32_t value);
+const sim_stats_t *sim_get_stats(void);
+__attribute__((noreturn, format(printf, 1, 2))) void sim_fail(const char *format, ...);
+
+/* Register storage without side effects, for the models */
+#define SIM_REG(address)        (*sim_reg(address))
+
+/* Virtual clock, interrupts and events */
+uint64_t sim_cycles(void);
+void sim_advance(uint64_t cycles);
+void sim_stall(uint64_t cycles);
+void sim_schedule(uint64_t delay, void (*callback)(void *arg), void *arg);
+void sim_set_irq(uint8_t irq_number, uint8_t level);
+uint8_t sim_irq_enabled(uint8_t irq_number);
+
+/* Running bootloader code */
+int sim_run(void (*entry)(void));
+__attribute__((noreturn)) void sim_stop(void);
+const sim_jump_t *sim_last_jump(void);
+
+/* Peripherals of sim_periph.c */
+void sim_periph_init(void);
+uint32_t sim_crc_update(uint32_t crc, uint32_t word);
+void sim_gpio_set_input(GPIO_RegDef_t *port, uint8_t pin, uint8_t level);
+uint8_t sim_gpio_get_output(GPIO_RegDef_t *port, uint8_t pin);
+void sim_watchdog_check(void);
+
+/* FLASH driver model, sim_flash.c */
+void sim_flash_init(void);
+void sim_flash_guard(uint32_t start_address, uint32_t end_address);
+void sim_flash_erase_all(void);
+uint32_t sim_flash_writes(void);
+
+/* USART model, sim_uart.c. The simulated host only sends while RTS is asserted (low). */
+void sim_uart_init(void);
+void sim_uart_set_rts(GPIO_RegDef_t *port, uint8_t pin);
+void sim_uart_set_char_cycles(uint32_t cycles);
+void sim_uart_send(const uint8_t *data, uint32_t length);
+uint32_t sim_uart_pending(void);
+uint32_t sim_uart_take(uint8_t *data, uint32_t max_length);
+uint32_t sim_uart_overruns(void);
+
+/* USB OTG FS model and the host on the bus, sim_usb.c */
+#define SIM_USB_ADDRESS         5       // Assigned by sim_usb_enumerate()
+#define SIM_USB_MAX_IN_PACKETS  1024
+
+void sim_usb_init(void);
+void sim_usb_bus_reset(void);
+void sim_usb_setup(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index, uint16_t length);
+void sim_usb_enumerate(void);
+uint8_t sim_usb_address(void);
+void sim_usb_set_host_reading(uint8_t reading);
+void sim_usb_send(const uint8_t *data, uint32_t length);
+uint32_t sim_usb_out_naks(void);
+uint32_t sim_usb_take(uint8_t *data, uint32_t max_length, uint16_t *packets, uint32_t *num_of_packets);
+
+/* CAN1 model and the bus with the host on it, sim_can.c */
+#define SIM_CAN_FRAME_CYCLES    (114 * (SIM_CORE_CLOCK_HZ / 500000))    // 8 data bytes at 500 kbit/s
+
+typedef struct
+{
+    uint32_t id;
+    uint8_t dlc;
+    uint8_t data[8];
+} sim_can_frame_t;
+
+void sim_can_init(void);
+void sim_can_set_receiver(void (*receiver)(const sim_can_frame_t *frame));
+void sim_can_set_host_connected(uint8_t connected);
+void sim_can_send(uint32_t id, const uint8_t *data, uint8_t dlc);
+uint32_t sim_can_pending(void);
+uint32_t sim_can_node_frames(void);
+uint32_t sim_can_overruns(void);
+
+/* SPI2 slave model, the NSS EXTI line and the host as bus master, sim_spi.c */
+void sim_spi_init(void);
+void sim_spi_transaction(const uint8_t *data, uint32_t length);
+void sim_spi_poll(uint8_t node_id, uint32_t num_of_dummies);
+uint32_t sim_spi_pending(void);
+uint32_t sim_spi_take(uint8_t *data, uint32_t max_length);
+uint32_t sim_spi_driven_bytes(void);
+uint32_t sim_spi_underruns(void);
+uint32_t sim_spi_overruns(void);
+
+/* QUADSPI model and the W25Q128JV on bank 1, sim_qspi.c */
+#define SIM_QSPI_MAPPED_BASE_ADDR   0x90000000U
+#define SIM_QSPI_FLASH_SIZE         (16U * 1024 * 1024)
+
+typedef struct
+{
+    uint32_t sector_erases;     // 4 KB
+    uint32_t block_erases;      // 64 KB
+    uint32_t page_programs;
+    uint32_t status_writes;
+    uint32_t resets;
+} sim_qspi_stats_t;
+
+void sim_qspi_init(void);
+void sim_qspi_erase_all(void);
+uint8_t sim_qspi_busy(void);
+uint8_t sim_qspi_mapped(void);
+void sim_qspi_set_connected(uint8_t connected);
+const sim_qspi_stats_t *sim_qspi_get_stats(void);
+
+#endif
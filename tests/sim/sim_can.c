@@ -0,0 +1,336 @@
+#include <string.h>
+
+#include "sim.h"
+
+/*
+ * CAN1 (bxCAN) and the bus it sits on, with the host as the only other node.
+ *
+ * Transmit mailbox 0 and receive FIFO 0 with its three entries are modelled, the other
+ * mailboxes always read as empty. Filter bank 0 is evaluated in 16-bit list mode, which is
+ * what the driver sets up. One frame is on the bus at a time, SIM_CAN_FRAME_CYCLES long, and
+ * the lower identifier wins arbitration. A frame that arrives with the FIFO full is lost and
+ * counted as an overrun.
+ *
+ * Once the host disconnects, nobody acknowledges the frames of the node: the mailbox stays
+ * pending, as the controller retransmits forever, until the driver aborts it.
+ */
+#define CAN1_RX0_IRQ_NO         20
+#define CAN1_BASE_ADDR          0x40006400U
+#define CAN_ADDR(offset)        (CAN1_BASE_ADDR + (offset))
+#define CAN(offset)             SIM_REG(CAN_ADDR(offset))
+
+#define CAN_MCR                 0x000
+#define CAN_MSR                 0x004
+#define CAN_TSR                 0x008
+#define CAN_RF0R                0x00C
+#define CAN_IER                 0x014
+#define CAN_TI0R                0x180
+#define CAN_TDT0R               0x184
+#define CAN_TDL0R               0x188
+#define CAN_TDH0R               0x18C
+#define CAN_RI0R                0x1B0
+#define CAN_RDT0R               0x1B4
+#define CAN_RDL0R               0x1B8
+#define CAN_RDH0R               0x1BC
+#define CAN_FA1R                0x21C
+#define CAN_F0R1                0x240
+#define CAN_F0R2                0x244
+
+#define CAN_MCR_INRQ            (1U << 0)
+#define CAN_MCR_SLEEP           (1U << 1)
+#define CAN_MCR_RESET_VALUE     0x00010002U
+#define CAN_MSR_INAK            (1U << 0)
+#define CAN_MSR_SLAK            (1U << 1)
+#define CAN_TSR_RQCP0           (1U << 0)
+#define CAN_TSR_TXOK0           (1U << 1)
+#define CAN_TSR_ABRQ0           (1U << 7)
+#define CAN_TSR_TME0            (1U << 26)
+#define CAN_TSR_TME1            (1U << 27)
+#define CAN_TSR_TME2            (1U << 28)
+#define CAN_RF0R_FULL0          (1U << 3)
+#define CAN_RF0R_FOVR0          (1U << 4)
+#define CAN_RF0R_RFOM0          (1U << 5)
+#define CAN_IER_FMPIE0          (1U << 1)
+#define CAN_TIR_TXRQ            (1U << 0)
+#define CAN_ID_STID_POS         21
+#define CAN_FILTER_STID_POS     5
+
+#define CAN_FIFO_SIZE           3
+#define CAN_HOST_QUEUE_SIZE     256
+
+static sim_can_frame_t fifo[CAN_FIFO_SIZE];
+static uint32_t fifo_count;
+static uint8_t tx_pending;
+
+/* Bus and host side */
+static uint8_t host_connected;
+static void (*host_receiver)(const sim_can_frame_t *frame);
+static sim_can_frame_t host_queue[CAN_HOST_QUEUE_SIZE];
+static uint32_t host_head;
+static uint32_t host_tail;
+static uint8_t bus_busy;
+static uint8_t bus_node_frame;      // The frame on the bus is the one in mailbox 0
+static uint32_t bus_frame;          // Incremented for every frame and abort, to spot an outdated end of frame
+static uint32_t overruns;
+static uint32_t node_frames;
+
+static uint8_t can_active(void)
+{
+    return !(CAN(CAN_MCR) & (CAN_MCR_INRQ | CAN_MCR_SLEEP));
+}
+
+static void can_update_irq(void)
+{
+    sim_set_irq(CAN1_RX0_IRQ_NO, fifo_count != 0 && (CAN(CAN_IER) & CAN_IER_FMPIE0));
+}
+
+static uint8_t can_filter_match(uint32_t id)
+{
+    if (!(CAN(CAN_FA1R) & 1U))
+    {
+        return 0;
+    }
+
+    const uint32_t words[2] = { CAN(CAN_F0R1), CAN(CAN_F0R2) };
+
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        uint32_t entry = (words[i / 2] >> (16 * (i % 2))) & 0xFFFFU;
+
+        if (entry >> CAN_FILTER_STID_POS == id)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void can_receive(const sim_can_frame_t *frame)
+{
+    if (!can_active() || !can_filter_match(frame->id))
+    {
+        return;
+    }
+
+    if (fifo_count == CAN_FIFO_SIZE)
+    {
+        CAN(CAN_RF0R) |= CAN_RF0R_FOVR0;
+        overruns++;
+        return;
+    }
+
+    fifo[fifo_count++] = *frame;
+    can_update_irq();
+}
+
+static void mailbox_frame(sim_can_frame_t *frame)
+{
+    uint32_t low = CAN(CAN_TDL0R);
+    uint32_t high = CAN(CAN_TDH0R);
+
+    frame->id = CAN(CAN_TI0R) >> CAN_ID_STID_POS;
+    frame->dlc = CAN(CAN_TDT0R) & 0xF;
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        frame->data[i] = (uint8_t)(low >> (8 * i));
+        frame->data[i + 4] = (uint8_t)(high >> (8 * i));
+    }
+}
+
+static void bus_start(void);
+
+static void bus_end(void *arg)
+{
+    if ((uint32_t)(uintptr_t)arg != bus_frame)
+    {
+        return;
+    }
+
+    bus_busy = 0;
+
+    if (bus_node_frame)
+    {
+        sim_can_frame_t frame;
+
+        mailbox_frame(&frame);
+        tx_pending = 0;
+        CAN(CAN_TI0R) &= ~CAN_TIR_TXRQ;
+        CAN(CAN_TSR) |= CAN_TSR_RQCP0 | CAN_TSR_TXOK0;
+        node_frames++;
+        if (host_receiver != NULL)
+        {
+            host_receiver(&frame);
+        }
+    }
+    else
+    {
+        can_receive(&host_queue[host_tail++ % CAN_HOST_QUEUE_SIZE]);
+    }
+
+    bus_start();
+}
+
+/* Arbitration between mailbox 0 and the next frame of the host */
+static void bus_start(void)
+{
+    uint8_t node = tx_pending && can_active();
+    uint8_t host = host_head != host_tail;
+
+    if (bus_busy || !host_connected || (!node && !host))
+    {
+        return;
+    }
+
+    bus_node_frame = node && (!host || CAN(CAN_TI0R) >> CAN_ID_STID_POS < host_queue[host_tail % CAN_HOST_QUEUE_SIZE].id);
+    bus_busy = 1;
+    sim_schedule(SIM_CAN_FRAME_CYCLES, bus_end, (void *)(uintptr_t)++bus_frame);
+}
+
+static uint32_t can_read(uint32_t address)
+{
+    const sim_can_frame_t *head = &fifo[0];
+    uint32_t mcr = CAN(CAN_MCR);
+
+    switch (address - CAN1_BASE_ADDR)
+    {
+    case CAN_MSR:
+        return (mcr & CAN_MCR_INRQ ? CAN_MSR_INAK : 0) | (mcr & CAN_MCR_SLEEP ? CAN_MSR_SLAK : 0);
+    case CAN_TSR:
+        return CAN(CAN_TSR) | (tx_pending ? 0 : CAN_TSR_TME0) | CAN_TSR_TME1 | CAN_TSR_TME2;
+    case CAN_RF0R:
+        return CAN(CAN_RF0R) | fifo_count | (fifo_count == CAN_FIFO_SIZE ? CAN_RF0R_FULL0 : 0);
+    case CAN_RI0R:
+        return fifo_count ? head->id << CAN_ID_STID_POS : 0;
+    case CAN_RDT0R:
+        return fifo_count ? head->dlc : 0;
+    case CAN_RDL0R:
+        return fifo_count ? head->data[0] | head->data[1] << 8 | head->data[2] << 16 | (uint32_t)head->data[3] << 24 : 0;
+    case CAN_RDH0R:
+        return fifo_count ? head->data[4] | head->data[5] << 8 | head->data[6] << 16 | (uint32_t)head->data[7] << 24 : 0;
+    default:
+        return SIM_REG(address);
+    }
+}
+
+static void can_write(uint32_t address, uint32_t value)
+{
+    switch (address - CAN1_BASE_ADDR)
+    {
+    case CAN_MCR:
+        CAN(CAN_MCR) = value;
+        bus_start();
+        break;
+    case CAN_TSR:
+        CAN(CAN_TSR) &= ~(value & (CAN_TSR_RQCP0 | CAN_TSR_TXOK0));
+        if ((value & CAN_TSR_ABRQ0) && tx_pending)
+        {
+            /* A frame on the bus is cut short */
+            if (bus_busy && bus_node_frame)
+            {
+                bus_busy = 0;
+                bus_frame++;
+            }
+            tx_pending = 0;
+            CAN(CAN_TI0R) &= ~CAN_TIR_TXRQ;
+            CAN(CAN_TSR) = (CAN(CAN_TSR) | CAN_TSR_RQCP0) & ~CAN_TSR_TXOK0;
+            bus_start();
+        }
+        break;
+    case CAN_RF0R:
+        CAN(CAN_RF0R) &= ~(value & (CAN_RF0R_FULL0 | CAN_RF0R_FOVR0));
+        if ((value & CAN_RF0R_RFOM0) && fifo_count)
+        {
+            memmove(&fifo[0], &fifo[1], --fifo_count * sizeof(fifo[0]));
+            can_update_irq();
+        }
+        break;
+    case CAN_IER:
+        CAN(CAN_IER) = value;
+        can_update_irq();
+        break;
+    case CAN_TI0R:
+        if (tx_pending)
+        {
+            break;
+        }
+        CAN(CAN_TI0R) = value;
+        if (value & CAN_TIR_TXRQ)
+        {
+            tx_pending = 1;
+            bus_start();
+        }
+        break;
+    case CAN_RI0R:
+    case CAN_RDT0R:
+    case CAN_RDL0R:
+    case CAN_RDH0R:
+        break;
+    default:
+        SIM_REG(address) = value;
+        break;
+    }
+}
+
+static void can_reset(void)
+{
+    CAN(CAN_MCR) = CAN_MCR_RESET_VALUE;
+    fifo_count = 0;
+    tx_pending = 0;
+    host_connected = 1;
+    host_head = 0;
+    host_tail = 0;
+    bus_busy = 0;
+    overruns = 0;
+    node_frames = 0;
+}
+
+static const sim_peripheral_t can1 = { CAN1_BASE_ADDR, 0x400, can_read, can_write, can_reset };
+
+void sim_can_init(void)
+{
+    sim_add_peripheral(&can1);
+}
+
+void sim_can_set_receiver(void (*receiver)(const sim_can_frame_t *frame))
+{
+    host_receiver = receiver;
+}
+
+void sim_can_set_host_connected(uint8_t connected)
+{
+    host_connected = connected;
+    bus_start();
+}
+
+void sim_can_send(uint32_t id, const uint8_t *data, uint8_t dlc)
+{
+    sim_can_frame_t *frame = &host_queue[host_head % CAN_HOST_QUEUE_SIZE];
+
+    if (host_head - host_tail == CAN_HOST_QUEUE_SIZE)
+    {
+        sim_fail("CAN host queue full");
+    }
+
+    frame->id = id;
+    frame->dlc = dlc;
+    memset(frame->data, 0, sizeof(frame->data));
+    memcpy(frame->data, data, dlc);
+    host_head++;
+    bus_start();
+}
+
+uint32_t sim_can_pending(void)
+{
+    return host_head - host_tail;
+}
+
+uint32_t sim_can_node_frames(void)
+{
+    return node_frames;
+}
+
+uint32_t sim_can_overruns(void)
+{
+    return overruns;
+}
@@ -0,0 +1,42 @@
+#ifndef __SIM_CORE_H__
+#define __SIM_CORE_H__
+
+#include <stdint.h>
+
+/* Core intrinsics of cortex_m4.h for the host test build, see sim.h */
+void sim_disable_irq(void);
+void sim_enable_irq(void);
+void sim_wfe(void);
+__attribute__((noreturn)) void sim_start_image(uint32_t msp, uint32_t reset_handler_addr);
+
+static inline void cpu_disable_irq(void)
+{
+    sim_disable_irq();
+}
+
+static inline void cpu_enable_irq(void)
+{
+    sim_enable_irq();
+}
+
+static inline void cpu_dsb(void)
+{
+    __asm volatile("" ::: "memory");
+}
+
+static inline void cpu_isb(void)
+{
+    __asm volatile("" ::: "memory");
+}
+
+static inline void cpu_wfe(void)
+{
+    sim_wfe();
+}
+
+static inline void cpu_start_image(uint32_t msp, uint32_t reset_handler_addr)
+{
+    sim_start_image(msp, reset_handler_addr);
+}
+
+#endif
@@ -0,0 +1,177 @@
+#include <string.h>
+
+#include "sim.h"
+#include "stm32f446xx_flash.h"
+
+/*
+ * Host stand-in for the FLASH driver. Programming can only clear bits, as on the real part,
+ * and erase and programming stall the core for their typical duration (DS10693, 6.3.12).
+ * The range set by sim_flash_guard() must never be written or erased, doing so ends the test.
+ */
+#define FLASH_NUM_OF_SECTORS        8
+#define FLASH_PROGRAM_CYCLES        256     // Per byte, 16 us at 16 MHz
+#define FLASH_MASS_ERASE_MS         8000
+#define OPTION_BYTES_RESET_VALUE    0x0FFFAAEDU     // RDP level 0 (0xAA), no write protection
+
+static const struct
+{
+    uint32_t base_address;
+    uint32_t size;
+    uint32_t erase_ms;
+} sectors[FLASH_NUM_OF_SECTORS] = {
+    { FLASH_SECTOR_0_BASE_ADDR, 16 * 1024, 250 },
+    { FLASH_SECTOR_1_BASE_ADDR, 16 * 1024, 250 },
+    { FLASH_SECTOR_2_BASE_ADDR, 16 * 1024, 250 },
+    { FLASH_SECTOR_3_BASE_ADDR, 16 * 1024, 250 },
+    { FLASH_SECTOR_4_BASE_ADDR, 64 * 1024, 550 },
+    { FLASH_SECTOR_5_BASE_ADDR, 128 * 1024, 1000 },
+    { FLASH_SECTOR_6_BASE_ADDR, 128 * 1024, 1000 },
+    { FLASH_SECTOR_7_BASE_ADDR, 128 * 1024, 1000 },
+};
+
+static uint8_t protection_levels[FLASH_NUM_OF_SECTORS];
+static uint32_t guard_start;
+static uint32_t guard_end;
+static uint32_t writes;
+
+static int sector_of(uint32_t address)
+{
+    for (int i = 0; i < FLASH_NUM_OF_SECTORS; i++)
+    {
+        if (address - sectors[i].base_address < sectors[i].size)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void check_guard(const char *operation, uint32_t address, uint32_t length)
+{
+    if (address < guard_end && guard_start < address + length)
+    {
+        sim_fail("FLASH %s of 0x%08X-0x%08X touches the protected range 0x%08X-0x%08X",
+                 operation, address, address + length - 1, guard_start, guard_end - 1);
+    }
+}
+
+void sim_flash_init(void)
+{
+    uint32_t option_bytes = OPTION_BYTES_RESET_VALUE;
+
+    memset(sim_mem(FLASH_BASE_ADDR), 0xFF, FLASH_END_ADDR - FLASH_BASE_ADDR + 1);
+    memcpy(sim_mem(OPTION_BYTES_BASE_ADDR), &option_bytes, sizeof(option_bytes));
+}
+
+/* Sets the range that must stay untouched, end_address is exclusive */
+void sim_flash_guard(uint32_t start_address, uint32_t end_address)
+{
+    guard_start = start_address;
+    guard_end = end_address;
+}
+
+void sim_flash_erase_all(void)
+{
+    memset(sim_mem(FLASH_BASE_ADDR), 0xFF, FLASH_END_ADDR - FLASH_BASE_ADDR + 1);
+    memset(protection_levels, 0, sizeof(protection_levels));
+}
+
+uint32_t sim_flash_writes(void)
+{
+    return writes;
+}
+
+void flash_init(void)
+{
+}
+
+void flash_write(uint32_t address, uint8_t *data, uint32_t length)
+{
+    if (length == 0)
+    {
+        return;
+    }
+
+    if (!sim_mapped(address, length) || sector_of(address) < 0 || sector_of(address + length - 1) < 0)
+    {
+        sim_fail("FLASH write of 0x%08X-0x%08X outside the FLASH", address, address + length - 1);
+    }
+    check_guard("write", address, length);
+
+    uint8_t *flash = sim_mem(address);
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        if (protection_levels[sector_of(address + i)] == 0)
+        {
+            flash[i] &= data[i];
+        }
+    }
+
+    writes++;
+    sim_stall((uint64_t)length * FLASH_PROGRAM_CYCLES);
+}
+
+uint8_t flash_read(uint32_t address, uint8_t *data, uint32_t length)
+{
+    if (!sim_mapped(address, length))
+    {
+        sim_fail("FLASH read of 0x%08X-0x%08X outside the simulated memory", address, address + length - 1);
+    }
+
+    memcpy(data, sim_mem(address), length);
+    sim_advance(length);
+
+    return FLASH_SUCCESS;
+}
+
+void flash_sector_erase(uint8_t sector_number)
+{
+    if (sector_number >= FLASH_NUM_OF_SECTORS)
+    {
+        sim_fail("Erase of FLASH sector %u, which does not exist", sector_number);
+    }
+    check_guard("erase", sectors[sector_number].base_address, sectors[sector_number].size);
+
+    if (protection_levels[sector_number] == 0)
+    {
+        memset(sim_mem(sectors[sector_number].base_address), 0xFF, sectors[sector_number].size);
+    }
+
+    writes++;
+    sim_stall(SIM_MS(sectors[sector_number].erase_ms));
+}
+
+void flash_mass_erase(void)
+{
+    check_guard("mass erase", FLASH_BASE_ADDR, FLASH_END_ADDR - FLASH_BASE_ADDR + 1);
+
+    for (uint8_t i = 0; i < FLASH_NUM_OF_SECTORS; i++)
+    {
+        if (protection_levels[i] == 0)
+        {
+            memset(sim_mem(sectors[i].base_address), 0xFF, sectors[i].size);
+        }
+    }
+
+    writes++;
+    sim_stall(SIM_MS(FLASH_MASS_ERASE_MS));
+}
+
+/* Sectors with a non-zero level ignore erase and programming */
+void flash_set_protection_level(uint8_t protection_level, uint8_t sector_mask)
+{
+    for (uint8_t i = 0; i < FLASH_NUM_OF_SECTORS; i++)
+    {
+        if (sector_mask & (1U << i))
+        {
+            protection_levels[i] = protection_level;
+        }
+    }
+}
+
+void flash_get_protection_level(uint8_t *levels)
+{
+    memcpy(levels, protection_levels, FLASH_NUM_OF_SECTORS);
+}
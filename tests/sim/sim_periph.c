@@ -0,0 +1,381 @@
+#include <string.h>
+
+#include "sim.h"
+#include "stm32f446xx_crc.h"
+#include "stm32f446xx_gpio.h"
+
+/* RCC (RM0390, 6.3) */
+#define RCC_CR_RESET_VALUE      0x00000083U     // HSI on and ready
+#define RCC_CR_HSEON            (1U << 16)
+#define RCC_CR_PLLON            (1U << 24)
+#define RCC_CSR_RESET_VALUE     0x0E000000U     // Power on, pin and brown-out reset flags
+#define RCC_APB1RSTR_SPI2RST    (1U << 14)
+#define SPI2_BASE_ADDR          0x40003800U
+
+/* GPIO ports A to E */
+#define GPIO_NUM_OF_PORTS       5
+#define GPIO_PORT_SIZE          0x400
+#define GPIO_IDR_OFFSET         0x10
+#define GPIO_ODR_OFFSET         0x14
+#define GPIO_BSRR_OFFSET        0x18
+
+/* Independent watchdog, clocked by the 32 kHz LSI */
+#define IWDG_BASE_ADDR          0x40003000U
+#define IWDG_KR_ADDR            (IWDG_BASE_ADDR + 0x00)
+#define IWDG_PR_ADDR            (IWDG_BASE_ADDR + 0x04)
+#define IWDG_RLR_ADDR           (IWDG_BASE_ADDR + 0x08)
+#define IWDG_SR_ADDR            (IWDG_BASE_ADDR + 0x0C)
+#define IWDG_KEY_START          0xCCCC
+#define IWDG_KEY_REFRESH        0xAAAA
+#define IWDG_LSI_CYCLES         (SIM_CORE_CLOCK_HZ / 32000)
+
+/* CRC unit, CRC-32 (Ethernet) polynomial without reflection or final XOR */
+#define CRC_POLYNOMIAL          0x04C11DB7U
+
+/* DMA2 stream 0, memory-to-memory transfers only */
+#define DMA2_BASE_ADDR          0x40026400U
+#define DMA2_LISR_ADDR          (DMA2_BASE_ADDR + 0x00)
+#define DMA2_LIFCR_ADDR         (DMA2_BASE_ADDR + 0x08)
+#define DMA2_S0CR_ADDR          (DMA2_BASE_ADDR + 0x10)
+#define DMA2_S0NDTR_ADDR        (DMA2_BASE_ADDR + 0x14)
+#define DMA2_S0PAR_ADDR         (DMA2_BASE_ADDR + 0x18)
+#define DMA2_S0M0AR_ADDR        (DMA2_BASE_ADDR + 0x1C)
+#define DMA_SxCR_EN             (1U << 0)
+#define DMA_SxCR_DIR_MASK       (3U << 6)
+#define DMA_SxCR_DIR_M2M        (2U << 6)
+#define DMA_SxCR_PINC           (1U << 9)
+#define DMA_SxCR_MINC           (1U << 10)
+#define DMA_LISR_TEIF0          (1U << 3)
+#define DMA_LISR_TCIF0          (1U << 5)
+#define DMA_CYCLES_PER_WORD     4
+
+static const struct
+{
+    uint32_t bit;
+    uint32_t base_address;
+} apb1_resets[] = {
+    { RCC_APB1RSTR_SPI2RST, SPI2_BASE_ADDR },
+};
+
+static uint16_t gpio_inputs[GPIO_NUM_OF_PORTS];
+static uint8_t iwdg_running;
+static uint64_t iwdg_deadline;
+static uint32_t dma_transfer;       // Incremented whenever a transfer starts or is aborted
+
+/* RCC: the oscillator and PLL ready flags follow their enable bits at once */
+
+static uint32_t rcc_read(uint32_t address)
+{
+    uint32_t value = SIM_REG(address);
+
+    if (address == (uint32_t)(uintptr_t)&RCC->CR)
+    {
+        value |= (value & (RCC_CR_HSEON | RCC_CR_PLLON)) << 1;
+    }
+
+    return value;
+}
+
+/* A peripheral with a model is reset when its bit in APB1RSTR is set */
+static void rcc_write(uint32_t address, uint32_t value)
+{
+    if (address == (uint32_t)(uintptr_t)&RCC->APB1RSTR)
+    {
+        uint32_t raised = value & ~SIM_REG(address);
+
+        for (uint32_t i = 0; i < sizeof(apb1_resets) / sizeof(apb1_resets[0]); i++)
+        {
+            if (raised & apb1_resets[i].bit)
+            {
+                sim_reset_peripheral(apb1_resets[i].base_address);
+            }
+        }
+    }
+
+    SIM_REG(address) = value;
+}
+
+static void rcc_reset(void)
+{
+    SIM_REG((uint32_t)(uintptr_t)&RCC->CR) = RCC_CR_RESET_VALUE;
+    SIM_REG((uint32_t)(uintptr_t)&RCC->CSR) = RCC_CSR_RESET_VALUE;
+}
+
+/* GPIO: IDR shows the driven level of output pins and the host supplied level of the others */
+
+static uint32_t gpio_port_index(uint32_t address)
+{
+    return (address - GPIOA_BASE_ADDR) / GPIO_PORT_SIZE;
+}
+
+static uint32_t gpio_read(uint32_t address)
+{
+    uint32_t base = address & ~(GPIO_PORT_SIZE - 1);
+
+    if (address - base == GPIO_IDR_OFFSET)
+    {
+        uint32_t moder = SIM_REG(base);
+        uint32_t outputs = 0;
+
+        for (uint32_t pin = 0; pin < 16; pin++)
+        {
+            if (((moder >> (2 * pin)) & 3) == GPIO_MODE_OUTPUT)
+            {
+                outputs |= 1U << pin;
+            }
+        }
+
+        return (SIM_REG(base + GPIO_ODR_OFFSET) & outputs) | (gpio_inputs[gpio_port_index(address)] & ~outputs);
+    }
+
+    return SIM_REG(address);
+}
+
+static void gpio_write(uint32_t address, uint32_t value)
+{
+    uint32_t base = address & ~(GPIO_PORT_SIZE - 1);
+
+    switch (address - base)
+    {
+    case GPIO_IDR_OFFSET:
+        break;
+    case GPIO_BSRR_OFFSET:
+        SIM_REG(base + GPIO_ODR_OFFSET) = (SIM_REG(base + GPIO_ODR_OFFSET) & ~(value >> 16)) | (value & 0xFFFF);
+        break;
+    default:
+        SIM_REG(address) = value;
+        break;
+    }
+}
+
+static void gpio_reset(void)
+{
+    memset(gpio_inputs, 0, sizeof(gpio_inputs));
+
+    /* The user button of the NUCLEO board has an external pull-up */
+    gpio_inputs[gpio_port_index(GPIOC_BASE_ADDR)] = 1U << GPIO_PIN_13;
+}
+
+void sim_gpio_set_input(GPIO_RegDef_t *port, uint8_t pin, uint8_t level)
+{
+    uint32_t index = gpio_port_index((uint32_t)(uintptr_t)port);
+
+    gpio_inputs[index] = (gpio_inputs[index] & ~(1U << pin)) | ((uint32_t)(level != 0) << pin);
+}
+
+uint8_t sim_gpio_get_output(GPIO_RegDef_t *port, uint8_t pin)
+{
+    return (SIM_REG((uint32_t)(uintptr_t)&port->ODR) >> pin) & 1;
+}
+
+/* GPIO driver stand-ins, they configure the pin without the access cost of the real driver */
+
+void gpio_init(gpio_handle_t *gpio_handle)
+{
+    GPIO_RegDef_t *gpiox = gpio_handle->gpiox;
+    gpio_config_t *config = &gpio_handle->config;
+    uint8_t pin = config->pin_number;
+
+    SIM_REG((uint32_t)(uintptr_t)&gpiox->MODER) &= ~(3U << (2 * pin));
+    SIM_REG((uint32_t)(uintptr_t)&gpiox->MODER) |= (uint32_t)config->pin_mode << (2 * pin);
+    SIM_REG((uint32_t)(uintptr_t)&gpiox->OSPEEDR) &= ~(3U << (2 * pin));
+    SIM_REG((uint32_t)(uintptr_t)&gpiox->OSPEEDR) |= (uint32_t)config->pin_speed << (2 * pin);
+    SIM_REG((uint32_t)(uintptr_t)&gpiox->PUPDR) &= ~(3U << (2 * pin));
+    SIM_REG((uint32_t)(uintptr_t)&gpiox->PUPDR) |= (uint32_t)config->pin_pupd << (2 * pin);
+    SIM_REG((uint32_t)(uintptr_t)&gpiox->OTYPER) &= ~(1U << pin);
+    SIM_REG((uint32_t)(uintptr_t)&gpiox->OTYPER) |= (uint32_t)config->pin_output_type << pin;
+
+    if (config->pin_mode == GPIO_MODE_ALT_FUNC)
+    {
+        SIM_REG((uint32_t)(uintptr_t)&gpiox->AFR[pin / 8]) &= ~(0xFU << (4 * (pin % 8)));
+        SIM_REG((uint32_t)(uintptr_t)&gpiox->AFR[pin / 8]) |= (uint32_t)config->pin_alt_func << (4 * (pin % 8));
+    }
+}
+
+uint8_t gpio_read_pin(GPIO_RegDef_t *gpiox, uint8_t pin_number)
+{
+    return (sim_read((uint32_t)(uintptr_t)&gpiox->IDR) >> pin_number) & 1;
+}
+
+/* IWDG: an expired watchdog resets the MCU, which ends the test */
+
+static uint64_t iwdg_period(void)
+{
+    uint32_t prescaler = 4U << (SIM_REG(IWDG_PR_ADDR) & 7);
+
+    return (uint64_t)((SIM_REG(IWDG_RLR_ADDR) & 0x0FFF) + 1) * prescaler * IWDG_LSI_CYCLES;
+}
+
+static uint32_t iwdg_read(uint32_t address)
+{
+    return address == IWDG_KR_ADDR || address == IWDG_SR_ADDR ? 0 : SIM_REG(address);
+}
+
+static void iwdg_write(uint32_t address, uint32_t value)
+{
+    if (address != IWDG_KR_ADDR)
+    {
+        SIM_REG(address) = value;
+        return;
+    }
+
+    if ((value & 0xFFFF) == IWDG_KEY_START)
+    {
+        iwdg_running = 1;
+    }
+    if ((value & 0xFFFF) == IWDG_KEY_START || (value & 0xFFFF) == IWDG_KEY_REFRESH)
+    {
+        iwdg_deadline = sim_cycles() + iwdg_period();
+    }
+}
+
+static void iwdg_reset(void)
+{
+    iwdg_running = 0;
+    SIM_REG(IWDG_RLR_ADDR) = 0x0FFF;
+}
+
+void sim_watchdog_check(void)
+{
+    if (iwdg_running && sim_cycles() >= iwdg_deadline)
+    {
+        sim_fail("Watchdog reset, not refreshed for %llu ms",
+                 (unsigned long long)(iwdg_period() / SIM_MS(1)));
+    }
+}
+
+/* CRC */
+
+uint32_t sim_crc_update(uint32_t crc, uint32_t word)
+{
+    crc ^= word;
+    for (uint32_t bit = 0; bit < 32; bit++)
+    {
+        crc = (crc & 0x80000000U) ? (crc << 1) ^ CRC_POLYNOMIAL : crc << 1;
+    }
+
+    return crc;
+}
+
+static void crc_write(uint32_t address, uint32_t value)
+{
+    if (address == (uint32_t)(uintptr_t)&CRC->DR)
+    {
+        SIM_REG(address) = sim_crc_update(SIM_REG(address), value);
+    }
+    else if (address == (uint32_t)(uintptr_t)&CRC->CR)
+    {
+        if (value & (1U << CRC_CR_RESET))
+        {
+            SIM_REG((uint32_t)(uintptr_t)&CRC->DR) = 0xFFFFFFFFU;
+        }
+    }
+    else
+    {
+        SIM_REG(address) = value & 0xFF;
+    }
+}
+
+static void crc_reset(void)
+{
+    SIM_REG((uint32_t)(uintptr_t)&CRC->DR) = 0xFFFFFFFFU;
+}
+
+uint32_t crc_accumulate(CRC_RegDef_t *crcx, uint32_t *data, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        sim_write((uint32_t)(uintptr_t)&crcx->DR, data[i]);
+    }
+    sim_advance(length * SIM_ACCESS_CYCLES);
+
+    return sim_read((uint32_t)(uintptr_t)&crcx->DR);
+}
+
+/*
+ * DMA2 stream 0: the words move when the transfer completes, NDTR cycles of 4 after it started.
+ * Only word transfers are modelled, bits 1:0 of both addresses are ignored as on the real part.
+ */
+
+static void dma_complete(void *arg)
+{
+    uint32_t ndtr = SIM_REG(DMA2_S0NDTR_ADDR) & 0xFFFF;
+    uint32_t cr = SIM_REG(DMA2_S0CR_ADDR);
+    uint32_t source = SIM_REG(DMA2_S0PAR_ADDR) & ~3U;
+    uint32_t destination = SIM_REG(DMA2_S0M0AR_ADDR) & ~3U;
+    uint32_t status = DMA_LISR_TCIF0;
+
+    if ((uint32_t)(uintptr_t)arg != dma_transfer || !(cr & DMA_SxCR_EN))
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < ndtr; i++)
+    {
+        uint32_t value;
+
+        if (sim_bus_read(source, &value) || sim_bus_write(destination, value))
+        {
+            status = DMA_LISR_TEIF0;
+            break;
+        }
+        source += (cr & DMA_SxCR_PINC) ? 4 : 0;
+        destination += (cr & DMA_SxCR_MINC) ? 4 : 0;
+    }
+
+    SIM_REG(DMA2_S0NDTR_ADDR) = 0;
+    SIM_REG(DMA2_S0CR_ADDR) = cr & ~DMA_SxCR_EN;
+    SIM_REG(DMA2_LISR_ADDR) |= status;
+}
+
+static uint32_t dma_read(uint32_t address)
+{
+    return address == DMA2_LIFCR_ADDR ? 0 : SIM_REG(address);
+}
+
+static void dma_write(uint32_t address, uint32_t value)
+{
+    switch (address)
+    {
+    case DMA2_LISR_ADDR:
+        break;
+    case DMA2_LIFCR_ADDR:
+        SIM_REG(DMA2_LISR_ADDR) &= ~value;
+        break;
+    case DMA2_S0CR_ADDR:
+        if ((value & DMA_SxCR_EN) && !(SIM_REG(address) & DMA_SxCR_EN))
+        {
+            if ((value & DMA_SxCR_DIR_MASK) != DMA_SxCR_DIR_M2M)
+            {
+                sim_fail("DMA2 stream 0 is only modelled for memory-to-memory transfers");
+            }
+            dma_transfer++;
+            sim_schedule((SIM_REG(DMA2_S0NDTR_ADDR) & 0xFFFF) * DMA_CYCLES_PER_WORD, dma_complete,
+                         (void *)(uintptr_t)dma_transfer);
+        }
+        else if (!(value & DMA_SxCR_EN))
+        {
+            dma_transfer++;
+        }
+        SIM_REG(address) = value;
+        break;
+    default:
+        SIM_REG(address) = value;
+        break;
+    }
+}
+
+static const sim_peripheral_t rcc = { RCC_BASE_ADDR, 0x400, rcc_read, rcc_write, rcc_reset };
+static const sim_peripheral_t gpio = { GPIOA_BASE_ADDR, GPIO_NUM_OF_PORTS * GPIO_PORT_SIZE, gpio_read, gpio_write, gpio_reset };
+static const sim_peripheral_t iwdg = { IWDG_BASE_ADDR, 0x400, iwdg_read, iwdg_write, iwdg_reset };
+static const sim_peripheral_t crc = { CRC_BASE_ADDR, 0x400, NULL, crc_write, crc_reset };
+static const sim_peripheral_t dma2 = { DMA2_BASE_ADDR, 0x400, dma_read, dma_write, NULL };
+
+void sim_periph_init(void)
+{
+    sim_add_peripheral(&rcc);
+    sim_add_peripheral(&gpio);
+    sim_add_peripheral(&iwdg);
+    sim_add_peripheral(&crc);
+    sim_add_peripheral(&dma2);
+}
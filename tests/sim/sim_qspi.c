@@ -0,0 +1,525 @@
+#include <string.h>
+#include <sys/mman.h>
+
+#include "sim.h"
+
+/*
+ * QUADSPI and the W25Q128JV on bank 1.
+ *
+ * Indirect, automatic polling and memory-mapped mode are modelled, transfers on the bus take no
+ * time and the data register is accessed a byte at a time. Every command is checked against
+ * the line modes and dummy cycles of the datasheet, and against the state of the device: one
+ * it would not execute as intended ends the test, as a command other than a status read or
+ * reset while the device is busy or a quad transfer with the QE bit clear. Without WEL set,
+ * erase, program and status writes are ignored as on the real part.
+ *
+ * Erase and page program take their typical time, programming can only clear bits and wraps
+ * around within the page. A status read while polling a busy device moves the clock on by up
+ * to POLL_SKIP_CYCLES, so waiting for an erase does not take thousands of trapped accesses.
+ *
+ * The window at SIM_QSPI_MAPPED_BASE_ADDR can only be read in memory-mapped mode. The device is
+ * not reset with the MCU: its contents, the QE bit and an erase or program in progress survive
+ * sim_reset().
+ *
+ * sim_qspi_set_connected(0) takes the device off the bus: the controller still completes every
+ * transfer, but nothing is executed and every byte read is 0xFF as on floating lines with the
+ * pull-ups of the pads, so the BUSY bit never clears.
+ */
+#define QUADSPI_BASE_ADDR       0xA0001000U
+#define QSPI(offset)            SIM_REG(QUADSPI_BASE_ADDR + (offset))
+
+#define QSPI_CR                 0x00
+#define QSPI_SR                 0x08
+#define QSPI_FCR                0x0C
+#define QSPI_DLR                0x10
+#define QSPI_CCR                0x14
+#define QSPI_AR                 0x18
+#define QSPI_DR                 0x20
+#define QSPI_PSMKR              0x24
+#define QSPI_PSMAR              0x28
+
+#define QSPI_CR_EN              (1U << 0)
+#define QSPI_CR_ABORT           (1U << 1)
+#define QSPI_CR_APMS            (1U << 22)
+#define QSPI_SR_TCF             (1U << 1)
+#define QSPI_SR_FTF             (1U << 2)
+#define QSPI_SR_SMF             (1U << 3)
+#define QSPI_SR_BUSY            (1U << 5)
+#define QSPI_FCR_FLAGS          0x1BU
+#define QSPI_CCR_INSTRUCTION(ccr)   ((ccr) & 0xFF)
+#define QSPI_CCR_IMODE(ccr)     (((ccr) >> 8) & 3)
+#define QSPI_CCR_ADMODE(ccr)    (((ccr) >> 10) & 3)
+#define QSPI_CCR_ADSIZE(ccr)    (((ccr) >> 12) & 3)
+#define QSPI_CCR_ABMODE(ccr)    (((ccr) >> 14) & 3)
+#define QSPI_CCR_DCYC(ccr)      (((ccr) >> 18) & 0x1F)
+#define QSPI_CCR_DMODE(ccr)     (((ccr) >> 24) & 3)
+#define QSPI_CCR_FMODE(ccr)     (((ccr) >> 26) & 3)
+#define QSPI_CCR_DDRM           (1U << 31)
+#define QSPI_MODE_1LINE         1
+#define QSPI_MODE_4LINES        3
+#define QSPI_ADSIZE_24BIT       2
+#define QSPI_FMODE_WRITE        0
+#define QSPI_FMODE_READ         1
+#define QSPI_FMODE_POLL         2
+#define QSPI_FMODE_MAPPED       3
+
+/* State of the controller */
+#define QSPI_IDLE               0
+#define QSPI_ADDRESS            1       // Waits for AR
+#define QSPI_WRITING            2       // Waits for DLR + 1 bytes in DR
+#define QSPI_READING            3       // Read data left in the FIFO
+#define QSPI_POLLING            4
+#define QSPI_MAPPED             5
+
+#define QSPI_DATA_MAX           4096
+#define POLL_SKIP_CYCLES        (SIM_CORE_CLOCK_HZ / 10000)     // 100 us
+
+/* W25Q128JV instructions and typical timings (datasheet, 9.6) */
+#define NOR_WRITE_ENABLE        0x06
+#define NOR_READ_STATUS_1       0x05
+#define NOR_READ_STATUS_2       0x35
+#define NOR_WRITE_STATUS_2      0x31
+#define NOR_SECTOR_ERASE        0x20
+#define NOR_BLOCK_ERASE         0xD8
+#define NOR_QUAD_PAGE_PROGRAM   0x32
+#define NOR_FAST_READ_QUAD_OUT  0x6B
+#define NOR_RESET_ENABLE        0x66
+#define NOR_RESET               0x99
+#define NOR_STATUS_1_BUSY       (1U << 0)
+#define NOR_STATUS_1_WEL        (1U << 1)
+#define NOR_STATUS_2_QE         (1U << 1)
+#define NOR_PAGE_SIZE           256
+#define NOR_SECTOR_SIZE         (4 * 1024)
+#define NOR_BLOCK_SIZE          (64 * 1024)
+#define NOR_US(us)              ((uint64_t)(us) * (SIM_CORE_CLOCK_HZ / 1000000))
+#define NOR_STATUS_WRITE_CYCLES NOR_US(10000)
+#define NOR_PAGE_PROGRAM_CYCLES NOR_US(400)
+#define NOR_SECTOR_ERASE_CYCLES NOR_US(45000)
+#define NOR_BLOCK_ERASE_CYCLES  NOR_US(150000)
+
+#define NOR_DATA_NONE           0
+#define NOR_DATA_IN             1       // From the device
+#define NOR_DATA_OUT            2       // To the device
+
+typedef struct
+{
+    uint8_t instruction;
+    uint8_t address;            // 24-bit address on one line
+    uint8_t data;               // NOR_DATA_*
+    uint8_t data_mode;          // Lines of the data phase, as DMODE
+    uint8_t dummy_cycles;
+} nor_instruction_t;
+
+static const nor_instruction_t nor_instructions[] = {
+    { NOR_WRITE_ENABLE, 0, NOR_DATA_NONE, 0, 0 },
+    { NOR_READ_STATUS_1, 0, NOR_DATA_IN, QSPI_MODE_1LINE, 0 },
+    { NOR_READ_STATUS_2, 0, NOR_DATA_IN, QSPI_MODE_1LINE, 0 },
+    { NOR_WRITE_STATUS_2, 0, NOR_DATA_OUT, QSPI_MODE_1LINE, 0 },
+    { NOR_SECTOR_ERASE, 1, NOR_DATA_NONE, 0, 0 },
+    { NOR_BLOCK_ERASE, 1, NOR_DATA_NONE, 0, 0 },
+    { NOR_QUAD_PAGE_PROGRAM, 1, NOR_DATA_OUT, QSPI_MODE_4LINES, 0 },
+    { NOR_FAST_READ_QUAD_OUT, 1, NOR_DATA_IN, QSPI_MODE_4LINES, 8 },
+    { NOR_RESET_ENABLE, 0, NOR_DATA_NONE, 0, 0 },
+    { NOR_RESET, 0, NOR_DATA_NONE, 0, 0 },
+};
+
+/* Controller */
+static uint8_t state;
+static uint32_t address;
+static uint8_t data[QSPI_DATA_MAX];
+static uint32_t data_length;            // Bytes received for an indirect write
+static uint32_t data_left;              // Bytes left to read
+
+/* Device */
+static uint8_t status_1;
+static uint8_t status_2;
+static uint8_t reset_enabled;
+static uint64_t busy_until;
+static uint8_t connected = 1;
+static sim_qspi_stats_t stats;
+
+static uint8_t nor_busy(void)
+{
+    return sim_cycles() < busy_until;
+}
+
+static uint8_t nor_status_1(void)
+{
+    if (!nor_busy())
+    {
+        status_1 &= ~(NOR_STATUS_1_BUSY | (busy_until != 0 ? NOR_STATUS_1_WEL : 0));
+        busy_until = 0;
+    }
+
+    return status_1;
+}
+
+static uint8_t *nor_mem(uint32_t offset)
+{
+    return sim_mem(SIM_QSPI_MAPPED_BASE_ADDR + offset % SIM_QSPI_FLASH_SIZE);
+}
+
+static void nor_start(uint64_t cycles)
+{
+    status_1 |= NOR_STATUS_1_BUSY;
+    busy_until = sim_cycles() + cycles;
+}
+
+static const nor_instruction_t *nor_check(uint32_t ccr)
+{
+    uint8_t instruction = QSPI_CCR_INSTRUCTION(ccr);
+    const nor_instruction_t *nor = NULL;
+
+    for (uint32_t i = 0; i < sizeof(nor_instructions) / sizeof(nor_instructions[0]); i++)
+    {
+        if (nor_instructions[i].instruction == instruction)
+        {
+            nor = &nor_instructions[i];
+        }
+    }
+
+    if (nor == NULL)
+    {
+        sim_fail("NOR instruction 0x%02X not modelled", instruction);
+    }
+
+    uint8_t reads = QSPI_CCR_FMODE(ccr) != QSPI_FMODE_WRITE;
+
+    if (QSPI_CCR_IMODE(ccr) != QSPI_MODE_1LINE || QSPI_CCR_ABMODE(ccr) != 0 || (ccr & QSPI_CCR_DDRM) ||
+        QSPI_CCR_ADMODE(ccr) != (nor->address ? QSPI_MODE_1LINE : 0) ||
+        (nor->address && QSPI_CCR_ADSIZE(ccr) != QSPI_ADSIZE_24BIT) ||
+        QSPI_CCR_DMODE(ccr) != nor->data_mode || QSPI_CCR_DCYC(ccr) != nor->dummy_cycles ||
+        (nor->data != NOR_DATA_NONE && reads != (nor->data == NOR_DATA_IN)))
+    {
+        sim_fail("NOR instruction 0x%02X does not match CCR 0x%08X", instruction, ccr);
+    }
+
+    /* Only the status can be read and the device reset while an erase or program runs */
+    if (nor_busy() && instruction != NOR_READ_STATUS_1 && instruction != NOR_READ_STATUS_2 &&
+        instruction != NOR_RESET_ENABLE && instruction != NOR_RESET)
+    {
+        sim_fail("NOR instruction 0x%02X while the device is busy", instruction);
+    }
+
+    /* IO2 and IO3 are /WP and /HOLD without QE */
+    if (nor->data_mode == QSPI_MODE_4LINES && !(status_2 & NOR_STATUS_2_QE))
+    {
+        sim_fail("NOR instruction 0x%02X on four lines with QE clear", instruction);
+    }
+
+    return nor;
+}
+
+/* Commands without data from the device */
+static void nor_execute(uint8_t instruction, uint32_t offset, const uint8_t *bytes, uint32_t length)
+{
+    if (!connected)
+    {
+        return;
+    }
+
+    uint8_t enabled = (nor_status_1() & NOR_STATUS_1_WEL) != 0;
+
+    if (instruction != NOR_RESET)
+    {
+        reset_enabled = 0;
+    }
+
+    switch (instruction)
+    {
+    case NOR_WRITE_ENABLE:
+        status_1 |= NOR_STATUS_1_WEL;
+        break;
+    case NOR_WRITE_STATUS_2:
+        if (enabled && length != 0)
+        {
+            status_2 = bytes[0];
+            stats.status_writes++;
+            nor_start(NOR_STATUS_WRITE_CYCLES);
+        }
+        break;
+    case NOR_SECTOR_ERASE:
+    case NOR_BLOCK_ERASE:
+        if (enabled)
+        {
+            uint32_t size = instruction == NOR_SECTOR_ERASE ? NOR_SECTOR_SIZE : NOR_BLOCK_SIZE;
+
+            memset(nor_mem(offset & ~(size - 1)), 0xFF, size);
+            if (instruction == NOR_SECTOR_ERASE)
+            {
+                stats.sector_erases++;
+            }
+            else
+            {
+                stats.block_erases++;
+            }
+            nor_start(instruction == NOR_SECTOR_ERASE ? NOR_SECTOR_ERASE_CYCLES : NOR_BLOCK_ERASE_CYCLES);
+        }
+        break;
+    case NOR_QUAD_PAGE_PROGRAM:
+        if (enabled)
+        {
+            uint32_t page = offset & ~(NOR_PAGE_SIZE - 1);
+
+            /* Past the end of the page the address wraps, the last bytes sent win */
+            for (uint32_t i = 0; i < length; i++)
+            {
+                *nor_mem(page + (offset + i) % NOR_PAGE_SIZE) &= bytes[i];
+            }
+            stats.page_programs++;
+            nor_start(NOR_PAGE_PROGRAM_CYCLES);
+        }
+        break;
+    case NOR_RESET_ENABLE:
+        reset_enabled = 1;
+        break;
+    case NOR_RESET:
+        if (reset_enabled)
+        {
+            /* An erase or program in progress is cut short */
+            status_1 = 0;
+            busy_until = 0;
+            reset_enabled = 0;
+            stats.resets++;
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static uint8_t nor_read(uint8_t instruction)
+{
+    if (!connected)
+    {
+        return 0xFF;
+    }
+
+    switch (instruction)
+    {
+    case NOR_READ_STATUS_1:
+        return nor_status_1();
+    case NOR_READ_STATUS_2:
+        return status_2;
+    default:
+        return *nor_mem(address++);
+    }
+}
+
+static void qspi_set_mapped(uint8_t mapped)
+{
+    mprotect((void *)(uintptr_t)SIM_QSPI_MAPPED_BASE_ADDR, SIM_QSPI_FLASH_SIZE, mapped ? PROT_READ : PROT_NONE);
+    state = mapped ? QSPI_MAPPED : QSPI_IDLE;
+}
+
+/* Instruction, address and, for a read, the data phase */
+static void qspi_start(void)
+{
+    uint32_t ccr = QSPI(QSPI_CCR);
+
+    switch (QSPI_CCR_FMODE(ccr))
+    {
+    case QSPI_FMODE_WRITE:
+        if (QSPI_CCR_DMODE(ccr) != 0)
+        {
+            data_length = 0;
+            state = QSPI_WRITING;
+            return;
+        }
+        nor_execute(QSPI_CCR_INSTRUCTION(ccr), address, NULL, 0);
+        QSPI(QSPI_SR) |= QSPI_SR_TCF;
+        state = QSPI_IDLE;
+        break;
+    case QSPI_FMODE_READ:
+        data_left = QSPI(QSPI_DLR) + 1;
+        QSPI(QSPI_SR) |= QSPI_SR_TCF;
+        state = QSPI_READING;
+        break;
+    case QSPI_FMODE_POLL:
+        if (QSPI(QSPI_DLR) != 0)
+        {
+            sim_fail("QUADSPI automatic polling of %u bytes not modelled", QSPI(QSPI_DLR) + 1);
+        }
+        state = QSPI_POLLING;
+        break;
+    default:
+        if (nor_busy())
+        {
+            sim_fail("QUADSPI memory-mapped mode while the device is busy");
+        }
+        qspi_set_mapped(1);
+        break;
+    }
+}
+
+/* The status byte is sampled as the CPU reads SR */
+static void qspi_poll(void)
+{
+    uint8_t status = nor_read(QSPI_CCR_INSTRUCTION(QSPI(QSPI_CCR)));
+
+    if ((status & QSPI(QSPI_PSMKR)) == (QSPI(QSPI_PSMAR) & QSPI(QSPI_PSMKR)))
+    {
+        QSPI(QSPI_SR) |= QSPI_SR_SMF;
+        if (QSPI(QSPI_CR) & QSPI_CR_APMS)
+        {
+            state = QSPI_IDLE;
+        }
+    }
+    else if (!connected)
+    {
+        sim_advance(POLL_SKIP_CYCLES);
+    }
+    else if (nor_busy())
+    {
+        uint64_t left = busy_until - sim_cycles();
+
+        sim_advance(left < POLL_SKIP_CYCLES ? left : POLL_SKIP_CYCLES);
+    }
+}
+
+static uint32_t qspi_read(uint32_t address_read)
+{
+    switch (address_read - QUADSPI_BASE_ADDR)
+    {
+    case QSPI_SR:
+        if (state == QSPI_POLLING)
+        {
+            qspi_poll();
+        }
+        return QSPI(QSPI_SR) | (state != QSPI_IDLE ? QSPI_SR_BUSY : 0) |
+               (state == QSPI_WRITING || (state == QSPI_READING && data_left != 0) ? QSPI_SR_FTF : 0);
+    case QSPI_DR:
+        if (state != QSPI_READING)
+        {
+            sim_fail("QUADSPI DR read outside an indirect read");
+        }
+        uint8_t value = nor_read(QSPI_CCR_INSTRUCTION(QSPI(QSPI_CCR)));
+        if (--data_left == 0)
+        {
+            state = QSPI_IDLE;
+        }
+        return value;
+    default:
+        return SIM_REG(address_read);
+    }
+}
+
+static void qspi_write(uint32_t address_written, uint32_t value)
+{
+    uint32_t offset = address_written - QUADSPI_BASE_ADDR;
+
+    /* While the peripheral is busy only the address it waits for, DR and ABORT can be written */
+    if (state != QSPI_IDLE && offset != QSPI_FCR && offset != QSPI_DR &&
+        !(offset == QSPI_AR && state == QSPI_ADDRESS) && !(offset == QSPI_CR && (value & QSPI_CR_ABORT)))
+    {
+        sim_fail("QUADSPI register 0x%02X written while busy", offset);
+    }
+
+    switch (offset)
+    {
+    case QSPI_CR:
+        QSPI(QSPI_CR) = value & ~QSPI_CR_ABORT;
+        if (value & QSPI_CR_ABORT)
+        {
+            qspi_set_mapped(0);
+        }
+        break;
+    case QSPI_SR:
+        break;
+    case QSPI_FCR:
+        QSPI(QSPI_SR) &= ~(value & QSPI_FCR_FLAGS);
+        break;
+    case QSPI_CCR:
+        if (!(QSPI(QSPI_CR) & QSPI_CR_EN))
+        {
+            sim_fail("QUADSPI command 0x%02X with the peripheral disabled", QSPI_CCR_INSTRUCTION(value));
+        }
+        nor_check(value);
+        QSPI(QSPI_CCR) = value;
+        if (QSPI_CCR_ADMODE(value) != 0 && QSPI_CCR_FMODE(value) != QSPI_FMODE_MAPPED)
+        {
+            state = QSPI_ADDRESS;
+        }
+        else
+        {
+            qspi_start();
+        }
+        break;
+    case QSPI_AR:
+        QSPI(QSPI_AR) = value;
+        address = value;
+        if (state == QSPI_ADDRESS)
+        {
+            qspi_start();
+        }
+        break;
+    case QSPI_DR:
+        if (state != QSPI_WRITING)
+        {
+            sim_fail("QUADSPI DR written outside an indirect write");
+        }
+        if (data_length == QSPI_DATA_MAX)
+        {
+            sim_fail("QUADSPI write of more than %u bytes", QSPI_DATA_MAX);
+        }
+        data[data_length++] = (uint8_t)value;
+        if (data_length == QSPI(QSPI_DLR) + 1)
+        {
+            nor_execute(QSPI_CCR_INSTRUCTION(QSPI(QSPI_CCR)), QSPI(QSPI_AR), data, data_length);
+            QSPI(QSPI_SR) |= QSPI_SR_TCF;
+            state = QSPI_IDLE;
+        }
+        break;
+    default:
+        SIM_REG(address_written) = value;
+        break;
+    }
+}
+
+/* The controller only, the device keeps its state */
+static void qspi_reset(void)
+{
+    qspi_set_mapped(0);
+    address = 0;
+    data_length = 0;
+    data_left = 0;
+}
+
+static const sim_peripheral_t quadspi = { QUADSPI_BASE_ADDR, 0x1000, qspi_read, qspi_write, qspi_reset };
+
+void sim_qspi_init(void)
+{
+    sim_add_peripheral(&quadspi);
+    sim_qspi_erase_all();
+}
+
+/* A device as it comes from the factory: erased, QE clear */
+void sim_qspi_erase_all(void)
+{
+    memset(sim_mem(SIM_QSPI_MAPPED_BASE_ADDR), 0xFF, SIM_QSPI_FLASH_SIZE);
+    status_1 = 0;
+    status_2 = 0;
+    reset_enabled = 0;
+    busy_until = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+uint8_t sim_qspi_busy(void)
+{
+    return nor_busy();
+}
+
+uint8_t sim_qspi_mapped(void)
+{
+    return state == QSPI_MAPPED;
+}
+
+const sim_qspi_stats_t *sim_qspi_get_stats(void)
+{
+    return &stats;
+}
+
+void sim_qspi_set_connected(uint8_t value)
+{
+    connected = value;
+}
@@ -0,0 +1,309 @@
+#include <string.h>
+
+#include "sim.h"
+
+/*
+ * SPI2 in slave mode with the EXTI lines the NSS pin is wired to, and the host as the bus
+ * master on the other end.
+ *
+ * The host clocks queued NSS-framed transactions at SPI_BYTE_CYCLES per byte, leaving the
+ * 10 us spi_slave.h asks for between the address byte and the first dummy byte. Every byte
+ * clocks the one in DR out on MISO and sets RXNE, a byte arriving while RXNE is still set is
+ * lost and counted as an overrun. The end of a transaction is the rising edge of NSS.
+ *
+ * MISO bytes are only taken by the host while the node drives the pin. Of them, only those the
+ * node wrote to DR are returned by sim_spi_take(), a dummy clocked out of an empty DR is
+ * counted as an underrun instead: a real host cannot tell them apart, the tests can.
+ */
+#define SPI2_IRQ_NO             36
+#define EXTI15_10_IRQ_NO        40
+#define SPI2_BASE_ADDR          0x40003800U
+#define SPI_CR1_ADDR            (SPI2_BASE_ADDR + 0x00)
+#define SPI_CR2_ADDR            (SPI2_BASE_ADDR + 0x04)
+#define SPI_SR_ADDR             (SPI2_BASE_ADDR + 0x08)
+#define SPI_DR_ADDR             (SPI2_BASE_ADDR + 0x0C)
+#define SPI_CR1_SPE             (1U << 6)
+#define SPI_CR2_RXNEIE          (1U << 6)
+#define SPI_SR_RXNE             (1U << 0)
+#define SPI_SR_TXE              (1U << 1)
+#define SPI_SR_OVR              (1U << 6)
+
+#define EXTI_BASE_ADDR          0x40013C00U
+#define EXTI_IMR_ADDR           (EXTI_BASE_ADDR + 0x00)
+#define EXTI_RTSR_ADDR          (EXTI_BASE_ADDR + 0x08)
+#define EXTI_PR_ADDR            (EXTI_BASE_ADDR + 0x14)
+#define EXTI15_10_LINES         0xFC00U
+
+#define NSS_PIN                 12
+#define MISO_PIN                14
+#define MODER_ALT_FUNC          2U
+
+#define SPI_BYTE_CYCLES         (SIM_CORE_CLOCK_HZ / 125000)    // 1 MHz SCK
+#define SPI_ADDRESS_GAP_CYCLES  (SIM_CORE_CLOCK_HZ / 100000)    // 10 us after the address byte
+#define SPI_NSS_CYCLES          (SIM_CORE_CLOCK_HZ / 50000)     // 20 us between transactions
+#define SPI_HOST_BUFFER_SIZE    (16 * 1024)
+
+static uint8_t rx_data;
+static uint8_t tx_data;
+static uint8_t tx_loaded;
+
+/* Host side */
+static uint8_t host_data[SPI_HOST_BUFFER_SIZE];
+static uint8_t host_last[SPI_HOST_BUFFER_SIZE];     // Byte ends its transaction
+static uint32_t host_head;
+static uint32_t host_tail;
+static uint32_t host_position;                      // Bytes clocked in the current transaction
+static uint8_t host_scheduled;
+static uint8_t miso_data[SPI_HOST_BUFFER_SIZE];
+static uint32_t miso_length;
+static uint32_t driven_bytes;
+static uint32_t underruns;
+static uint32_t overruns;
+
+static void spi_update_irq(void)
+{
+    sim_set_irq(SPI2_IRQ_NO, (SIM_REG(SPI_SR_ADDR) & SPI_SR_RXNE) && (SIM_REG(SPI_CR2_ADDR) & SPI_CR2_RXNEIE));
+}
+
+static void exti_update_irq(void)
+{
+    sim_set_irq(EXTI15_10_IRQ_NO, (SIM_REG(EXTI_PR_ADDR) & SIM_REG(EXTI_IMR_ADDR) & EXTI15_10_LINES) != 0);
+}
+
+static uint8_t miso_driven(void)
+{
+    return ((SIM_REG((uint32_t)(uintptr_t)&GPIOB->MODER) >> (2 * MISO_PIN)) & 3) == MODER_ALT_FUNC;
+}
+
+/* One byte in each direction */
+static void spi_transfer(uint8_t byte)
+{
+    if (!(SIM_REG(SPI_CR1_ADDR) & SPI_CR1_SPE))
+    {
+        return;
+    }
+
+    if (miso_driven())
+    {
+        driven_bytes++;
+        if (!tx_loaded)
+        {
+            underruns++;
+        }
+        else if (miso_length < SPI_HOST_BUFFER_SIZE)
+        {
+            miso_data[miso_length++] = tx_data;
+        }
+        else
+        {
+            sim_fail("SPI host buffer full");
+        }
+    }
+    tx_loaded = 0;
+
+    if (SIM_REG(SPI_SR_ADDR) & SPI_SR_RXNE)
+    {
+        SIM_REG(SPI_SR_ADDR) |= SPI_SR_OVR;
+        overruns++;
+    }
+    else
+    {
+        rx_data = byte;
+        SIM_REG(SPI_SR_ADDR) |= SPI_SR_RXNE;
+    }
+    spi_update_irq();
+}
+
+/* Rising edge of NSS */
+static void nss_rise(void)
+{
+    if (SIM_REG(EXTI_RTSR_ADDR) & (1U << NSS_PIN))
+    {
+        SIM_REG(EXTI_PR_ADDR) |= 1U << NSS_PIN;
+        exti_update_irq();
+    }
+}
+
+static void host_clock(void *arg);
+
+static void host_schedule(void)
+{
+    uint64_t delay = SPI_BYTE_CYCLES;
+
+    if (host_head == host_tail)
+    {
+        host_scheduled = 0;
+        return;
+    }
+
+    if (host_position == 0)
+    {
+        delay += SPI_NSS_CYCLES;
+    }
+    else if (host_position == 1)
+    {
+        delay += SPI_ADDRESS_GAP_CYCLES;
+    }
+
+    host_scheduled = 1;
+    sim_schedule(delay, host_clock, NULL);
+}
+
+static void host_clock(void *arg)
+{
+    uint32_t index = host_tail++ % SPI_HOST_BUFFER_SIZE;
+
+    spi_transfer(host_data[index]);
+    host_position++;
+
+    if (host_last[index])
+    {
+        host_position = 0;
+        nss_rise();
+    }
+
+    host_schedule();
+}
+
+static uint32_t spi_read(uint32_t address)
+{
+    switch (address)
+    {
+    case SPI_SR_ADDR:
+        return SIM_REG(address) | (tx_loaded ? 0 : SPI_SR_TXE);
+    case SPI_DR_ADDR:
+        SIM_REG(SPI_SR_ADDR) &= ~SPI_SR_RXNE;
+        spi_update_irq();
+        return rx_data;
+    default:
+        return SIM_REG(address);
+    }
+}
+
+static void spi_write(uint32_t address, uint32_t value)
+{
+    switch (address)
+    {
+    case SPI_SR_ADDR:
+        break;
+    case SPI_DR_ADDR:
+        tx_data = (uint8_t)value;
+        tx_loaded = 1;
+        break;
+    default:
+        SIM_REG(address) = value;
+        spi_update_irq();
+        break;
+    }
+}
+
+/* Also run through the RCC reset bit, the host on the bus keeps going */
+static void spi_reset(void)
+{
+    rx_data = 0;
+    tx_loaded = 0;
+    spi_update_irq();
+}
+
+static void exti_write(uint32_t address, uint32_t value)
+{
+    if (address == EXTI_PR_ADDR)
+    {
+        SIM_REG(address) &= ~value;
+    }
+    else
+    {
+        SIM_REG(address) = value;
+    }
+    exti_update_irq();
+}
+
+/* NSS and the host driving it */
+static void exti_reset(void)
+{
+    host_head = 0;
+    host_tail = 0;
+    host_position = 0;
+    host_scheduled = 0;
+    miso_length = 0;
+    driven_bytes = 0;
+    underruns = 0;
+    overruns = 0;
+}
+
+static const sim_peripheral_t spi2 = { SPI2_BASE_ADDR, 0x400, spi_read, spi_write, spi_reset };
+static const sim_peripheral_t exti = { EXTI_BASE_ADDR, 0x400, NULL, exti_write, exti_reset };
+
+void sim_spi_init(void)
+{
+    sim_add_peripheral(&spi2);
+    sim_add_peripheral(&exti);
+}
+
+void sim_spi_transaction(const uint8_t *data, uint32_t length)
+{
+    if (length == 0)
+    {
+        return;
+    }
+    if (length > SPI_HOST_BUFFER_SIZE - (host_head - host_tail))
+    {
+        sim_fail("SPI host buffer full");
+    }
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        host_data[host_head % SPI_HOST_BUFFER_SIZE] = data[i];
+        host_last[host_head % SPI_HOST_BUFFER_SIZE] = i == length - 1;
+        host_head++;
+    }
+
+    if (!host_scheduled)
+    {
+        host_schedule();
+    }
+}
+
+/* Polls the node: its ID followed by num_of_dummies dummy bytes */
+void sim_spi_poll(uint8_t node_id, uint32_t num_of_dummies)
+{
+    uint8_t data[SPI_HOST_BUFFER_SIZE / 4] = { node_id };
+
+    if (num_of_dummies >= sizeof(data))
+    {
+        sim_fail("SPI poll of %u bytes", num_of_dummies);
+    }
+
+    sim_spi_transaction(data, 1 + num_of_dummies);
+}
+
+uint32_t sim_spi_pending(void)
+{
+    return host_head - host_tail;
+}
+
+uint32_t sim_spi_take(uint8_t *data, uint32_t max_length)
+{
+    uint32_t length = miso_length < max_length ? miso_length : max_length;
+
+    memcpy(data, miso_data, length);
+    memmove(miso_data, &miso_data[length], miso_length - length);
+    miso_length -= length;
+
+    return length;
+}
+
+uint32_t sim_spi_driven_bytes(void)
+{
+    return driven_bytes;
+}
+
+uint32_t sim_spi_underruns(void)
+{
+    return underruns;
+}
+
+uint32_t sim_spi_overruns(void)
+{
+    return overruns;
+}
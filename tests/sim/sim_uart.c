@@ -0,0 +1,245 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sim.h"
+#include "stm32f446xx_gpio.h"
+#include "stm32f446xx_usart.h"
+
+/*
+ * USART2 as seen by the bootloader and the simulated host on the other end of the line.
+ * Received bytes arrive one character time apart and only while RTS is asserted; a byte that
+ * arrives while RXNE is still set is lost and raises ORE. The transmitter is always ready,
+ * usart_transmit() only takes the time the characters need on the line.
+ */
+#define USART2_IRQ_NO           38
+#define USART_SR_ORE            (1U << 3)
+#define USART_SR_RXNE           (1U << 5)
+#define USART_SR_TC             (1U << 6)
+#define USART_SR_TXE            (1U << 7)
+#define USART_CR1_RE            (1U << 2)
+#define USART_CR1_TE            (1U << 3)
+#define USART_CR1_RXNEIE        (1U << 5)
+#define USART_CR1_UE            (1U << 13)
+
+#define UART_DEFAULT_CHAR_CYCLES (10 * SIM_CORE_CLOCK_HZ / 115200)
+#define UART_BUFFER_SIZE        (64 * 1024)
+
+static uint8_t rx_queue[UART_BUFFER_SIZE];
+static uint32_t rx_head;
+static uint32_t rx_tail;
+static uint8_t rx_scheduled;
+static uint8_t tx_capture[UART_BUFFER_SIZE];
+static uint32_t tx_length;
+static uint32_t overruns;
+static uint32_t char_cycles = UART_DEFAULT_CHAR_CYCLES;
+static GPIO_RegDef_t *rts_port;
+static uint8_t rts_pin;
+
+static void uart_update_irq(void)
+{
+    uint32_t sr = SIM_REG((uint32_t)(uintptr_t)&USART2->SR);
+    uint32_t cr1 = SIM_REG((uint32_t)(uintptr_t)&USART2->CR1);
+
+    sim_set_irq(USART2_IRQ_NO, (sr & USART_SR_RXNE) && (cr1 & USART_CR1_RXNEIE));
+}
+
+static void uart_deliver(void *arg)
+{
+    uint32_t cr1 = SIM_REG((uint32_t)(uintptr_t)&USART2->CR1);
+
+    rx_scheduled = 0;
+    if (rx_head == rx_tail)
+    {
+        return;
+    }
+
+    /* The host checks RTS before every character, a deasserted RTS is polled again a character later */
+    if (rts_port == NULL || !sim_gpio_get_output(rts_port, rts_pin))
+    {
+        uint8_t byte = rx_queue[rx_tail++ % UART_BUFFER_SIZE];
+
+        if ((cr1 & (USART_CR1_UE | USART_CR1_RE)) == (USART_CR1_UE | USART_CR1_RE))
+        {
+            if (SIM_REG((uint32_t)(uintptr_t)&USART2->SR) & USART_SR_RXNE)
+            {
+                SIM_REG((uint32_t)(uintptr_t)&USART2->SR) |= USART_SR_ORE;
+                overruns++;
+            }
+            else
+            {
+                SIM_REG((uint32_t)(uintptr_t)&USART2->DR) = byte;
+                SIM_REG((uint32_t)(uintptr_t)&USART2->SR) |= USART_SR_RXNE;
+            }
+        }
+        uart_update_irq();
+    }
+
+    if (rx_head != rx_tail)
+    {
+        rx_scheduled = 1;
+        sim_schedule(char_cycles, uart_deliver, NULL);
+    }
+}
+
+static uint32_t uart_read(uint32_t address)
+{
+    if (address == (uint32_t)(uintptr_t)&USART2->SR)
+    {
+        return SIM_REG(address) | USART_SR_TXE | USART_SR_TC;
+    }
+    if (address == (uint32_t)(uintptr_t)&USART2->DR)
+    {
+        SIM_REG((uint32_t)(uintptr_t)&USART2->SR) &= ~(USART_SR_RXNE | USART_SR_ORE);
+        uart_update_irq();
+        return SIM_REG(address) & 0xFF;
+    }
+
+    return SIM_REG(address);
+}
+
+static void uart_write(uint32_t address, uint32_t value)
+{
+    if (address == (uint32_t)(uintptr_t)&USART2->DR)
+    {
+        if (tx_length < UART_BUFFER_SIZE)
+        {
+            tx_capture[tx_length++] = (uint8_t)value;
+        }
+        return;
+    }
+    if (address == (uint32_t)(uintptr_t)&USART2->SR)
+    {
+        /* Only clearing TC and RXNE by writing 0 has an effect */
+        SIM_REG(address) &= value | ~USART_SR_RXNE;
+        uart_update_irq();
+        return;
+    }
+
+    SIM_REG(address) = value;
+    uart_update_irq();
+}
+
+static void uart_reset(void)
+{
+    rx_head = 0;
+    rx_tail = 0;
+    rx_scheduled = 0;
+    tx_length = 0;
+    overruns = 0;
+}
+
+static const sim_peripheral_t usart2_model = { USART2_BASE_ADDR, 0x400, uart_read, uart_write, uart_reset };
+
+void sim_uart_init(void)
+{
+    sim_add_peripheral(&usart2_model);
+}
+
+/* The pin the bootloader drives as RTS, NULL for a host without flow control */
+void sim_uart_set_rts(GPIO_RegDef_t *port, uint8_t pin)
+{
+    rts_port = port;
+    rts_pin = pin;
+}
+
+void sim_uart_set_char_cycles(uint32_t cycles)
+{
+    char_cycles = cycles;
+}
+
+/* Queues bytes from the host, the first one arrives a character time from now */
+void sim_uart_send(const uint8_t *data, uint32_t length)
+{
+    if (length > UART_BUFFER_SIZE - (rx_head - rx_tail))
+    {
+        sim_fail("Host UART queue full");
+    }
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        rx_queue[rx_head++ % UART_BUFFER_SIZE] = data[i];
+    }
+
+    if (!rx_scheduled && length != 0)
+    {
+        rx_scheduled = 1;
+        sim_schedule(char_cycles, uart_deliver, NULL);
+    }
+}
+
+/* Bytes sent by the host that the bootloader has not read from DR yet */
+uint32_t sim_uart_pending(void)
+{
+    return rx_head - rx_tail + ((SIM_REG((uint32_t)(uintptr_t)&USART2->SR) & USART_SR_RXNE) ? 1 : 0);
+}
+
+/* Takes up to max_length bytes the bootloader sent, returns how many */
+uint32_t sim_uart_take(uint8_t *data, uint32_t max_length)
+{
+    uint32_t length = tx_length < max_length ? tx_length : max_length;
+
+    memcpy(data, tx_capture, length);
+    memmove(tx_capture, &tx_capture[length], tx_length - length);
+    tx_length -= length;
+
+    return length;
+}
+
+uint32_t sim_uart_overruns(void)
+{
+    return overruns;
+}
+
+/* USART driver stand-ins */
+
+void usart_init(usart_handle_t *usart_handle)
+{
+    /* Characters on the host link take as long as the configured baud rate makes them */
+    if (usart_handle->usartx == USART2)
+    {
+        char_cycles = 10 * SIM_CORE_CLOCK_HZ / usart_handle->config.baudrate;
+    }
+    sim_write((uint32_t)(uintptr_t)&usart_handle->usartx->CR1, USART_CR1_UE | USART_CR1_TE | USART_CR1_RE);
+}
+
+/* Output on other USARTs is debug output, shown with SIM_VERBOSE set in the environment */
+void usart_transmit(usart_handle_t *usart_handle, uint8_t *tx_buffer, uint32_t length)
+{
+    static int verbose = -1;
+
+    if (usart_handle->usartx == USART2)
+    {
+        if (length > UART_BUFFER_SIZE - tx_length)
+        {
+            sim_fail("Bootloader sent more than %u bytes without the host reading them", UART_BUFFER_SIZE);
+        }
+        memcpy(&tx_capture[tx_length], tx_buffer, length);
+        tx_length += length;
+    }
+    else
+    {
+        if (verbose < 0)
+        {
+            verbose = getenv("SIM_VERBOSE") != NULL;
+        }
+        if (verbose)
+        {
+            fwrite(tx_buffer, 1, length, stderr);
+        }
+    }
+
+    sim_advance((uint64_t)length * char_cycles);
+}
+
+void usart_receive(usart_handle_t *usart_handle, uint8_t *rx_buffer, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        while (!(sim_read((uint32_t)(uintptr_t)&usart_handle->usartx->SR) & USART_SR_RXNE))
+        {
+            sim_advance(SIM_ACCESS_CYCLES);
+        }
+        rx_buffer[i] = (uint8_t)sim_read((uint32_t)(uintptr_t)&usart_handle->usartx->DR);
+    }
+}
@@ -0,0 +1,457 @@
+#include <string.h>
+
+#include "sim.h"
+
+/*
+ * USB OTG FS core in device mode with a full-speed host on the other end of the cable.
+ *
+ * Only what a device driver sees is modelled: the receive status queue popped through GRXSTSP
+ * and read through FIFO 0, one transmit FIFO per IN endpoint and the endpoint interrupts
+ * summarised in DAINT and GINTSTS. The host polls an enabled IN endpoint once per packet time
+ * and retries an OUT packet the device NAKs, until the endpoint is enabled again. Control
+ * transfers are sent as SETUP packets without checking the status stage.
+ */
+#define OTG_FS_IRQ_NO           67
+#define OTG_BASE_ADDR           0x50000000U
+#define OTG_ADDR(offset)        (OTG_BASE_ADDR + (offset))
+#define OTG(offset)             SIM_REG(OTG_ADDR(offset))
+
+#define OTG_GAHBCFG             0x008
+#define OTG_GRSTCTL             0x010
+#define OTG_GINTSTS             0x014
+#define OTG_GINTMSK             0x018
+#define OTG_GRXSTSP             0x020
+#define OTG_DCFG                0x800
+#define OTG_DIEPMSK             0x810
+#define OTG_DOEPMSK             0x814
+#define OTG_DAINT               0x818
+#define OTG_DAINTMSK            0x81C
+#define OTG_DIEPCTL(n)          (0x900 + 0x20 * (n))
+#define OTG_DIEPINT(n)          (0x908 + 0x20 * (n))
+#define OTG_DIEPTSIZ(n)         (0x910 + 0x20 * (n))
+#define OTG_DOEPCTL(n)          (0xB00 + 0x20 * (n))
+#define OTG_DOEPINT(n)          (0xB08 + 0x20 * (n))
+#define OTG_FIFO(n)             (0x1000 + 0x1000 * (n))
+
+#define GAHBCFG_GINTMSK         (1U << 0)
+#define GRSTCTL_CSRST           (1U << 0)
+#define GRSTCTL_RXFFLSH         (1U << 4)
+#define GRSTCTL_TXFFLSH         (1U << 5)
+#define GRSTCTL_AHBIDL          (1U << 31)
+#define GINTSTS_RXFLVL          (1U << 4)
+#define GINTSTS_USBRST          (1U << 12)
+#define GINTSTS_ENUMDNE         (1U << 13)
+#define GINTSTS_IEPINT          (1U << 18)
+#define GINTSTS_OEPINT          (1U << 19)
+#define DCFG_DAD_POS            4
+#define DEPCTL_CNAK             (1U << 26)
+#define DEPCTL_SNAK             (1U << 27)
+#define DEPCTL_EPENA            (1U << 31)
+#define DEPINT_XFRC             (1U << 0)
+#define DOEPINT_STUP            (1U << 3)
+#define DEPTSIZ_XFRSIZ_MASK     0x7FFFFU
+#define GRXSTS_BCNT_POS         4
+#define GRXSTS_PKTSTS_POS       17
+#define PKTSTS_OUT_DATA         2
+#define PKTSTS_SETUP_DATA       6
+
+#define USB_NUM_OF_EPS          4
+#define USB_DATA_EP             1
+#define USB_PACKET_SIZE         64
+#define USB_PACKET_CYCLES       (SIM_CORE_CLOCK_HZ / 10000)     // 100 us per packet and retry
+#define USB_RX_QUEUE_SIZE       16
+#define USB_TX_FIFO_SIZE        512
+#define USB_HOST_BUFFER_SIZE    (16 * 1024)
+#define USB_MAX_IN_PACKETS      SIM_USB_MAX_IN_PACKETS
+
+typedef struct
+{
+    uint32_t status;
+    uint8_t data[USB_PACKET_SIZE];
+} rx_entry_t;
+
+static rx_entry_t rx_queue[USB_RX_QUEUE_SIZE];
+static uint32_t rx_head;
+static uint32_t rx_tail;
+static rx_entry_t rx_current;
+static uint32_t rx_current_offset;
+
+static uint8_t tx_fifo[USB_NUM_OF_EPS][USB_TX_FIFO_SIZE];
+static uint32_t tx_length[USB_NUM_OF_EPS];
+static uint8_t in_scheduled[USB_NUM_OF_EPS];
+
+/* Host side */
+static uint8_t host_reading;
+static uint8_t out_data[USB_HOST_BUFFER_SIZE];
+static uint32_t out_head;
+static uint32_t out_tail;
+static uint8_t out_scheduled;
+static uint32_t out_naks;
+static uint8_t in_data[USB_HOST_BUFFER_SIZE];
+static uint32_t in_length;
+static uint16_t in_packets[USB_MAX_IN_PACKETS];
+static uint32_t num_of_in_packets;
+
+static uint32_t usb_daint(void)
+{
+    uint32_t daint = 0;
+
+    for (uint32_t n = 0; n < USB_NUM_OF_EPS; n++)
+    {
+        if (OTG(OTG_DIEPINT(n)) & OTG(OTG_DIEPMSK))
+        {
+            daint |= 1U << n;
+        }
+        if (OTG(OTG_DOEPINT(n)) & OTG(OTG_DOEPMSK))
+        {
+            daint |= 1U << (16 + n);
+        }
+    }
+
+    return daint;
+}
+
+static uint32_t usb_gintsts(void)
+{
+    uint32_t daint = usb_daint() & OTG(OTG_DAINTMSK);
+    uint32_t gintsts = OTG(OTG_GINTSTS) & (GINTSTS_USBRST | GINTSTS_ENUMDNE);
+
+    if (rx_head != rx_tail)
+    {
+        gintsts |= GINTSTS_RXFLVL;
+    }
+    if (daint & 0xFFFFU)
+    {
+        gintsts |= GINTSTS_IEPINT;
+    }
+    if (daint >> 16)
+    {
+        gintsts |= GINTSTS_OEPINT;
+    }
+
+    return gintsts;
+}
+
+static void usb_update_irq(void)
+{
+    sim_set_irq(OTG_FS_IRQ_NO, (OTG(OTG_GAHBCFG) & GAHBCFG_GINTMSK) && (usb_gintsts() & OTG(OTG_GINTMSK)));
+}
+
+static void rx_push(uint8_t ep_number, uint8_t packet_status, const uint8_t *data, uint32_t length)
+{
+    if (rx_head - rx_tail == USB_RX_QUEUE_SIZE)
+    {
+        sim_fail("USB receive FIFO overflow");
+    }
+
+    rx_entry_t *entry = &rx_queue[rx_head++ % USB_RX_QUEUE_SIZE];
+    entry->status = ep_number | (length << GRXSTS_BCNT_POS) | ((uint32_t)packet_status << GRXSTS_PKTSTS_POS);
+    memcpy(entry->data, data, length);
+}
+
+static void in_complete(void *arg)
+{
+    uint32_t n = (uint32_t)(uintptr_t)arg;
+    uint32_t length = OTG(OTG_DIEPTSIZ(n)) & DEPTSIZ_XFRSIZ_MASK;
+
+    in_scheduled[n] = 0;
+    if (!(OTG(OTG_DIEPCTL(n)) & DEPCTL_EPENA) || (n != 0 && !host_reading))
+    {
+        return;
+    }
+
+    if (n == USB_DATA_EP)
+    {
+        if (length > USB_HOST_BUFFER_SIZE - in_length || num_of_in_packets == USB_MAX_IN_PACKETS)
+        {
+            sim_fail("USB host buffer full");
+        }
+        memcpy(&in_data[in_length], tx_fifo[n], length);
+        in_length += length;
+        in_packets[num_of_in_packets++] = length;
+    }
+
+    /* What was written beyond the transfer size was word padding */
+    tx_length[n] = 0;
+    OTG(OTG_DIEPCTL(n)) &= ~DEPCTL_EPENA;
+    OTG(OTG_DIEPINT(n)) |= DEPINT_XFRC;
+    usb_update_irq();
+}
+
+/* The host fetches a packet once the endpoint is enabled and the FIFO holds all of it */
+static void in_try(uint32_t n)
+{
+    uint32_t length = OTG(OTG_DIEPTSIZ(n)) & DEPTSIZ_XFRSIZ_MASK;
+
+    if (!in_scheduled[n] && (OTG(OTG_DIEPCTL(n)) & DEPCTL_EPENA) && tx_length[n] >= length &&
+        (n == 0 || host_reading))
+    {
+        in_scheduled[n] = 1;
+        sim_schedule(USB_PACKET_CYCLES, in_complete, (void *)(uintptr_t)n);
+    }
+}
+
+static void out_send(void *arg)
+{
+    out_scheduled = 0;
+    if (out_head == out_tail)
+    {
+        return;
+    }
+
+    if (OTG(OTG_DOEPCTL(USB_DATA_EP)) & DEPCTL_EPENA)
+    {
+        uint8_t packet[USB_PACKET_SIZE];
+        uint32_t length = 0;
+
+        while (length < USB_PACKET_SIZE && out_tail != out_head)
+        {
+            packet[length++] = out_data[out_tail++ % USB_HOST_BUFFER_SIZE];
+        }
+
+        rx_push(USB_DATA_EP, PKTSTS_OUT_DATA, packet, length);
+        OTG(OTG_DOEPCTL(USB_DATA_EP)) &= ~DEPCTL_EPENA;
+        OTG(OTG_DOEPINT(USB_DATA_EP)) |= DEPINT_XFRC;
+        usb_update_irq();
+    }
+    else
+    {
+        out_naks++;
+    }
+
+    if (out_head != out_tail)
+    {
+        out_scheduled = 1;
+        sim_schedule(USB_PACKET_CYCLES, out_send, NULL);
+    }
+}
+
+static uint32_t usb_read(uint32_t address)
+{
+    uint32_t offset = address - OTG_BASE_ADDR;
+
+    switch (offset)
+    {
+    case OTG_GRSTCTL:
+        return SIM_REG(address) | GRSTCTL_AHBIDL;
+    case OTG_GINTSTS:
+        return usb_gintsts();
+    case OTG_DAINT:
+        return usb_daint();
+    case OTG_GRXSTSP:
+        if (rx_head == rx_tail)
+        {
+            return 0;
+        }
+        rx_current = rx_queue[rx_tail++ % USB_RX_QUEUE_SIZE];
+        rx_current_offset = 0;
+        usb_update_irq();
+        return rx_current.status;
+    default:
+        break;
+    }
+
+    if (offset >= OTG_FIFO(0) && offset < OTG_FIFO(1))
+    {
+        uint32_t word = 0;
+
+        if (rx_current_offset + 4 <= sizeof(rx_current.data))
+        {
+            memcpy(&word, &rx_current.data[rx_current_offset], sizeof(word));
+            rx_current_offset += 4;
+        }
+        return word;
+    }
+
+    return SIM_REG(address);
+}
+
+static void usb_write(uint32_t address, uint32_t value)
+{
+    uint32_t offset = address - OTG_BASE_ADDR;
+
+    if (offset >= OTG_FIFO(0) && offset < OTG_FIFO(USB_NUM_OF_EPS))
+    {
+        uint32_t n = (offset - OTG_FIFO(0)) / 0x1000;
+
+        if (tx_length[n] + 4 > USB_TX_FIFO_SIZE)
+        {
+            sim_fail("USB transmit FIFO %u overflow", n);
+        }
+        memcpy(&tx_fifo[n][tx_length[n]], &value, sizeof(value));
+        tx_length[n] += 4;
+        in_try(n);
+        return;
+    }
+
+    for (uint32_t n = 0; n < USB_NUM_OF_EPS; n++)
+    {
+        if (offset == OTG_DIEPINT(n) || offset == OTG_DOEPINT(n))
+        {
+            SIM_REG(address) &= ~value;
+            usb_update_irq();
+            return;
+        }
+        if (offset == OTG_DIEPCTL(n))
+        {
+            SIM_REG(address) = value & ~(DEPCTL_CNAK | DEPCTL_SNAK);
+            in_try(n);
+            return;
+        }
+        if (offset == OTG_DOEPCTL(n))
+        {
+            SIM_REG(address) = value & ~(DEPCTL_CNAK | DEPCTL_SNAK);
+            return;
+        }
+    }
+
+    switch (offset)
+    {
+    case OTG_GRSTCTL:
+        /* Resets and flushes complete at once */
+        if (value & GRSTCTL_TXFFLSH)
+        {
+            memset(tx_length, 0, sizeof(tx_length));
+        }
+        if (value & GRSTCTL_RXFFLSH)
+        {
+            rx_tail = rx_head;
+        }
+        SIM_REG(address) = value & ~(GRSTCTL_CSRST | GRSTCTL_TXFFLSH | GRSTCTL_RXFFLSH);
+        break;
+    case OTG_GINTSTS:
+        SIM_REG(address) &= ~value;
+        break;
+    default:
+        SIM_REG(address) = value;
+        break;
+    }
+
+    usb_update_irq();
+}
+
+static void usb_reset(void)
+{
+    rx_head = 0;
+    rx_tail = 0;
+    rx_current_offset = sizeof(rx_current.data);
+    memset(tx_length, 0, sizeof(tx_length));
+    memset(in_scheduled, 0, sizeof(in_scheduled));
+    host_reading = 1;
+    out_head = 0;
+    out_tail = 0;
+    out_scheduled = 0;
+    out_naks = 0;
+    in_length = 0;
+    num_of_in_packets = 0;
+}
+
+static const sim_peripheral_t otg_fs = { OTG_BASE_ADDR, 0x20000, usb_read, usb_write, usb_reset };
+
+void sim_usb_init(void)
+{
+    sim_add_peripheral(&otg_fs);
+}
+
+/* Bus reset followed by the end of speed enumeration, as when the cable is plugged in */
+void sim_usb_bus_reset(void)
+{
+    OTG(OTG_GINTSTS) |= GINTSTS_USBRST | GINTSTS_ENUMDNE;
+    usb_update_irq();
+}
+
+void sim_usb_setup(uint8_t request_type, uint8_t request, uint16_t value, uint16_t index, uint16_t length)
+{
+    uint8_t setup[8] = {
+        request_type, request, value & 0xFF, value >> 8, index & 0xFF, index >> 8, length & 0xFF, length >> 8
+    };
+
+    rx_push(0, PKTSTS_SETUP_DATA, setup, sizeof(setup));
+    OTG(OTG_DOEPINT(0)) |= DOEPINT_STUP;
+    usb_update_irq();
+}
+
+static void enumerate_step(void *arg)
+{
+    switch ((uintptr_t)arg)
+    {
+    case 0:
+        sim_usb_bus_reset();
+        break;
+    case 1:
+        sim_usb_setup(0x00, 0x05, SIM_USB_ADDRESS, 0, 0);         // SET_ADDRESS
+        break;
+    case 2:
+        sim_usb_setup(0x00, 0x09, 1, 0, 0);                       // SET_CONFIGURATION
+        return;
+    }
+
+    sim_schedule(SIM_MS(1), enumerate_step, (void *)((uintptr_t)arg + 1));
+}
+
+/* Resets the bus and configures the device, one step per millisecond from now */
+void sim_usb_enumerate(void)
+{
+    sim_schedule(SIM_MS(1), enumerate_step, (void *)0);
+}
+
+uint8_t sim_usb_address(void)
+{
+    return (OTG(OTG_DCFG) >> DCFG_DAD_POS) & 0x7F;
+}
+
+/* A host that stops reading leaves IN packets in the FIFO, resuming fetches them */
+void sim_usb_set_host_reading(uint8_t reading)
+{
+    host_reading = reading;
+    for (uint32_t n = 0; n < USB_NUM_OF_EPS; n++)
+    {
+        in_try(n);
+    }
+}
+
+/* Queues bytes for the bulk OUT endpoint, sent in full-size packets */
+void sim_usb_send(const uint8_t *data, uint32_t length)
+{
+    if (length > USB_HOST_BUFFER_SIZE - (out_head - out_tail))
+    {
+        sim_fail("USB host OUT queue full");
+    }
+
+    for (uint32_t i = 0; i < length; i++)
+    {
+        out_data[out_head++ % USB_HOST_BUFFER_SIZE] = data[i];
+    }
+
+    if (!out_scheduled && length != 0)
+    {
+        out_scheduled = 1;
+        sim_schedule(USB_PACKET_CYCLES, out_send, NULL);
+    }
+}
+
+uint32_t sim_usb_out_naks(void)
+{
+    return out_naks;
+}
+
+/* Takes what the host read from the bulk IN endpoint and the size of every packet it came in */
+uint32_t sim_usb_take(uint8_t *data, uint32_t max_length, uint16_t *packets, uint32_t *num_of_packets)
+{
+    uint32_t length = in_length < max_length ? in_length : max_length;
+
+    memcpy(data, in_data, length);
+    if (packets != NULL)
+    {
+        memcpy(packets, in_packets, num_of_in_packets * sizeof(in_packets[0]));
+    }
+    if (num_of_packets != NULL)
+    {
+        *num_of_packets = num_of_in_packets;
+    }
+
+    in_length = 0;
+    num_of_in_packets = 0;
+
+    return length;
+}
@@ -0,0 +1,485 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "harness.h"
+#include "sim_core.h"
+#include "bootloader.h"
+#include "transport.h"
+#include "can_isotp.h"
+
+/*
+ * CAN ISO-TP transport against the simulated bxCAN and a host on the bus: single and
+ * segmented messages in both directions, the pacing by flow control that keeps the three
+ * frame receive FIFO from overrunning, the acceptance filter, the bounded waits for a
+ * mailbox nobody acknowledges and for the flow control of the host, and the separation time
+ * the host asks for.
+ */
+#define REQUEST_ID              (CAN_ISOTP_REQUEST_BASE_ID + BL_NODE_ID)
+#define BROADCAST_ID            (CAN_ISOTP_REQUEST_BASE_ID + BL_BROADCAST_NODE_ID)
+#define RESPONSE_ID             (CAN_ISOTP_RESPONSE_BASE_ID + BL_NODE_ID)
+#define OTHER_REQUEST_ID        (CAN_ISOTP_REQUEST_BASE_ID + BL_NODE_ID + 1)
+
+#define ISOTP_SINGLE_FRAME      0x0
+#define ISOTP_FIRST_FRAME       0x1
+#define ISOTP_CONSECUTIVE_FRAME 0x2
+#define ISOTP_FLOW_CONTROL      0x3
+#define ISOTP_FC_CONTINUE       0x0
+#define ISOTP_FC_WAIT           0x1
+#define FC_WAIT_INTERVAL_MS     500     // Between the FC_WAIT frames of the host, below N_Bs
+#define ISOTP_PADDING_BYTE      0xCC
+
+static uint32_t failures;
+
+#define CHECK(condition)                                                            \
+    do                                                                              \
+    {                                                                               \
+        if (!(condition))                                                           \
+        {                                                                           \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__,    \
+                    __func__, #condition);                                          \
+            failures++;                                                             \
+        }                                                                           \
+    } while (0)
+
+/* ISO-TP on the host side, run from the end of every frame the node sends */
+static struct
+{
+    uint32_t id;
+    const uint8_t *data;
+    uint32_t length;
+    uint32_t offset;
+    uint8_t sequence;
+    uint8_t ignore_flow_control;    // Sends all consecutive frames at once, as a careless host would
+    uint32_t flow_controls;         // Received from the node
+} host_tx;
+
+static struct
+{
+    uint8_t data[HARNESS_REPLY_MAX_SIZE];   // Every message received, back to back
+    uint32_t length;
+    uint32_t message_length;
+    uint32_t message_received;
+    uint8_t sequence;
+    uint32_t num_of_messages;
+    uint32_t bad_frames;
+    uint8_t silent;                 // Never answers a first frame
+    uint32_t fc_waits;              // FC_WAIT frames to send before the FC_CONTINUE
+    uint32_t fc_waits_sent;
+    uint8_t st_min;                 // Of the FC_CONTINUE
+    uint64_t last_consecutive;      // Cycle count at the last consecutive frame
+    uint64_t min_gap;               // Shortest time between two consecutive frames
+} host_rx;
+
+static uintptr_t host_exchanges;       // Counted by host_reset()
+static uint8_t tx_data[8];
+static uint8_t *frame;
+static uint8_t available;
+
+static void start_entry(void)
+{
+    can_isotp_init();
+}
+
+static void frame_entry(void)
+{
+    static uint8_t rx_buffer[HARNESS_FRAME_MAX_SIZE] __attribute__((aligned(4)));
+
+    transport_wait_for_host(0);
+    frame = bootloader_receive_frame(rx_buffer);
+    if (frame != NULL)
+    {
+        bootloader_process_frame(frame);
+    }
+}
+
+/* Lets the last frames of a reply cross the bus */
+static void wait_entry(void)
+{
+    sim_advance(SIM_MS(5));
+}
+
+/* The bootloader does not poll the FIFO for a while */
+static void busy_entry(void)
+{
+    sim_advance(SIM_MS(20));
+    available = can_isotp_data_available();
+}
+
+/* Two single frame messages, the second one has to wait for the mailbox */
+static void send_entry(void)
+{
+    can_isotp_send(tx_data, sizeof(tx_data) - 1);
+    can_isotp_send(tx_data, sizeof(tx_data) - 1);
+}
+
+static void host_frame(uint32_t id, const uint8_t *data, uint32_t length)
+{
+    uint8_t padded[8];
+
+    memset(padded, ISOTP_PADDING_BYTE, sizeof(padded));
+    memcpy(padded, data, length);
+    sim_can_send(id, padded, sizeof(padded));
+}
+
+static void host_send_consecutive(uint32_t count)
+{
+    while (count-- && host_tx.offset < host_tx.length)
+    {
+        uint8_t data[8] = { (ISOTP_CONSECUTIVE_FRAME << 4) | host_tx.sequence };
+        uint32_t chunk = host_tx.length - host_tx.offset > 7 ? 7 : host_tx.length - host_tx.offset;
+
+        memcpy(&data[1], &host_tx.data[host_tx.offset], chunk);
+        host_frame(host_tx.id, data, 1 + chunk);
+        host_tx.offset += chunk;
+        host_tx.sequence = (host_tx.sequence + 1) & 0x0F;
+    }
+}
+
+static void host_send(uint32_t id, const uint8_t *data, uint32_t length)
+{
+    uint8_t first[8];
+
+    if (length <= 7)
+    {
+        first[0] = (ISOTP_SINGLE_FRAME << 4) | length;
+        memcpy(&first[1], data, length);
+        host_frame(id, first, 1 + length);
+        return;
+    }
+
+    host_tx.id = id;
+    host_tx.data = data;
+    host_tx.length = length;
+    host_tx.offset = 6;
+    host_tx.sequence = 1;
+    first[0] = (ISOTP_FIRST_FRAME << 4) | (length >> 8);
+    first[1] = length & 0xFF;
+    memcpy(&first[2], data, 6);
+    host_frame(id, first, sizeof(first));
+
+    if (host_tx.ignore_flow_control)
+    {
+        host_send_consecutive(UINT32_MAX);
+    }
+}
+
+/* FC_WAIT until host_rx.fc_waits are sent, then FC_CONTINUE. arg is the exchange it belongs to. */
+static void host_flow_control(void *arg)
+{
+    uint8_t flow_control[3] = { (ISOTP_FLOW_CONTROL << 4) | ISOTP_FC_CONTINUE, 0, host_rx.st_min };
+
+    if ((uintptr_t)arg != host_exchanges)
+    {
+        return;
+    }
+
+    if (host_rx.fc_waits_sent < host_rx.fc_waits)
+    {
+        flow_control[0] = (ISOTP_FLOW_CONTROL << 4) | ISOTP_FC_WAIT;
+        host_rx.fc_waits_sent++;
+        sim_schedule(SIM_MS(FC_WAIT_INTERVAL_MS), host_flow_control, arg);
+    }
+    host_frame(REQUEST_ID, flow_control, sizeof(flow_control));
+}
+
+static void host_message_done(const uint8_t *data, uint32_t length)
+{
+    memcpy(&host_rx.data[host_rx.length], data, length);
+    host_rx.length += length;
+    host_rx.num_of_messages++;
+}
+
+static void host_receive(const sim_can_frame_t *can_frame)
+{
+    static uint8_t message[CAN_ISOTP_MAX_MESSAGE_SIZE];
+    const uint8_t *data = can_frame->data;
+    uint32_t length;
+
+    if (can_frame->id != RESPONSE_ID || can_frame->dlc != 8)
+    {
+        host_rx.bad_frames++;
+        return;
+    }
+
+    switch (data[0] >> 4)
+    {
+    case ISOTP_SINGLE_FRAME:
+        host_message_done(&data[1], data[0] & 0x0F);
+        break;
+    case ISOTP_FIRST_FRAME:
+        host_rx.message_length = ((data[0] & 0x0F) << 8) | data[1];
+        host_rx.message_received = 6;
+        host_rx.sequence = 1;
+        host_rx.last_consecutive = 0;
+        memcpy(message, &data[2], 6);
+        /* Any number of consecutive frames, STmin apart */
+        if (!host_rx.silent)
+        {
+            host_flow_control((void *)host_exchanges);
+        }
+        break;
+    case ISOTP_CONSECUTIVE_FRAME:
+        if ((data[0] & 0x0F) != host_rx.sequence || host_rx.message_received >= host_rx.message_length)
+        {
+            host_rx.bad_frames++;
+            break;
+        }
+        if (host_rx.last_consecutive != 0 && sim_cycles() - host_rx.last_consecutive < host_rx.min_gap)
+        {
+            host_rx.min_gap = sim_cycles() - host_rx.last_consecutive;
+        }
+        host_rx.last_consecutive = sim_cycles();
+        length = host_rx.message_length - host_rx.message_received;
+        length = length > 7 ? 7 : length;
+        memcpy(&message[host_rx.message_received], &data[1], length);
+        host_rx.message_received += length;
+        host_rx.sequence = (host_rx.sequence + 1) & 0x0F;
+        if (host_rx.message_received == host_rx.message_length)
+        {
+            host_message_done(message, host_rx.message_length);
+        }
+        break;
+    case ISOTP_FLOW_CONTROL:
+        host_tx.flow_controls++;
+        if ((data[0] & 0x0F) == ISOTP_FC_CONTINUE && !host_tx.ignore_flow_control)
+        {
+            host_send_consecutive(data[1] != 0 ? data[1] : UINT32_MAX);
+        }
+        break;
+    default:
+        host_rx.bad_frames++;
+        break;
+    }
+}
+
+static void host_reset(void)
+{
+    memset(&host_tx, 0, sizeof(host_tx));
+    memset(&host_rx, 0, sizeof(host_rx));
+    host_rx.min_gap = UINT64_MAX;
+    host_exchanges++;
+}
+
+/* Sends a frame as one ISO-TP message and collects the reply */
+static void exchange(uint32_t id, const uint8_t *request, uint32_t size)
+{
+    host_reset();
+    host_send(id, request, size);
+    CHECK(sim_run(frame_entry) == SIM_RETURNED);
+    CHECK(frame != NULL && memcmp(frame, request, size) == 0);
+    CHECK(sim_run(wait_entry) == SIM_RETURNED);
+    CHECK(host_rx.bad_frames == 0);
+}
+
+static void test_single_frames(void)
+{
+    uint8_t request[HARNESS_FRAME_MAX_SIZE];
+    uint32_t size = harness_build_frame(request, BL_GET_VER, NULL, 0);
+
+    sim_can_set_receiver(host_receive);
+    CHECK(sim_run(start_entry) == SIM_RETURNED);
+    exchange(REQUEST_ID, request, size);
+
+    CHECK(strcmp(transport_get_active()->name, "can1") == 0);
+    CHECK(host_rx.num_of_messages == 2);
+    CHECK(host_rx.length == 3 && host_rx.data[0] == BL_ACK && host_rx.data[1] == 1 && host_rx.data[2] == BL_VERSION);
+}
+
+/* The node lets CAN_ISOTP_BLOCK_SIZE frames through per flow control frame, so none is lost */
+static void test_segmented_request(void)
+{
+    uint8_t request[HARNESS_FRAME_MAX_SIZE];
+    uint8_t fields[5 + 200];
+    uint32_t address = BOARD_APP_BASE_ADDR + 0x5000;
+    uint32_t overruns = sim_can_overruns();
+
+    memcpy(fields, &address, sizeof(address));
+    fields[4] = 200;
+    for (uint32_t i = 0; i < 200; i++)
+    {
+        fields[5 + i] = (uint8_t)(i * 5 + 3);
+    }
+    uint32_t size = harness_build_frame(request, BL_MEM_WRITE, fields, sizeof(fields));
+    uint32_t num_of_consecutive = (size - 6 + 7 - 1) / 7;
+
+    exchange(REQUEST_ID, request, size);
+
+    CHECK(sim_can_overruns() == overruns);
+    CHECK(host_tx.flow_controls == 1 + (num_of_consecutive - 1) / CAN_ISOTP_BLOCK_SIZE);
+    CHECK(host_rx.length == 3 && host_rx.data[0] == BL_ACK && host_rx.data[2] == FLASH_SUCCESS);
+    CHECK(memcmp(sim_mem(address), &fields[5], 200) == 0);
+}
+
+static void test_segmented_reply(void)
+{
+    uint8_t request[HARNESS_FRAME_MAX_SIZE];
+    uint8_t fields[5];
+    uint32_t address = BOARD_APP_BASE_ADDR + 0x5000;
+
+    memcpy(fields, &address, sizeof(address));
+    fields[4] = 128;
+    uint32_t size = harness_build_frame(request, BL_MEM_READ, fields, sizeof(fields));
+
+    exchange(REQUEST_ID, request, size);
+
+    CHECK(host_rx.num_of_messages == 2);
+    CHECK(host_rx.length == 2 + 1 + 128 && host_rx.data[0] == BL_ACK && host_rx.data[1] == 1 + 128);
+    CHECK(host_rx.data[2] == FLASH_SUCCESS && memcmp(&host_rx.data[3], sim_mem(address), 128) == 0);
+}
+
+/* Frames for another node are filtered out, a broadcast is answered on the response ID */
+static void test_addressing(void)
+{
+    uint8_t request[HARNESS_FRAME_MAX_SIZE];
+    uint8_t other[HARNESS_FRAME_MAX_SIZE];
+    uint32_t size = harness_build_frame(request, BL_GET_VER, NULL, 0);
+    uint32_t other_size = harness_build_frame(other, BL_GET_DEV_ID, NULL, 0);
+
+    host_reset();
+    host_send(OTHER_REQUEST_ID, other, other_size);
+    host_send(BROADCAST_ID, request, size);
+    CHECK(sim_run(frame_entry) == SIM_RETURNED);
+    CHECK(frame != NULL && frame[1] == BL_GET_VER);
+    CHECK(sim_run(wait_entry) == SIM_RETURNED);
+    CHECK(!can_isotp_data_available());
+    CHECK(host_rx.length == 3 && host_rx.data[2] == BL_VERSION);
+}
+
+/* Without the pacing, a node that is not polling loses frames and with them the message */
+static void test_flow_control_ignored(void)
+{
+    uint8_t request[HARNESS_FRAME_MAX_SIZE];
+    uint8_t fields[5 + 64];
+    uint32_t address = BOARD_APP_BASE_ADDR + 0x6000;
+    uint32_t overruns = sim_can_overruns();
+
+    memcpy(fields, &address, sizeof(address));
+    fields[4] = 64;
+    memset(&fields[5], 0x3C, 64);
+    uint32_t size = harness_build_frame(request, BL_MEM_WRITE, fields, sizeof(fields));
+
+    host_reset();
+    host_tx.ignore_flow_control = 1;
+    host_send(REQUEST_ID, request, size);
+    CHECK(sim_run(busy_entry) == SIM_RETURNED);
+    CHECK(sim_can_pending() == 0);
+    CHECK(sim_can_overruns() > overruns);
+    CHECK(!available);
+
+    /* The next message is received whole */
+    size = harness_build_frame(request, BL_GET_VER, NULL, 0);
+    exchange(REQUEST_ID, request, size);
+    CHECK(host_rx.length == 3 && host_rx.data[2] == BL_VERSION);
+}
+
+/* Nobody acknowledges: the second message waits CAN_ISOTP_TX_TIMEOUT_MS and aborts the first */
+static void test_no_acknowledge(void)
+{
+    uint8_t request[HARNESS_FRAME_MAX_SIZE];
+    uint32_t size = harness_build_frame(request, BL_GET_VER, NULL, 0);
+    uint32_t node_frames = sim_can_node_frames();
+
+    sim_can_set_host_connected(0);
+    memset(tx_data, 0x77, sizeof(tx_data));
+
+    uint64_t start = sim_cycles();
+    CHECK(sim_run(send_entry) == SIM_RETURNED);
+    uint64_t elapsed = sim_cycles() - start;
+
+    CHECK(elapsed >= SIM_MS(CAN_ISOTP_TX_TIMEOUT_MS) && elapsed < SIM_MS(2 * CAN_ISOTP_TX_TIMEOUT_MS));
+    CHECK(sim_can_node_frames() == node_frames);
+
+    /* The mailbox is free again once the host is back */
+    sim_can_set_host_connected(1);
+    size = harness_build_frame(request, BL_GET_VER, NULL, 0);
+    exchange(REQUEST_ID, request, size);
+    CHECK(host_rx.length == 3 && host_rx.data[2] == BL_VERSION);
+}
+
+static uint32_t read_request(uint8_t *request)
+{
+    uint8_t fields[5];
+    uint32_t address = BOARD_APP_BASE_ADDR + 0x5000;
+
+    memcpy(fields, &address, sizeof(address));
+    fields[4] = 128;
+    return harness_build_frame(request, BL_MEM_READ, fields, sizeof(fields));
+}
+
+/* Returns the cycles it took to answer, the reply of 2 + 1 + 128 bytes is segmented */
+static uint64_t exchange_read(void)
+{
+    uint8_t request[HARNESS_FRAME_MAX_SIZE];
+    uint32_t size = read_request(request);
+    uint64_t start = sim_cycles();
+
+    host_send(REQUEST_ID, request, size);
+    CHECK(sim_run(frame_entry) == SIM_RETURNED);
+    uint64_t elapsed = sim_cycles() - start;
+    CHECK(sim_run(wait_entry) == SIM_RETURNED);
+    CHECK(host_rx.bad_frames == 0);
+
+    return elapsed;
+}
+
+/*
+ * N_Bs is counted in milliseconds and restarted by every FC_WAIT, but only
+ * CAN_ISOTP_FC_WAIT_MAX of those are accepted, so a host can never hold the node forever
+ */
+static void test_flow_control_timeout(void)
+{
+    uint64_t elapsed;
+
+    host_reset();
+    host_rx.fc_waits = CAN_ISOTP_FC_WAIT_MAX;
+    exchange_read();
+    CHECK(host_rx.fc_waits_sent == CAN_ISOTP_FC_WAIT_MAX);
+    CHECK(host_rx.length == 2 + 1 + 128);
+
+    /* One more and the node gives up on the spot, the reply stays incomplete */
+    host_reset();
+    host_rx.fc_waits = CAN_ISOTP_FC_WAIT_MAX + 1;
+    elapsed = exchange_read();
+    CHECK(elapsed < SIM_MS(CAN_ISOTP_FC_WAIT_MAX * FC_WAIT_INTERVAL_MS + CAN_ISOTP_FC_TIMEOUT_MS / 2));
+    CHECK(host_rx.num_of_messages == 1 && host_rx.message_received < host_rx.message_length);
+
+    host_reset();
+    host_rx.silent = 1;
+    elapsed = exchange_read();
+    CHECK(elapsed >= SIM_MS(CAN_ISOTP_FC_TIMEOUT_MS) && elapsed < SIM_MS(CAN_ISOTP_FC_TIMEOUT_MS + 100));
+    CHECK(host_rx.num_of_messages == 1 && host_rx.message_received == 6);
+}
+
+/* Consecutive frames are at least STmin apart, in milliseconds and in 100 us steps */
+static void test_separation_time(void)
+{
+    const uint8_t st_min[] = { 5, 0xF3 };
+    const uint64_t gap[] = { SIM_MS(5), SIM_MS(1) * 3 / 10 };
+
+    for (uint32_t i = 0; i < sizeof(st_min); i++)
+    {
+        host_reset();
+        host_rx.st_min = st_min[i];
+        exchange_read();
+        CHECK(host_rx.num_of_messages == 2 && host_rx.length == 2 + 1 + 128);
+        CHECK(host_rx.min_gap >= gap[i] && host_rx.min_gap < gap[i] + SIM_MS(1));
+    }
+}
+
+int main(void)
+{
+    harness_init();
+
+    test_single_frames();
+    test_segmented_request();
+    test_segmented_reply();
+    test_addressing();
+    test_flow_control_ignored();
+    test_no_acknowledge();
+    test_flow_control_timeout();
+    test_separation_time();
+
+    printf("%u failures\n", failures);
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "harness.h"
+#include "bootloader.h"
+#include "frames.h"
+#include "policy.h"
+#include "multicast.h"
+
+/*
+ * Properties of bootloader_process_frame() and of the USART2 receive path: replies follow
+ * the protocol, nothing is read past a frame, protected memory is never written or erased
+ * and only executable regions are jumped to. The checks themselves live in the harness and
+ * the simulator, which end the test on the first violation.
+ */
+#define RANDOM_ITERATIONS       3000
+#define APP_STACK_TOP           0x20020000U
+#define APP_RESET_HANDLER       (BOARD_APP_BASE_ADDR + 0x201U)
+
+int bootloader_main(void);
+
+static uint32_t failures;
+
+#define CHECK(condition)                                                            \
+    do                                                                              \
+    {                                                                               \
+        if (!(condition))                                                           \
+        {                                                                           \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__,    \
+                    __func__, #condition);                                          \
+            failures++;                                                             \
+        }                                                                           \
+    } while (0)
+
+static void command(uint8_t command, const void *fields, uint32_t fields_length, harness_reply_t *reply)
+{
+    uint8_t frame[HARNESS_FRAME_MAX_SIZE];
+
+    harness_build_frame(frame, command, fields, fields_length);
+    harness_process(frame, reply);
+}
+
+static void put32(uint8_t *field, uint32_t value)
+{
+    memcpy(field, &value, sizeof(value));
+}
+
+/* A vector table the bootloader accepts, written as if programmed by an earlier update */
+static void install_image(uint32_t base_address)
+{
+    uint32_t vectors[2] = { APP_STACK_TOP, APP_RESET_HANDLER };
+
+    memcpy(sim_mem(base_address), vectors, sizeof(vectors));
+}
+
+static void test_get_version(void)
+{
+    harness_reply_t reply;
+
+    command(BL_GET_VER, NULL, 0, &reply);
+    CHECK(reply.length == 3 && reply.data[2] == BL_VERSION);
+}
+
+static void test_get_device_id(void)
+{
+    harness_reply_t reply;
+
+    command(BL_GET_DEV_ID, NULL, 0, &reply);
+    CHECK(reply.length == 4 && reply.data[2] == 0x21 && reply.data[3] == 0x04);
+}
+
+static void test_get_rdp_level(void)
+{
+    harness_reply_t reply;
+
+    command(BL_GET_RDP_LEVEL, NULL, 0, &reply);
+    CHECK(reply.length == 3 && reply.data[2] == 0xAA);
+}
+
+/* Every length below the minimum, with a valid CRC, is refused before the handler reads a field */
+static void test_short_frames(void)
+{
+    uint8_t frame[HARNESS_FRAME_MAX_SIZE];
+    harness_reply_t reply;
+
+    for (uint32_t command = 0; command < 256; command++)
+    {
+        for (uint32_t length = 1; length < bootloader_frame_min_length(command); length++)
+        {
+            memset(frame, 0x55, sizeof(frame));
+            frame[0] = length;
+            frame[1] = command;
+            harness_fix_crc(frame);
+            harness_process(frame, &reply);
+
+            CHECK(command == BL_MCAST_DATA ? reply.length == 0 : reply.length == 1 && reply.data[0] == BL_NACK);
+        }
+    }
+}
+
+static void test_bad_crc(void)
+{
+    uint8_t frame[HARNESS_FRAME_MAX_SIZE];
+    harness_reply_t reply;
+
+    harness_build_frame(frame, BL_GET_VER, NULL, 0);
+    frame[2] ^= 0x01;
+    harness_process(frame, &reply);
+    CHECK(reply.length == 1 && reply.data[0] == BL_NACK);
+}
+
+static void test_mem_write(void)
+{
+    uint8_t fields[5 + 16];
+    harness_reply_t reply;
+
+    for (uint32_t i = 0; i < 16; i++)
+    {
+        fields[5 + i] = i;
+    }
+    fields[4] = 16;
+
+    /* The bootloader itself, the metadata sector and SRAM are not writable */
+    const uint32_t protected[] = { BOARD_FLASH_BASE_ADDR, BOARD_APP_BASE_ADDR - 8, 0x08060000U, 0x20000000U, 0x40024000U };
+    uint32_t writes = sim_flash_writes();
+
+    for (uint32_t i = 0; i < sizeof(protected) / sizeof(protected[0]); i++)
+    {
+        put32(fields, protected[i]);
+        command(BL_MEM_WRITE, fields, sizeof(fields), &reply);
+        CHECK(reply.length == 3 && reply.data[2] == FLASH_FAIL);
+    }
+    CHECK(sim_flash_writes() == writes);
+
+    /* A payload size that does not match the frame is refused */
+    put32(fields, BOARD_APP_BASE_ADDR + 0x1000);
+    fields[4] = 15;
+    command(BL_MEM_WRITE, fields, sizeof(fields), &reply);
+    CHECK(reply.length == 3 && reply.data[2] == FLASH_FAIL);
+
+    fields[4] = 16;
+    command(BL_MEM_WRITE, fields, sizeof(fields), &reply);
+    CHECK(reply.length == 3 && reply.data[2] == FLASH_SUCCESS);
+    CHECK(memcmp(sim_mem(BOARD_APP_BASE_ADDR + 0x1000), &fields[5], 16) == 0);
+
+    /* Unaligned, the DMA only feeds the words in between to the CRC unit */
+    put32(fields, BOARD_APP_BASE_ADDR + 0x1101);
+    command(BL_MEM_WRITE, fields, sizeof(fields), &reply);
+    CHECK(reply.length == 3 && reply.data[2] == FLASH_SUCCESS);
+    CHECK(memcmp(sim_mem(BOARD_APP_BASE_ADDR + 0x1101), &fields[5], 16) == 0);
+}
+
+static void mcast_data(uint16_t sequence, const uint8_t *payload, uint32_t payload_size)
+{
+    uint8_t fields[2 + 16];
+    harness_reply_t reply;
+
+    memcpy(fields, &sequence, sizeof(sequence));
+    memcpy(&fields[2], payload, payload_size);
+    command(BL_MCAST_DATA, fields, 2 + payload_size, &reply);
+}
+
+/* Returns the session state, the missing frames count and the first byte of the bitmap */
+static void mcast_status(uint8_t *active, uint16_t *missing, uint8_t *bitmap)
+{
+    uint8_t fields[2] = { 0, 0 };
+    harness_reply_t reply;
+
+    command(BL_MCAST_STATUS, fields, sizeof(fields), &reply);
+    CHECK(reply.length == 2 + 3 + MCAST_BITMAP_WINDOW);
+    *active = reply.data[2];
+    *missing = reply.data[3] | reply.data[4] << 8;
+    *bitmap = reply.data[5];
+}
+
+/* Three frames of 8 bytes, the last one shorter */
+static void test_mcast(void)
+{
+    uint32_t base_address = BOARD_APP_BASE_ADDR + 0x2000;
+    uint8_t image[8 + 8 + 5];
+    uint8_t fields[7];
+    harness_reply_t reply;
+    uint8_t active, bitmap;
+    uint16_t missing;
+
+    for (uint32_t i = 0; i < sizeof(image); i++)
+    {
+        image[i] = (uint8_t)(0x40 + i);
+    }
+
+    /* A refused start leaves no session, which must not look like a finished update */
+    put32(fields, base_address);
+    fields[4] = 0;
+    fields[5] = 0;
+    fields[6] = 8;
+    command(BL_MCAST_START, fields, sizeof(fields), &reply);
+    CHECK(reply.length == 3 && reply.data[2] == FLASH_FAIL);
+    mcast_status(&active, &missing, &bitmap);
+    CHECK(active == MCAST_SESSION_NONE && missing == 0);
+
+    fields[4] = 3;
+    command(BL_MCAST_START, fields, sizeof(fields), &reply);
+    CHECK(reply.length == 3 && reply.data[2] == FLASH_SUCCESS);
+
+    /* Short frames other than the last one and an empty last one are dropped */
+    mcast_data(0, &image[0], 8);
+    mcast_data(1, &image[8], 7);
+    mcast_data(2, &image[16], 0);
+    mcast_status(&active, &missing, &bitmap);
+    CHECK(active == MCAST_SESSION_ACTIVE && missing == 2 && bitmap == 0x06);
+    CHECK(sim_mem(base_address + 8)[0] == 0xFF);
+
+    mcast_data(2, &image[16], 5);
+    mcast_data(1, &image[8], 8);
+    mcast_status(&active, &missing, &bitmap);
+    CHECK(active == MCAST_SESSION_ACTIVE && missing == 0 && bitmap == 0x00);
+    CHECK(memcmp(sim_mem(base_address), image, sizeof(image)) == 0);
+}
+
+static void test_flash_erase(void)
+{
+    harness_reply_t reply;
+    uint8_t fields[2];
+
+    /* Sectors 0 and 1 hold the bootloader, 7 the metadata, a mass erase would take all of them */
+    const uint8_t refused[][2] = { { 0, 1 }, { 1, 1 }, { 0, 8 }, { 7, 1 }, { 2, 6 }, { 0xFF, 0 }, { 8, 1 }, { 2, 0xFF } };
+
+    for (uint32_t i = 0; i < sizeof(refused) / sizeof(refused[0]); i++)
+    {
+        memcpy(fields, refused[i], sizeof(fields));
+        command(BL_FLASH_ERASE, fields, sizeof(fields), &reply);
+        CHECK(reply.length == 3 && reply.data[2] == ERASE_FAILURE);
+    }
+
+    memset(sim_mem(FLASH_SECTOR_2_BASE_ADDR), 0, 16);
+    fields[0] = 2;
+    fields[1] = 1;
+    command(BL_FLASH_ERASE, fields, sizeof(fields), &reply);
+    CHECK(reply.length == 3 && reply.data[2] == ERASE_SUCCESS);
+    CHECK(sim_mem(FLASH_SECTOR_2_BASE_ADDR)[0] == 0xFF);
+}
+
+static void test_jump(void)
+{
+    uint8_t fields[4];
+    harness_reply_t reply;
+
+    /* SRAM is not writable, so nothing a host could have put there is run */
+    const uint32_t refused[] = { BOARD_FLASH_BASE_ADDR, BOARD_APP_BASE_ADDR - 1, 0x08060000U, 0x20000000U, 0x2001A000U,
+                                 0x20020000U, 0x40024000U, 0xE000E000U };
+
+    for (uint32_t i = 0; i < sizeof(refused) / sizeof(refused[0]); i++)
+    {
+        put32(fields, refused[i]);
+        command(BL_JMP_ADDR, fields, sizeof(fields), &reply);
+        CHECK(reply.result == SIM_RETURNED && reply.length == 3 && reply.data[2] == INVALID_ADDR);
+    }
+
+    /* Without a vector table the address itself is branched to */
+    sim_flash_erase_all();
+    put32(fields, BOARD_APP_BASE_ADDR + 0x100);
+    command(BL_JMP_ADDR, fields, sizeof(fields), &reply);
+    CHECK(reply.result == SIM_JUMPED && !sim_last_jump()->started);
+    CHECK(sim_last_jump()->address == ((BOARD_APP_BASE_ADDR + 0x100) | 1));
+
+    install_image(BOARD_APP_BASE_ADDR);
+    put32(fields, BOARD_APP_BASE_ADDR);
+    command(BL_JMP_ADDR, fields, sizeof(fields), &reply);
+    CHECK(reply.result == SIM_JUMPED && sim_last_jump()->started);
+    CHECK(sim_last_jump()->vtor == BOARD_APP_BASE_ADDR && sim_last_jump()->msp == APP_STACK_TOP);
+    CHECK(sim_last_jump()->address == APP_RESET_HANDLER);
+    sim_flash_erase_all();
+}
+
+static void test_batch_jump(void)
+{
+    uint8_t fields[2 * 9];
+    uint8_t sub[HARNESS_FRAME_MAX_SIZE];
+    uint32_t address = BOARD_APP_BASE_ADDR;
+    harness_reply_t reply;
+
+    /* JMP is never run from a batch, the batch stops in front of it */
+    harness_build_frame(sub, BL_GET_VER, NULL, 0);
+    memcpy(fields, sub, 6);
+    harness_build_frame(sub, BL_JMP_ADDR, &address, sizeof(address));
+    memcpy(&fields[6], sub, 10);
+    command(BL_BATCH, fields, 16, &reply);
+    CHECK(reply.result == SIM_RETURNED);
+    CHECK(reply.length == 6 && reply.data[2] == 1 && reply.data[3] == BL_ACK && reply.data[5] == BL_VERSION);
+}
+
+/* Several frames back to back over USART2, RTS has to keep the host from overrunning the receiver */
+static void test_uart_exchange(void)
+{
+    uint8_t data[4 * HARNESS_FRAME_MAX_SIZE];
+    uint8_t fields[5 + 200];
+    uint32_t length = 0;
+    uint32_t overruns = sim_uart_overruns();
+    harness_reply_t reply;
+
+    memset(fields, 0xA5, sizeof(fields));
+    put32(fields, BOARD_APP_BASE_ADDR + 0x2000);
+    fields[4] = 200;
+
+    length += harness_build_frame(&data[length], BL_GET_VER, NULL, 0);
+    length += harness_build_frame(&data[length], BL_MEM_WRITE, fields, sizeof(fields));
+    length += harness_build_frame(&data[length], BL_GET_DEV_ID, NULL, 0);
+    harness_exchange(data, length, &reply);
+
+    CHECK(reply.result == SIM_STOPPED);
+    CHECK(reply.length == 3 + 3 + 4);
+    CHECK(harness_get_stats()->frames != 0);
+    CHECK(sim_uart_overruns() == overruns);
+    CHECK(memcmp(sim_mem(BOARD_APP_BASE_ADDR + 0x2000), &fields[5], 200) == 0);
+}
+
+/* After reset without the button pressed a valid image is started */
+static void test_boot_application(void)
+{
+    sim_flash_erase_all();
+    install_image(BOARD_APP_BASE_ADDR);
+    sim_reset();
+
+    CHECK(sim_run((void (*)(void))bootloader_main) == SIM_JUMPED);
+    CHECK(sim_last_jump()->started && sim_last_jump()->vtor == BOARD_APP_BASE_ADDR);
+
+    sim_flash_erase_all();
+    harness_boot();
+}
+
+static void test_random_frames(void)
+{
+    uint8_t frame[HARNESS_FRAME_MAX_SIZE];
+    uint32_t seed = 1;
+    harness_reply_t reply;
+
+    for (uint32_t i = 0; i < RANDOM_ITERATIONS; i++)
+    {
+        uint32_t size = harness_random_frame(&seed, frame);
+
+        if (i % 2 == 0)
+        {
+            harness_process(frame, &reply);
+        }
+        else
+        {
+            harness_exchange(frame, size, &reply);
+        }
+    }
+}
+
+int main(void)
+{
+    harness_init();
+
+    test_get_version();
+    test_get_device_id();
+    test_get_rdp_level();
+    test_short_frames();
+    test_bad_crc();
+    test_mem_write();
+    test_mcast();
+    test_flash_erase();
+    test_jump();
+    test_batch_jump();
+    test_uart_exchange();
+    test_boot_application();
+    test_random_frames();
+
+    const harness_stats_t *stats = harness_get_stats();
+    printf("%llu frames, %llu jumps, %llu boots, %u failures\n", (unsigned long long)stats->frames,
+           (unsigned long long)stats->jumps, (unsigned long long)stats->boots, failures);
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,252 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "harness.h"
+#include "bootloader.h"
+#include "frames.h"
+#include "pool.h"
+
+/*
+ * Frame layouts: the packed structures of frames.h against the minimum lengths, and random
+ * frames of every command sent over the simulated USART2 into bootloader_receive_frame().
+ * Each has to land whole at the offset of its command within a pool buffer, with the payload
+ * of BL_MEM_WRITE and BL_MCAST_DATA on a word boundary, nothing of the buffer around it
+ * written and its CRC checked in place. Frames cut short are dropped without writing past
+ * what was received.
+ */
+#define LAYOUT_ITERATIONS       1000
+#define CANARY                  0x5A
+
+static uint32_t failures;
+
+#define CHECK(condition)                                                            \
+    do                                                                              \
+    {                                                                               \
+        if (!(condition))                                                           \
+        {                                                                           \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__,    \
+                    __func__, #condition);                                          \
+            failures++;                                                             \
+        }                                                                           \
+    } while (0)
+
+typedef struct
+{
+    uint8_t command;
+    uint32_t size;              // Of the frame structure
+    uint32_t payload_offset;    // 0 without a payload read in place
+} layout_t;
+
+#define LAYOUT(command, type)               { command, sizeof(type), 0 }
+#define LAYOUT_PAYLOAD(command, type)       { command, sizeof(type), offsetof(type, payload) }
+
+static const layout_t layouts[] = {
+    LAYOUT(BL_GET_VER, bl_frame_header_t),
+    LAYOUT(BL_GET_HELP, bl_frame_header_t),
+    LAYOUT(BL_GET_DEV_ID, bl_frame_header_t),
+    LAYOUT(BL_GET_RDP_LEVEL, bl_frame_header_t),
+    LAYOUT(BL_JMP_ADDR, bl_jump_address_frame_t),
+    LAYOUT(BL_FLASH_ERASE, bl_flash_erase_frame_t),
+    LAYOUT_PAYLOAD(BL_MEM_WRITE, bl_mem_write_frame_t),
+    LAYOUT(BL_MEM_READ, bl_mem_read_frame_t),
+    LAYOUT(BL_SET_RW_PROTECT, bl_set_rw_protect_frame_t),
+    LAYOUT(BL_GET_RW_PROTECT, bl_frame_header_t),
+    LAYOUT(BL_MCAST_START, bl_mcast_start_frame_t),
+    LAYOUT_PAYLOAD(BL_MCAST_DATA, bl_mcast_data_frame_t),
+    LAYOUT(BL_MCAST_STATUS, bl_mcast_status_frame_t),
+    LAYOUT(BL_SESSION_BEGIN, bl_session_begin_frame_t),
+    LAYOUT(BL_SESSION_QUERY, bl_session_frame_t),
+    LAYOUT(BL_SESSION_END, bl_session_frame_t),
+    LAYOUT(BL_GET_STATUS, bl_frame_header_t),
+    LAYOUT(BL_SET_TIMEOUTS, bl_set_timeouts_frame_t),
+    LAYOUT(BL_BATCH, bl_frame_header_t),
+    LAYOUT(BL_STAGE_ERASE, bl_stage_erase_frame_t),
+    LAYOUT(BL_STAGE_WRITE, bl_stage_write_frame_t),
+    LAYOUT(BL_STAGE_COMMIT, bl_stage_commit_frame_t),
+    LAYOUT(BL_GET_MANIFEST, bl_get_manifest_frame_t),
+    LAYOUT(BL_GET_BOOT_LOG, bl_get_boot_log_frame_t),
+};
+
+#define NUM_OF_LAYOUTS          (sizeof(layouts) / sizeof(layouts[0]))
+
+/* Result of receive_entry() */
+static uint8_t buffer_copy[POOL_BUFFER_SIZE];
+static int32_t frame_offset;        // Within the pool buffer, -1 if no frame was returned
+static uint8_t crc_status;
+
+static void receive_entry(void)
+{
+    uint8_t *buffer = pool_acquire();
+
+    memset(buffer, CANARY, POOL_BUFFER_SIZE);
+    uint8_t *frame = bootloader_receive_frame(buffer);
+
+    frame_offset = frame != NULL ? frame - buffer : -1;
+    if (frame != NULL)
+    {
+        crc_status = bootloader_verify_frame_crc(frame);
+    }
+
+    memcpy(buffer_copy, buffer, POOL_BUFFER_SIZE);
+    pool_release(buffer);
+}
+
+static const layout_t *find_layout(uint8_t command)
+{
+    for (uint32_t i = 0; i < NUM_OF_LAYOUTS; i++)
+    {
+        if (layouts[i].command == command)
+        {
+            return &layouts[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Bytes of the buffer outside [start, end) that are not the canary */
+static uint32_t written_outside(uint32_t start, uint32_t end)
+{
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < POOL_BUFFER_SIZE; i++)
+    {
+        if ((i < start || i >= end) && buffer_copy[i] != CANARY)
+        {
+            count++;
+        }
+    }
+
+    return count;
+}
+
+static void test_layouts(void)
+{
+    for (uint32_t i = 0; i < NUM_OF_LAYOUTS; i++)
+    {
+        const layout_t *layout = &layouts[i];
+        uint32_t offset = bootloader_frame_offset(layout->command);
+
+        CHECK(bootloader_frame_min_length(layout->command) == layout->size + BL_FRAME_CRC_SIZE - 1);
+        CHECK(layout->payload_offset != 0 ? (offset + layout->payload_offset) % 4 == 0 : offset == 0);
+        CHECK(offset + HARNESS_FRAME_MAX_SIZE <= POOL_BUFFER_SIZE);
+    }
+
+    /* Unknown commands are a header and a CRC */
+    CHECK(bootloader_frame_offset(0x00) == 0 && bootloader_frame_min_length(0x00) == 1 + BL_FRAME_CRC_SIZE);
+}
+
+/* A frame of the given command, its length close to the minimum or anything up to 255 */
+static uint32_t random_frame(uint32_t *seed, uint8_t command, uint8_t *frame)
+{
+    uint32_t min_length = bootloader_frame_min_length(command);
+    uint32_t length;
+
+    if (harness_random(seed) % 2)
+    {
+        length = min_length - 2 + harness_random(seed) % 5;
+    }
+    else
+    {
+        length = 1 + harness_random(seed) % 255;
+    }
+    length = length < 1 ? 1 : (length > 255 ? 255 : length);
+
+    frame[0] = length;
+    frame[1] = command;
+    for (uint32_t i = 2; i <= length; i++)
+    {
+        frame[i] = (uint8_t)harness_random(seed);
+    }
+
+    return length + 1;
+}
+
+static void test_random_layouts(void)
+{
+    uint8_t frame[HARNESS_FRAME_MAX_SIZE];
+    uint32_t seed = 1;
+
+    for (uint32_t i = 0; i < LAYOUT_ITERATIONS; i++)
+    {
+        uint8_t command = harness_random(&seed) % 8 != 0 ? layouts[harness_random(&seed) % NUM_OF_LAYOUTS].command
+                                                         : (uint8_t)harness_random(&seed);
+        uint32_t size = random_frame(&seed, command, frame);
+        uint8_t crc_valid = harness_random(&seed) % 4 != 0 && size >= sizeof(bl_frame_header_t) + BL_FRAME_CRC_SIZE;
+        uint32_t sent = size;
+
+        if (crc_valid)
+        {
+            harness_fix_crc(frame);
+        }
+        if (harness_random(&seed) % 8 == 0)
+        {
+            sent = 1 + harness_random(&seed) % (size - 1);
+        }
+
+        sim_uart_send(frame, sent);
+        CHECK(sim_run(receive_entry) == SIM_RETURNED);
+        CHECK(sim_uart_pending() == 0);
+
+        uint32_t offset = bootloader_frame_offset(command);
+
+        if (sent < size)
+        {
+            /* Only the bytes received were written, the header possibly not at all */
+            CHECK(frame_offset == -1);
+            CHECK(written_outside(offset, offset + sent) == 0);
+            continue;
+        }
+
+        CHECK(frame_offset == (int32_t)offset);
+        if (frame_offset != (int32_t)offset)
+        {
+            continue;
+        }
+        CHECK(memcmp(&buffer_copy[offset], frame, size) == 0);
+        CHECK(written_outside(offset, offset + size) == 0);
+
+        const layout_t *layout = find_layout(command);
+        if (layout != NULL && layout->payload_offset != 0)
+        {
+            CHECK((offset + layout->payload_offset) % 4 == 0);
+        }
+
+        /* A random CRC may happen to be right, one of a frame too short to carry it never is */
+        uint32_t host_crc;
+        uint8_t expected = 0;
+
+        if (size >= sizeof(bl_frame_header_t) + BL_FRAME_CRC_SIZE)
+        {
+            memcpy(&host_crc, &frame[size - BL_FRAME_CRC_SIZE], sizeof(host_crc));
+            expected = harness_crc(frame, size - BL_FRAME_CRC_SIZE) == host_crc;
+        }
+        CHECK(!crc_valid || expected);
+        CHECK((crc_status == CRC_STATUS_SUCCESS) == expected);
+    }
+}
+
+/* An empty frame is not received at all */
+static void test_empty_frame(void)
+{
+    const uint8_t empty = 0;
+
+    sim_uart_send(&empty, 1);
+    CHECK(sim_run(receive_entry) == SIM_RETURNED);
+    CHECK(frame_offset == -1);
+    CHECK(written_outside(0, 0) == 0);
+}
+
+int main(void)
+{
+    harness_init();
+
+    test_layouts();
+    test_random_layouts();
+    test_empty_frame();
+
+    printf("%u failures\n", failures);
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,307 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "harness.h"
+#include "bootloader.h"
+#include "frames.h"
+#include "qspi.h"
+
+/*
+ * QSPI staging against the simulated QUADSPI and W25Q128JV, built for a board with
+ * BL_CMD_ENABLE_STAGE: the device set up for quad transfers once, erases split into sectors
+ * and blocks, page programs across page boundaries, BL_STAGE_COMMIT copying only an image
+ * that matches its CRC, an erase cut short by a reset of the MCU, and a device that stops
+ * answering.
+ */
+#define STAGE_CHUNK_SIZE        240
+#define IMAGE_OFFSET            0x10000U
+#define IMAGE_SIZE              6000
+
+static uint32_t failures;
+
+#define CHECK(condition)                                                            \
+    do                                                                              \
+    {                                                                               \
+        if (!(condition))                                                           \
+        {                                                                           \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__,    \
+                    __func__, #condition);                                          \
+            failures++;                                                             \
+        }                                                                           \
+    } while (0)
+
+static uint8_t image[IMAGE_SIZE];
+
+static void put32(uint8_t *field, uint32_t value)
+{
+    memcpy(field, &value, sizeof(value));
+}
+
+/*
+ * Returns the status byte of the reply, 0xFF if there is none. The window is mapped again
+ * after every command, unless the device stopped answering.
+ */
+static uint8_t command(uint8_t command, const void *fields, uint32_t fields_length)
+{
+    uint8_t frame[HARNESS_FRAME_MAX_SIZE];
+    harness_reply_t reply;
+
+    harness_build_frame(frame, command, fields, fields_length);
+    harness_process(frame, &reply);
+    CHECK(sim_qspi_mapped() || !qspi_is_ready());
+
+    return reply.length == 3 && reply.data[0] == BL_ACK && reply.data[1] == 1 ? reply.data[2] : 0xFF;
+}
+
+static uint8_t stage_erase(uint32_t offset, uint32_t length)
+{
+    uint8_t fields[8];
+
+    put32(&fields[0], offset);
+    put32(&fields[4], length);
+    return command(BL_STAGE_ERASE, fields, sizeof(fields));
+}
+
+static uint8_t stage_write(uint32_t offset, const uint8_t *data, uint32_t length)
+{
+    uint8_t fields[5 + STAGE_CHUNK_SIZE];
+
+    put32(&fields[0], offset);
+    fields[4] = length;
+    memcpy(&fields[5], data, length);
+    return command(BL_STAGE_WRITE, fields, 5 + length);
+}
+
+static uint8_t stage_commit(uint32_t offset, uint32_t destination_address, uint32_t length, uint32_t crc)
+{
+    uint8_t fields[16];
+
+    put32(&fields[0], offset);
+    put32(&fields[4], destination_address);
+    put32(&fields[8], length);
+    put32(&fields[12], crc);
+    return command(BL_STAGE_COMMIT, fields, sizeof(fields));
+}
+
+static uint8_t *staged(uint32_t offset)
+{
+    return sim_mem(SIM_QSPI_MAPPED_BASE_ADDR + offset);
+}
+
+static uint8_t all_equal(const uint8_t *data, uint8_t value, uint32_t length)
+{
+    for (uint32_t i = 0; i < length; i++)
+    {
+        if (data[i] != value)
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/* QE is non-volatile, it is only written on the first boot with a new device */
+static void test_init(void)
+{
+    const sim_qspi_stats_t *stats = sim_qspi_get_stats();
+    uint32_t resets = stats->resets;
+
+    CHECK(BOARD_QSPI_FLASH_SIZE == SIM_QSPI_FLASH_SIZE);
+    CHECK(stats->status_writes == 1);
+
+    harness_boot();
+    CHECK(stats->status_writes == 1);
+    CHECK(stats->resets == resets + 1);
+}
+
+/* 4 KB sectors up to a block boundary, then 64 KB blocks, then sectors again */
+static void test_erase(void)
+{
+    const sim_qspi_stats_t *stats = sim_qspi_get_stats();
+    uint32_t offset = QSPI_BLOCK_SIZE - QSPI_SECTOR_SIZE;
+    uint32_t length = QSPI_BLOCK_SIZE + 3 * QSPI_SECTOR_SIZE;
+    uint32_t sector_erases = stats->sector_erases;
+    uint32_t block_erases = stats->block_erases;
+
+    memset(staged(0), 0x00, offset + length + QSPI_SECTOR_SIZE);
+    CHECK(stage_erase(offset, length) == FLASH_SUCCESS);
+    CHECK(stats->sector_erases == sector_erases + 3 && stats->block_erases == block_erases + 1);
+    CHECK(all_equal(staged(offset), 0xFF, length));
+    CHECK(all_equal(staged(0), 0x00, offset));
+    CHECK(all_equal(staged(offset + length), 0x00, QSPI_SECTOR_SIZE));
+
+    /* Unaligned or past the end of the device, nothing is erased */
+    CHECK(stage_erase(offset + 1, QSPI_SECTOR_SIZE) == FLASH_FAIL);
+    CHECK(stage_erase(offset, QSPI_SECTOR_SIZE + 1) == FLASH_FAIL);
+    CHECK(stage_erase(BOARD_QSPI_FLASH_SIZE - QSPI_SECTOR_SIZE, 2 * QSPI_SECTOR_SIZE) == FLASH_FAIL);
+    CHECK(stats->sector_erases == sector_erases + 3 && stats->block_erases == block_erases + 1);
+    CHECK(all_equal(staged(0), 0x00, offset));
+}
+
+static void test_write(void)
+{
+    const sim_qspi_stats_t *stats = sim_qspi_get_stats();
+    uint32_t offset = QSPI_PAGE_SIZE - 40;
+    uint32_t page_programs = stats->page_programs;
+    uint8_t data[STAGE_CHUNK_SIZE];
+    uint8_t fields[5 + 8];
+
+    for (uint32_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (uint8_t)(i * 7 + 3);
+    }
+
+    CHECK(stage_erase(0, QSPI_SECTOR_SIZE) == FLASH_SUCCESS);
+
+    /* Split at the page boundary, a single program would wrap around to the start of the page */
+    CHECK(stage_write(offset, data, sizeof(data)) == FLASH_SUCCESS);
+    CHECK(stats->page_programs == page_programs + 2);
+    CHECK(memcmp(staged(offset), data, sizeof(data)) == 0);
+    CHECK(all_equal(staged(0), 0xFF, offset));
+    CHECK(all_equal(staged(offset + sizeof(data)), 0xFF, QSPI_SECTOR_SIZE - offset - sizeof(data)));
+
+    /* Programming only clears bits, the host has to erase first */
+    memset(data, 0x0F, 8);
+    CHECK(stage_write(0, data, 8) == FLASH_SUCCESS);
+    memset(data, 0xF0, 8);
+    CHECK(stage_write(0, data, 8) == FLASH_SUCCESS);
+    CHECK(all_equal(staged(0), 0x00, 8));
+
+    /* A payload size that does not match the frame and a range past the end are refused */
+    put32(&fields[0], 16);
+    fields[4] = 9;
+    memset(&fields[5], 0x00, 8);
+    CHECK(command(BL_STAGE_WRITE, fields, sizeof(fields)) == FLASH_FAIL);
+    CHECK(all_equal(staged(16), 0xFF, 8));
+    CHECK(stage_write(BOARD_QSPI_FLASH_SIZE - 4, data, 8) == FLASH_FAIL);
+}
+
+static void stage_image(void)
+{
+    CHECK(stage_erase(IMAGE_OFFSET, 2 * QSPI_SECTOR_SIZE) == FLASH_SUCCESS);
+    for (uint32_t done = 0; done < IMAGE_SIZE; done += STAGE_CHUNK_SIZE)
+    {
+        uint32_t length = IMAGE_SIZE - done < STAGE_CHUNK_SIZE ? IMAGE_SIZE - done : STAGE_CHUNK_SIZE;
+
+        CHECK(stage_write(IMAGE_OFFSET + done, &image[done], length) == FLASH_SUCCESS);
+    }
+    CHECK(memcmp(staged(IMAGE_OFFSET), image, IMAGE_SIZE) == 0);
+}
+
+static void test_commit(void)
+{
+    uint32_t crc;
+
+    for (uint32_t i = 0; i < IMAGE_SIZE; i++)
+    {
+        image[i] = (uint8_t)(i * 13 + i / 256);
+    }
+    crc = harness_crc(image, IMAGE_SIZE);
+    stage_image();
+
+    CHECK(stage_commit(IMAGE_OFFSET, BOARD_APP_BASE_ADDR, IMAGE_SIZE, crc) == FLASH_SUCCESS);
+    CHECK(memcmp(sim_mem(BOARD_APP_BASE_ADDR), image, IMAGE_SIZE) == 0);
+
+    /*
+     * A wrong CRC, a destination that is not the base of a sector or not writable, an offset
+     * not on a word or past the end of the device: the internal FLASH is not even erased
+     */
+    uint32_t writes = sim_flash_writes();
+
+    *staged(IMAGE_OFFSET + 100) = 0x00;
+    CHECK(stage_commit(IMAGE_OFFSET, BOARD_APP_BASE_ADDR, IMAGE_SIZE, crc) == FLASH_FAIL);
+    CHECK(stage_commit(IMAGE_OFFSET + 4, BOARD_APP_BASE_ADDR + 4, IMAGE_SIZE - 4, crc) == FLASH_FAIL);
+    CHECK(stage_commit(IMAGE_OFFSET + 2, BOARD_APP_BASE_ADDR, IMAGE_SIZE, crc) == FLASH_FAIL);
+    CHECK(stage_commit(BOARD_QSPI_FLASH_SIZE - 4, BOARD_APP_BASE_ADDR, IMAGE_SIZE, crc) == FLASH_FAIL);
+    CHECK(stage_commit(IMAGE_OFFSET, BOARD_FLASH_BASE_ADDR, IMAGE_SIZE, crc) == FLASH_FAIL);
+    CHECK(sim_flash_writes() == writes);
+    CHECK(memcmp(sim_mem(BOARD_APP_BASE_ADDR), image, IMAGE_SIZE) == 0);
+}
+
+static void erase_entry(void)
+{
+    qspi_erase(0, QSPI_BLOCK_SIZE);
+}
+
+static void stop_event(void *arg)
+{
+    sim_stop();
+}
+
+/* The reset in qspi_init() ends an erase the MCU did not live to finish */
+static void test_interrupted_erase(void)
+{
+    uint8_t data[16];
+
+    sim_schedule(SIM_MS(20), stop_event, NULL);
+    CHECK(sim_run(erase_entry) == SIM_STOPPED);
+    CHECK(sim_qspi_busy());
+
+    harness_boot();
+    CHECK(!sim_qspi_busy());
+
+    memset(data, 0xA5, sizeof(data));
+    CHECK(stage_erase(0, QSPI_BLOCK_SIZE) == FLASH_SUCCESS);
+    CHECK(stage_write(0, data, sizeof(data)) == FLASH_SUCCESS);
+    CHECK(memcmp(staged(0), data, sizeof(data)) == 0);
+}
+
+/* Every wait ends, the staging commands fail and the internal FLASH is left alone */
+static void test_dead_device(void)
+{
+    const sim_qspi_stats_t *stats = sim_qspi_get_stats();
+    uint32_t crc = harness_crc(image, IMAGE_SIZE);
+    uint32_t writes = sim_flash_writes();
+    uint32_t page_programs;
+    uint8_t data[16];
+
+    memset(data, 0x5A, sizeof(data));
+    *staged(IMAGE_OFFSET + 100) = image[100];
+
+    /* Gone before the boot, qspi_init() gives up after the reset */
+    sim_qspi_set_connected(0);
+    harness_boot();
+    CHECK(!qspi_is_ready() && !sim_qspi_mapped());
+    CHECK(stage_erase(0, QSPI_SECTOR_SIZE) == FLASH_FAIL);
+    CHECK(stage_write(0, data, sizeof(data)) == FLASH_FAIL);
+    CHECK(stage_commit(IMAGE_OFFSET, BOARD_APP_BASE_ADDR, IMAGE_SIZE, crc) == FLASH_FAIL);
+    CHECK(sim_flash_writes() == writes);
+
+    /* Gone in the middle of an erase, the device is not used again */
+    sim_qspi_set_connected(1);
+    harness_boot();
+    CHECK(qspi_is_ready());
+    sim_qspi_set_connected(0);
+    CHECK(stage_erase(0, QSPI_BLOCK_SIZE) == FLASH_FAIL);
+    CHECK(!qspi_is_ready() && !sim_qspi_mapped());
+    sim_qspi_set_connected(1);
+    page_programs = stats->page_programs;
+    CHECK(stage_write(0, data, sizeof(data)) == FLASH_FAIL);
+    CHECK(stage_commit(IMAGE_OFFSET, BOARD_APP_BASE_ADDR, IMAGE_SIZE, crc) == FLASH_FAIL);
+    CHECK(stats->page_programs == page_programs);
+    CHECK(sim_flash_writes() == writes);
+
+    /* Until the next boot finds it again */
+    harness_boot();
+    CHECK(stage_erase(0, QSPI_SECTOR_SIZE) == FLASH_SUCCESS);
+    CHECK(stage_write(0, data, sizeof(data)) == FLASH_SUCCESS);
+    CHECK(memcmp(staged(0), data, sizeof(data)) == 0);
+    CHECK(stage_commit(IMAGE_OFFSET, BOARD_APP_BASE_ADDR, IMAGE_SIZE, crc) == FLASH_SUCCESS);
+}
+
+int main(void)
+{
+    harness_init();
+
+    test_init();
+    test_erase();
+    test_write();
+    test_commit();
+    test_interrupted_erase();
+    test_dead_device();
+
+    printf("%u failures\n", failures);
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "harness.h"
+#include "sim_core.h"
+#include "bootloader.h"
+#include "transport.h"
+#include "spi_slave.h"
+
+/*
+ * SPI slave transport against the simulated SPI2 and a host clocking the bus: node
+ * addressing and broadcasts, replies fetched by polling, a frame arriving while the
+ * bootloader is busy and the bounded wait for a host that never polls.
+ */
+#define POLL_DUMMIES            4
+#define OTHER_NODE_ID           (BL_NODE_ID + 1)
+
+static uint32_t failures;
+
+#define CHECK(condition)                                                            \
+    do                                                                              \
+    {                                                                               \
+        if (!(condition))                                                           \
+        {                                                                           \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__,    \
+                    __func__, #condition);                                          \
+            failures++;                                                             \
+        }                                                                           \
+    } while (0)
+
+static uint8_t tx_data[16];
+static uint32_t tx_length;
+static uint8_t *frame;
+static uint8_t reply[HARNESS_REPLY_MAX_SIZE];
+static uint32_t reply_length;
+static uint32_t reply_expected;
+static uint32_t poller;         // Incremented for every reply, an outdated poll event stops
+
+static void start_entry(void)
+{
+    spi_slave_init();
+}
+
+static void receive_entry(void)
+{
+    static uint8_t rx_buffer[HARNESS_FRAME_MAX_SIZE] __attribute__((aligned(4)));
+
+    transport_wait_for_host(0);
+    frame = bootloader_receive_frame(rx_buffer);
+}
+
+static void process_entry(void)
+{
+    if (frame != NULL)
+    {
+        bootloader_process_frame(frame);
+    }
+}
+
+/* Interrupts are taken, the main loop does not read the receive buffer */
+static void busy_entry(void)
+{
+    for (uint32_t i = 0; i < 20; i++)
+    {
+        sim_advance(SIM_MS(1));
+    }
+}
+
+static void send_entry(void)
+{
+    spi_slave_send(tx_data, tx_length);
+}
+
+/* The host polls the node once per millisecond until it has the whole reply */
+static void poll_event(void *arg)
+{
+    if ((uint32_t)(uintptr_t)arg != poller)
+    {
+        return;
+    }
+
+    reply_length += sim_spi_take(&reply[reply_length], sizeof(reply) - reply_length);
+    if (reply_length >= reply_expected)
+    {
+        return;
+    }
+
+    if (sim_spi_pending() == 0)
+    {
+        sim_spi_poll(BL_NODE_ID, POLL_DUMMIES);
+    }
+    sim_schedule(SIM_MS(1), poll_event, arg);
+}
+
+static void host_poll(uint32_t expected_length)
+{
+    reply_length = 0;
+    reply_expected = expected_length;
+    sim_schedule(SIM_MS(1), poll_event, (void *)(uintptr_t)++poller);
+}
+
+static void host_send(uint8_t node_id, const uint8_t *data, uint32_t length)
+{
+    uint8_t transaction[1 + HARNESS_FRAME_MAX_SIZE] = { node_id };
+
+    memcpy(&transaction[1], data, length);
+    sim_spi_transaction(transaction, 1 + length);
+}
+
+/* Sends a frame to the node, has it processed and polls for the reply */
+static void exchange(uint8_t node_id, const uint8_t *request, uint32_t size, uint32_t expected_length)
+{
+    host_send(node_id, request, size);
+    CHECK(sim_run(receive_entry) == SIM_RETURNED);
+    CHECK(frame != NULL && memcmp(frame, request, size) == 0);
+
+    host_poll(expected_length);
+    CHECK(sim_run(process_entry) == SIM_RETURNED);
+    reply_length += sim_spi_take(&reply[reply_length], sizeof(reply) - reply_length);
+}
+
+static void test_unicast(void)
+{
+    uint8_t request[HARNESS_FRAME_MAX_SIZE];
+    uint32_t size = harness_build_frame(request, BL_GET_VER, NULL, 0);
+
+    CHECK(sim_run(start_entry) == SIM_RETURNED);
+    exchange(BL_NODE_ID, request, size, 3);
+
+    CHECK(strcmp(transport_get_active()->name, "spi2") == 0);
+    CHECK(reply_length == 3 && reply[0] == BL_ACK && reply[1] == 1 && reply[2] == BL_VERSION);
+}
+
+/* MISO stays floating in a broadcast, a transaction for another node is not received at all */
+static void test_addressing(void)
+{
+    uint8_t request[HARNESS_FRAME_MAX_SIZE];
+    uint8_t other[HARNESS_FRAME_MAX_SIZE];
+    uint32_t size = harness_build_frame(request, BL_GET_VER, NULL, 0);
+    uint32_t other_size = harness_build_frame(other, BL_GET_DEV_ID, NULL, 0);
+
+    CHECK(sim_run(start_entry) == SIM_RETURNED);
+    host_send(OTHER_NODE_ID, other, other_size);
+    host_send(BL_BROADCAST_NODE_ID, request, size);
+
+    uint32_t driven_bytes = sim_spi_driven_bytes();
+    CHECK(sim_run(receive_entry) == SIM_RETURNED);
+    CHECK(frame != NULL && frame[1] == BL_GET_VER);
+    CHECK(sim_spi_driven_bytes() == driven_bytes);
+    CHECK(!spi_slave_data_available());
+
+    /* The ACK is collected by polling the node */
+    host_poll(3);
+    CHECK(sim_run(process_entry) == SIM_RETURNED);
+    reply_length += sim_spi_take(&reply[reply_length], sizeof(reply) - reply_length);
+    CHECK(reply_length == 3 && reply[0] == BL_ACK && reply[2] == BL_VERSION);
+}
+
+/* The receive interrupt keeps up with a whole frame while the bootloader does something else */
+static void test_busy_receive(void)
+{
+    uint8_t request[HARNESS_FRAME_MAX_SIZE];
+    uint8_t fields[5 + 200];
+    uint32_t address = BOARD_APP_BASE_ADDR + 0x4000;
+    uint32_t overruns = sim_spi_overruns();
+
+    memcpy(fields, &address, sizeof(address));
+    fields[4] = 200;
+    for (uint32_t i = 0; i < 200; i++)
+    {
+        fields[5 + i] = (uint8_t)(i * 3 + 1);
+    }
+    uint32_t size = harness_build_frame(request, BL_MEM_WRITE, fields, sizeof(fields));
+
+    CHECK(sim_run(start_entry) == SIM_RETURNED);
+    host_send(BL_NODE_ID, request, size);
+    CHECK(sim_run(busy_entry) == SIM_RETURNED);
+    CHECK(sim_spi_pending() == 0);
+    CHECK(sim_spi_overruns() == overruns);
+
+    CHECK(sim_run(receive_entry) == SIM_RETURNED);
+    CHECK(frame != NULL && memcmp(frame, request, size) == 0);
+
+    host_poll(3);
+    CHECK(sim_run(process_entry) == SIM_RETURNED);
+    reply_length += sim_spi_take(&reply[reply_length], sizeof(reply) - reply_length);
+    CHECK(reply_length == 3 && reply[0] == BL_ACK && reply[2] == FLASH_SUCCESS);
+    CHECK(memcmp(sim_mem(address), &fields[5], 200) == 0);
+}
+
+/* A host that never fetches the reply costs SPI_SLAVE_TX_TIMEOUT_MS, after that it is gone */
+static void test_reply_timeout(void)
+{
+    uint8_t data[16];
+
+    CHECK(sim_run(start_entry) == SIM_RETURNED);
+    memset(tx_data, 0x5A, sizeof(tx_data));
+    tx_length = 2;
+
+    /* A poll without dummy bytes loads the first byte and ends before it is clocked out */
+    sim_spi_poll(BL_NODE_ID, 0);
+
+    uint64_t start = sim_cycles();
+    CHECK(sim_run(send_entry) == SIM_RETURNED);
+    uint64_t elapsed = sim_cycles() - start;
+
+    CHECK(elapsed >= SIM_MS(SPI_SLAVE_TX_TIMEOUT_MS) && elapsed < SIM_MS(2 * SPI_SLAVE_TX_TIMEOUT_MS));
+    CHECK(sim_spi_take(data, sizeof(data)) == 0);
+
+    /* The next poll clocks out nothing the node loaded */
+    uint32_t underruns = sim_spi_underruns();
+    sim_spi_poll(BL_NODE_ID, 2);
+    CHECK(sim_run(busy_entry) == SIM_RETURNED);
+    CHECK(sim_spi_take(data, sizeof(data)) == 0);
+    CHECK(sim_spi_underruns() == underruns + 2);
+}
+
+int main(void)
+{
+    harness_init();
+
+    test_unicast();
+    test_addressing();
+    test_busy_receive();
+    test_reply_timeout();
+
+    printf("%u failures\n", failures);
+
+    return failures == 0 ? 0 : 1;
+}
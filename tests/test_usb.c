@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "harness.h"
+#include "sim_core.h"
+#include "bootloader.h"
+#include "transport.h"
+#include "usb_cdc.h"
+
+/*
+ * USB CDC transport against the simulated OTG FS core and host: enumeration, the packet
+ * boundaries of replies (a transfer that fills its last packet ends with a zero-length one),
+ * the bounded wait for a host that stops reading and NAKing OUT data the receive buffer has
+ * no room for.
+ */
+#define USB_PACKET_SIZE         64
+
+static uint32_t failures;
+
+#define CHECK(condition)                                                            \
+    do                                                                              \
+    {                                                                               \
+        if (!(condition))                                                           \
+        {                                                                           \
+            fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, __LINE__,    \
+                    __func__, #condition);                                          \
+            failures++;                                                             \
+        }                                                                           \
+    } while (0)
+
+static uint8_t tx_data[1024];
+static uint32_t tx_length;
+static uint8_t rx_data[4096];
+static uint32_t rx_length;
+static uint8_t *frame;
+
+static void start_entry(void)
+{
+    usb_cdc_init();
+    while (!usb_cdc_is_configured())
+    {
+        sim_wfe();
+    }
+}
+
+/* Lets the host fetch what the core still holds */
+static void wait_entry(void)
+{
+    sim_advance(SIM_MS(1));
+}
+
+static void bus_reset(void *arg)
+{
+    sim_usb_bus_reset();
+}
+
+static void send_entry(void)
+{
+    usb_cdc_send(tx_data, tx_length);
+}
+
+/* Reads slowly, so that the receive buffer fills up and the endpoint has to NAK */
+static void receive_entry(void)
+{
+    for (uint32_t i = 0; i < rx_length; i++)
+    {
+        while (!usb_cdc_data_available())
+        {
+            sim_wfe();
+        }
+        usb_cdc_receive(&rx_data[i], 1);
+
+        if (i % 256 == 0)
+        {
+            sim_advance(SIM_MS(2));
+        }
+    }
+}
+
+static void frame_entry(void)
+{
+    static uint8_t rx_buffer[HARNESS_FRAME_MAX_SIZE] __attribute__((aligned(4)));
+
+    transport_wait_for_host(0);
+    frame = bootloader_receive_frame(rx_buffer);
+    if (frame != NULL)
+    {
+        bootloader_process_frame(frame);
+    }
+}
+
+/* Everything the host has read so far, with the size of every packet */
+static uint32_t host_read(uint8_t *data, uint16_t *packets, uint32_t *num_of_packets)
+{
+    return sim_usb_take(data, sizeof(rx_data), packets, num_of_packets);
+}
+
+static void test_enumeration(void)
+{
+    sim_usb_enumerate();
+    CHECK(sim_run(start_entry) == SIM_RETURNED);
+    CHECK(usb_cdc_is_configured());
+    CHECK(sim_usb_address() == SIM_USB_ADDRESS);
+}
+
+static void test_packet_boundaries(void)
+{
+    static const uint32_t lengths[] = { 1, 10, 63, 64, 65, 128, 200, 256 };
+    static uint16_t packets[SIM_USB_MAX_IN_PACKETS];
+    static uint8_t data[4096];
+    uint32_t num_of_packets;
+
+    for (uint32_t i = 0; i < sizeof(tx_data); i++)
+    {
+        tx_data[i] = (uint8_t)(i * 7);
+    }
+
+    for (uint32_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++)
+    {
+        tx_length = lengths[i];
+        CHECK(sim_run(send_entry) == SIM_RETURNED);
+
+        /* The last packet has only been handed to the core */
+        sim_run(wait_entry);
+
+        uint32_t length = host_read(data, packets, &num_of_packets);
+        uint32_t full_packets = tx_length / USB_PACKET_SIZE;
+
+        CHECK(length == tx_length && memcmp(data, tx_data, length) == 0);
+        CHECK(num_of_packets == full_packets + 1);
+        for (uint32_t p = 0; p < full_packets && p < num_of_packets; p++)
+        {
+            CHECK(packets[p] == USB_PACKET_SIZE);
+        }
+        CHECK(num_of_packets == 0 || packets[num_of_packets - 1] == tx_length % USB_PACKET_SIZE);
+    }
+}
+
+/* A host that stops reading costs USB_CDC_TX_TIMEOUT_MS per reply and the rest of it */
+static void test_host_not_reading(void)
+{
+    static uint8_t data[4096];
+
+    sim_usb_set_host_reading(0);
+    tx_length = 4 * USB_PACKET_SIZE;
+
+    uint64_t start = sim_cycles();
+    CHECK(sim_run(send_entry) == SIM_RETURNED);
+    uint64_t elapsed = sim_cycles() - start;
+
+    CHECK(elapsed >= SIM_MS(USB_CDC_TX_TIMEOUT_MS) && elapsed < SIM_MS(2 * USB_CDC_TX_TIMEOUT_MS));
+
+    /* Only the packet already in the FIFO is fetched once the host reads again */
+    sim_usb_set_host_reading(1);
+    sim_run(wait_entry);
+    CHECK(host_read(data, NULL, NULL) == USB_PACKET_SIZE);
+
+    /* And the next reply goes out whole */
+    tx_length = 10;
+    CHECK(sim_run(send_entry) == SIM_RETURNED);
+    sim_run(wait_entry);
+    CHECK(host_read(data, NULL, NULL) == 10);
+}
+
+/* The wait ends as soon as a bus reset unconfigures the device */
+static void test_bus_reset_while_sending(void)
+{
+    sim_usb_set_host_reading(0);
+    tx_length = 4 * USB_PACKET_SIZE;
+    sim_schedule(SIM_MS(10), bus_reset, NULL);
+
+    uint64_t start = sim_cycles();
+    CHECK(sim_run(send_entry) == SIM_RETURNED);
+    CHECK(sim_cycles() - start < SIM_MS(USB_CDC_TX_TIMEOUT_MS));
+    CHECK(!usb_cdc_is_configured());
+
+    /* The packet left in the FIFO may still be fetched before the device is configured again */
+    sim_usb_set_host_reading(1);
+    sim_usb_enumerate();
+    CHECK(sim_run(start_entry) == SIM_RETURNED);
+    sim_usb_take(rx_data, sizeof(rx_data), NULL, NULL);
+}
+
+static void test_receive_flow_control(void)
+{
+    static uint8_t data[4096];
+    uint32_t naks = sim_usb_out_naks();
+
+    for (uint32_t i = 0; i < sizeof(data); i++)
+    {
+        data[i] = (uint8_t)(i ^ (i >> 8));
+    }
+
+    rx_length = sizeof(data);
+    sim_usb_send(data, sizeof(data));
+    CHECK(sim_run(receive_entry) == SIM_RETURNED);
+    CHECK(memcmp(rx_data, data, sizeof(data)) == 0);
+    CHECK(sim_usb_out_naks() > naks);
+}
+
+static void test_frame(void)
+{
+    uint8_t request[HARNESS_FRAME_MAX_SIZE];
+    uint8_t reply[16];
+    uint32_t size = harness_build_frame(request, BL_GET_VER, NULL, 0);
+
+    sim_usb_send(request, size);
+    CHECK(sim_run(frame_entry) == SIM_RETURNED);
+    CHECK(frame != NULL);
+    CHECK(strcmp(transport_get_active()->name, "usb-cdc") == 0);
+
+    sim_run(wait_entry);
+    CHECK(sim_usb_take(reply, sizeof(reply), NULL, NULL) == 3);
+    CHECK(reply[0] == BL_ACK && reply[1] == 1 && reply[2] == BL_VERSION);
+}
+
+int main(void)
+{
+    harness_init();
+
+    test_enumeration();
+    test_packet_boundaries();
+    test_host_not_reading();
+    test_bus_reset_while_sending();
+    test_receive_flow_control();
+    test_frame();
+
+    printf("%u failures\n", failures);
+
+    return failures == 0 ? 0 : 1;
+}